@@ -9,19 +9,49 @@
  *          Mario RAZAFINONY :              36%
  */
 
+ #define _GNU_SOURCE                   /* O_DIRECT */
+
  #include <stdio.h>
  #include <stdlib.h>
  #include <string.h>
+ #include <stdint.h>
+ #include <stddef.h>
  #include <time.h>
- #include <sys/file.h>
+ #include <errno.h>
+ #include <fcntl.h>
  #include <unistd.h>
+ #include <getopt.h>
+ #include <pthread.h>
+ #include <dirent.h>
+ #include <sys/stat.h>
+ #include <sys/sendfile.h>
+ #include <sys/socket.h>
+ #include <sys/un.h>
+ #include <poll.h>
+ #include <fnmatch.h>
+ #include <signal.h>
  
  #define MAX_FILE_NAME 255              /**< Taille maximum d'un nom de fichier */
  #define NUM_BLOCKS 1024                /**< Nombre de blocs dans la partition simulée */
  #define BLOCK_SIZE 512                 /**< Taille d'un bloc en octets */
  #define NUM_INODES 256                 /**< Nombre maximal d'inodes disponibles */
  #define NUM_DIRECTORY_ENTRIES 256      /**< Nombre maximal d'entrées dans un répertoire */
- #define MAX_FILE_OPEN 64               /**< Nombre maximal de fichiers ouverts simultanément */
+ #define MAX_FILE_OPEN 64               /**< Taille de l'ancienne table des descripteurs, gardée dans l'image */
+ #define DEFAULT_MAX_OPEN 4096          /**< Descripteurs ouverts au plus par session (option --max-open) */
+ #define FD_CHUNK 256                   /**< Descripteurs ajoutés d'un coup quand une table grandit */
+ #define DIRECT_IO_ALIGN 4096           /**< Alignement (adresse, offset, taille) exigé par O_DIRECT */
+ #define DIRECT_IO_MIN (64 * 1024)      /**< Taille minimale d'un transfert pour passer en O_DIRECT */
+ #define COPY_CHUNK (1024 * 1024)       /**< Taille maximale d'un transfert du moteur de copie */
+ #define RECLAIM_BATCH 32               /**< Nombre d'inodes libérés par passe du récupérateur */
+ #define JOURNAL_SIZE (4 * 1024 * 1024) /**< Taille de la zone de journal des métadonnées */
+ #define JOURNAL_MAGIC "TFMJRNL1"       /**< Signature de l'en-tête du journal */
+ #define SEGMENT_BLOCKS 64              /**< Taille d'un segment du mode journalisé (option -l), en blocs */
+ #define NUM_SEGMENTS (NUM_BLOCKS / SEGMENT_BLOCKS) /**< Nombre de segments de la zone de données */
+ #define CLEAN_THRESHOLD 2              /**< Nettoyer quand il reste moins de segments entièrement libres */
+ #define CLEAN_MAX_LIVE (SEGMENT_BLOCKS * 3 / 4) /**< Un segment plus rempli que cela n'est pas nettoyé */
+ #define SNAPSHOT_PREFIX "filesystem.img.snap." /**< Préfixe des fichiers d'instantanés, à côté de l'image */
+ #define SNAPSHOT_MAGIC "TFMSNAP1"      /**< Signature de l'en-tête d'un instantané */
+ #define MAX_SNAPSHOT_NAME 64           /**< Taille maximum d'un nom d'instantané */
  
  /**
   * @brief Représente un inode dans le système de fichiers simulé.
@@ -54,12 +84,40 @@
  } Directory;
  
  /**
-  * @brief Représente un fichier actuellement ouvert dans le système.
+  * @brief Ancienne entrée de la table des descripteurs de l'image.
+  *
+  * Les descripteurs ne sont plus écrits dans l'image (voir FdTable) ; la
+  * place est gardée pour que les images existantes restent lisibles.
   */
  typedef struct {
      int inode;          /**< Numéro d'inode du fichier ouvert */
-     int tete_lecture;   /**< Position actuelle de la tête de lecture dans le fichier */
+     int tete_lecture;   /**< Position de la tête de lecture, en octets depuis le début du fichier */
  } OpenFile;
+
+ /**
+  * @brief Représente un fichier actuellement ouvert dans une session.
+  */
+ typedef struct {
+     int inode;          /**< Numéro d'inode du fichier ouvert, -1 si le descripteur est libre */
+     int tete_lecture;   /**< Position de la tête de lecture, en octets depuis le début du fichier */
+     int next_free;      /**< Descripteur libre suivant (liste libre de la table) */
+ } FileDesc;
+
+ /**
+  * @brief Table des descripteurs d'une session, hors de l'image.
+  *
+  * Les descripteurs sont alloués par tranches de FD_CHUNK qui ne bougent
+  * plus : un descripteur reste utilisable sans verrou pendant que la table
+  * grandit. Les descripteurs libres forment une liste, ouvrir et fermer se
+  * font donc en temps constant.
+  */
+ typedef struct {
+     FileDesc **chunks;      /**< Tranches allouées (max_open_files / FD_CHUNK au plus) */
+     int capacity;           /**< Nombre de descripteurs alloués */
+     int free_head;          /**< Premier descripteur libre, -1 si aucun */
+     int nb_open;            /**< Nombre de descripteurs ouverts */
+     pthread_mutex_t mutex;  /**< Protège la liste libre et l'agrandissement */
+ } FdTable;
  
  /**
   * @brief Représente l'ensemble du système de fichiers simulé.
@@ -70,13 +128,239 @@
      Inode inodes[NUM_INODES];           /**< Tableau contenant tous les inodes du système */
      Directory root_dir;                 /**< Répertoire racine */
      Directory directories[NUM_INODES];  /**< Tableau des répertoires indexés par les indices d'inodes */
-     int free_blocks[NUM_BLOCKS];        /**< Tableau indiquant l'état libre ou occupé des blocs de données */
+     int free_blocks[NUM_BLOCKS];        /**< Compteur de références de chaque bloc : 0 = libre, n = partagé par n inodes */
      int current_dir;                    /**< Indice de l'inode du répertoire courant */
-     OpenFile opened_file[MAX_FILE_OPEN];/**< Tableau des fichiers actuellement ouverts indexés par descripteur */
+     OpenFile unused_opened_file[MAX_FILE_OPEN]; /**< Inutilisé : les descripteurs sont propres à chaque session (FdTable) */
+     int orphans[NUM_INODES];            /**< Répertoires détachés dont le contenu reste à libérer */
+     int nb_orphans;                     /**< Nombre de répertoires en attente dans orphans */
+     int clone_src[NUM_INODES];          /**< Répertoire dont un clone (clone) n'a pas encore recopié les entrées, -1 sinon */
  } Filesystem;
 
 Filesystem fs;  // Instance globale du système de fichiers
 
+/**
+ * @brief Début de la zone de données dans l'image.
+ *
+ * La structure Filesystem est suivie d'un bourrage pour que le bloc 0 tombe
+ * sur une frontière DIRECT_IO_ALIGN : sans cela aucun transfert ne pourrait
+ * passer en O_DIRECT.
+ */
+#define DATA_OFFSET (((sizeof(Filesystem) + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN) * DIRECT_IO_ALIGN)
+
+/** Position dans l'image du premier octet du bloc b */
+#define BLOCK_OFFSET(b) (DATA_OFFSET + (size_t)(b) * BLOCK_SIZE)
+
+pthread_mutex_t fs_mutex = PTHREAD_MUTEX_INITIALIZER;     // Protège fs entre le shell et le récupérateur
+pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;   // Réveille le récupérateur quand un répertoire est orphelin
+pthread_t reclaimer_thread;
+int reclaimer_running = 0;
+int reclaimer_stop = 0;
+
+#define DEFRAG_BUDGET 1024  /**< Débit de recopie par défaut de la défragmentation en fond, en Ko/s */
+#define DEFRAG_IDLE 5       /**< Secondes entre deux recherches quand la défragmentation en fond n'a rien trouvé */
+#define DEFRAG_ROUNDS 8     /**< Passes au plus de la commande defrag */
+
+int defrag_background = 0;          // Défragmentation en tâche de fond (defrag --background, option --defrag)
+int defrag_budget = DEFRAG_BUDGET;  // Blocs lus et écrits par seconde en fond, en Ko
+
+#define ALLOC_GROUPS 16                          /**< Groupes d'allocation, verrouillés séparément */
+#define GROUP_BLOCKS (NUM_BLOCKS / ALLOC_GROUPS)  /**< Blocs par groupe */
+#define GROUP_INODES (NUM_INODES / ALLOC_GROUPS)  /**< Inodes par groupe */
+#define MAX_OP_INODES 4                          /**< Inodes verrouillés au plus par une opération */
+#define SEQ_RETRIES 8                            /**< Relectures sans verrou avant d'attendre l'écrivain */
+
+/*
+ * Verrous entre threads. Une opération prend namespace_lock en partage puis
+ * les verrous des inodes qu'elle touche (InodeLocks), toujours par numéro
+ * d'inode croissant. Les opérations qui touchent tout l'état (validation du
+ * journal, transactions, instantanés...) le prennent en exclusif et n'ont
+ * alors besoin d'aucun autre verrou. Les ouvriers d'un parcours
+ * d'arborescence (pool_run) travaillent sous l'opération de l'appelant et se
+ * coordonnent entre eux par les verrous d'inodes. Les recherches de
+ * noms, les permissions et stat ne prennent aucun verrou : elles relisent
+ * tant que le compteur de séquence de l'inode a bougé (inode_seq).
+ */
+pthread_rwlock_t namespace_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_rwlock_t inode_rwlocks[NUM_INODES] = { [0 ... NUM_INODES - 1] = PTHREAD_RWLOCK_INITIALIZER };
+unsigned inode_seq[NUM_INODES];  // Impair pendant qu'un thread modifie l'inode ou son répertoire
+__thread unsigned char seq_held[NUM_INODES];  // Inodes que ce thread tient en écriture
+pthread_mutex_t group_locks[ALLOC_GROUPS] = { [0 ... ALLOC_GROUPS - 1] = PTHREAD_MUTEX_INITIALIZER };  // Tranches des tables de blocs et d'inodes
+pthread_mutex_t log_head_mutex = PTHREAD_MUTEX_INITIALIZER;     // Tête d'écriture du mode journalisé
+pthread_mutex_t orphans_mutex = PTHREAD_MUTEX_INITIALIZER;      // Liste des répertoires orphelins
+__thread int op_mode = 0;       // Opération en cours dans ce thread : 0 aucune, 1 partagée, 2 exclusive
+__thread int group_home = -1;   // Groupe d'allocation préféré de ce thread
+int next_group = 0;
+
+int direct_io_enabled = 0;  // Mode O_DIRECT demandé (option -d)
+int fd_direct = -1;         // Descripteur O_DIRECT sur l'image, -1 si indisponible
+
+int log_structured = 0;     // Écritures en journal de données (option -l)
+int log_head = -1;          // Prochain bloc de la tête d'écriture, -1 si aucun segment n'est ouvert
+int cleaning_segment = -1;  // Segment en cours de nettoyage, jamais choisi comme tête
+unsigned char block_limbo[NUM_BLOCKS];  // Libérés en mode journalisé, réutilisables une fois la validation sur disque
+int limbo_count = 0;        // Nombre de blocs dans block_limbo
+long limbo_seq = 0;         // Validation qui doit être sur disque avant de les rendre
+
+int snapshot_pins[NUM_BLOCKS];         // Nombre d'instantanés retenant chaque bloc (le nettoyeur ne les déplace pas)
+int snapshot_mounted = 0;              // Un instantané est monté à la place de l'état courant (lecture seule)
+const char *snapshot_to_mount = NULL;  // Instantané demandé au lancement (option -s)
+
+Filesystem *tx_snapshot = NULL;  // État validé au début de la transaction en cours, NULL hors transaction
+
+int max_open_files = DEFAULT_MAX_OPEN;  // Limite de descripteurs par session (option --max-open)
+FdTable process_fds = {NULL, 0, -1, 0, PTHREAD_MUTEX_INITIALIZER};  // Descripteurs du shell, des scripts et de l'API
+__thread FdTable *session_fds = NULL;   // Table de la session servie par ce thread, NULL : process_fds
+int open_refs[NUM_INODES];              // Descripteurs ouverts sur chaque inode, toutes sessions confondues
+
+/** Début de la zone de journal, juste après la zone de données */
+#define JOURNAL_OFFSET (DATA_OFFSET + (size_t)NUM_BLOCKS * BLOCK_SIZE)
+
+/** Compteur de génération des métadonnées, juste après le journal (voir revalidate_metadata) */
+#define GENERATION_OFFSET (JOURNAL_OFFSET + JOURNAL_SIZE)
+
+/** Région verrouillée pour les métadonnées : le compteur de blocs, que tout écrivain modifie */
+#define META_LOCK_OFFSET offsetof(Filesystem, free_blocks)
+
+/** Région verrouillée pour les données d'un inode */
+#define INODE_LOCK_OFFSET(i) (offsetof(Filesystem, inodes) + (size_t)(i) * sizeof(Inode))
+
+uint64_t meta_generation = 0;  // Génération des métadonnées en mémoire
+short meta_lock = F_UNLCK;     // Verrou tenu sur les métadonnées : F_UNLCK, F_RDLCK ou F_WRLCK
+int session_exclusive = 0;     // Mode script : le verrou exclusif est gardé jusqu'à la fin
+int serving = 0;               // Mode serveur (option --serve) : commandes reçues sur une socket
+__thread int session_fd = -1;          // Client dont ce thread exécute la requête, -1 sinon
+__thread char *session_out = NULL;     // Sortie de la requête en attente d'envoi (SERVE_CHUNK octets)
+__thread size_t session_out_len = 0;
+__thread pthread_mutex_t *session_send_lock = NULL;  // Partagé par les ouvriers d'un parcours qui écrivent chez le même client
+
+/**
+ * @brief Types des enregistrements du journal des métadonnées.
+ */
+enum {
+    J_INODE = 1,   /**< Métadonnées d'un inode (sans son tableau de blocs) */
+    J_BLOCKS,      /**< Plage du tableau de blocs d'un inode */
+    J_DIRENT,      /**< Une entrée de répertoire */
+    J_REFS,        /**< Plage du compteur de références des blocs */
+    J_STATE,       /**< Répertoire courant et liste des orphelins */
+    J_CLONE        /**< Source d'un clone de répertoire encore paresseux */
+};
+#define J_COMMIT 0x314e5854u  /**< Marque d'un en-tête de validation */
+
+/**
+ * @brief En-tête de la zone de journal.
+ */
+typedef struct {
+    char magic[8];          /**< JOURNAL_MAGIC */
+    uint32_t generation;    /**< Incrémentée à chaque point de contrôle */
+} JournalHeader;
+
+/**
+ * @brief En-tête d'une validation, suivi de ses enregistrements.
+ */
+typedef struct {
+    uint32_t type;          /**< J_COMMIT */
+    uint32_t generation;    /**< Génération du journal au moment de l'écriture */
+    uint32_t seq;           /**< Numéro de la validation */
+    uint32_t length;        /**< Taille des enregistrements qui suivent */
+    uint32_t checksum;      /**< Somme de contrôle des enregistrements */
+} JournalCommit;
+
+Filesystem *journal_shadow = NULL;         // État déjà écrit dans le journal (référence des différences)
+unsigned char journal_dir_dirty[NUM_INODES];  // Répertoires modifiés depuis la dernière validation
+unsigned char ckpt_inode_dirty[NUM_INODES];   // Inodes à réécrire au prochain point de contrôle
+unsigned char ckpt_dir_dirty[NUM_INODES];     // Répertoires à réécrire au prochain point de contrôle
+char *journal_buf = NULL;                  // Tampon des enregistrements en cours d'encodage
+size_t journal_buf_len = 0;
+size_t journal_buf_capacity = 0;
+size_t journal_tail = sizeof(JournalHeader);  // Position de la prochaine validation dans la zone
+uint32_t journal_generation = 0;
+long journal_written_seq = 0;              // Dernière validation écrite
+long journal_synced_seq = 0;               // Dernière validation sur disque
+int journal_syncing = 0;                   // Un meneur est en train de faire fdatasync
+pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t journal_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Ouvre (si demandé) un second descripteur de l'image en O_DIRECT.
+ *
+ * Certains systèmes de fichiers hôtes (tmpfs par exemple) refusent O_DIRECT :
+ * on reste alors silencieusement en mode bufferisé.
+ *
+ * @param filename Nom du fichier image.
+ */
+void open_direct_io(const char *filename) {
+    if (!direct_io_enabled || fd_direct != -1) {
+        return;
+    }
+    fd_direct = open(filename, O_RDWR | O_DIRECT);
+    if (fd_direct == -1) {
+        fprintf(fs.log, "\nO_DIRECT indisponible sur %s, transferts bufferisés\n", filename);
+    } else {
+        fprintf(fs.log, "\nO_DIRECT activé sur %s\n", filename);
+    }
+}
+
+/**
+ * @brief Alloue un tampon utilisable pour un transfert O_DIRECT.
+ *
+ * @param size Taille du tampon en octets.
+ * @return Le tampon (à libérer avec free) ou NULL en cas d'échec.
+ */
+void *alloc_io_buffer(size_t size) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, DIRECT_IO_ALIGN, size) != 0) {
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * @brief Indique si un transfert sur une suite de blocs contigus peut passer en O_DIRECT.
+ *
+ * Il faut que le descripteur O_DIRECT soit ouvert, que l'offset, la taille et
+ * l'adresse du tampon soient alignés, et que le transfert soit assez gros :
+ * les petites écritures et les métadonnées restent dans le cache de l'hôte.
+ */
+int is_direct_transfer(int first_block, const void *buf, size_t size) {
+    return fd_direct != -1
+        && size >= DIRECT_IO_MIN
+        && BLOCK_OFFSET(first_block) % DIRECT_IO_ALIGN == 0
+        && size % DIRECT_IO_ALIGN == 0
+        && (uintptr_t)buf % DIRECT_IO_ALIGN == 0;
+}
+
+/**
+ * @brief Lit une suite de blocs physiquement contigus de l'image.
+ *
+ * @param first_block Premier bloc de la suite.
+ * @param buf Tampon de destination.
+ * @param size Nombre d'octets à lire (peut finir au milieu d'un bloc).
+ * @return Le nombre d'octets lus ou -1 en cas d'erreur.
+ */
+ssize_t read_blocks(int first_block, void *buf, size_t size) {
+    if (is_direct_transfer(first_block, buf, size)) {
+        return pread(fd_direct, buf, size, BLOCK_OFFSET(first_block));
+    }
+    fflush(fs.file);  // Ne pas lire derrière des écritures encore dans le tampon stdio
+    return pread(fileno(fs.file), buf, size, BLOCK_OFFSET(first_block));
+}
+
+/**
+ * @brief Écrit une suite de blocs physiquement contigus de l'image.
+ *
+ * @param first_block Premier bloc de la suite.
+ * @param buf Données à écrire.
+ * @param size Nombre d'octets à écrire.
+ * @return Le nombre d'octets écrits ou -1 en cas d'erreur.
+ */
+ssize_t write_blocks(int first_block, const void *buf, size_t size) {
+    if (is_direct_transfer(first_block, buf, size)) {
+        return pwrite(fd_direct, buf, size, BLOCK_OFFSET(first_block));
+    }
+    fflush(fs.file);
+    return pwrite(fileno(fs.file), buf, size, BLOCK_OFFSET(first_block));
+}
+
 /**
  * @brief Initialise le système de fichiers à partir d'un fichier simulé.
  *
@@ -106,25 +390,30 @@ void init_filesystem(const char *filename) {
         memset(fs.inodes[i].permissions, 0, 3);
         memset(fs.inodes[i].blocks, -1, NUM_BLOCKS * sizeof(int));  // Bloc non alloué
         fs.inodes[i].link_count = 0;  // Aucun lien
+        fs.clone_src[i] = -1;         // Aucun clone en attente
         for (int j = 1 ; j < NUM_DIRECTORY_ENTRIES ; j++){
             fs.directories[i].entries[j].inode_index = -1;
             memset(fs.directories[i].entries[j].filename, 0, MAX_FILE_NAME * sizeof(char));
         }
     }
 
-    // Marquer qu'aucun fichier n'est ouvert
-    for (int i ; i < MAX_FILE_OPEN ; i++) {
-        fs.opened_file[i].inode = -1;
-        fs.opened_file[i].tete_lecture = -1;
-    }
+    memset(fs.unused_opened_file, 0, sizeof(fs.unused_opened_file));
 
-    // Remplissage du fichier binaire pour y ecrire plus tard
-    char buf[2];
-    buf[0] = '\0';
-    for(int i = sizeof(Filesystem) ; i < sizeof(Filesystem) + NUM_BLOCKS*BLOCK_SIZE ; i++){
-        fseek(fs.file, i, SEEK_SET);
-        fwrite(buf, sizeof(char), 1, fs.file);
+    // Remplissage de la zone de données par grandes écritures alignées
+    size_t zone = (size_t)NUM_BLOCKS * BLOCK_SIZE;
+    size_t chunk = zone < DIRECT_IO_MIN * 16 ? zone : DIRECT_IO_MIN * 16;
+    char *zeros = alloc_io_buffer(chunk);
+    if (!zeros) {
+        perror("Erreur d'allocation du tampon d'initialisation");
+        exit(1);
+    }
+    memset(zeros, 0, chunk);
+    fflush(fs.file);
+    open_direct_io(filename);
+    for (size_t done = 0 ; done < zone ; done += chunk) {
+        write_blocks(done / BLOCK_SIZE, zeros, zone - done < chunk ? zone - done : chunk);
     }
+    free(zeros);
 
 
     // Initialisation du répertoire racine
@@ -143,6 +432,7 @@ void init_filesystem(const char *filename) {
     fs.inodes[0].inode_rep_parent = 0;
     strncpy(fs.inodes[0].permissions, "rwx", 3);
     fs.current_dir = 0;
+    fs.nb_orphans = 0;
 
     // printf("fs size : %d\n", sizeof(Filesystem));
 
@@ -157,1749 +447,8001 @@ void init_filesystem(const char *filename) {
 }
 
 /**
- * @brief Alloue un bloc libre dans le système de fichiers.
+ * @brief Compte les blocs libres d'un segment du mode journalisé.
  *
- * @return L'index du bloc alloué ou -1 si aucun bloc n'est disponible.
+ * @param seg Numéro du segment.
+ * @return Le nombre de blocs libres du segment.
  */
-int allocate_block() {
-    for (int i = 0; i < NUM_BLOCKS; i++) {
-        if (fs.free_blocks[i] == 0) {
-            fs.free_blocks[i] = 1;  // Marquer le bloc comme alloué
-            fprintf(fs.log,"\nAllocation du bloc %d \n",i);
-            return i;
+int segment_free_blocks(int seg) {
+    int libres = 0;
+    for (int b = seg * SEGMENT_BLOCKS; b < (seg + 1) * SEGMENT_BLOCKS; b++) {
+        if (fs.free_blocks[b] == 0 && !block_limbo[b]) {
+            libres++;
         }
     }
-    fprintf(fs.log,"\nEchec d'allocation\n");
-    return -1;  // Aucun bloc libre trouvé
+    return libres;
 }
 
 /**
- * @brief Libère un bloc précédemment alloué.
- *
- * @param block_index L'index du bloc à libérer.
+ * @brief Indique si un segment contient un bloc retenu par un instantané.
  */
-void free_block(int block_index) {
-    if (block_index >= 0 && block_index < NUM_BLOCKS) {
-        fs.free_blocks[block_index] = 0;  // Marquer le bloc comme libre
-        fprintf(fs.log,"\nLibération du bloc %d\n",block_index);
-    } else {
-        printf("Erreur: tentative de libération d'un bloc invalide (%d).\n", block_index);
-        fprintf(fs.log,"\nEchec de la libération du bloc %d\n", block_index);
+int segment_pinned(int seg) {
+    for (int b = seg * SEGMENT_BLOCKS; b < (seg + 1) * SEGMENT_BLOCKS; b++) {
+        if (snapshot_pins[b] > 0) {
+            return 1;
+        }
     }
+    return 0;
 }
 
-
-
 /**
- * @brief Recherche l'inode correspondant à un nom de fichier dans un répertoire donné.
- *
- * @param filename Le nom du fichier recherché.
- * @param dir Le répertoire dans lequel effectuer la recherche.
- * @return L'index de l'inode correspondant, ou -1 si introuvable.
+ * @brief Compte les segments entièrement libres.
  */
-int rechInode(const char *filename, Directory dir){
-    int inode = -1;
-    int i = 0;
-
-    //chercher le numero d'inode du fichier dans le repertoire
-    while (i<NUM_DIRECTORY_ENTRIES && inode==-1){
-        if (strcmp(filename, dir.entries[i].filename) == 0){
-            inode = dir.entries[i].inode_index;
+int count_free_segments() {
+    int n = 0;
+    for (int seg = 0; seg < NUM_SEGMENTS; seg++) {
+        if (segment_free_blocks(seg) == SEGMENT_BLOCKS) {
+            n++;
         }
-        i++;
     }
-    return inode;
-    fprintf(fs.log,"\nNuméro d'inode de %s : %d\n", filename, inode);
+    return n;
 }
 
 /**
- * @brief Recherche une entrée libre dans un répertoire donné.
+ * @brief Place la tête d'écriture au début du segment le plus libre.
  *
- * @param dir_inode L'index de l'inode du répertoire à examiner.
- * @return L'index de l'entrée libre trouvée, ou -1 si aucune n'est disponible.
+ * Un segment entièrement libre est toujours préféré ; à défaut la tête
+ * comble les trous du segment le moins rempli. Le récupérateur est réveillé
+ * quand les segments libres deviennent rares, pour qu'il en nettoie.
+ *
+ * @return 0 si un segment a été ouvert, -1 si la zone de données est pleine.
  */
-int rechEntree(int dir_inode){
-    int index = -1;
-    int i = 0;
-    Directory dir = fs.directories[dir_inode];
-
-    // Chercher une entrée libre
-    while(i<NUM_DIRECTORY_ENTRIES && index==-1){
-        if (dir.entries[i].inode_index == -1){
-            index = i;
+int open_segment() {
+    int best = -1, best_free = 0;
+    for (int seg = 0; seg < NUM_SEGMENTS; seg++) {
+        if (seg == cleaning_segment) {
+            continue;
+        }
+        int libres = segment_free_blocks(seg);
+        if (libres > best_free) {
+            best = seg;
+            best_free = libres;
         }
-        i++;
     }
-    return index;
-    fprintf(fs.log,"\nEntrée de répertoire trouvé : %d\n", index);
+    if (best == -1) {
+        return -1;
+    }
+    log_head = best * SEGMENT_BLOCKS;
+    fprintf(fs.log, "\nOuverture du segment %d (%d blocs libres)\n", best, best_free);
+    if (count_free_segments() < CLEAN_THRESHOLD) {
+        pthread_cond_signal(&reclaim_cond);
+    }
+    return 0;
 }
 
 /**
- * Vérifie si un inode donné possède une permission spécifique.
+ * @brief Alloue une suite de blocs contigus à la tête d'écriture (mode journalisé).
  *
- * @param inode_index L'index de l'inode à vérifier.
- * @param perm Le caractère de permission ('r' pour read, 'w' pour write, 'x' pour execute).
- * @return 1 si l'inode possède la permission, 0 sinon.
+ * Les blocs sont pris dans l'ordre à partir de la tête, qui ne revient jamais
+ * en arrière dans un segment : des écritures successives, même sur des
+ * fichiers différents, tombent les unes derrière les autres sur le disque.
+ * La suite s'arrête au premier bloc occupé ou à la fin du segment.
+ *
+ * @param count Nombre de blocs souhaités.
+ * @param length Reçoit le nombre de blocs effectivement alloués.
+ * @return Le premier bloc de la suite ou -1 si aucun bloc n'est disponible.
  */
- int has_permission(int inode_index, char perm) {
-    // Vérification que l'inode est valide
-    if (inode_index < 0 || inode_index >= NUM_INODES) {
-        return 0;
+int allocate_log_run(int count, int *length) {
+    *length = 0;
+    pthread_mutex_lock(&log_head_mutex);
+    for (int essais = 0; essais <= NUM_SEGMENTS; essais++) {
+        if (log_head == -1 && open_segment() == -1) {
+            break;
+        }
+        int fin_segment = (log_head / SEGMENT_BLOCKS + 1) * SEGMENT_BLOCKS;
+        while (log_head < fin_segment && (fs.free_blocks[log_head] != 0 || block_limbo[log_head])) {
+            log_head++;
+        }
+        if (log_head == fin_segment) {
+            log_head = -1;  // Segment plein : on passe au suivant
+            continue;
+        }
+        int first = log_head;
+        while (*length < count && log_head < fin_segment && fs.free_blocks[log_head] == 0 && !block_limbo[log_head]) {
+            fs.free_blocks[log_head++] = 1;
+            (*length)++;
+        }
+        if (log_head == fin_segment) {
+            log_head = -1;
+        }
+        pthread_mutex_unlock(&log_head_mutex);
+        fprintf(fs.log, "\nAllocation des blocs %d à %d en tête de journal\n", first, first + *length - 1);
+        return first;
     }
+    pthread_mutex_unlock(&log_head_mutex);
+    return -1;
+}
 
-    Inode *inode = &fs.inodes[inode_index];
-    fprintf(fs.log,"\nPermissions du fichier d'inode %d : %s\n", inode_index, inode->permissions);
+/*
+ * Groupes d'allocation. L'image est découpée en ALLOC_GROUPS groupes : le
+ * groupe g possède les blocs [g * GROUP_BLOCKS, (g + 1) * GROUP_BLOCKS) du
+ * compteur de références (sa table de blocs) et les inodes
+ * [g * GROUP_INODES, (g + 1) * GROUP_INODES) (sa table d'inodes, un inode
+ * libre ayant la taille -1). group_locks[g] protège ces deux tranches : des
+ * écrivains de groupes différents n'ont aucun verrou en commun. Un fichier
+ * prend son inode dans le groupe de son répertoire et ses blocs dans le
+ * groupe de son inode ; un nouveau répertoire part du groupe du thread qui
+ * le crée, ce qui répartit les arborescences des sessions entre les groupes.
+ * On ne déborde sur les groupes suivants que si le groupe voulu est plein.
+ */
 
-    // Vérification de la présence du caractère de permission dans la chaîne de permissions
-    if (perm == 'r' && strchr(inode->permissions, 'r')) return 1;
-    if (perm == 'w' && strchr(inode->permissions, 'w')) return 1;
-    if (perm == 'x' && strchr(inode->permissions, 'x')) return 1;
+/**
+ * @brief Retourne le groupe d'allocation préféré du thread appelant.
+ *
+ * Chaque thread reçoit le sien au premier appel : des écrivains parallèles
+ * ne se disputent pas le même groupe. Le premier thread (le shell) reçoit le
+ * groupe 0, ce qui garde l'ordre d'allocation d'un seul thread inchangé.
+ */
+int home_group() {
+    if (group_home == -1) {
+        group_home = __atomic_fetch_add(&next_group, 1, __ATOMIC_RELAXED) % ALLOC_GROUPS;
+    }
+    return group_home;
+}
 
-    return 0;  // Permission refusée
+/**
+ * @brief Retourne le groupe d'allocation d'un inode.
+ *
+ * @param inode_index L'inode, ou -1 pour le groupe du thread appelant.
+ */
+int inode_group(int inode_index) {
+    if (inode_index < 0 || inode_index >= NUM_INODES) {
+        return home_group();
+    }
+    return inode_index / GROUP_INODES;
 }
 
 /**
- * @brief Modifie les permissions (r, w, x) d'un fichier ou répertoire.
- * @param filename Le nom du fichier/répertoire.
- * @param newPerms Chaîne de 3 caractères (ex.: "rw-", "r-x", etc.).
- * @param dir_inode L'inode du répertoire courant ou parent.
- * @return 0 si succès, -1 si erreur.
+ * @brief Retourne le bloc physique où placer de préférence le bloc logique idx d'un inode.
+ *
+ * C'est le bloc qui prolonge le bloc alloué le plus proche avant idx (ou,
+ * à défaut, qui le précède le plus proche après idx) : des ajouts
+ * entrecoupés d'écritures dans d'autres fichiers restent contigus.
+ *
+ * @param inode_index Inode du fichier.
+ * @param idx Indice logique du bloc à placer.
+ * @return Le bloc visé, ou -1 si le fichier n'a aucun bloc (on vise alors le groupe de l'inode).
  */
- int change_permissions(const char *filename, const char *newPerms, int dir_inode) {
-    // 1) Retrouver l'inode du fichier/répertoire
-    int inode_index = rechInode(filename, fs.directories[dir_inode]);
-    if (inode_index == -1) {
-        fprintf(fs.log, "\nErreur lors du changement de permissions sur le fichier %s\n", filename);
-        printf("Erreur : '%s' introuvable dans ce répertoire.\n", filename);
+int block_goal(int inode_index, int idx) {
+    if (inode_index < 0 || inode_index >= NUM_INODES) {
         return -1;
     }
-
-    // 2) Mettre à jour les permissions (3 caractères max)
-    Inode *node = &fs.inodes[inode_index];
-    strncpy(node->permissions, newPerms, 3);
-    node->modification_time = time(NULL);
-
-    fprintf(fs.log, "\nNouvelles permissions pour le fichier %s : %s\n", filename, newPerms);
-
-    printf("Permissions de '%s' modifiées en '%s'.\n", filename, newPerms);
-    return 0;
+    int *blocks = fs.inodes[inode_index].blocks;
+    for (int p = idx - 1; p >= 0; p--) {
+        if (blocks[p] != -1) {
+            int goal = blocks[p] + idx - p;
+            return goal < NUM_BLOCKS ? goal : -1;
+        }
+    }
+    for (int p = idx + 1; p < NUM_BLOCKS; p++) {
+        if (blocks[p] != -1) {
+            int goal = blocks[p] - (p - idx);
+            return goal >= 0 ? goal : -1;
+        }
+    }
+    return -1;
 }
 
-
+int reclaim_orphans(int budget, int clones);
+int lock_range(off_t start, off_t len, short type);
+void lock_inode(int inode_index, short type);
+void lock_filesystem(int exclusif);
+void unlock_filesystem();
+int allocation_quota(int count, int *pris);
+int allocation_end(int pris, int first, int alloues);
 
 /**
- * @brief Crée un nouveau fichier dans un répertoire spécifié.
+ * @brief Alloue un bloc libre dans le système de fichiers.
  *
- * Cette fonction vérifie les permissions d'écriture du répertoire parent avant de créer un nouveau fichier.
- * Elle vérifie également qu'aucun fichier portant le même nom n'existe déjà dans le répertoire. Ensuite,
- * elle alloue un inode et un bloc de données pour le nouveau fichier, initialise ses métadonnées et ajoute
- * une entrée dans le répertoire parent.
+ * La recherche part du bloc visé et s'en éloigne des deux côtés, en
+ * commençant par l'avant, dans le groupe du bloc visé ; sans bloc visé,
+ * elle parcourt le groupe de l'inode destinataire depuis son début. Elle
+ * passe ensuite aux groupes suivants, chacun sous son propre verrou.
  *
- * @param filename Nom du fichier à créer.
- * @param permissions Chaîne de caractères représentant les permissions initiales du fichier (ex : "rw-", "rwx").
- * @param dir_inode Index de l'inode du répertoire parent où le fichier doit être créé.
+ * Quand le bloc visé est pris et que le bloc libre trouvé suit un bloc
+ * occupé, c'est sans doute le bloc visé d'un autre fichier qui grandit en
+ * même temps : on se place alors au milieu de l'espace libre qui commence
+ * là, pour que les deux fichiers continuent chacun de leur côté.
  *
- * @return L'index de l'inode du fichier créé en cas de succès, ou -1 en cas d'erreur (permissions insuffisantes,
- *         absence d'espace ou d'inode disponible, fichier déjà existant, etc.).
+ * @param inode_index Inode qui recevra le bloc (-1 : groupe du thread).
+ * @param goal Bloc visé (voir block_goal), ou -1.
+ * @return L'index du bloc alloué ou -1 si aucun bloc n'est disponible.
  */
-int create_file(const char *filename, const char *permissions, int dir_inode) {
-    // Vérifier permission 'w' sur le répertoire parent
-    if (!has_permission(dir_inode, 'w')) {
-        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
-        printf("Erreur : permission insuffisante pour créer un fichier dans ce répertoire.\n");
-        return -1;
+int allocate_block(int inode_index, int goal) {
+    if (log_structured) {
+        int length;
+        int block = allocate_log_run(1, &length);
+        if (block != -1) {
+            return block;
+        }
+    } else {
+        int pris;
+        int first_group = goal >= 0 && goal < NUM_BLOCKS ? goal / GROUP_BLOCKS : inode_group(inode_index);
+        int start = goal >= 0 && goal < NUM_BLOCKS ? goal : first_group * GROUP_BLOCKS;
+        for (int s = allocation_quota(1, &pris) > 0 ? 0 : ALLOC_GROUPS; s < ALLOC_GROUPS; s++) {
+            int group = (first_group + s) % ALLOC_GROUPS;
+            int debut = group * GROUP_BLOCKS;
+            int fin = debut + GROUP_BLOCKS;
+            int centre = s == 0 ? start : debut;
+            pthread_mutex_lock(&group_locks[group]);
+            for (int d = 0; d < GROUP_BLOCKS; d++) {
+                int candidats[2] = { centre + d, centre - d };
+                for (int c = 0; c < (d > 0 ? 2 : 1); c++) {
+                    int i = candidats[c];
+                    if (i >= debut && i < fin && fs.free_blocks[i] == 0) {
+                        if (goal != -1 && i != goal && i > debut && fs.free_blocks[i - 1] != 0) {
+                            int libres = 1;
+                            while (i + libres < fin && fs.free_blocks[i + libres] == 0) {
+                                libres++;
+                            }
+                            i += libres / 2;
+                        }
+                        fs.free_blocks[i] = 1;  // Marquer le bloc comme alloué
+                        pthread_mutex_unlock(&group_locks[group]);
+                        if (allocation_end(pris, i, 1) == 0) {
+                            return allocate_block(inode_index, goal);  // Place réservée entre-temps : recompter
+                        }
+                        fprintf(fs.log,"\nAllocation du bloc %d \n",i);
+                        return i;
+                    }
+                }
+            }
+            pthread_mutex_unlock(&group_locks[group]);
+        }
+        allocation_end(pris, -1, 0);
     }
-
-    // Répertoire où on va créer le fichier
-    Directory *dir = &fs.directories[dir_inode];
-    int inode_index = -1;
-
-    // Vérifier si le fichier existe dans le répertoire
-    if (rechInode(filename, *dir) != -1){
-        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
-        printf("Erreur de création, un fichier de même nom existe déjà dans le répertoire\n");
-        return -1;
+    // Des répertoires supprimés retiennent encore des blocs : on les libère tout de suite
+    if (fs.nb_orphans > 0 && reclaim_orphans(-1, 0) > 0) {
+        return allocate_block(inode_index, goal);
     }
+    fprintf(fs.log,"\nEchec d'allocation\n");
+    return -1;  // Aucun bloc libre trouvé
+}
 
-    // Trouver un inode libre
-    for (int i = 0; i < NUM_INODES; i++) {
-        if (fs.inodes[i].size == -1) { 
-            inode_index = i;
-            fs.inodes[i].size = 0; // Marquer comme utilisé
-            break;
+/**
+ * @brief Alloue une suite de blocs libres physiquement contigus.
+ *
+ * La suite commence au premier bloc libre à partir du bloc visé, en
+ * revenant au début de son groupe s'il n'y en a plus après lui (sans bloc
+ * visé : au premier bloc libre du groupe de l'inode), ou dans un groupe
+ * suivant. Elle s'arrête au premier bloc occupé ou quand count blocs
+ * ont été alloués : elle peut donc être plus courte. En mode journalisé,
+ * elle est prise à la tête d'écriture (allocate_log_run). Une suite qui
+ * déborde sur les groupes suivants les verrouille au passage, toujours dans
+ * l'ordre croissant.
+ *
+ * @param count Nombre de blocs souhaités.
+ * @param length Reçoit le nombre de blocs effectivement alloués.
+ * @param inode_index Inode qui recevra les blocs (-1 : groupe du thread).
+ * @param goal Bloc visé (voir block_goal), ou -1.
+ * @return Le premier bloc de la suite ou -1 si aucun bloc n'est disponible.
+ */
+int allocate_run(int count, int *length, int inode_index, int goal) {
+    if (log_structured) {
+        int first = allocate_log_run(count, length);
+        if (first == -1) {
+            fprintf(fs.log,"\nEchec d'allocation\n");
         }
+        return first;
     }
-
-    // Vérifier si on a trouvé un inode libre
-    if (inode_index == -1) {
-        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
-        printf("Erreur: Aucun inode libre.\n");
-        return -1;
+    *length = 0;
+    int pris;
+    count = allocation_quota(count, &pris);
+    int first_group = goal >= 0 && goal < NUM_BLOCKS ? goal / GROUP_BLOCKS : inode_group(inode_index);
+    int decalage = goal >= 0 && goal < NUM_BLOCKS ? goal % GROUP_BLOCKS : 0;
+    for (int s = count > 0 ? 0 : ALLOC_GROUPS; s < ALLOC_GROUPS; s++) {
+        int group = (first_group + s) % ALLOC_GROUPS;
+        pthread_mutex_lock(&group_locks[group]);
+        for (int k = 0; k < GROUP_BLOCKS; k++) {
+            int i = group * GROUP_BLOCKS + (k + (s == 0 ? decalage : 0)) % GROUP_BLOCKS;
+            if (fs.free_blocks[i] != 0) {
+                continue;
+            }
+            int derniere = group;
+            while (*length < count && i + *length < NUM_BLOCKS) {
+                int b = i + *length;
+                if (b / GROUP_BLOCKS != derniere) {
+                    derniere = b / GROUP_BLOCKS;
+                    pthread_mutex_lock(&group_locks[derniere]);
+                }
+                if (fs.free_blocks[b] != 0) {
+                    break;
+                }
+                fs.free_blocks[b] = 1;
+                (*length)++;
+            }
+            for (int k = group; k <= derniere; k++) {
+                pthread_mutex_unlock(&group_locks[k]);
+            }
+            *length = allocation_end(pris, i, *length);
+            if (*length == 0) {
+                return allocate_run(count, length, inode_index, goal);
+            }
+            fprintf(fs.log,"\nAllocation des blocs %d à %d\n", i, i + *length - 1);
+            return i;
+        }
+        pthread_mutex_unlock(&group_locks[group]);
     }
+    allocation_end(pris, -1, 0);
+    fprintf(fs.log,"\nEchec d'allocation\n");
+    return -1;
+}
 
-    Inode *inode = &fs.inodes[inode_index];
-
-    // Allouer uniquement 1 bloc pour commencer
-    int block = allocate_block();
-    if (block == -1) {
-        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
-        printf("Erreur: Pas de blocs libres disponibles.\n");
-        inode->size = -1; // Marquer l'inode comme inutilisé
-        return -1;
+/**
+ * @brief Met de côté un bloc libéré en mode journalisé jusqu'à ce que sa libération soit sur disque.
+ *
+ * Tant que la validation qui le libère n'est pas synchronisée, l'état sur
+ * disque désigne encore ce bloc (ancienne version d'un bloc réécrit, bloc
+ * d'un segment nettoyé) : la tête d'écriture ne doit pas le recouvrir. Il
+ * est libre dans fs.free_blocks, mais allocate_log_run le saute.
+ * Appelée avec log_head_mutex.
+ *
+ * @param block_index Le bloc libéré.
+ */
+void limbo_add(int block_index) {
+    if (!block_limbo[block_index]) {
+        block_limbo[block_index] = 1;
+        limbo_count++;
     }
+    limbo_seq = __atomic_load_n(&journal_written_seq, __ATOMIC_RELAXED) + 1;
+}
 
-    // Chercher un espace libre dans le répertoire
-    int index_rep = rechEntree(dir_inode);
-    if(index_rep == -1){
-        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
-        printf("Erreur: Aucun espace dans le répertoire.\n");
-        free_block(block); // Libérer le bloc alloué
-        inode->size = -1; // Marquer l'inode comme inutilisé
-        return -1;
+/**
+ * @brief Rend à la tête d'écriture les blocs dont la libération est sur disque.
+ *
+ * Appelée après chaque synchronisation du journal (journal_sync, point de contrôle).
+ */
+void limbo_release() {
+    pthread_mutex_lock(&log_head_mutex);
+    if (limbo_count > 0 && __atomic_load_n(&journal_synced_seq, __ATOMIC_ACQUIRE) >= limbo_seq) {
+        memset(block_limbo, 0, sizeof(block_limbo));
+        fprintf(fs.log, "\n%d blocs libérés réutilisables\n", limbo_count);
+        limbo_count = 0;
     }
+    pthread_mutex_unlock(&log_head_mutex);
+}
 
-    // Ajouter le fichier au répertoire
-    strncpy(dir->entries[index_rep].filename, filename, MAX_FILE_NAME);
-    dir->entries[index_rep].inode_index = inode_index;
-    fprintf(fs.log, "\nFichier %s créé avec les permissions %s dans le repertoire d'inode %d\n", filename, permissions, dir_inode);
-    printf("Fichier '%s' créé avec succès.\n", filename);
+/**
+ * @brief Libère un bloc précédemment alloué.
+ *
+ * Le bloc peut être partagé entre plusieurs inodes (copie par partage de blocs) :
+ * on retire seulement une référence, le bloc ne redevient libre qu'à la dernière.
+ *
+ * @param block_index L'index du bloc à libérer.
+ */
+void free_block(int block_index) {
+    int restant = -1;
+    if (block_index >= 0 && block_index < NUM_BLOCKS) {
+        pthread_mutex_lock(&group_locks[block_index / GROUP_BLOCKS]);
+        if (fs.free_blocks[block_index] > 0) {
+            restant = --fs.free_blocks[block_index];
+        }
+        pthread_mutex_unlock(&group_locks[block_index / GROUP_BLOCKS]);
+    }
+    if (restant == 0) {
+        if (log_structured) {
+            pthread_mutex_lock(&log_head_mutex);
+            limbo_add(block_index);
+            pthread_mutex_unlock(&log_head_mutex);
+        }
+        fprintf(fs.log,"\nLibération du bloc %d\n",block_index);
+    } else if (restant == -1) {
+        printf("Erreur: tentative de libération d'un bloc invalide (%d).\n", block_index);
+        fprintf(fs.log,"\nEchec de la libération du bloc %d\n", block_index);
+    }
+}
 
-    // Initialiser l'inode
-    inode->blocks[0] = block;
-    inode->type = 1;
-    inode->creation_time = time(NULL);
-    inode->modification_time = time(NULL);
-    inode->inode_rep_parent = dir_inode;
-    strncpy(inode->permissions, permissions, 3);
 
-    //printf("block : %d\n", block);
 
-    return inode_index;
+/**
+ * @brief Ajoute une référence sur un bloc déjà alloué (partage entre deux inodes).
+ *
+ * @param block_index L'index du bloc partagé.
+ */
+void share_block(int block_index) {
+    if (block_index >= 0 && block_index < NUM_BLOCKS) {
+        pthread_mutex_lock(&group_locks[block_index / GROUP_BLOCKS]);
+        if (fs.free_blocks[block_index] > 0) {
+            fs.free_blocks[block_index]++;
+        }
+        pthread_mutex_unlock(&group_locks[block_index / GROUP_BLOCKS]);
+    }
 }
 
 /**
- * @brief Supprime un fichier spécifié d'un répertoire.
- *
- * Cette fonction vérifie l'existence du fichier indiqué dans le répertoire spécifié par son inode. 
- * Si le fichier existe, elle libère tous les blocs associés au fichier, réinitialise l'inode correspondant 
- * pour le rendre disponible et supprime l'entrée correspondante dans le répertoire parent. Elle prend également
- * en compte les éventuels liens durs vers ce fichier.
+ * @brief Signale qu'un répertoire a été modifié (entrées ajoutées, retirées ou renommées).
  *
- * @param filename Nom du fichier à supprimer.
- * @param dir_inode Index de l'inode du répertoire contenant le fichier à supprimer.
+ * Les inodes et le compteur de blocs sont comparés en entier à chaque
+ * validation du journal ; les répertoires (66 Ko chacun) ne le sont que
+ * s'ils ont été signalés ici.
  *
- * @note Cette fonction ne peut pas supprimer un répertoire.
+ * @param dir_inode L'inode du répertoire modifié.
  */
-void delete_file(char *filename, int dir_inode) {
-    // Répertoire où le fichier se situe
-    Directory *dir = &fs.directories[dir_inode];
-    int inode_index = rechInode(filename, *dir);
-
-    // Vérifier si le fichier existe
-    if(inode_index == -1){
-        fprintf(fs.log, "\nErreur sur la suppression du fichier %s\n", filename);
-        printf("Erreur : Fichier inexistant.\n");
-    } else if(fs.inodes[inode_index].type != 1 && fs.inodes[inode_index].type != 2){
-        fprintf(fs.log, "\nErreur sur la suppression du fichier %s\n", filename);
-        printf("Erreur : Type de fichier non reconnu ou est un répertoire.\n");
-    } else {
-        Inode *inode = &fs.inodes[inode_index];
+void mark_dir(int dir_inode) {
+    if (dir_inode >= 0 && dir_inode < NUM_INODES) {
+        journal_dir_dirty[dir_inode] = 1;
+    }
+}
 
-        // Libérer tous les blocs associés
-        for (int i = 0; i < NUM_BLOCKS; i++) {
-            if (inode->blocks[i] != -1) {
-                free_block(inode->blocks[i]);
-                inode->blocks[i] = -1;
-            }
+/**
+ * @brief Indique s'il reste au moins un clone de répertoire paresseux.
+ */
+int pending_clones() {
+    for (int i = 0; i < NUM_INODES; i++) {
+        if (fs.clone_src[i] != -1) {
+            return 1;
         }
+    }
+    return 0;
+}
 
-        inode->size = -1; // Marquer l'inode comme libre
-        inode->type = -1;
-        inode->creation_time = time(NULL);
-        inode->modification_time = time(NULL);
-        inode->link_count = 0;
-        inode->inode_rep_parent = -1;
+int allocate_inode(int dir_inode, int type);
+int flush_delayed(int inode_index);
 
-        // Supprimer l'entrée du répertoire
-        int i = 0;
-        while (inode_index != -1) {
-            if (dir->entries[i].inode_index == inode_index && strcmp(filename,dir->entries[i].filename) == 0) { // Vérifier le nom du fichier au cas où on a un lien dur
-                dir->entries[i].inode_index = -1;
-                memset(dir->entries[i].filename, 0, MAX_FILE_NAME);
-                inode_index = -1;
-            }
-            i++;
+/**
+ * @brief Crée un nouvel inode identique à src, dont les blocs sont partagés (copie sur écriture).
+ *
+ * @param src Inode à reproduire.
+ * @param parent Répertoire parent du nouvel inode.
+ * @return L'index du nouvel inode, ou -1 si aucun inode n'est libre.
+ */
+int clone_inode(int src, int parent) {
+    flush_delayed(src);  // Le clone partage les blocs : ils doivent exister
+    int i = allocate_inode(parent, fs.inodes[src].type);
+    if (i == -1) {
+        return -1;
+    }
+    memcpy(&fs.inodes[i], &fs.inodes[src], sizeof(Inode));
+    fs.inodes[i].id = i;
+    fs.inodes[i].link_count = 1;
+    fs.inodes[i].inode_rep_parent = parent;
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        if (fs.inodes[i].blocks[b] != -1) {
+            share_block(fs.inodes[i].blocks[b]);
         }
-
-        printf("Fichier %s supprimé avec succès.\n", filename);
-        fprintf(fs.log, "\nFichier %s supprimé\n", filename);
     }
+    return i;
 }
 
-
+Directory *dir_of(int dir_inode);
 
 /**
- * @brief Supprime un répertoire vide du système de fichiers.
+ * @brief Recopie les entrées d'un clone paresseux depuis sa source, sur un seul niveau.
  *
- * @param dirname    Le nom du répertoire à supprimer.
- * @param parent_dir L'inode du répertoire parent (celui qui contient dirname).
- * @return 0 si la suppression réussit, -1 en cas d'erreur.
+ * Chaque fichier de la source devient un nouvel inode qui partage ses blocs ;
+ * chaque sous-répertoire devient à son tour un clone paresseux. Le coût est
+ * donc proportionnel au nombre d'entrées du répertoire, jamais à la taille de
+ * l'arborescence. Rien n'est modifié si les inodes libres ne suffisent pas.
+ *
+ * @param dir_inode Le clone à matérialiser.
+ * @return 0 si succès, -1 si les inodes libres manquent.
  */
-int delete_directory(const char *dirname, int parent_dir) {
-    // 1) Trouver l'inode du répertoire à supprimer en cherchant dirname dans le répertoire parent
-    int dir_inode = rechInode(dirname, fs.directories[parent_dir]);
-    if (dir_inode == -1) {
-        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
-        printf("Erreur: Le répertoire '%s' n'existe pas dans le répertoire %d.\n", dirname, parent_dir);
-        return -1;
+int materialize_clone(int dir_inode) {
+    int src = fs.clone_src[dir_inode];
+    if (src == -1) {
+        return 0;
     }
+    Directory *source = dir_of(src);  // La source peut elle-même être un clone en attente
 
-    // 2) Vérifier que c'est bien un répertoire
-    if (fs.inodes[dir_inode].type != 0) {  // 0 = répertoire
-        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
-        printf("Erreur: '%s' n'est pas un répertoire.\n", dirname);
-        return -1;
+    int besoin = 0, libres = 0;
+    for (int e = 0; e < NUM_DIRECTORY_ENTRIES; e++) {
+        besoin += source->entries[e].inode_index != -1;
     }
-    // 3) Vérifier permission 'w' sur ce répertoire
-    if (!has_permission(dir_inode, 'w')) {
-        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
-        printf("Erreur : pas de permission d'écriture sur le répertoire '%s'.\n", dirname);
+    for (int i = 0; i < NUM_INODES; i++) {
+        libres += fs.inodes[i].size == -1;
+    }
+    if (libres < besoin) {
+        printf("Erreur : pas assez d'inodes libres pour détacher le clone (inode %d).\n", dir_inode);
+        fprintf(fs.log, "\nEchec de la matérialisation du clone %d\n", dir_inode);
         return -1;
     }
 
-    // 4) Supprimer récursivement
-    Directory *dir_to_delete = &fs.directories[dir_inode];
-    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-        if (dir_to_delete->entries[i].inode_index != -1) {
-            int inode = dir_to_delete->entries[i].inode_index;
-            //printf("inode %d\n", inode);
-            if (fs.inodes[inode].type == 0){
-                delete_directory(dir_to_delete->entries[i].filename, dir_inode);
-            }
+    fs.clone_src[dir_inode] = -1;
+    Directory *dir = &fs.directories[dir_inode];
+    for (int e = 0; e < NUM_DIRECTORY_ENTRIES; e++) {
+        int child = source->entries[e].inode_index;
+        if (child == -1) {
+            continue;
+        }
+        int copy = clone_inode(child, dir_inode);
+        if (fs.inodes[child].type == 0) {
+            fs.clone_src[copy] = child;
+        }
+        memcpy(dir->entries[e].filename, source->entries[e].filename, MAX_FILE_NAME);
+        dir->entries[e].inode_index = copy;
+    }
+    mark_dir(dir_inode);
+    fprintf(fs.log, "\nMatérialisation du clone %d (source %d) : %d entrées\n", dir_inode, src, besoin);
+    return 0;
+}
 
-            if (fs.inodes[inode].type == 1 || fs.inodes[inode].type == 2){
-                delete_file(dir_to_delete->entries[i].filename, dir_inode);
-            }
+/**
+ * @brief Retourne la table d'entrées d'un répertoire, en matérialisant d'abord un clone paresseux.
+ *
+ * Toute lecture ou modification des entrées d'un répertoire passe par ici.
+ *
+ * @param dir_inode Inode du répertoire.
+ * @return La table d'entrées du répertoire.
+ */
+Directory *dir_of(int dir_inode) {
+    if (fs.clone_src[dir_inode] != -1) {
+        materialize_clone(dir_inode);
+    }
+    return &fs.directories[dir_inode];
+}
+
+/**
+ * @brief Indique si dir_inode est la source d'un clone encore paresseux.
+ */
+int has_clones(int dir_inode) {
+    for (int i = 0; i < NUM_INODES; i++) {
+        if (fs.clone_src[i] == dir_inode) {
+            return 1;
         }
     }
+    return 0;
+}
 
-    // 4) Supprimer l'entrée correspondant à ce répertoire dans le parent
-    Directory *parent_directory = &fs.directories[parent_dir];
-    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-        if (parent_directory->entries[i].inode_index == dir_inode &&
-            strcmp(parent_directory->entries[i].filename, dirname) == 0)
-        {
-            parent_directory->entries[i].inode_index = -1;
-            memset(parent_directory->entries[i].filename, 0, MAX_FILE_NAME);
+/**
+ * @brief Matérialise tous les clones paresseux dont la source est dir_inode.
+ *
+ * @return 0 si succès, -1 si un clone n'a pas pu être matérialisé.
+ */
+int materialize_clones_of(int dir_inode) {
+    for (int i = 0; i < NUM_INODES; i++) {
+        if (fs.clone_src[i] == dir_inode && materialize_clone(i) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Prépare la modification d'un répertoire ou d'un de ses fichiers.
+ *
+ * Un clone paresseux lit les entrées de sa source au moment où il est
+ * matérialisé : avant que dir_inode ou un de ses ancêtres ne change, leurs
+ * clones en attente sont matérialisés, du haut de l'arborescence vers le bas
+ * pour que chaque niveau reprenne l'état d'avant la modification.
+ *
+ * @param dir_inode Répertoire sur le point d'être modifié.
+ * @return 0 si succès, -1 si un clone n'a pas pu être matérialisé.
+ */
+int unshare_dir(int dir_inode) {
+    if (dir_inode < 0 || !pending_clones()) {
+        return 0;
+    }
+    int chemin[NUM_INODES];
+    int n = 0;
+    for (int x = dir_inode; x >= 0 && n < NUM_INODES; x = fs.inodes[x].inode_rep_parent) {
+        chemin[n++] = x;
+        if (x == 0) {
             break;
         }
     }
-    
-           
-    // 5) Libérer l'inode du répertoire
-    Inode *inode_ptr = &fs.inodes[dir_inode];
-    inode_ptr->size = -1;
-    inode_ptr->type = -1;
-    inode_ptr->creation_time = time(NULL);
-    inode_ptr->modification_time = time(NULL);
-    inode_ptr->inode_rep_parent = -1;
-    inode_ptr->link_count = 0;
-    for (int i = 0; i < NUM_BLOCKS; i++) {
-        if (inode_ptr->blocks[i] != -1) {
-            // Normalement, un répertoire n'a pas de blocs de données, mais par sécurité :
-            free_block(inode_ptr->blocks[i]);
-            inode_ptr->blocks[i] = -1;
+    for (int k = n - 1; k >= 0; k--) {
+        if (materialize_clones_of(chemin[k]) == -1) {
+            return -1;
         }
     }
-
-    printf("Le répertoire '%s' a été supprimé avec succès.\n", dirname);
-    fprintf(fs.log, "\nSuccès de la suppression du répertoire %s\n", dirname);
     return 0;
 }
 
-
 /**
- * Crée un répertoire dans le système de fichiers simulé.
+ * @brief Prépare la modification du contenu ou des attributs d'un inode (voir unshare_dir).
  *
- * @param dirname Nom du répertoire à créer.
- * @return L'index de l'inode du répertoire créé, ou -1 en cas d'erreur.
+ * Un fichier à plusieurs liens durs peut figurer dans plusieurs répertoires :
+ * ils sont alors tous cherchés.
+ *
+ * @param inode_index Inode sur le point d'être modifié.
+ * @return 0 si succès, -1 si un clone n'a pas pu être matérialisé.
  */
- int create_directory(const char *dirname, int inode_dir) {
-    int inode_index = -1;
-
-    // Rechercher un inode libre pour stocker le répertoire
-    int i = 0;
-    while (i < NUM_INODES && inode_index == -1) {
-        if (fs.inodes[i].size == -1) {  // Un inode libre a une taille de -1
-            inode_index = i;
+int unshare_inode(int inode_index) {
+    if (!pending_clones()) {
+        return 0;
+    }
+    if (fs.inodes[inode_index].type == 0 || fs.inodes[inode_index].link_count <= 1) {
+        return unshare_dir(fs.inodes[inode_index].inode_rep_parent);
+    }
+    for (int d = 0; d < NUM_INODES; d++) {
+        if (fs.inodes[d].type != 0 || fs.clone_src[d] != -1) {
+            continue;
+        }
+        for (int e = 0; e < NUM_DIRECTORY_ENTRIES; e++) {
+            if (fs.directories[d].entries[e].inode_index == inode_index) {
+                if (unshare_dir(d) == -1) {
+                    return -1;
+                }
+                break;
+            }
         }
-        i++;
     }
+    return 0;
+}
 
-    // Vérifier si un inode a été trouvé
-    if (inode_index == -1) {
-        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
-        printf("Erreur: Aucun inode libre pour créer un répertoire.\n");
-        return -1;
+/**
+ * @brief Entre dans une opération sur l'état partagé.
+ *
+ * En partage, plusieurs threads travaillent en même temps et chacun
+ * verrouille ensuite les inodes qu'il touche (InodeLocks). Tant qu'il reste
+ * un clone paresseux, toute lecture de répertoire peut le matérialiser :
+ * l'opération passe alors en exclusif. Un appel imbriqué dans une opération
+ * déjà commencée par le même thread ne prend rien.
+ *
+ * @param exclusif 1 pour une opération qui touche tout l'état.
+ * @return 1 si le verrou a été pris (à rendre avec op_end), 0 sinon.
+ */
+int op_begin(int exclusif) {
+    if (op_mode != 0) {
+        return 0;
     }
-
-    Directory *dir = &fs.directories[inode_dir];
-
-    //Vérifier si le fichier existe dans le répertoire
-    if (rechInode(dirname, *dir) != -1){
-        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
-        printf("Erreur de création, un fichier de même nom existe déjà dans le répertoire\n");
-        return -1;
+    if (!exclusif) {
+        pthread_rwlock_rdlock(&namespace_lock);
+        if (!pending_clones()) {
+            op_mode = 1;
+            return 1;
+        }
+        pthread_rwlock_unlock(&namespace_lock);
     }
+    pthread_rwlock_wrlock(&namespace_lock);
+    op_mode = 2;
+    return 1;
+}
 
-    // Chercher une entrée libre dans le répertoire
-    int index = rechEntree(inode_dir);
-    if (index == -1){
-        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
-        printf("Erreur: Pas d'espace libre dans le répertoire.\n");
-        return -1;
+/**
+ * @brief Sort d'une opération commencée par op_begin.
+ *
+ * @param pris Valeur rendue par op_begin.
+ */
+void op_end(int pris) {
+    if (pris) {
+        op_mode = 0;
+        pthread_rwlock_unlock(&namespace_lock);
     }
+}
 
-    Directory *new_dir = &fs.directories[inode_index];
-
-    // Initialisation de l'inode pour le répertoire
-    Inode *inode = &fs.inodes[inode_index];
-    inode->size = 0;  // Un répertoire commence vide
-    inode->type = 0;
-    inode->inode_rep_parent = inode_dir;
-    inode->creation_time = time(NULL);
-    inode->modification_time = time(NULL);
-    strncpy(inode->permissions, "rwx", 3);  // Lecture, écriture et exécution
-    inode->link_count = 1;  // Le répertoire est lié à lui-même
-
-    // Aucun bloc n'est alloué directement
-    for (int i = 0; i < NUM_BLOCKS; i++) {
-        inode->blocks[i] = -1;
+/**
+ * @brief Début de lecture sans verrou d'un inode (et de son répertoire).
+ *
+ * @param inode L'inode lu.
+ * @return Le compteur à repasser à seq_read_retry, impair si une modification est en cours.
+ */
+unsigned seq_read_begin(int inode) {
+    if (seq_held[inode]) {
+        return 0;  // C'est ce thread qui écrit : sa lecture est forcément cohérente
     }
+    return __atomic_load_n(&inode_seq[inode], __ATOMIC_ACQUIRE);
+}
 
-    //Initialiser les entrées du répertoire
-    for(int i = 0 ; i < NUM_DIRECTORY_ENTRIES ; i++){
-        memset(new_dir->entries[i].filename, 0, MAX_FILE_NAME * sizeof(char));
-        new_dir->entries[i].inode_index = -1;
+/**
+ * @brief Indique si une lecture sans verrou doit être recommencée.
+ *
+ * @param inode L'inode lu.
+ * @param seq Valeur rendue par seq_read_begin.
+ * @return 1 si une modification a eu lieu pendant la lecture (ou était en cours), 0 si la lecture est cohérente.
+ */
+int seq_read_retry(int inode, unsigned seq) {
+    if (seq_held[inode]) {
+        return 0;
     }
-
-    // Ajouter le répertoire au répertoire parent
-    strncpy(dir->entries[index].filename, dirname, MAX_FILE_NAME);
-    dir->entries[index].inode_index = inode_index;
-    fprintf(fs.log, "\nRépertoire '%s' créé avec succès\n", dirname);
-    printf("Répertoire '%s' créé avec succès.\n", dirname);
-    return inode_index;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seq & 1) || __atomic_load_n(&inode_seq[inode], __ATOMIC_RELAXED) != seq;
 }
 
-
-
-
-
-
 /**
- * Déplace un répertoire (et son contenu) d'un répertoire parent source vers un répertoire parent destination.
+ * @brief Inodes qu'une opération partagée verrouille.
  *
- * @param srcDirName   Le nom du répertoire à déplacer.
- * @param srcParentDir L'inode du répertoire parent source.
- * @param dstParentDir L'inode du répertoire parent destination.
- * @return 0 si la réussite, -1 si erreur.
+ * Les verrous sont pris par numéro d'inode croissant : deux opérations qui
+ * se croisent (mv de A vers B et de B vers A) ne peuvent pas s'attendre
+ * mutuellement. Dans une opération exclusive, rien n'est verrouillé.
  */
- int move_directory(const char *srcDirName, int srcParentDir, int dstParentDir) {
-    // 1) Récupérer l'inode du répertoire source
-    int srcDirInode = rechInode(srcDirName, fs.directories[srcParentDir]);
-    if (srcDirInode == -1) {
-        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
-        printf("Erreur : Le répertoire '%s' n'existe pas dans le répertoire %d.\n", srcDirName, srcParentDir);
-        return -1;
-    }
+typedef struct {
+    int nb;
+    int inode[MAX_OP_INODES];
+    int ecriture[MAX_OP_INODES];  /**< 1 pour un verrou en écriture */
+    int pris;                     /**< Les verrous sont tenus */
+} InodeLocks;
 
-    // 2) Vérifier que c'est bien un répertoire
-    if (fs.inodes[srcDirInode].type != 0) {
-        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
-        printf("Erreur : '%s' n'est pas un répertoire.\n", srcDirName);
-        return -1;
+/**
+ * @brief Ajoute un inode à l'ensemble (sans le verrouiller encore).
+ */
+void inode_locks_add(InodeLocks *l, int inode, int ecriture) {
+    if (inode < 0 || inode >= NUM_INODES) {
+        return;
     }
-     // 3) Vérifier la permission 'w' sur le répertoire source (pour supprimer l'entrée)
-     if (!has_permission(srcParentDir, 'w')) {
-        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
-        printf("Erreur : permission d'écriture refusée dans le répertoire source (inode %d).\n", srcParentDir);
-        return -1;
+    for (int k = 0; k < l->nb; k++) {
+        if (l->inode[k] == inode) {
+            l->ecriture[k] |= ecriture;
+            return;
+        }
+    }
+    if (l->nb < MAX_OP_INODES) {
+        l->inode[l->nb] = inode;
+        l->ecriture[l->nb] = ecriture;
+        l->nb++;
     }
+}
 
-    // 4) Vérifier qu'il n'y a pas déjà un répertoire (ou fichier) du même nom dans la destination
-    if (rechInode(srcDirName, fs.directories[dstParentDir]) != -1) {
-        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
-        printf("Erreur : Le nom '%s' existe déjà dans le répertoire %d.\n", srcDirName, dstParentDir);
-        return -1;
+/**
+ * @brief Verrouille les inodes de l'ensemble, par numéro croissant.
+ */
+void inode_locks_acquire(InodeLocks *l) {
+    l->pris = op_mode == 1;
+    if (!l->pris) {
+        return;
     }
-    // 5) Vérifier la permission 'w' sur le répertoire cible (pour créer l'entrée)
-    if (!has_permission(dstParentDir, 'w')) {
-        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
-        printf("Erreur : permission d'écriture refusée dans le répertoire cible (inode %d).\n", dstParentDir);
-        return -1;
+    for (int k = 1; k < l->nb; k++) {
+        for (int m = k; m > 0 && l->inode[m - 1] > l->inode[m]; m--) {
+            int inode = l->inode[m], ecriture = l->ecriture[m];
+            l->inode[m] = l->inode[m - 1];
+            l->ecriture[m] = l->ecriture[m - 1];
+            l->inode[m - 1] = inode;
+            l->ecriture[m - 1] = ecriture;
+        }
     }
-
-    // 6) Ajouter une entrée dans le répertoire destination
-    int dstIndex = rechEntree(dstParentDir);
-    if (dstIndex == -1) {
-        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
-        printf("Erreur : Pas d'espace libre dans le répertoire %d.\n", dstParentDir);
-        return -1;
+    for (int k = 0; k < l->nb; k++) {
+        if (l->ecriture[k]) {
+            pthread_rwlock_wrlock(&inode_rwlocks[l->inode[k]]);
+            // Compteur impair : les lecteurs sans verrou recommenceront
+            __atomic_add_fetch(&inode_seq[l->inode[k]], 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            seq_held[l->inode[k]] = 1;
+        } else {
+            pthread_rwlock_rdlock(&inode_rwlocks[l->inode[k]]);
+        }
     }
-    Directory *destDir = &fs.directories[dstParentDir];
-    strncpy(destDir->entries[dstIndex].filename, srcDirName, MAX_FILE_NAME);
-    destDir->entries[dstIndex].inode_index = srcDirInode;
+}
 
-    // 7) Supprimer l'entrée du répertoire source
-    Directory *sourceDir = &fs.directories[srcParentDir];
-    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-        if (sourceDir->entries[i].inode_index == srcDirInode &&
-            strcmp(sourceDir->entries[i].filename, srcDirName) == 0)
-        {
-            sourceDir->entries[i].inode_index = -1;
-            memset(sourceDir->entries[i].filename, 0, MAX_FILE_NAME);
-            break;
+/**
+ * @brief Relâche les verrous de l'ensemble.
+ */
+void inode_locks_release(InodeLocks *l) {
+    if (!l->pris) {
+        return;
+    }
+    for (int k = l->nb - 1; k >= 0; k--) {
+        if (l->ecriture[k]) {
+            seq_held[l->inode[k]] = 0;
+            __atomic_add_fetch(&inode_seq[l->inode[k]], 1, __ATOMIC_RELEASE);
         }
+        pthread_rwlock_unlock(&inode_rwlocks[l->inode[k]]);
     }
+    l->pris = 0;
+}
 
-    // 8) Mettre à jour l'inode du répertoire pour pointer vers son nouveau parent
-    fs.inodes[srcDirInode].inode_rep_parent = dstParentDir;
-    fs.inodes[srcDirInode].modification_time = time(NULL);
+int rechInode(const char *filename, const Directory *dir);
 
-    fprintf(fs.log, "\nRépertoire '%s' (inode %d) déplacé de %d vers %d\n", srcDirName, srcDirInode, srcParentDir, dstParentDir);
-    printf("Répertoire '%s' (inode %d) déplacé de %d vers %d.\n", srcDirName, srcDirInode, srcParentDir, dstParentDir);
-    return 0;
+/**
+ * @brief Verrouille l'ensemble ainsi que l'inode désigné par une entrée de répertoire.
+ *
+ * L'inode n'est connu qu'en lisant le répertoire : on le cherche sous les
+ * verrous de l'ensemble, puis on reprend tous les verrous dans l'ordre avec
+ * lui et on vérifie que l'entrée n'a pas changé entre-temps.
+ *
+ * @param l Ensemble contenant déjà le répertoire.
+ * @param dir_inode Répertoire où chercher.
+ * @param name Nom de l'entrée.
+ * @param ecriture 1 pour verrouiller l'inode trouvé en écriture.
+ * @return L'inode trouvé, ou -1 s'il n'existe pas. Les verrous sont tenus dans les deux cas.
+ */
+int inode_locks_entry(InodeLocks *l, int dir_inode, const char *name, int ecriture) {
+    int nb = l->nb;
+    while (1) {
+        inode_locks_acquire(l);
+        int inode = rechInode(name, dir_of(dir_inode));
+        int deja = 0;
+        for (int k = 0; k < l->nb; k++) {
+            deja |= l->inode[k] == inode;
+        }
+        if (inode == -1 || deja || !l->pris) {
+            inode_locks_add(l, inode, ecriture);
+            return inode;
+        }
+        inode_locks_release(l);
+        inode_locks_add(l, inode, ecriture);
+        inode_locks_acquire(l);
+        if (rechInode(name, dir_of(dir_inode)) == inode) {
+            return inode;
+        }
+        // L'entrée a changé pendant qu'on reprenait les verrous : on recommence
+        inode_locks_release(l);
+        l->nb = nb;
+    }
 }
 
 /**
- * Retourne l'inode correspondant à un chemin (absolu ou relatif) dans le système de fichiers.
+ * @brief Réserve un inode libre (taille passée de -1 à 0).
  *
- * @param path          Le chemin (ex: "/home/user/file.txt" ou "docs/fichier1.txt")
- * @param current_dir   L'inode du répertoire courant (utilisé si le chemin n'est pas absolu)
- * @return L'inode du fichier/répertoire pointé par 'path', ou -1 en cas d'erreur.
+ * Un fichier ou un lien est placé dans le groupe de son répertoire, pour que
+ * ses blocs soient proches de ceux de ses voisins ; un répertoire part du
+ * groupe du thread appelant. Les groupes suivants ne servent que si celui-là
+ * est plein.
+ *
+ * @param dir_inode Répertoire qui recevra l'inode.
+ * @param type Type de l'inode (0 répertoire, 1 fichier, 2 lien symbolique).
+ * @return L'index de l'inode réservé, ou -1 si aucun n'est libre.
  */
- int get_inode_from_path(const char *path, int current_dir) {
-    // 1) Déterminer si le chemin est absolu ou relatif
-    int inode = 0;  // Par défaut, la racine
-    if (path[0] != '/') {
-        // Chemin relatif => partir du répertoire courant
-        inode = current_dir;
+int allocate_inode(int dir_inode, int type) {
+    int goal = type == 0 ? home_group() : inode_group(dir_inode);
+    for (int s = 0; s < ALLOC_GROUPS; s++) {
+        int group = (goal + s) % ALLOC_GROUPS;
+        pthread_mutex_lock(&group_locks[group]);
+        for (int i = group * GROUP_INODES; i < (group + 1) * GROUP_INODES; i++) {
+            if (fs.inodes[i].size == -1) {
+                fs.inodes[i].size = 0; // Marquer comme utilisé
+                pthread_mutex_unlock(&group_locks[group]);
+                return i;
+            }
+        }
+        pthread_mutex_unlock(&group_locks[group]);
     }
+    return -1;
+}
 
-    // 2) Copie du chemin local pour strtok (car strtok modifie la chaîne)
-    char tempPath[1024];
-    memset(tempPath, 0, sizeof(tempPath));
-    strncpy(tempPath, path, sizeof(tempPath) - 1);
+/**
+ * @brief Retourne le bloc physique où écrire le bloc logique idx d'un inode.
+ *
+ * Le bloc est alloué s'il n'existe pas encore. S'il est partagé avec un autre
+ * inode, il est d'abord recopié dans un bloc neuf (copie sur écriture) pour
+ * que l'écriture ne soit pas visible par les autres propriétaires.
+ *
+ * @param inode_index Inode du fichier.
+ * @param idx Indice logique du bloc dans le fichier.
+ * @return Le numéro du bloc physique, ou -1 si aucun bloc n'est disponible.
+ */
+int block_for_write(int inode_index, int idx) {
+    Inode *inode = &fs.inodes[inode_index];
+    int num_block = inode->blocks[idx];
 
-    // 3) Découper par les "/"
-    char *token = strtok(tempPath, "/");
-    while (token != NULL) {
-        // Ignorer les "." (rester dans le même répertoire)
-        if (strcmp(token, ".") == 0) {
-            // On ne change rien
+    if (num_block == -1) {
+        num_block = allocate_block(inode_index, block_goal(inode_index, idx));
+        inode->blocks[idx] = num_block;
+        return num_block;
+    }
+
+    if (fs.free_blocks[num_block] > 1) {
+        char content[BLOCK_SIZE];
+        int copy = allocate_block(inode_index, block_goal(inode_index, idx));
+        if (copy == -1) {
+            return -1;
         }
-        else {
-            // aller au repertoire parent si on a ".."
-            if (strcmp(token, "..") == 0){
-                inode = fs.inodes[inode].inode_rep_parent;
-            } else {
+        read_blocks(num_block, content, BLOCK_SIZE);
+        write_blocks(copy, content, BLOCK_SIZE);
+        free_block(num_block);
+        inode->blocks[idx] = copy;
+        fprintf(fs.log, "\nCopie sur écriture du bloc %d vers le bloc %d (inode %d)\n", num_block, copy, inode_index);
+        num_block = copy;
+    }
+    return num_block;
+}
 
-                // 3.1) Chercher le token dans le répertoire inode actuel
-                int foundInode = rechInode(token, fs.directories[inode]);
-                if (foundInode == -1) {
-                    // Pas trouvé
-                    fprintf(fs.log, "\nErreur : '%s' est introuvable dans le répertoire inode %d.\n", token, inode);
-                    printf("Erreur : '%s' est introuvable dans le répertoire inode %d.\n", token, inode);
-                    return -1;
+int copy_range_unsupported = 0;  // copy_file_range absent du noyau ou du système de fichiers hôte
+
+/**
+ * @brief Copie len octets d'un descripteur à un autre dans le noyau (copy_file_range).
+ *
+ * Peut être appelée par plusieurs ouvriers à la fois. Seul un noyau ou un
+ * système de fichiers qui ne connaît pas l'appel (ENOSYS, EOPNOTSUPP) le
+ * fait abandonner pour de bon ; un refus propre à ces fichiers ou à ces
+ * positions (EXDEV, EINVAL) ne vaut que pour cette copie.
+ *
+ * @return 0 si tout est copié, 1 si l'appelant doit copier par tampon, -1 en cas d'erreur d'E/S.
+ */
+int kernel_copy(int fd_in, loff_t off_in, int fd_out, loff_t off_out, size_t len) {
+    if (__atomic_load_n(&copy_range_unsupported, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = copy_file_range(fd_in, &off_in, fd_out, &off_out, len - done, 0);
+        if (n == 0) {
+            return 1;  // Source plus courte que prévu : la copie par tampon dira si c'est une erreur
+        }
+        if (n < 0) {
+            if (errno == ENOSYS || errno == EOPNOTSUPP) {
+                if (!__atomic_exchange_n(&copy_range_unsupported, 1, __ATOMIC_RELAXED)) {
+                    fprintf(fs.log, "\ncopy_file_range indisponible, copies par tampon\n");
                 }
-                // 3.2) Mettre à jour l'inode actuel
-                inode = foundInode;
+                return 1;
             }
+            return errno == EXDEV || errno == EINVAL ? 1 : -1;
         }
-
-        token = strtok(NULL, "/");
+        done += n;
     }
-
-    // 4) inode final
-    
-    fprintf(fs.log, "\nInode du fichier du chemin %s : %d\n", path, inode);
-    return inode;
+    return 0;
 }
 
-
 /**
- * Crée un lien symbolique (symlink) vers une cible (targetPath), dans le répertoire parent parentDir.
+ * @brief Copie une suite de blocs contigus vers une autre suite de blocs contigus de l'image.
  *
- * @param linkName   Nom du lien symbolique (ex: "lien_symb")
- * @param targetPath Chemin vers la cible (ex: "/home/user/fichier.txt" ou "fichier2.txt")
- * @param parentDir  Inode du répertoire dans lequel on crée le lien symbolique
- * @return L'inode du lien symbolique créé, ou -1 en cas d'erreur
+ * Les deux suites étant dans le même fichier, on demande d'abord au noyau de
+ * faire la copie (copy_file_range) : les données ne remontent pas en espace
+ * utilisateur. Si le noyau ou le système hôte ne le permet pas, on repasse
+ * par un tampon borné de COPY_CHUNK octets.
+ *
+ * @param src Premier bloc source.
+ * @param dst Premier bloc destination.
+ * @param count Nombre de blocs (au plus COPY_CHUNK / BLOCK_SIZE).
+ * @param buffer Tampon de repli, alloué à la demande et libéré par l'appelant.
+ * @return 0 si succès, -1 en cas d'erreur.
  */
- int create_symbolic_link(const char *linkName, const char *targetPath, int parentDir) {
-    // 1) Vérifier si un fichier ou répertoire du même nom existe déjà dans parentDir
-    int existingInode = rechInode(linkName, fs.directories[parentDir]);
-    if (existingInode != -1) {
-        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
-        printf("Erreur : Le nom '%s' existe déjà dans le répertoire inode %d.\n", linkName, parentDir);
-        return -1;
-    }
+int copy_block_run(int src, int dst, int count, char **buffer) {
+    size_t size = (size_t)count * BLOCK_SIZE;
 
-    // 2) Vérifier que le chemin est valide
-    int path_inode = get_inode_from_path(targetPath, parentDir);
-    if(path_inode == -1){
-        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
-        printf("Erreur : le chemin n'est pas valide\n");
-        return -1;
+    fflush(fs.file);
+    int fd = fileno(fs.file);
+    int status = kernel_copy(fd, BLOCK_OFFSET(src), fd, BLOCK_OFFSET(dst), size);
+    if (status != 1) {
+        return status;
     }
 
-    // 3) Trouver un inode libre
-    int symlinkInode = -1;
-    for (int i = 0; i < NUM_INODES; i++) {
-        if (fs.inodes[i].size == -1) {  // -1 signifie inode libre
-            symlinkInode = i;
-            break;
+    if (*buffer == NULL) {
+        *buffer = alloc_io_buffer(COPY_CHUNK);
+        if (*buffer == NULL) {
+            return -1;
         }
     }
-    if (symlinkInode == -1) {
-        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
-        printf("Erreur : Pas d'inode libre pour créer le lien symbolique.\n");
+    if (read_blocks(src, *buffer, size) != (ssize_t)size || write_blocks(dst, *buffer, size) != (ssize_t)size) {
         return -1;
     }
+    return 0;
+}
 
-    // 4) Chercher une entrée libre dans le répertoire parent
-    int dirIndex = rechEntree(parentDir);
-    if (dirIndex == -1) {
-        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
-        printf("Erreur : Pas d'espace libre dans le répertoire inode %d.\n", parentDir);
-        return -1;
-    }
+/**
+ * @brief Une copie de blocs à effectuer : count blocs contigus de src vers dst.
+ */
+typedef struct {
+    int src;    /**< Premier bloc source */
+    int dst;    /**< Premier bloc destination */
+    int count;  /**< Nombre de blocs */
+} CopyJob;
 
-    // 5) Allouer un bloc pour stocker la chaîne de la cible (targetPath)
-    int blockIndex = allocate_block();
-    if (blockIndex == -1) {
-        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
-        printf("Erreur : Pas de blocs libres pour créer le lien symbolique.\n");
-        return -1;
-    }
+/**
+ * @brief Liste des copies de blocs préparées, exécutées ensuite par run_copy_jobs.
+ */
+typedef struct {
+    CopyJob *items;   /**< Copies à effectuer */
+    int count;        /**< Nombre de copies */
+    int capacity;     /**< Taille allouée du tableau items */
+    int next;         /**< Prochaine copie à prendre par un ouvrier */
+    int failed;       /**< Passe à 1 si une copie a échoué */
+} CopyJobs;
 
-    // 6) Initialiser l'inode du lien symbolique
-    Inode *inodePtr = &fs.inodes[symlinkInode];
-    inodePtr->size = sizeof(targetPath)+1;                   // La 'taille' du lien peut représenter la taille de la chaîne si on veut
-    inodePtr->type = 2;                   // 2 = lien symbolique
-    inodePtr->creation_time = time(NULL);
-    inodePtr->modification_time = time(NULL);
-    inodePtr->inode_rep_parent = parentDir;
-    inodePtr->link_count = 1;             // Au moins un lien (ce lien lui-même)
-    strncpy(inodePtr->permissions, "rwx", 3);  // Par exemple, autoriser la lecture/exec du lien
+int copy_threads = 4;  // Nombre d'ouvriers des copies et parcours d'arborescence (option -j)
 
-    // Mettre tous les blocs à -1, sauf celui qu’on vient d’allouer
+/**
+ * @brief Annule une préparation de copie interrompue (voir plan_file_copy).
+ *
+ * Retire de jobs les copies ajoutées pour ce fichier et rend les blocs déjà
+ * alloués à la destination : sans cela, run_copy_jobs écrirait plus tard
+ * dans des blocs libérés entre-temps, peut-être donnés à un autre fichier.
+ *
+ * @param target Inode destination.
+ * @param jobs Liste des copies.
+ * @param count Nombre de copies de jobs avant la préparation.
+ */
+void cancel_file_copy(Inode *target, CopyJobs *jobs, int count) {
+    jobs->count = count;
     for (int i = 0; i < NUM_BLOCKS; i++) {
-        inodePtr->blocks[i] = -1;
+        if (target->blocks[i] != -1) {
+            free_block(target->blocks[i]);
+            target->blocks[i] = -1;
+        }
     }
-    inodePtr->blocks[0] = blockIndex;
+}
 
-    // 7) Écrire la chaîne targetPath dans le bloc alloué
-        int i = 0;
-        while (*(targetPath+i) != '\0'){
-            fseek(fs.file, sizeof(Filesystem) + blockIndex * BLOCK_SIZE + i, SEEK_SET);
-            fwrite(targetPath+i, sizeof(char), 1, fs.file);
+/**
+ * @brief Prépare la recopie du contenu d'un inode dans un autre.
+ *
+ * Alloue à l'inode destination ses propres blocs, par suites contiguës
+ * calquées sur celles de la source, et ajoute à jobs les copies de blocs
+ * correspondantes. Aucune donnée n'est lue ni écrite ici. En cas d'échec,
+ * jobs et la destination sont remis dans leur état de départ, sans bloc.
+ *
+ * @param src_inode Inode source.
+ * @param dst_inode Inode destination, qui ne doit posséder que le bloc initial de create_file.
+ * @param jobs Liste recevant les copies de blocs à effectuer.
+ * @return 0 si succès, -1 si l'espace manque.
+ */
+int plan_file_copy(int src_inode, int dst_inode, CopyJobs *jobs) {
+    Inode *source = &fs.inodes[src_inode];
+    Inode *target = &fs.inodes[dst_inode];
+    int nb_blocks = (source->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int deja = jobs->count;
+
+    if (nb_blocks == 0) {
+        return 0;  // Fichier vide : on garde le bloc initial
+    }
+    free_block(target->blocks[0]);
+    target->blocks[0] = -1;
+
+    int i = 0;
+    while (i < nb_blocks) {
+        // Trou dans la source : il reste un trou dans la copie
+        if (source->blocks[i] == -1) {
             i++;
+            continue;
         }
 
-        fseek(fs.file, sizeof(Filesystem) + blockIndex * BLOCK_SIZE + i, SEEK_SET);
-        fwrite(targetPath+i, sizeof(char), 1, fs.file);
-    
-
-    // 8) Ajouter l'entrée (linkName) dans le répertoire parent
-    Directory *dirPtr = &fs.directories[parentDir];
-    strncpy(dirPtr->entries[dirIndex].filename, linkName, MAX_FILE_NAME);
-    dirPtr->entries[dirIndex].inode_index = symlinkInode;
+        // Longueur de la suite contiguë côté source
+        int run = 1;
+        while (i + run < nb_blocks && run < COPY_CHUNK / BLOCK_SIZE
+               && source->blocks[i + run] == source->blocks[i] + run) {
+            run++;
+        }
 
-    
-    fprintf(fs.log, "\nLien symbolique '%s' (inode %d) créé, pointant vers '%s'\n", linkName, symlinkInode, targetPath);
-    printf("Lien symbolique '%s' (inode %d) créé, pointant vers '%s'.\n", linkName, symlinkInode, targetPath);
-    return symlinkInode;
-}
+        // Suite contiguë côté destination (éventuellement plus courte)
+        int length;
+        int first = allocate_run(run, &length, dst_inode, block_goal(dst_inode, i));
+        if (first == -1) {
+            printf("Erreur : ordinateur saturé !!!! (aucun bloc disponible)\n");
+            cancel_file_copy(target, jobs, deja);
+            return -1;
+        }
+        for (int k = 0; k < length; k++) {
+            target->blocks[i + k] = first + k;
+        }
 
+        if (jobs->count == jobs->capacity) {
+            int capacity = jobs->capacity ? jobs->capacity * 2 : 64;
+            CopyJob *items = realloc(jobs->items, capacity * sizeof(CopyJob));
+            if (!items) {
+                cancel_file_copy(target, jobs, deja);
+                return -1;
+            }
+            jobs->items = items;
+            jobs->capacity = capacity;
+        }
+        jobs->items[jobs->count].src = source->blocks[i];
+        jobs->items[jobs->count].dst = first;
+        jobs->items[jobs->count].count = length;
+        jobs->count++;
+        i += length;
+    }
 
+    fprintf(fs.log, "\nContenu de l'inode %d à recopier dans l'inode %d (%d blocs)\n", src_inode, dst_inode, nb_blocks);
+    return 0;
+}
 
 /**
- * @brief Ouvre un fichier et crée un descripteur de fichier.
+ * @brief Boucle d'un ouvrier : prend les copies une à une jusqu'à épuisement.
  *
- * @param filename Nom du fichier à ouvrir.
- * @param dir_inode L'inode du répertoire où se trouve le fichier.
- * @return Le descripteur du fichier ouvert ou -1 en cas d'erreur.
+ * Les copies ne touchent que des blocs déjà alloués, par des lectures et
+ * écritures positionnées : plusieurs ouvriers peuvent tourner en parallèle
+ * sans toucher aux métadonnées.
  */
-int open_file (const char *filename, int dir_inode){
-    // On cherche le repertoire parent et l'inode
-    Directory dir = fs.directories[dir_inode];
-    int inode = rechInode(filename, dir);
-    int i = 0;
-    int desc = -1;
-
-    // Vérifier que le fichier existe
-    if (inode == -1){
-        fprintf(fs.log, "\nErreur sur l'ouverture du fichier %s\n", filename);
-        printf("Erreur : fichier non ouvert.\n");
-        return -1;
+void *copy_worker(void *arg) {
+    CopyJobs *jobs = arg;
+    char *buffer = NULL;
+    int i;
+    while ((i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) < jobs->count) {
+        CopyJob *job = &jobs->items[i];
+        if (copy_block_run(job->src, job->dst, job->count, &buffer) == -1) {
+            __atomic_store_n(&jobs->failed, 1, __ATOMIC_RELAXED);
+        }
     }
+    free(buffer);
+    return NULL;
+}
 
-    // Vérifierr si le type de fichier n'est pas un répertoire
-    if(fs.inodes[inode].type != 1 && fs.inodes[inode].type != 2){
-        printf("Erreur : fichier es un répertoire ou non reconnu");
-        fprintf(fs.log, "\nErreur sur l'ouverture du fichier %s\n", filename);
-        return -1;
+/**
+ * @brief Exécute les copies de blocs préparées, avec au plus nb_threads ouvriers.
+ *
+ * @param jobs Copies à effectuer (la liste est vidée et libérée).
+ * @param nb_threads Nombre maximal d'ouvriers.
+ * @return 0 si toutes les copies ont réussi, -1 sinon.
+ */
+int run_copy_jobs(CopyJobs *jobs, int nb_threads) {
+    if (nb_threads > jobs->count) {
+        nb_threads = jobs->count;
     }
+    fflush(fs.file);
 
-    // On crée un nouveau descripteur de fichier
-    while (desc == -1 && i<MAX_FILE_OPEN){
-        if (fs.opened_file[i].inode == -1){
-            fs.opened_file[i].inode = inode;
-            fs.opened_file[i].tete_lecture = sizeof(Filesystem) + fs.inodes[inode].blocks[0]*BLOCK_SIZE;
-            desc = i;
+    if (nb_threads <= 1) {
+        copy_worker(jobs);
+    } else {
+        pthread_t threads[nb_threads];
+        int started = 0;
+        while (started < nb_threads && pthread_create(&threads[started], NULL, copy_worker, jobs) == 0) {
+            started++;
+        }
+        if (started == 0) {
+            copy_worker(jobs);  // Pas de thread disponible : copie dans l'appelant
+        }
+        for (int t = 0; t < started; t++) {
+            pthread_join(threads[t], NULL);
         }
-        i++;
     }
 
-    // Vérifier si on a réussi a créer un descripteur
-    if (desc == -1){
-        printf("Erreur : fichier non ouvert.\n");
-        fprintf(fs.log, "\nErreur sur l'ouverture du fichier %s\n", filename);
-    }
-    
-    fprintf(fs.log, "\nNouveau descripteur %d pour le fichier %s\n", desc, filename);
-    return desc;
+    int status = jobs->failed ? -1 : 0;
+    free(jobs->items);
+    memset(jobs, 0, sizeof(CopyJobs));
+    return status;
 }
 
 /**
- * @brief Écrit des données dans un fichier ouvert.
+ * @brief Recopie le contenu d'un inode dans un autre, par suites de blocs contigus.
  *
- * @param desc Descripteur du fichier ouvert.
- * @param texte Chaîne à écrire dans le fichier.
- * @param size Nombre d'octets à écrire.
- * @return Nombre d'octets écrits ou -1 en cas d'erreur.
+ * L'inode destination reçoit ses propres blocs (aucun partage). La mémoire
+ * utilisée est bornée par COPY_CHUNK quelle que soit la taille du fichier.
+ *
+ * @param src_inode Inode source.
+ * @param dst_inode Inode destination, qui ne doit posséder que le bloc initial de create_file.
+ * @return 0 si succès, -1 si l'espace manque ou en cas d'erreur d'entrée/sortie.
  */
-int write_file(int desc, const char *texte, int size){
-    // Vérifier si le descripteur est valide
-    if (desc > MAX_FILE_OPEN || desc < 0 || fs.opened_file[desc].inode == -1){
-        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
-        printf("Erreur : descrpiteur invalide\n");
+int copy_file_data(int src_inode, int dst_inode) {
+    CopyJobs jobs = {0};
+    if (plan_file_copy(src_inode, dst_inode, &jobs) == -1) {
+        free(jobs.items);
         return -1;
-    } else if(size < 0) {
-        printf("Erreur : taille négatif\n");
-        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+    }
+    return run_copy_jobs(&jobs, 1);
+}
+
+void session_flush();
+int session_join(int fd, pthread_mutex_t *lock);
+void session_leave();
+
+#define POOL_MAX_WORKERS 64  /**< Ouvriers au plus dans un parcours d'arborescence */
+
+/**
+ * @brief Une tâche d'un parcours d'arborescence : en général un répertoire à traiter.
+ */
+typedef struct {
+    int inode;   /**< Répertoire à traiter */
+    int aux;     /**< Donnée propre au parcours (répertoire destination d'une copie...) */
+    char *path;  /**< Chemin alloué par malloc et libéré après la tâche, ou NULL */
+} Task;
+
+/**
+ * @brief File de tâches d'un ouvrier.
+ *
+ * L'ouvrier pousse et reprend ses tâches au bout de la file : il descend en
+ * profondeur et garde peu de tâches en attente. Un ouvrier inoccupé vole au
+ * début, où se trouvent les répertoires les plus hauts, donc les plus gros
+ * morceaux de travail.
+ */
+typedef struct {
+    Task *items;            /**< Tâches, de head (côté vol) à tail (côté propriétaire) */
+    int head;
+    int tail;
+    int capacity;           /**< Taille allouée de items */
+    pthread_mutex_t mutex;
+} TaskDeque;
+
+typedef struct TaskPool TaskPool;
+
+/**
+ * @brief Traite une tâche, en poussant au besoin des sous-tâches (pool_push).
+ *
+ * @return 0 pour continuer, -1 pour annuler le reste du parcours.
+ */
+typedef int (*TaskVisit)(TaskPool *pool, int worker, Task task);
+
+/**
+ * @brief Groupe d'ouvriers à vol de tâches, pour un parcours d'arborescence.
+ */
+struct TaskPool {
+    TaskDeque deques[POOL_MAX_WORKERS];  /**< Une file par ouvrier */
+    int nb_workers;
+    int pending;            /**< Tâches poussées et pas encore terminées */
+    int available;          /**< Tâches en attente dans les files */
+    int idle;               /**< Ouvriers endormis faute de tâche */
+    int cancel;             /**< Passe à 1 : les tâches restantes sont abandonnées */
+    TaskVisit visit;        /**< Traitement d'une tâche */
+    void *arg;              /**< Contexte du parcours, lu par visit */
+    int session;            /**< Client du serveur qui reçoit la sortie des ouvriers, -1 sinon */
+    pthread_mutex_t mutex;  /**< Sommeil des ouvriers et envoi de leur sortie au client */
+    pthread_cond_t cond;
+};
+
+/**
+ * @brief Annule un parcours : les tâches encore en attente ne seront pas traitées.
+ */
+void pool_cancel(TaskPool *pool) {
+    __atomic_store_n(&pool->cancel, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Réveille les ouvriers endormis (nouvelle tâche ou fin du parcours).
+ */
+void pool_wake(TaskPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * @brief Ajoute une tâche à la file d'un ouvrier.
+ *
+ * @param pool Le parcours.
+ * @param worker L'ouvrier qui pousse la tâche (celui qui exécute visit).
+ * @param task La tâche ; son chemin appartient désormais au parcours.
+ */
+void pool_push(TaskPool *pool, int worker, Task task) {
+    TaskDeque *d = &pool->deques[worker];
+    pthread_mutex_lock(&d->mutex);
+    if (d->tail == d->capacity && d->head > 0) {
+        memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(Task));
+        d->tail -= d->head;
+        d->head = 0;
+    }
+    if (d->tail == d->capacity) {
+        int capacity = d->capacity ? d->capacity * 2 : 64;
+        Task *items = realloc(d->items, capacity * sizeof(Task));
+        if (!items) {
+            pthread_mutex_unlock(&d->mutex);
+            free(task.path);
+            pool_cancel(pool);
+            return;
+        }
+        d->items = items;
+        d->capacity = capacity;
+    }
+    d->items[d->tail++] = task;
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&d->mutex);
+
+    __atomic_add_fetch(&pool->available, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0) {
+        pool_wake(pool);
+    }
+}
+
+/**
+ * @brief Prend une tâche : la dernière de sa propre file, sinon la première d'une autre.
+ *
+ * @return 1 si une tâche a été prise, 0 si toutes les files sont vides.
+ */
+int pool_take(TaskPool *pool, int worker, Task *task) {
+    for (int k = 0; k < pool->nb_workers; k++) {
+        int victime = (worker + k) % pool->nb_workers;
+        TaskDeque *d = &pool->deques[victime];
+        pthread_mutex_lock(&d->mutex);
+        int pris = d->head < d->tail;
+        if (pris) {
+            *task = victime == worker ? d->items[--d->tail] : d->items[d->head++];
+        }
+        pthread_mutex_unlock(&d->mutex);
+        if (pris) {
+            __atomic_sub_fetch(&pool->available, 1, __ATOMIC_SEQ_CST);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Boucle d'un ouvrier : traite ou vole des tâches jusqu'à la fin du parcours.
+ */
+void pool_work(TaskPool *pool, int worker) {
+    while (1) {
+        Task task;
+        if (pool_take(pool, worker, &task)) {
+            if (!__atomic_load_n(&pool->cancel, __ATOMIC_RELAXED) && pool->visit(pool, worker, task) == -1) {
+                pool_cancel(pool);
+            }
+            free(task.path);
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+                pool_wake(pool);
+            }
+            continue;
+        }
+
+        // Rien à voler : dormir jusqu'à la prochaine tâche ou la fin du parcours
+        pthread_mutex_lock(&pool->mutex);
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0 &&
+               __atomic_load_n(&pool->available, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        int fini = __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&pool->mutex);
+        if (fini) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Un ouvrier d'un parcours et son numéro.
+ */
+typedef struct {
+    TaskPool *pool;
+    int worker;
+} PoolWorker;
+
+/**
+ * @brief Thread d'un ouvrier.
+ *
+ * L'appelant de pool_run tient l'opération (op_begin) pour tout le parcours
+ * et attend la fin des ouvriers : ceux-ci travaillent donc en opération
+ * partagée et se coordonnent par les verrous d'inodes, même si l'appelant
+ * tient l'état en exclusif. En mode serveur, leur sortie part chez le
+ * client de l'appelant, une trame à la fois.
+ */
+void *pool_thread(void *arg) {
+    PoolWorker *w = arg;
+    TaskPool *pool = w->pool;
+    op_mode = 1;
+    if (pool->session != -1) {
+        session_join(pool->session, &pool->mutex);
+    }
+    pool_work(pool, w->worker);
+    session_leave();
+    op_mode = 0;
+    return NULL;
+}
+
+/**
+ * @brief Parcourt une arborescence avec au plus nb_threads ouvriers qui se volent les tâches.
+ *
+ * La tâche racine est traitée par visit, qui pousse les sous-répertoires
+ * comme nouvelles tâches : la profondeur de l'arborescence ne pèse pas sur
+ * la pile. Tant qu'il reste un clone paresseux, toute lecture de répertoire
+ * peut le recopier : le parcours se fait alors dans l'appelant seul.
+ *
+ * @param visit Traitement d'une tâche.
+ * @param arg Contexte du parcours (pool->arg).
+ * @param root Tâche de départ (son chemin appartient au parcours).
+ * @param nb_threads Nombre maximal d'ouvriers, ramené au nombre de cœurs (1 : parcours dans l'appelant).
+ * @return 0 si le parcours est allé au bout, -1 s'il a été annulé.
+ */
+int pool_run(TaskVisit visit, void *arg, Task root, int nb_threads) {
+    int pris = op_begin(0);
+    // Le travail d'un parcours est en mémoire : plus d'ouvriers que de cœurs ne ferait qu'attendre
+    long coeurs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (coeurs > 0 && nb_threads > coeurs) {
+        nb_threads = coeurs;
+    }
+    if (nb_threads > POOL_MAX_WORKERS) {
+        nb_threads = POOL_MAX_WORKERS;
+    }
+    if (nb_threads < 1 || pending_clones()) {
+        nb_threads = 1;
+    }
+    TaskPool *pool = calloc(1, sizeof(TaskPool));
+    if (!pool) {
+        free(root.path);
+        op_end(pris);
+        return -1;
+    }
+    pool->nb_workers = nb_threads;
+    pool->visit = visit;
+    pool->arg = arg;
+    pool->session = session_fd;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    for (int k = 0; k < nb_threads; k++) {
+        pthread_mutex_init(&pool->deques[k].mutex, NULL);
+    }
+    pool_push(pool, 0, root);
+
+    if (nb_threads == 1) {
+        pool_work(pool, 0);
+    } else {
+        if (session_fd != -1) {
+            session_flush();  // La sortie déjà produite passe avant celle des ouvriers
+        }
+        pthread_t threads[POOL_MAX_WORKERS];
+        PoolWorker workers[POOL_MAX_WORKERS];
+        int started = 0;
+        while (started < nb_threads) {
+            workers[started].pool = pool;
+            workers[started].worker = started;
+            if (pthread_create(&threads[started], NULL, pool_thread, &workers[started]) != 0) {
+                break;
+            }
+            started++;
+        }
+        if (started == 0) {
+            pool_work(pool, 0);  // Pas de thread disponible : parcours dans l'appelant
+        }
+        for (int t = 0; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    int status = pool->cancel ? -1 : 0;
+    for (int k = 0; k < nb_threads; k++) {
+        TaskDeque *d = &pool->deques[k];
+        for (int i = d->head; i < d->tail; i++) {
+            free(d->items[i].path);  // Jamais traitées si le parcours n'a pas pu démarrer
+        }
+        free(d->items);
+        pthread_mutex_destroy(&d->mutex);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+    op_end(pris);
+    return status;
+}
+
+/**
+ * @brief Copie cohérente des entrées d'un répertoire, sans verrou tant qu'aucun écrivain ne le garde.
+ *
+ * Les parcours travaillent sur cette copie : ils peuvent ensuite verrouiller
+ * les enfants sans tenir le répertoire, donc sans entorse à l'ordre des verrous.
+ *
+ * @param dir_inode Répertoire à copier.
+ * @param copie Reçoit la copie.
+ */
+void dir_snapshot(int dir_inode, Directory *copie) {
+    Directory *dir = dir_of(dir_inode);
+    for (int essai = 0; essai < SEQ_RETRIES; essai++) {
+        unsigned seq = seq_read_begin(dir_inode);
+        if (seq & 1) {
+            break;
+        }
+        memcpy(copie, dir, sizeof(Directory));
+        if (!seq_read_retry(dir_inode, seq)) {
+            return;
+        }
+    }
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, dir_inode, 0);
+    inode_locks_acquire(&verrous);
+    memcpy(copie, dir, sizeof(Directory));
+    inode_locks_release(&verrous);
+}
+
+/**
+ * @brief Liste de chemins remplie par un ouvrier (résultats de find, répertoires exportés...).
+ */
+typedef struct {
+    char **paths;   /**< Chemins alloués par malloc */
+    int *inodes;    /**< Inode de chaque chemin */
+    int nb;
+    int capacity;
+} PathList;
+
+/**
+ * @brief Ajoute une copie d'un chemin à la liste.
+ *
+ * @return 0 si succès, -1 si la mémoire manque.
+ */
+int path_list_add(PathList *l, const char *path, int inode) {
+    if (l->nb == l->capacity) {
+        int capacity = l->capacity ? l->capacity * 2 : 64;
+        char **paths = realloc(l->paths, capacity * sizeof(char *));
+        if (!paths) {
+            return -1;
+        }
+        l->paths = paths;
+        int *inodes = realloc(l->inodes, capacity * sizeof(int));
+        if (!inodes) {
+            return -1;
+        }
+        l->inodes = inodes;
+        l->capacity = capacity;
+    }
+    if ((l->paths[l->nb] = strdup(path)) == NULL) {
+        return -1;
+    }
+    l->inodes[l->nb++] = inode;
+    return 0;
+}
+
+/**
+ * @brief Libère les chemins de la liste et la remet à zéro.
+ */
+void path_list_free(PathList *l) {
+    for (int i = 0; i < l->nb; i++) {
+        free(l->paths[i]);
+    }
+    free(l->paths);
+    free(l->inodes);
+    memset(l, 0, sizeof(PathList));
+}
+
+/**
+ * @brief Joint un chemin de répertoire et un nom d'entrée.
+ */
+void join_path(char *dest, size_t size, const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    snprintf(dest, size, "%s%s%s", dir, len > 0 && dir[len - 1] == '/' ? "" : "/", name);
+}
+
+/**
+ * @brief Répercute une variation de taille d'un inode sur tous ses répertoires parents.
+ *
+ * @param inode_index Inode dont la taille a changé.
+ * @param delta Variation de taille en octets.
+ */
+void update_parent_sizes(int inode_index, int delta) {
+    int id_rep_parent = inode_index;
+    while (id_rep_parent != 0) {
+        id_rep_parent = fs.inodes[id_rep_parent].inode_rep_parent;
+        if (id_rep_parent == -1) {
+            break;  // Fichier supprimé mais encore ouvert : il n'a plus de répertoire
+        }
+        // Des écrivains de répertoires voisins remontent en même temps vers les mêmes ancêtres
+        __atomic_add_fetch(&fs.inodes[id_rep_parent].size, delta, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Recherche l'inode correspondant à un nom de fichier dans un répertoire donné.
+ *
+ * Le répertoire est lu en place : il peut l'être sans verrou (lookup_entry),
+ * la comparaison reste donc bornée à la taille d'un nom.
+ *
+ * @param filename Le nom du fichier recherché.
+ * @param dir Le répertoire dans lequel effectuer la recherche.
+ * @return L'index de l'inode correspondant, ou -1 si introuvable.
+ */
+int rechInode(const char *filename, const Directory *dir){
+    int inode = -1;
+    int i = 0;
+
+    //chercher le numero d'inode du fichier dans le repertoire
+    while (i<NUM_DIRECTORY_ENTRIES && inode==-1){
+        if (strncmp(filename, dir->entries[i].filename, MAX_FILE_NAME) == 0){
+            inode = dir->entries[i].inode_index;
+        }
+        i++;
+    }
+    return inode;
+}
+
+/**
+ * @brief Vérifie qu'un nouveau nom d'entrée tient dans filename avec son zéro final.
+ *
+ * Un nom de MAX_FILE_NAME octets ou plus serait tronqué, ou rangé sans zéro
+ * final, à la création de l'entrée.
+ *
+ * @param name Le nom à créer.
+ * @return 0 si le nom est accepté, -1 sinon.
+ */
+int check_entry_name(const char *name) {
+    if (strnlen(name, MAX_FILE_NAME) >= MAX_FILE_NAME) {
+        printf("Erreur : nom trop long (%d caractères au plus).\n", MAX_FILE_NAME - 1);
+        fprintf(fs.log, "\nErreur : nom trop long refusé\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Recherche une entrée libre dans un répertoire donné.
+ *
+ * @param dir_inode L'index de l'inode du répertoire à examiner.
+ * @return L'index de l'entrée libre trouvée, ou -1 si aucune n'est disponible.
+ */
+int rechEntree(int dir_inode){
+    int index = -1;
+    int i = 0;
+    Directory *dir = dir_of(dir_inode);
+
+    // Chercher une entrée libre
+    while(i<NUM_DIRECTORY_ENTRIES && index==-1){
+        if (dir->entries[i].inode_index == -1){
+            index = i;
+        }
+        i++;
+    }
+    return index;
+    fprintf(fs.log,"\nEntrée de répertoire trouvé : %d\n", index);
+}
+
+/**
+ * @brief Cherche un nom dans un répertoire sans écrire dans la mémoire partagée.
+ *
+ * La recherche est refaite tant que le compteur de séquence du répertoire a
+ * bougé. Si un écrivain le garde trop longtemps, on attend son verrou en
+ * lecture plutôt que de tourner à vide.
+ *
+ * @param dir_inode Répertoire où chercher.
+ * @param name Nom cherché.
+ * @return L'inode trouvé, ou -1.
+ */
+int lookup_entry(int dir_inode, const char *name) {
+    Directory *dir = dir_of(dir_inode);
+    for (int essai = 0; essai < SEQ_RETRIES; essai++) {
+        unsigned seq = seq_read_begin(dir_inode);
+        if (seq & 1) {
+            break;
+        }
+        int inode = rechInode(name, dir);
+        if (!seq_read_retry(dir_inode, seq)) {
+            return inode;
+        }
+    }
+
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, dir_inode, 0);
+    inode_locks_acquire(&verrous);
+    int inode = rechInode(name, dir);
+    inode_locks_release(&verrous);
+    return inode;
+}
+
+/**
+ * Vérifie si un inode donné possède une permission spécifique.
+ *
+ * @param inode_index L'index de l'inode à vérifier.
+ * @param perm Le caractère de permission ('r' pour read, 'w' pour write, 'x' pour execute).
+ * @return 1 si l'inode possède la permission, 0 sinon.
+ */
+ int has_permission(int inode_index, char perm) {
+    // Vérification que l'inode est valide
+    if (inode_index < 0 || inode_index >= NUM_INODES) {
+        return 0;
+    }
+
+    // Copie cohérente des permissions, sans verrou (chmod peut les réécrire en même temps).
+    // Un écrivain peut garder l'inode longtemps (gros wfile) sans toucher aux permissions :
+    // au-delà de quelques relectures on garde la copie, chaque caractère étant lu d'un bloc.
+    char permissions[sizeof(fs.inodes[0].permissions)];
+    unsigned seq;
+    int essai = 0;
+    do {
+        seq = seq_read_begin(inode_index);
+        memcpy(permissions, fs.inodes[inode_index].permissions, sizeof(permissions));
+    } while (seq_read_retry(inode_index, seq) && ++essai < SEQ_RETRIES);
+
+    // Vérification de la présence du caractère de permission dans la chaîne de permissions
+    if ((perm == 'r' || perm == 'w' || perm == 'x') && memchr(permissions, perm, sizeof(permissions))) return 1;
+
+    // Seuls les refus sont tracés : le journal est partagé par tous les threads
+    fprintf(fs.log,"\nPermission %c refusée sur l'inode %d : %.3s\n", perm, inode_index, permissions);
+    return 0;  // Permission refusée
+}
+
+/**
+ * @brief Modifie les permissions (r, w, x) d'un fichier ou répertoire.
+ * @param filename Le nom du fichier/répertoire.
+ * @param newPerms Chaîne de 3 caractères (ex.: "rw-", "r-x", etc.).
+ * @param dir_inode L'inode du répertoire courant ou parent.
+ * @return 0 si succès, -1 si erreur.
+ */
+ int change_permissions_locked(const char *filename, const char *newPerms, int dir_inode) {
+    // 1) Retrouver l'inode du fichier/répertoire
+    int inode_index = rechInode(filename, dir_of(dir_inode));
+    if (inode_index == -1) {
+        fprintf(fs.log, "\nErreur lors du changement de permissions sur le fichier %s\n", filename);
+        printf("Erreur : '%s' introuvable dans ce répertoire.\n", filename);
+        return -1;
+    }
+
+    // Les clones qui partagent encore cet inode doivent garder les anciennes permissions
+    if (unshare_inode(inode_index) == -1) {
+        fprintf(fs.log, "\nErreur lors du changement de permissions sur le fichier %s\n", filename);
+        return -1;
+    }
+
+    // 2) Mettre à jour les permissions (3 caractères max)
+    Inode *node = &fs.inodes[inode_index];
+    strncpy(node->permissions, newPerms, 3);
+    node->modification_time = time(NULL);
+
+    fprintf(fs.log, "\nNouvelles permissions pour le fichier %s : %s\n", filename, newPerms);
+
+    printf("Permissions de '%s' modifiées en '%s'.\n", filename, newPerms);
+    return 0;
+}
+
+/**
+ * @brief Modifie les permissions (voir change_permissions_locked) sous le verrou de l'inode.
+ */
+int change_permissions(const char *filename, const char *newPerms, int dir_inode) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, dir_inode, 0);
+    inode_locks_entry(&verrous, dir_inode, filename, 1);
+    int resultat = change_permissions_locked(filename, newPerms, dir_inode);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return resultat;
+}
+
+
+
+/**
+ * @brief Crée un nouveau fichier dans un répertoire spécifié.
+ *
+ * Cette fonction vérifie les permissions d'écriture du répertoire parent avant de créer un nouveau fichier.
+ * Elle vérifie également qu'aucun fichier portant le même nom n'existe déjà dans le répertoire. Ensuite,
+ * elle alloue un inode et un bloc de données pour le nouveau fichier, initialise ses métadonnées et ajoute
+ * une entrée dans le répertoire parent.
+ *
+ * @param filename Nom du fichier à créer.
+ * @param permissions Chaîne de caractères représentant les permissions initiales du fichier (ex : "rw-", "rwx").
+ * @param dir_inode Index de l'inode du répertoire parent où le fichier doit être créé.
+ *
+ * @return L'index de l'inode du fichier créé en cas de succès, ou -1 en cas d'erreur (permissions insuffisantes,
+ *         absence d'espace ou d'inode disponible, fichier déjà existant, etc.).
+ */
+int create_file_locked(const char *filename, const char *permissions, int dir_inode) {
+    if (check_entry_name(filename) == -1) {
+        return -1;
+    }
+    // Vérifier permission 'w' sur le répertoire parent
+    if (!has_permission(dir_inode, 'w')) {
+        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
+        printf("Erreur : permission insuffisante pour créer un fichier dans ce répertoire.\n");
+        return -1;
+    }
+    if (unshare_dir(dir_inode) == -1) {
+        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
+        return -1;
+    }
+
+    // Répertoire où on va créer le fichier
+    Directory *dir = dir_of(dir_inode);
+    int inode_index = -1;
+
+    // Vérifier si le fichier existe dans le répertoire
+    if (rechInode(filename, dir) != -1){
+        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
+        printf("Erreur de création, un fichier de même nom existe déjà dans le répertoire\n");
+        return -1;
+    }
+
+    // Trouver un inode libre
+    inode_index = allocate_inode(dir_inode, 1);
+
+    // Vérifier si on a trouvé un inode libre
+    if (inode_index == -1) {
+        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
+        printf("Erreur: Aucun inode libre.\n");
+        return -1;
+    }
+
+    Inode *inode = &fs.inodes[inode_index];
+
+    // Allouer uniquement 1 bloc pour commencer
+    int block = allocate_block(inode_index, -1);
+    if (block == -1) {
+        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
+        printf("Erreur: Pas de blocs libres disponibles.\n");
+        inode->size = -1; // Marquer l'inode comme inutilisé
+        return -1;
+    }
+
+    // Chercher un espace libre dans le répertoire
+    int index_rep = rechEntree(dir_inode);
+    if(index_rep == -1){
+        fprintf(fs.log, "\nErreur sur la création du fichier %s\n", filename);
+        printf("Erreur: Aucun espace dans le répertoire.\n");
+        free_block(block); // Libérer le bloc alloué
+        inode->size = -1; // Marquer l'inode comme inutilisé
+        return -1;
+    }
+
+    // Ajouter le fichier au répertoire
+    strncpy(dir->entries[index_rep].filename, filename, MAX_FILE_NAME);
+    dir->entries[index_rep].inode_index = inode_index;
+    mark_dir(dir_inode);
+    fprintf(fs.log, "\nFichier %s créé avec les permissions %s dans le repertoire d'inode %d\n", filename, permissions, dir_inode);
+    printf("Fichier '%s' créé avec succès.\n", filename);
+
+    // Initialiser l'inode
+    inode->blocks[0] = block;
+    inode->type = 1;
+    inode->creation_time = time(NULL);
+    inode->modification_time = time(NULL);
+    inode->inode_rep_parent = dir_inode;
+    strncpy(inode->permissions, permissions, 3);
+
+    //printf("block : %d\n", block);
+
+    return inode_index;
+}
+
+/**
+ * @brief Crée un fichier (voir create_file_locked) sous le verrou du répertoire parent.
+ */
+int create_file(const char *filename, const char *permissions, int dir_inode) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, dir_inode, 1);
+    inode_locks_acquire(&verrous);
+    int inode_index = create_file_locked(filename, permissions, dir_inode);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return inode_index;
+}
+
+#define DELAY_MAX (64 * BLOCK_SIZE)  /**< Octets en attente d'allocation au plus par fichier */
+
+/**
+ * @brief Écritures en fin de fichier dont les blocs ne sont pas encore choisis (allocation différée).
+ *
+ * Les octets écrits au-delà des blocs alloués d'un fichier restent ici, et
+ * seule leur place est réservée (delayed_blocks). Les blocs physiques sont
+ * choisis au moment de les écrire (flush_delayed), quand la taille finale de
+ * la zone est connue : une suite d'ajouts devient une seule suite contiguë,
+ * et un fichier supprimé avant n'a jamais rien écrit dans l'image.
+ */
+typedef struct {
+    char *data;            /**< Octets en attente (capacité multiple de BLOCK_SIZE) */
+    int capacity;          /**< Taille de data */
+    int start;             /**< Position dans le fichier du premier octet, multiple de BLOCK_SIZE */
+    int len;               /**< Nombre d'octets en attente, 0 si aucun */
+    int reserved;          /**< Blocs réservés pour eux */
+    pthread_mutex_t mutex; /**< Lecteurs et validation peuvent vider la zone sous un verrou partagé */
+} DelayedWrite;
+
+DelayedWrite delayed[NUM_INODES] = { [0 ... NUM_INODES - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER } };  // Hors de l'image
+int delayed_blocks = 0;    // Blocs réservés par toutes les écritures différées
+pthread_mutex_t delayed_mutex = PTHREAD_MUTEX_INITIALIZER;  // Protège delayed_blocks
+int delayed_alloc = 1;     // Allocation différée des écritures (désactivée par --no-delalloc)
+__thread int reserve_credit = 0;  // Blocs réservés que ce thread peut prendre (vidage d'une zone en attente)
+
+int count_free_blocks();
+
+/**
+ * @brief Borne une allocation à la place que les écritures différées n'ont pas réservée.
+ *
+ * Tant qu'une réservation existe, allocations et réservations (delay_write)
+ * passent l'une après l'autre sous delayed_mutex : une écriture acceptée
+ * trouve toujours ses blocs au vidage. Sans réservation, l'allocation se
+ * fait sans ce verrou, et allocation_end vérifie après coup qu'aucune
+ * réservation n'est arrivée entre-temps. Le vidage d'une zone puise dans
+ * sa propre réservation (reserve_credit).
+ *
+ * @param count Nombre de blocs voulus.
+ * @param pris Reçoit 1 si delayed_mutex est tenu, à rendre par allocation_end.
+ * @return Le nombre de blocs permis (au plus count, 0 si toute la place libre est réservée).
+ */
+int allocation_quota(int count, int *pris) {
+    *pris = 0;
+    if (__atomic_load_n(&delayed_blocks, __ATOMIC_ACQUIRE) == 0) {
+        return count;
+    }
+    pthread_mutex_lock(&delayed_mutex);
+    *pris = 1;
+    int permis = count_free_blocks() - delayed_blocks + reserve_credit;
+    if (permis < count) {
+        return permis > 0 ? permis : 0;
+    }
+    return count;
+}
+
+/**
+ * @brief Termine une allocation bornée par allocation_quota.
+ *
+ * Une allocation faite sans delayed_mutex a pu croiser une réservation qui
+ * comptait encore ses blocs comme libres (l'une publie, puis relit l'autre :
+ * au moins une des deux voit l'autre). Dans ce cas, les blocs en trop sont
+ * rendus, en commençant par la fin de la suite.
+ *
+ * @param pris Valeur rendue dans *pris par allocation_quota.
+ * @param first Premier bloc alloué.
+ * @param alloues Nombre de blocs alloués à partir de first.
+ * @return Le nombre de blocs gardés.
+ */
+int allocation_end(int pris, int first, int alloues) {
+    if (!pris && alloues > 0) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&delayed_blocks, __ATOMIC_SEQ_CST) != 0) {
+            pthread_mutex_lock(&delayed_mutex);
+            int trop = delayed_blocks - reserve_credit - count_free_blocks();
+            while (trop-- > 0 && alloues > 0) {
+                int b = first + --alloues;
+                pthread_mutex_lock(&group_locks[b / GROUP_BLOCKS]);
+                fs.free_blocks[b] = 0;
+                pthread_mutex_unlock(&group_locks[b / GROUP_BLOCKS]);
+            }
+            pthread_mutex_unlock(&delayed_mutex);
+        }
+    }
+    reserve_credit -= alloues < reserve_credit ? alloues : reserve_credit;
+    if (pris) {
+        pthread_mutex_unlock(&delayed_mutex);
+    }
+    return alloues;
+}
+
+/**
+ * @brief Rend la réservation et la mémoire d'une zone en attente, sans rien écrire.
+ *
+ * Appelée avec d->mutex.
+ */
+void delay_drop(DelayedWrite *d) {
+    pthread_mutex_lock(&delayed_mutex);
+    delayed_blocks -= d->reserved;
+    pthread_mutex_unlock(&delayed_mutex);
+    free(d->data);
+    d->data = NULL;
+    d->capacity = 0;
+    d->len = 0;
+    d->reserved = 0;
+}
+
+/**
+ * @brief Alloue les blocs des octets en attente d'un inode et les écrit (voir flush_delayed).
+ *
+ * Appelée avec le mutex de la zone. Les blocs sont pris en suites contiguës
+ * à partir du bloc qui prolonge le fichier (block_goal).
+ *
+ * @return 0 si succès, -1 si l'espace manque (le fichier est raccourci aux octets écrits).
+ */
+int flush_delayed_locked(int inode_index) {
+    DelayedWrite *d = &delayed[inode_index];
+    if (d->len == 0) {
+        return 0;
+    }
+    Inode *inode = &fs.inodes[inode_index];
+    int idx = d->start / BLOCK_SIZE;
+    int nb = (d->len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    memset(d->data + d->len, 0, (size_t)nb * BLOCK_SIZE - d->len);  // Fin du dernier bloc
+
+    int faits = 0, segments = 0;
+    reserve_credit = d->reserved;
+    while (faits < nb) {
+        int length;
+        int first = allocate_run(nb - faits, &length, inode_index, block_goal(inode_index, idx + faits));
+        if (first == -1 && fs.nb_orphans > 0 && reclaim_orphans(-1, 0) > 0) {
+            first = allocate_run(nb - faits, &length, inode_index, block_goal(inode_index, idx + faits));
+        }
+        if (first == -1) {
+            break;
+        }
+        write_blocks(first, d->data + (size_t)faits * BLOCK_SIZE, (size_t)length * BLOCK_SIZE);
+        for (int k = 0; k < length; k++) {
+            inode->blocks[idx + faits + k] = first + k;
+        }
+        faits += length;
+        segments++;
+    }
+    reserve_credit = 0;
+
+    int status = 0;
+    if (faits < nb) {
+        // Ne devrait pas arriver, la place étant réservée : on garde ce qui a pu être écrit
+        int fin = d->start + faits * BLOCK_SIZE;
+        if (inode->size > fin) {
+            update_parent_sizes(inode_index, fin - inode->size);
+            inode->size = fin;
+        }
+        printf("Erreur : ordinateur saturé !!!! (aucun bloc disponible)\n");
+        fprintf(fs.log, "\nErreur d'allocation différée : inode %d raccourci à %d octets\n", inode_index, fin);
+        status = -1;
+    }
+    fprintf(fs.log, "\nAllocation différée : %d blocs de l'inode %d écrits en %d segment(s)\n", faits, inode_index, segments);
+    delay_drop(d);
+    return status;
+}
+
+/**
+ * @brief Donne leurs blocs aux octets en attente d'un inode et les écrit dans l'image.
+ *
+ * Appelée avant tout accès direct aux blocs du fichier (cat, get, cp, clone)
+ * et, pour tous les inodes, avant chaque validation du journal : les données
+ * sont dans l'image avant les métadonnées qui les décrivent.
+ *
+ * @param inode_index L'inode.
+ * @return 0 si succès, -1 si l'espace manque.
+ */
+int flush_delayed(int inode_index) {
+    if (inode_index < 0 || inode_index >= NUM_INODES) {
+        return 0;
+    }
+    DelayedWrite *d = &delayed[inode_index];
+    if (__atomic_load_n(&d->len, __ATOMIC_ACQUIRE) == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&d->mutex);
+    int status = flush_delayed_locked(inode_index);
+    pthread_mutex_unlock(&d->mutex);
+    return status;
+}
+
+/**
+ * @brief Vide les zones en attente de tous les inodes (voir flush_delayed).
+ *
+ * @return Le nombre d'inodes dont les données n'ont pas toutes trouvé de place.
+ */
+int flush_all_delayed() {
+    int erreurs = 0;
+    for (int i = 0; i < NUM_INODES; i++) {
+        erreurs += flush_delayed(i) == -1;
+    }
+    return erreurs;
+}
+
+/**
+ * @brief Oublie les octets en attente d'un inode (fichier libéré, transaction annulée).
+ */
+void discard_delayed(int inode_index) {
+    DelayedWrite *d = &delayed[inode_index];
+    if (__atomic_load_n(&d->len, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&d->mutex);
+    fprintf(fs.log, "\nAllocation différée : %d octets de l'inode %d abandonnés sans écriture\n", d->len, inode_index);
+    delay_drop(d);
+    pthread_mutex_unlock(&d->mutex);
+}
+
+/**
+ * @brief Garde en mémoire des octets écrits en fin de fichier, sans leur choisir de blocs.
+ *
+ * Les octets sont acceptés s'ils prolongent (ou recouvrent) la zone en
+ * attente, ou s'ils commencent une nouvelle zone : position en fin de
+ * fichier, au début d'un bloc sans données. Le bloc vide laissé par
+ * create_file est alors rendu, la zone choisira le sien. La place est
+ * réservée tout de suite : sans elle, ou au-delà de DELAY_MAX, la zone est
+ * écrite et l'écriture passe par le chemin habituel.
+ * Appelée sous le verrou en écriture de l'inode.
+ *
+ * @param inode_index Inode du fichier.
+ * @param texte Octets à écrire.
+ * @param size Nombre d'octets.
+ * @param pos Position d'écriture dans le fichier.
+ * @return Le nombre d'octets gardés (0 : l'appelant écrit lui-même).
+ */
+int delay_write(int inode_index, const char *texte, int size, int pos) {
+    if (!delayed_alloc || log_structured || snapshot_mounted) {
+        return 0;
+    }
+    Inode *inode = &fs.inodes[inode_index];
+    DelayedWrite *d = &delayed[inode_index];
+    pthread_mutex_lock(&d->mutex);
+
+    // Écriture après la zone sans la prolonger : la zone prend ses blocs d'abord
+    if (d->len > 0 && (pos > d->start + d->len || pos - d->start >= DELAY_MAX)) {
+        flush_delayed_locked(inode_index);
+    }
+    // Écriture avant la zone : dans des blocs déjà alloués (ou un trou), par le chemin habituel
+    if (d->len > 0 && pos < d->start) {
+        pthread_mutex_unlock(&d->mutex);
+        return 0;
+    }
+    if (d->len == 0) {
+        int idx = pos / BLOCK_SIZE;
+        int b = idx < NUM_BLOCKS ? inode->blocks[idx] : -1;
+        if (idx >= NUM_BLOCKS || pos % BLOCK_SIZE != 0 || pos < inode->size ||
+            (b != -1 && fs.free_blocks[b] != 1)) {
+            pthread_mutex_unlock(&d->mutex);
+            return 0;
+        }
+        d->start = pos;
+    }
+
+    // Ne pas dépasser DELAY_MAX, ni recouvrir un bloc déjà alloué plus loin
+    int n = size;
+    if (pos - d->start + n > DELAY_MAX) {
+        n = DELAY_MAX - (pos - d->start);
+    }
+    int fin_blocs = (d->start + DELAY_MAX) / BLOCK_SIZE;
+    if (fin_blocs > NUM_BLOCKS) {
+        fin_blocs = NUM_BLOCKS;
+    }
+    for (int k = (d->start + d->len + BLOCK_SIZE - 1) / BLOCK_SIZE; k < fin_blocs; k++) {
+        int b = inode->blocks[k];
+        if (b != -1 && (k * BLOCK_SIZE > d->start || fs.free_blocks[b] != 1)) {
+            fin_blocs = k;
+            break;
+        }
+    }
+    if (pos - d->start + n > (fin_blocs * BLOCK_SIZE - d->start)) {
+        n = fin_blocs * BLOCK_SIZE - d->start - (pos - d->start);
+    }
+    if (n <= 0) {
+        flush_delayed_locked(inode_index);
+        pthread_mutex_unlock(&d->mutex);
+        return 0;
+    }
+
+    // Réserver la place des blocs supplémentaires
+    int len = pos - d->start + n > d->len ? pos - d->start + n : d->len;
+    int nb = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int ok = 1;
+    if (nb > d->reserved) {
+        // Publier la réservation avant de compter : une allocation faite
+        // sans verrou au même moment la verra (allocation_end)
+        pthread_mutex_lock(&delayed_mutex);
+        __atomic_add_fetch(&delayed_blocks, nb - d->reserved, __ATOMIC_SEQ_CST);
+        ok = count_free_blocks() - delayed_blocks >= -(inode->blocks[d->start / BLOCK_SIZE] != -1);
+        if (!ok) {
+            __atomic_sub_fetch(&delayed_blocks, nb - d->reserved, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&delayed_mutex);
+    }
+    if (ok && nb * BLOCK_SIZE > d->capacity) {
+        int capacity = d->capacity ? d->capacity : 8 * BLOCK_SIZE;
+        while (capacity < nb * BLOCK_SIZE) {
+            capacity *= 2;
+        }
+        char *data = realloc(d->data, capacity);
+        if (data == NULL) {
+            pthread_mutex_lock(&delayed_mutex);
+            delayed_blocks -= nb - d->reserved;
+            pthread_mutex_unlock(&delayed_mutex);
+            ok = 0;
+        } else {
+            d->data = data;
+            d->capacity = capacity;
+        }
+    }
+    if (!ok) {
+        flush_delayed_locked(inode_index);
+        pthread_mutex_unlock(&d->mutex);
+        return 0;
+    }
+    if (nb > d->reserved) {
+        d->reserved = nb;
+    }
+
+    // Le bloc vide de create_file (ou laissé libre en fin de fichier) n'est plus utile
+    int premier = d->start / BLOCK_SIZE;
+    if (d->len == 0 && inode->blocks[premier] != -1) {
+        free_block(inode->blocks[premier]);
+        inode->blocks[premier] = -1;
+    }
+
+    memcpy(d->data + (pos - d->start), texte, n);
+    __atomic_store_n(&d->len, len, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&d->mutex);
+    return n;
+}
+
+/**
+ * @brief Lit des octets d'une partie du fichier sans bloc : en attente d'allocation, ou trou (zéros).
+ *
+ * Un lecteur sous verrou partagé peut croiser cat ou get qui vident la zone
+ * (flush_delayed) : le bloc est relu sous le mutex de la zone, et s'il a
+ * été alloué entre-temps, les octets sont lus dans l'image.
+ *
+ * @param inode_index Inode du fichier.
+ * @param texte Tampon de destination.
+ * @param pos Position dans le fichier.
+ * @param size Nombre d'octets, sans dépasser la fin du bloc de pos.
+ */
+void delay_read(int inode_index, char *texte, int pos, int size) {
+    memset(texte, 0, size);
+    DelayedWrite *d = &delayed[inode_index];
+    pthread_mutex_lock(&d->mutex);
+    int num_block = fs.inodes[inode_index].blocks[pos / BLOCK_SIZE];
+    if (num_block != -1) {
+        if (pread(fileno(fs.file), texte, size, BLOCK_OFFSET(num_block) + pos % BLOCK_SIZE) != size) {
+            memset(texte, 0, size);
+        }
+    } else if (d->len > 0) {
+        int debut = pos > d->start ? pos : d->start;
+        int fin = pos + size < d->start + d->len ? pos + size : d->start + d->len;
+        if (fin > debut) {
+            memcpy(texte + (debut - pos), d->data + (debut - d->start), fin - debut);
+        }
+    }
+    pthread_mutex_unlock(&d->mutex);
+}
+
+/**
+ * @brief Libère les blocs d'un inode et le marque comme libre.
+ *
+ * @param inode_index L'inode à libérer.
+ */
+void release_inode(int inode_index) {
+    Inode *inode = &fs.inodes[inode_index];
+    discard_delayed(inode_index);  // Octets jamais écrits : rien à rendre dans l'image
+    lock_inode(inode_index, F_WRLCK);  // Attendre les lecteurs d'autres processus avant de rendre les blocs
+
+    // Libérer tous les blocs associés
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        if (inode->blocks[i] != -1) {
+            free_block(inode->blocks[i]);
+            inode->blocks[i] = -1;
+        }
+    }
+
+    inode->type = -1;
+    fs.clone_src[inode_index] = -1;
+    inode->creation_time = time(NULL);
+    inode->modification_time = time(NULL);
+    inode->link_count = 0;
+    inode->inode_rep_parent = -1;
+    // En dernier : un autre thread peut réserver l'inode dès qu'il le voit libre
+    int group = inode_index / GROUP_INODES;  // Toujours un vrai inode ici (voir inode_group)
+    pthread_mutex_lock(&group_locks[group]);
+    inode->size = -1; // Marquer l'inode comme libre
+    pthread_mutex_unlock(&group_locks[group]);
+}
+
+/**
+ * @brief Libère les fichiers supprimés pendant qu'ils étaient ouverts.
+ *
+ * Au montage plus aucun descripteur n'existe : un fichier détaché de son
+ * répertoire (parent -1) avant un arrêt brutal n'a plus de raison d'être.
+ *
+ * @return Le nombre d'inodes libérés.
+ */
+int release_unlinked_inodes() {
+    int liberes = 0;
+    for (int i = 1; i < NUM_INODES; i++) {
+        Inode *inode = &fs.inodes[i];
+        if (inode->size >= 0 && (inode->type == 1 || inode->type == 2) && inode->inode_rep_parent == -1) {
+            release_inode(i);
+            liberes++;
+        }
+    }
+    if (liberes > 0) {
+        fprintf(fs.log, "\nLibération de %d fichiers supprimés pendant qu'ils étaient ouverts\n", liberes);
+    }
+    return liberes;
+}
+
+/**
+ * @brief Supprime un fichier spécifié d'un répertoire.
+ *
+ * Cette fonction vérifie l'existence du fichier indiqué dans le répertoire spécifié par son inode. 
+ * Si le fichier existe, elle libère tous les blocs associés au fichier, réinitialise l'inode correspondant 
+ * pour le rendre disponible et supprime l'entrée correspondante dans le répertoire parent. Elle prend également
+ * en compte les éventuels liens durs vers ce fichier.
+ *
+ * @param filename Nom du fichier à supprimer.
+ * @param dir_inode Index de l'inode du répertoire contenant le fichier à supprimer.
+ *
+ * @return 0 si succès, -1 en cas d'erreur.
+ *
+ * @note Cette fonction ne peut pas supprimer un répertoire.
+ */
+int delete_file_locked(char *filename, int dir_inode) {
+    // Répertoire où le fichier se situe
+    Directory *dir = dir_of(dir_inode);
+    int inode_index = rechInode(filename, dir);
+    int status = -1;
+
+    // Vérifier si le fichier existe
+    if(inode_index == -1){
+        fprintf(fs.log, "\nErreur sur la suppression du fichier %s\n", filename);
+        printf("Erreur : Fichier inexistant.\n");
+    } else if(fs.inodes[inode_index].type != 1 && fs.inodes[inode_index].type != 2){
+        fprintf(fs.log, "\nErreur sur la suppression du fichier %s\n", filename);
+        printf("Erreur : Type de fichier non reconnu ou est un répertoire.\n");
+    } else if (unshare_dir(dir_inode) == -1) {
+        fprintf(fs.log, "\nErreur sur la suppression du fichier %s\n", filename);
+    } else {
+        if (__atomic_load_n(&open_refs[inode_index], __ATOMIC_ACQUIRE) > 0) {
+            // Encore ouvert : le contenu reste lisible jusqu'à la dernière fermeture (close_file)
+            fs.inodes[inode_index].inode_rep_parent = -1;
+            fprintf(fs.log, "\nInode %d détaché, libéré à la dernière fermeture\n", inode_index);
+        } else {
+            release_inode(inode_index);
+        }
+
+        // Supprimer l'entrée du répertoire
+        int i = 0;
+        while (inode_index != -1) {
+            if (dir->entries[i].inode_index == inode_index && strcmp(filename,dir->entries[i].filename) == 0) { // Vérifier le nom du fichier au cas où on a un lien dur
+                dir->entries[i].inode_index = -1;
+                mark_dir(dir_inode);
+                memset(dir->entries[i].filename, 0, MAX_FILE_NAME);
+                inode_index = -1;
+            }
+            i++;
+        }
+
+        printf("Fichier %s supprimé avec succès.\n", filename);
+        fprintf(fs.log, "\nFichier %s supprimé\n", filename);
+        status = 0;
+    }
+    return status;
+}
+
+/**
+ * @brief Supprime un fichier (voir delete_file_locked) sous les verrous du répertoire et du fichier.
+ */
+int delete_file(char *filename, int dir_inode) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, dir_inode, 1);
+    inode_locks_entry(&verrous, dir_inode, filename, 1);
+    int status = delete_file_locked(filename, dir_inode);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return status;
+}
+
+
+
+/**
+ * @brief Libère progressivement le contenu des répertoires orphelins.
+ *
+ * Un répertoire orphelin n'est plus accessible depuis la racine. Ses entrées
+ * sont libérées une à une ; ses sous-répertoires deviennent orphelins à leur
+ * tour ; l'inode du répertoire est libéré quand il est vide. L'état est
+ * toujours cohérent entre deux inodes : le travail reprend là où il s'est
+ * arrêté, y compris au montage suivant.
+ *
+ * Matérialiser un clone réécrit un répertoire que d'autres threads peuvent
+ * lire : seul un appelant qui a exclu les autres opérations (op_begin(1)) le
+ * fait. Les autres sautent les orphelins dont un clone est encore paresseux,
+ * que le récupérateur traitera.
+ *
+ * @param budget Nombre maximal d'inodes à libérer, -1 pour tout libérer.
+ * @param clones 1 si les clones des orphelins peuvent être matérialisés.
+ * @return Le nombre d'inodes libérés.
+ */
+int reclaim_orphans(int budget, int clones) {
+    int freed = 0;
+    pthread_mutex_lock(&orphans_mutex);  // Un autre thread peut déjà récupérer (allocation à court de blocs)
+
+    int k = fs.nb_orphans - 1;  // Le dernier ajouté d'abord : un sous-répertoire avant son parent
+    while (k >= 0 && (budget < 0 || freed < budget)) {
+        int dir_inode = fs.orphans[k];
+        Directory *dir = &fs.directories[dir_inode];  // Un clone encore paresseux est vide : rien à recopier
+
+        // Les clones de ce répertoire doivent recopier ses entrées avant qu'elles disparaissent
+        if (!clones) {
+            if (has_clones(dir_inode)) {
+                k--;
+                continue;
+            }
+        } else if (materialize_clones_of(dir_inode) == -1) {
+            break;
+        }
+
+        // Chercher une entrée restante dans le répertoire orphelin
+        int i = 0;
+        while (i < NUM_DIRECTORY_ENTRIES && dir->entries[i].inode_index == -1) {
+            i++;
+        }
+
+        if (i == NUM_DIRECTORY_ENTRIES) {
+            // Répertoire vide : on libère son inode
+            memmove(&fs.orphans[k], &fs.orphans[k + 1], (fs.nb_orphans - k - 1) * sizeof(int));
+            fs.nb_orphans--;
+            release_inode(dir_inode);
+        } else {
+            int child = dir->entries[i].inode_index;
+            dir->entries[i].inode_index = -1;
+            mark_dir(dir_inode);
+            memset(dir->entries[i].filename, 0, MAX_FILE_NAME);
+            if (fs.inodes[child].type == 0) {
+                fs.orphans[fs.nb_orphans++] = child;  // Traité avant son parent
+                k = fs.nb_orphans - 1;
+                continue;
+            }
+            if (__atomic_load_n(&open_refs[child], __ATOMIC_ACQUIRE) > 0) {
+                // Encore ouvert : libéré à la dernière fermeture, comme dans delete_file_locked
+                fs.inodes[child].inode_rep_parent = -1;
+                fprintf(fs.log, "\nInode %d détaché, libéré à la dernière fermeture\n", child);
+            } else {
+                release_inode(child);
+            }
+        }
+        freed++;
+        k = fs.nb_orphans - 1;
+    }
+
+    if (freed > 0) {
+        fprintf(fs.log, "\nRécupération de %d inodes, %d répertoires encore en attente\n", freed, fs.nb_orphans);
+    }
+    pthread_mutex_unlock(&orphans_mutex);
+    return freed;
+}
+
+long journal_commit();
+void journal_sync(long seq);
+
+/**
+ * @brief Nettoie un segment du mode journalisé pour le rendre entièrement libre.
+ *
+ * La victime est le segment le moins rempli hors de la tête d'écriture ; ses
+ * blocs vivants sont recopiés à la tête (le compteur de références suit le
+ * bloc), puis les inodes qui les désignaient sont redirigés. Rien n'est fait
+ * pendant une transaction : l'instantané désigne encore les anciens blocs.
+ * Pour la même raison, un segment qui contient un bloc retenu par un
+ * instantané (snapshot create) n'est jamais choisi.
+ *
+ * @return Le nombre de blocs déplacés, 0 si aucun segment ne valait la peine.
+ */
+int clean_segment() {
+    if (!log_structured || tx_snapshot != NULL) {
+        return 0;
+    }
+
+    int tete = log_head == -1 ? -1 : log_head / SEGMENT_BLOCKS;
+    int victime = -1, moins_vivants = CLEAN_MAX_LIVE;
+    for (int seg = 0; seg < NUM_SEGMENTS; seg++) {
+        int vivants = SEGMENT_BLOCKS - segment_free_blocks(seg);
+        if (seg != tete && vivants > 0 && vivants < moins_vivants && !segment_pinned(seg)) {
+            victime = seg;
+            moins_vivants = vivants;
+        }
+    }
+    if (victime == -1 || count_free_blocks() - (SEGMENT_BLOCKS - moins_vivants) < moins_vivants) {
+        return 0;
+    }
+
+    // Un lecteur d'un autre processus peut être en train de lire les blocs à
+    // déplacer : attendre qu'aucun inode ne soit verrouillé
+    if (!snapshot_mounted) {
+        lock_range(offsetof(Filesystem, inodes), sizeof(fs.inodes), F_WRLCK);
+    }
+
+    int base = victime * SEGMENT_BLOCKS;
+    int nouveau[SEGMENT_BLOCKS];
+    char *buffer = NULL;
+    int deplaces = 0;
+    cleaning_segment = victime;
+    for (int k = 0; k < SEGMENT_BLOCKS; k++) {
+        nouveau[k] = -1;
+        if (fs.free_blocks[base + k] == 0) {
+            continue;
+        }
+        int length;
+        int dst = allocate_log_run(1, &length);
+        if (dst == -1 || copy_block_run(base + k, dst, 1, &buffer) == -1) {
+            if (dst != -1) {
+                fs.free_blocks[dst] = 0;
+            }
+            break;
+        }
+        fs.free_blocks[dst] = fs.free_blocks[base + k];
+        fs.free_blocks[base + k] = 0;
+        pthread_mutex_lock(&log_head_mutex);
+        limbo_add(base + k);  // Désigné par l'état sur disque jusqu'à la prochaine validation
+        pthread_mutex_unlock(&log_head_mutex);
+        nouveau[k] = dst;
+        deplaces++;
+    }
+    cleaning_segment = -1;
+    free(buffer);
+
+    // Rediriger les inodes vers les nouveaux emplacements
+    for (int i = 0; i < NUM_INODES; i++) {
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            int num = fs.inodes[i].blocks[b];
+            if (num >= base && num < base + SEGMENT_BLOCKS && nouveau[num - base] != -1) {
+                fs.inodes[i].blocks[b] = nouveau[num - base];
+            }
+        }
+    }
+
+    fprintf(fs.log, "\nNettoyage du segment %d : %d blocs déplacés\n", victime, deplaces);
+    return deplaces;
+}
+
+/**
+ * @brief Indique si le nettoyeur de segments doit passer.
+ */
+int cleaning_needed() {
+    return log_structured && tx_snapshot == NULL && count_free_segments() < CLEAN_THRESHOLD;
+}
+
+int defrag_wanted();
+int defrag_step();
+
+/**
+ * @brief Calcule l'échéance absolue (CLOCK_REALTIME) d'une attente sur reclaim_cond.
+ */
+struct timespec reclaim_deadline(long long micro) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    long long ns = t.tv_nsec + micro % 1000000 * 1000;
+    t.tv_sec += micro / 1000000 + ns / 1000000000;
+    t.tv_nsec = ns % 1000000000;
+    return t;
+}
+
+/**
+ * @brief Boucle du récupérateur : libère les orphelins par lots en tâche de fond.
+ *
+ * Le verrou fs_mutex est relâché entre deux lots pour que les commandes du
+ * shell ne soient pas retardées par la suppression d'une grosse arborescence.
+ * En mode journalisé, il nettoie aussi un segment par passe quand les
+ * segments libres se font rares. Sinon, si la défragmentation en fond est
+ * active, il déplace un fichier par passe puis attend assez longtemps pour
+ * rester sous defrag_budget ; sans rien à déplacer, il recherche de nouveau
+ * toutes les DEFRAG_IDLE secondes.
+ */
+void *reclaimer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&fs_mutex);
+    while (!reclaimer_stop) {
+        long seq = -1;
+        int travail = 0;
+        long long pause = 0;
+        int deplace = 0;
+        if (fs.nb_orphans > 0 || cleaning_needed() || defrag_wanted()) {
+            // Un autre processus a peut-être déjà fait le travail : le verrou revalide l'état
+            int pris = op_begin(1);
+            lock_filesystem(1);
+            if (fs.nb_orphans > 0) {
+                reclaim_orphans(RECLAIM_BATCH, 1);
+                travail = 1;
+            } else if (cleaning_needed() && clean_segment() > 0) {
+                travail = 1;
+            } else if (defrag_wanted()) {
+                int blocs = defrag_step();
+                if (blocs > 0) {
+                    // Chaque bloc déplacé est lu puis écrit
+                    pause = (long long)blocs * 2 * BLOCK_SIZE * 1000000 / ((long long)defrag_budget * 1024);
+                    deplace = 1;
+                    travail = 1;
+                }
+            }
+            if (travail) {
+                // Les anciens blocs seront réutilisés : le lot doit être au journal avant
+                seq = journal_commit();
+            }
+            if (deplace) {
+                // Les anciens blocs d'un fichier déplacé sont déjà libres en mémoire :
+                // personne ne doit les reprendre avant que sa nouvelle table soit sur disque
+                journal_sync(seq);
+                seq = -1;
+            }
+            unlock_filesystem();
+            op_end(pris);
+        }
+        if (!travail) {
+            if (defrag_wanted()) {
+                struct timespec fin = reclaim_deadline(DEFRAG_IDLE * 1000000LL);
+                pthread_cond_timedwait(&reclaim_cond, &fs_mutex, &fin);
+            } else {
+                pthread_cond_wait(&reclaim_cond, &fs_mutex);
+            }
+            continue;
+        }
+        pthread_mutex_unlock(&fs_mutex);
+        if (seq != -1) {
+            journal_sync(seq);
+        }
+        usleep(1000);
+        pthread_mutex_lock(&fs_mutex);
+        if (pause > 0) {
+            // Attente interrompue seulement par stop_reclaimer : un réveil pour
+            // des orphelins ne doit pas faire dépasser le débit permis
+            struct timespec fin = reclaim_deadline(pause);
+            while (!reclaimer_stop && pthread_cond_timedwait(&reclaim_cond, &fs_mutex, &fin) != ETIMEDOUT) {
+            }
+        }
+    }
+    pthread_mutex_unlock(&fs_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Démarre le récupérateur ; il reprend aussitôt les orphelins laissés par une session précédente.
+ */
+void start_reclaimer() {
+    if (fs.nb_orphans > 0) {
+        fprintf(fs.log, "\nReprise de la récupération de %d répertoires supprimés\n", fs.nb_orphans);
+    }
+    reclaimer_stop = 0;
+    reclaimer_running = pthread_create(&reclaimer_thread, NULL, reclaimer_main, NULL) == 0;
+}
+
+/**
+ * @brief Arrête le récupérateur. Les orphelins restants sont conservés dans l'image.
+ */
+void stop_reclaimer() {
+    if (!reclaimer_running) {
+        return;
+    }
+    pthread_mutex_lock(&fs_mutex);
+    reclaimer_stop = 1;
+    pthread_cond_signal(&reclaim_cond);
+    pthread_mutex_unlock(&fs_mutex);
+    pthread_join(reclaimer_thread, NULL);
+    reclaimer_running = 0;
+}
+
+/**
+ * @brief Supprime un répertoire (et tout son contenu) du système de fichiers.
+ *
+ * Le répertoire est seulement détaché de son parent et placé dans la liste des
+ * orphelins : la commande rend la main immédiatement, quelle que soit la
+ * taille de l'arborescence. Les inodes et les blocs sont libérés ensuite par
+ * le récupérateur (reclaim_orphans).
+ *
+ * @param dirname    Le nom du répertoire à supprimer.
+ * @param parent_dir L'inode du répertoire parent (celui qui contient dirname).
+ * @return 0 si la suppression réussit, -1 en cas d'erreur.
+ */
+int delete_directory(const char *dirname, int parent_dir) {
+    // 1) Trouver l'inode du répertoire à supprimer en cherchant dirname dans le répertoire parent
+    int dir_inode = rechInode(dirname, dir_of(parent_dir));
+    if (dir_inode == -1) {
+        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
+        printf("Erreur: Le répertoire '%s' n'existe pas dans le répertoire %d.\n", dirname, parent_dir);
+        return -1;
+    }
+
+    // 2) Vérifier que c'est bien un répertoire
+    if (fs.inodes[dir_inode].type != 0) {  // 0 = répertoire
+        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
+        printf("Erreur: '%s' n'est pas un répertoire.\n", dirname);
+        return -1;
+    }
+    // 3) Vérifier permission 'w' sur ce répertoire
+    if (!has_permission(dir_inode, 'w')) {
+        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
+        printf("Erreur : pas de permission d'écriture sur le répertoire '%s'.\n", dirname);
+        return -1;
+    }
+
+    if (unshare_dir(parent_dir) == -1) {
+        fprintf(fs.log, "\nErreur sur la suppression du répertoire %s\n", dirname);
+        return -1;
+    }
+
+    // 4) Supprimer l'entrée correspondant à ce répertoire dans le parent
+    Directory *parent_directory = dir_of(parent_dir);
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        if (parent_directory->entries[i].inode_index == dir_inode &&
+            strcmp(parent_directory->entries[i].filename, dirname) == 0)
+        {
+            parent_directory->entries[i].inode_index = -1;
+            mark_dir(parent_dir);
+            memset(parent_directory->entries[i].filename, 0, MAX_FILE_NAME);
+            break;
+        }
+    }
+    update_parent_sizes(dir_inode, -fs.inodes[dir_inode].size);
+
+    // 5) Confier l'arborescence détachée au récupérateur
+    pthread_mutex_lock(&orphans_mutex);
+    fs.orphans[fs.nb_orphans++] = dir_inode;
+    pthread_mutex_unlock(&orphans_mutex);
+    pthread_cond_signal(&reclaim_cond);
+
+    printf("Le répertoire '%s' a été supprimé avec succès.\n", dirname);
+    fprintf(fs.log, "\nSuccès de la suppression du répertoire %s (inode %d en attente de récupération)\n", dirname, dir_inode);
+    return 0;
+}
+
+
+/**
+ * Crée un répertoire dans le système de fichiers simulé.
+ *
+ * @param dirname Nom du répertoire à créer.
+ * @return L'index de l'inode du répertoire créé, ou -1 en cas d'erreur.
+ */
+ int create_directory_locked(const char *dirname, int inode_dir) {
+    if (check_entry_name(dirname) == -1) {
+        return -1;
+    }
+    if (unshare_dir(inode_dir) == -1) {
+        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
+        return -1;
+    }
+
+    Directory *dir = dir_of(inode_dir);
+
+    //Vérifier si le fichier existe dans le répertoire
+    if (rechInode(dirname, dir) != -1){
+        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
+        printf("Erreur de création, un fichier de même nom existe déjà dans le répertoire\n");
+        return -1;
+    }
+
+    // Chercher une entrée libre dans le répertoire
+    int index = rechEntree(inode_dir);
+    if (index == -1){
+        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
+        printf("Erreur: Pas d'espace libre dans le répertoire.\n");
+        return -1;
+    }
+
+    // Réserver un inode libre pour stocker le répertoire
+    int inode_index = allocate_inode(inode_dir, 0);
+    if (inode_index == -1) {
+        fprintf(fs.log, "\nErreur sur la création du répertoire %s\n", dirname);
+        printf("Erreur: Aucun inode libre pour créer un répertoire.\n");
+        return -1;
+    }
+
+    Directory *new_dir = dir_of(inode_index);
+
+    // Initialisation de l'inode pour le répertoire
+    Inode *inode = &fs.inodes[inode_index];
+    inode->size = 0;  // Un répertoire commence vide
+    inode->type = 0;
+    inode->inode_rep_parent = inode_dir;
+    inode->creation_time = time(NULL);
+    inode->modification_time = time(NULL);
+    strncpy(inode->permissions, "rwx", 3);  // Lecture, écriture et exécution
+    inode->link_count = 1;  // Le répertoire est lié à lui-même
+
+    // Aucun bloc n'est alloué directement
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        inode->blocks[i] = -1;
+    }
+
+    //Initialiser les entrées du répertoire
+    for(int i = 0 ; i < NUM_DIRECTORY_ENTRIES ; i++){
+        memset(new_dir->entries[i].filename, 0, MAX_FILE_NAME * sizeof(char));
+        new_dir->entries[i].inode_index = -1;
+    }
+
+    // Ajouter le répertoire au répertoire parent
+    strncpy(dir->entries[index].filename, dirname, MAX_FILE_NAME);
+    dir->entries[index].inode_index = inode_index;
+    mark_dir(inode_dir);
+    mark_dir(inode_index);
+    fprintf(fs.log, "\nRépertoire '%s' créé avec succès\n", dirname);
+    printf("Répertoire '%s' créé avec succès.\n", dirname);
+    return inode_index;
+}
+
+/**
+ * @brief Crée un répertoire (voir create_directory_locked) sous le verrou du répertoire parent.
+ */
+int create_directory(const char *dirname, int inode_dir) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, inode_dir, 1);
+    inode_locks_acquire(&verrous);
+    int inode_index = create_directory_locked(dirname, inode_dir);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return inode_index;
+}
+
+
+
+
+
+
+/**
+ * Déplace un répertoire (et son contenu) d'un répertoire parent source vers un répertoire parent destination.
+ *
+ * @param srcDirName   Le nom du répertoire à déplacer.
+ * @param srcParentDir L'inode du répertoire parent source.
+ * @param dstParentDir L'inode du répertoire parent destination.
+ * @return 0 si la réussite, -1 si erreur.
+ */
+ int move_directory(const char *srcDirName, int srcParentDir, int dstParentDir) {
+    // 1) Récupérer l'inode du répertoire source
+    int srcDirInode = rechInode(srcDirName, dir_of(srcParentDir));
+    if (srcDirInode == -1) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        printf("Erreur : Le répertoire '%s' n'existe pas dans le répertoire %d.\n", srcDirName, srcParentDir);
+        return -1;
+    }
+
+    // 2) Vérifier que c'est bien un répertoire
+    if (fs.inodes[srcDirInode].type != 0) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        printf("Erreur : '%s' n'est pas un répertoire.\n", srcDirName);
+        return -1;
+    }
+     // 3) Vérifier la permission 'w' sur le répertoire source (pour supprimer l'entrée)
+     if (!has_permission(srcParentDir, 'w')) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        printf("Erreur : permission d'écriture refusée dans le répertoire source (inode %d).\n", srcParentDir);
+        return -1;
+    }
+
+    // 4) Vérifier qu'il n'y a pas déjà un répertoire (ou fichier) du même nom dans la destination
+    if (rechInode(srcDirName, dir_of(dstParentDir)) != -1) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        printf("Erreur : Le nom '%s' existe déjà dans le répertoire %d.\n", srcDirName, dstParentDir);
+        return -1;
+    }
+    // 5) Vérifier la permission 'w' sur le répertoire cible (pour créer l'entrée)
+    if (!has_permission(dstParentDir, 'w')) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        printf("Erreur : permission d'écriture refusée dans le répertoire cible (inode %d).\n", dstParentDir);
+        return -1;
+    }
+
+    if (unshare_dir(srcParentDir) == -1 || unshare_dir(dstParentDir) == -1) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        return -1;
+    }
+
+    // 6) Ajouter une entrée dans le répertoire destination
+    int dstIndex = rechEntree(dstParentDir);
+    if (dstIndex == -1) {
+        fprintf(fs.log, "\nErreur sur le déplacement du répertoire %s\n", srcDirName);
+        printf("Erreur : Pas d'espace libre dans le répertoire %d.\n", dstParentDir);
+        return -1;
+    }
+    Directory *destDir = dir_of(dstParentDir);
+    strncpy(destDir->entries[dstIndex].filename, srcDirName, MAX_FILE_NAME);
+    destDir->entries[dstIndex].inode_index = srcDirInode;
+    mark_dir(dstParentDir);
+
+    // 7) Supprimer l'entrée du répertoire source
+    Directory *sourceDir = dir_of(srcParentDir);
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        if (sourceDir->entries[i].inode_index == srcDirInode &&
+            strcmp(sourceDir->entries[i].filename, srcDirName) == 0)
+        {
+            sourceDir->entries[i].inode_index = -1;
+            mark_dir(srcParentDir);
+            memset(sourceDir->entries[i].filename, 0, MAX_FILE_NAME);
+            break;
+        }
+    }
+
+    // 8) Mettre à jour l'inode du répertoire pour pointer vers son nouveau parent
+    fs.inodes[srcDirInode].inode_rep_parent = dstParentDir;
+    fs.inodes[srcDirInode].modification_time = time(NULL);
+
+    fprintf(fs.log, "\nRépertoire '%s' (inode %d) déplacé de %d vers %d\n", srcDirName, srcDirInode, srcParentDir, dstParentDir);
+    printf("Répertoire '%s' (inode %d) déplacé de %d vers %d.\n", srcDirName, srcDirInode, srcParentDir, dstParentDir);
+    return 0;
+}
+
+/**
+ * Retourne l'inode correspondant à un chemin (absolu ou relatif) dans le système de fichiers.
+ *
+ * @param path          Le chemin (ex: "/home/user/file.txt" ou "docs/fichier1.txt")
+ * @param current_dir   L'inode du répertoire courant (utilisé si le chemin n'est pas absolu)
+ * @return L'inode du fichier/répertoire pointé par 'path', ou -1 en cas d'erreur.
+ */
+ int get_inode_from_path(const char *path, int current_dir) {
+    // 1) Déterminer si le chemin est absolu ou relatif
+    int inode = 0;  // Par défaut, la racine
+    if (path[0] != '/') {
+        // Chemin relatif => partir du répertoire courant
+        inode = current_dir;
+    }
+
+    // 2) Copie du chemin local pour strtok (car strtok modifie la chaîne)
+    char tempPath[1024];
+    memset(tempPath, 0, sizeof(tempPath));
+    strncpy(tempPath, path, sizeof(tempPath) - 1);
+
+    // 3) Découper par les "/"
+    char *suite;
+    char *token = strtok_r(tempPath, "/", &suite);
+    while (token != NULL) {
+        // Ignorer les "." (rester dans le même répertoire)
+        if (strcmp(token, ".") == 0) {
+            // On ne change rien
+        }
+        else {
+            // aller au repertoire parent si on a ".."
+            if (strcmp(token, "..") == 0){
+                inode = fs.inodes[inode].inode_rep_parent;
+            } else {
+
+                // 3.1) Chercher le token dans le répertoire inode actuel
+                int foundInode = lookup_entry(inode, token);
+                if (foundInode == -1) {
+                    // Pas trouvé
+                    fprintf(fs.log, "\nErreur : '%s' est introuvable dans le répertoire inode %d.\n", token, inode);
+                    printf("Erreur : '%s' est introuvable dans le répertoire inode %d.\n", token, inode);
+                    return -1;
+                }
+                // 3.2) Mettre à jour l'inode actuel
+                inode = foundInode;
+            }
+        }
+
+        token = strtok_r(NULL, "/", &suite);
+    }
+
+    // 4) inode final
+    return inode;
+}
+
+
+/**
+ * Crée un lien symbolique (symlink) vers une cible (targetPath), dans le répertoire parent parentDir.
+ *
+ * @param linkName   Nom du lien symbolique (ex: "lien_symb")
+ * @param targetPath Chemin vers la cible (ex: "/home/user/fichier.txt" ou "fichier2.txt")
+ * @param parentDir  Inode du répertoire dans lequel on crée le lien symbolique
+ * @return L'inode du lien symbolique créé, ou -1 en cas d'erreur
+ */
+ int create_symbolic_link(const char *linkName, const char *targetPath, int parentDir) {
+    if (check_entry_name(linkName) == -1) {
+        return -1;
+    }
+    // 1) Vérifier si un fichier ou répertoire du même nom existe déjà dans parentDir
+    int existingInode = rechInode(linkName, dir_of(parentDir));
+    if (existingInode != -1) {
+        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
+        printf("Erreur : Le nom '%s' existe déjà dans le répertoire inode %d.\n", linkName, parentDir);
+        return -1;
+    }
+
+    // 2) Vérifier que le chemin est valide
+    int path_inode = get_inode_from_path(targetPath, parentDir);
+    if(path_inode == -1){
+        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
+        printf("Erreur : le chemin n'est pas valide\n");
+        return -1;
+    }
+
+    if (unshare_dir(parentDir) == -1) {
+        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
+        return -1;
+    }
+
+    // 3) Chercher une entrée libre dans le répertoire parent
+    int dirIndex = rechEntree(parentDir);
+    if (dirIndex == -1) {
+        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
+        printf("Erreur : Pas d'espace libre dans le répertoire inode %d.\n", parentDir);
+        return -1;
+    }
+
+    // 4) Réserver un inode libre, dans le groupe du répertoire parent
+    int symlinkInode = allocate_inode(parentDir, 2);
+    if (symlinkInode == -1) {
+        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
+        printf("Erreur : Pas d'inode libre pour créer le lien symbolique.\n");
+        return -1;
+    }
+
+    // 5) Allouer un bloc pour stocker la chaîne de la cible (targetPath)
+    int blockIndex = allocate_block(symlinkInode, -1);
+    if (blockIndex == -1) {
+        fprintf(fs.log, "\nErreur lors de la création du lien symbolique vers %s\n", targetPath);
+        printf("Erreur : Pas de blocs libres pour créer le lien symbolique.\n");
+        fs.inodes[symlinkInode].size = -1;  // Rendre l'inode réservé
+        return -1;
+    }
+
+    // 6) Initialiser l'inode du lien symbolique
+    Inode *inodePtr = &fs.inodes[symlinkInode];
+    inodePtr->size = strlen(targetPath);                     // La taille du lien est celle du chemin cible
+    inodePtr->type = 2;                   // 2 = lien symbolique
+    inodePtr->creation_time = time(NULL);
+    inodePtr->modification_time = time(NULL);
+    inodePtr->inode_rep_parent = parentDir;
+    inodePtr->link_count = 1;             // Au moins un lien (ce lien lui-même)
+    strncpy(inodePtr->permissions, "rwx", 3);  // Par exemple, autoriser la lecture/exec du lien
+
+    // Mettre tous les blocs à -1, sauf celui qu’on vient d’allouer
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        inodePtr->blocks[i] = -1;
+    }
+    inodePtr->blocks[0] = blockIndex;
+
+    // 7) Écrire la chaîne targetPath (avec son '\0') dans le bloc alloué
+    write_blocks(blockIndex, targetPath, strlen(targetPath) + 1);
+
+    // 8) Ajouter l'entrée (linkName) dans le répertoire parent
+    Directory *dirPtr = dir_of(parentDir);
+    strncpy(dirPtr->entries[dirIndex].filename, linkName, MAX_FILE_NAME);
+    dirPtr->entries[dirIndex].inode_index = symlinkInode;
+    mark_dir(parentDir);
+
+    
+    fprintf(fs.log, "\nLien symbolique '%s' (inode %d) créé, pointant vers '%s'\n", linkName, symlinkInode, targetPath);
+    printf("Lien symbolique '%s' (inode %d) créé, pointant vers '%s'.\n", linkName, symlinkInode, targetPath);
+    return symlinkInode;
+}
+
+
+
+/**
+ * @brief Table des descripteurs du thread appelant : celle de sa session, ou celle du processus.
+ */
+FdTable *fd_table() {
+    return session_fds != NULL ? session_fds : &process_fds;
+}
+
+/**
+ * @brief Retrouve un descripteur ouvert.
+ *
+ * @param desc Numéro du descripteur.
+ * @return Le descripteur, ou NULL s'il n'est pas ouvert.
+ */
+FileDesc *fd_get(int desc) {
+    FdTable *t = fd_table();
+    if (desc < 0 || desc >= __atomic_load_n(&t->capacity, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    FileDesc *f = &t->chunks[desc / FD_CHUNK][desc % FD_CHUNK];
+    return f->inode == -1 ? NULL : f;
+}
+
+/**
+ * @brief Réserve un descripteur pour un inode, en tête de la liste libre.
+ *
+ * La table grandit d'une tranche de FD_CHUNK quand la liste est vide, sans
+ * dépasser max_open_files.
+ *
+ * @param inode Inode ouvert.
+ * @return Le descripteur, ou -1 si la limite est atteinte.
+ */
+int fd_alloc(int inode) {
+    FdTable *t = fd_table();
+    pthread_mutex_lock(&t->mutex);
+    if (t->free_head == -1 && t->capacity < max_open_files) {
+        if (t->chunks == NULL) {
+            t->chunks = calloc((max_open_files + FD_CHUNK - 1) / FD_CHUNK, sizeof(FileDesc *));
+        }
+        FileDesc *tranche = t->chunks != NULL ? malloc(FD_CHUNK * sizeof(FileDesc)) : NULL;
+        if (tranche != NULL) {
+            for (int k = 0; k < FD_CHUNK; k++) {
+                tranche[k].inode = -1;
+                tranche[k].tete_lecture = -1;
+                tranche[k].next_free = k + 1 < FD_CHUNK ? t->capacity + k + 1 : -1;
+            }
+            t->chunks[t->capacity / FD_CHUNK] = tranche;
+            t->free_head = t->capacity;
+            __atomic_store_n(&t->capacity, t->capacity + FD_CHUNK, __ATOMIC_RELEASE);
+        }
+    }
+    int desc = t->free_head;
+    if (desc != -1 && desc >= max_open_files) {
+        desc = -1;  // Dernière tranche entamée au-delà de la limite
+    }
+    if (desc != -1) {
+        FileDesc *f = &t->chunks[desc / FD_CHUNK][desc % FD_CHUNK];
+        t->free_head = f->next_free;
+        f->tete_lecture = 0;  // Position logique : début du fichier
+        f->inode = inode;
+        t->nb_open++;
+        __atomic_add_fetch(&open_refs[inode], 1, __ATOMIC_ACQ_REL);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    return desc;
+}
+
+/**
+ * @brief Rend un descripteur à la liste libre.
+ *
+ * @param desc Numéro du descripteur.
+ * @return L'inode qui était ouvert, ou -1 si le descripteur ne l'était pas.
+ */
+int fd_release(int desc) {
+    FdTable *t = fd_table();
+    pthread_mutex_lock(&t->mutex);
+    FileDesc *f = fd_get(desc);
+    int inode = -1;
+    if (f != NULL) {
+        inode = f->inode;
+        f->inode = -1;
+        f->tete_lecture = -1;
+        f->next_free = t->free_head;
+        t->free_head = desc;
+        t->nb_open--;
+    }
+    pthread_mutex_unlock(&t->mutex);
+    return inode;
+}
+
+/**
+ * @brief Ouvre un fichier et crée un descripteur de fichier.
+ *
+ * @param filename Nom du fichier à ouvrir.
+ * @param dir_inode L'inode du répertoire où se trouve le fichier.
+ * @return Le descripteur du fichier ouvert ou -1 en cas d'erreur.
+ */
+int open_file_locked(const char *filename, int dir_inode){
+    // On cherche le repertoire parent et l'inode
+    Directory *dir = dir_of(dir_inode);
+    int inode = rechInode(filename, dir);
+    int desc = -1;
+
+    // Vérifier que le fichier existe
+    if (inode == -1){
+        fprintf(fs.log, "\nErreur sur l'ouverture du fichier %s\n", filename);
+        printf("Erreur : fichier non ouvert.\n");
+        return -1;
+    }
+
+    // Vérifierr si le type de fichier n'est pas un répertoire
+    if(fs.inodes[inode].type != 1 && fs.inodes[inode].type != 2){
+        printf("Erreur : fichier es un répertoire ou non reconnu");
+        fprintf(fs.log, "\nErreur sur l'ouverture du fichier %s\n", filename);
+        return -1;
+    }
+
+    // On crée un nouveau descripteur de fichier, pris dans la liste libre de la session
+    desc = fd_alloc(inode);
+
+    // Vérifier si on a réussi a créer un descripteur
+    if (desc == -1){
+        printf("Erreur : fichier non ouvert (%d descripteurs déjà ouverts).\n", max_open_files);
+        fprintf(fs.log, "\nErreur sur l'ouverture du fichier %s\n", filename);
+        return -1;
+    }
+    
+    fprintf(fs.log, "\nNouveau descripteur %d pour le fichier %s\n", desc, filename);
+    return desc;
+}
+
+/**
+ * @brief Ouvre un fichier (voir open_file_locked) sous le verrou en lecture de son répertoire.
+ */
+int open_file(const char *filename, int dir_inode) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, dir_inode, 0);
+    inode_locks_entry(&verrous, dir_inode, filename, 0);
+    int desc = open_file_locked(filename, dir_inode);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return desc;
+}
+
+/**
+ * @brief Retourne l'inode ouvert sous un descripteur, -1 si le descripteur est invalide.
+ */
+int desc_inode(int desc) {
+    FileDesc *f = fd_get(desc);
+    return f != NULL ? f->inode : -1;
+}
+
+/**
+ * @brief Écrit des données à la tête du journal de données (mode journalisé).
+ *
+ * Les blocs touchés ne sont jamais réécrits sur place : chaque suite de
+ * blocs logiques est assemblée en mémoire (en reprenant l'ancien contenu
+ * des blocs écrits partiellement), écrite d'un seul tenant dans des blocs
+ * neufs pris à la tête, puis les anciens blocs sont relâchés. Un bloc
+ * partagé perd simplement une référence, comme pour une copie sur écriture.
+ *
+ * @param inode_index Inode du fichier.
+ * @param texte Données à écrire.
+ * @param size Nombre d'octets à écrire.
+ * @param pos Position d'écriture dans le fichier.
+ * @return Le nombre d'octets écrits (moins que size si l'espace manque).
+ */
+int write_log(int inode_index, const char *texte, int size, int pos) {
+    Inode *inode = &fs.inodes[inode_index];
+    char *buffer = NULL;
+    int j = 0;
+
+    while (j < size && (pos + j) / BLOCK_SIZE < NUM_BLOCKS) {
+        int idx = (pos + j) / BLOCK_SIZE;
+        int offset = (pos + j) % BLOCK_SIZE;
+        int want = (offset + size - j + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (want > NUM_BLOCKS - idx) {
+            want = NUM_BLOCKS - idx;
+        }
+        if (want > COPY_CHUNK / BLOCK_SIZE) {
+            want = COPY_CHUNK / BLOCK_SIZE;
+        }
+
+        int length;
+        int first = allocate_run(want, &length, inode_index, block_goal(inode_index, idx));
+        if (first == -1 && fs.nb_orphans > 0 && reclaim_orphans(-1, 0) > 0) {
+            first = allocate_run(want, &length, inode_index, block_goal(inode_index, idx));
+        }
+        if (first == -1) {
+            break;
+        }
+        if (buffer == NULL && (buffer = alloc_io_buffer(COPY_CHUNK)) == NULL) {
+            for (int k = 0; k < length; k++) {
+                free_block(first + k);
+            }
+            break;
+        }
+
+        // Assembler la suite : ancien contenu autour des octets écrits
+        int n = 0;
+        for (int k = 0; k < length; k++) {
+            char *dst = buffer + (size_t)k * BLOCK_SIZE;
+            int debut = k == 0 ? offset : 0;
+            int fin = debut + (size - j - n) < BLOCK_SIZE ? debut + (size - j - n) : BLOCK_SIZE;
+            if (debut > 0 || fin < BLOCK_SIZE) {
+                if (inode->blocks[idx + k] != -1) {
+                    read_blocks(inode->blocks[idx + k], dst, BLOCK_SIZE);
+                } else {
+                    memset(dst, 0, BLOCK_SIZE);
+                }
+            }
+            memcpy(dst + debut, texte + j + n, fin - debut);
+            n += fin - debut;
+        }
+        write_blocks(first, buffer, (size_t)length * BLOCK_SIZE);
+
+        for (int k = 0; k < length; k++) {
+            if (inode->blocks[idx + k] != -1) {
+                free_block(inode->blocks[idx + k]);
+            }
+            inode->blocks[idx + k] = first + k;
+        }
+        fprintf(fs.log, "\nÉcriture en tête de journal des blocs %d à %d (inode %d)\n", first, first + length - 1, inode_index);
+        j += n;
+    }
+
+    free(buffer);
+    return j;
+}
+
+/**
+ * @brief Écrit des données dans un fichier ouvert.
+ *
+ * @param desc Descripteur du fichier ouvert.
+ * @param texte Chaîne à écrire dans le fichier.
+ * @param size Nombre d'octets à écrire.
+ * @return Nombre d'octets écrits ou -1 en cas d'erreur.
+ */
+int write_file_locked(int desc, const char *texte, int size){
+    FileDesc *f = fd_get(desc);
+    // Vérifier si le descripteur est valide
+    if (f == NULL){
+        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+        printf("Erreur : descrpiteur invalide\n");
+        return -1;
+    } else if(size < 0) {
+        printf("Erreur : taille négatif\n");
+        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+        return -1;
+    }
+    // Vérifier la permission 'w'
+    int inode_idx = f->inode;
+    if (!has_permission(inode_idx, 'w')) {
+        printf("Erreur : permission d'écriture refusée.\n");
+        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+        return -1;
+    }
+
+    // Vérifier si on ecrit bien dans un fichier
+    if(fs.inodes[f->inode].type != 1){
+        printf("Erreur : tente d'ecrire dans un repertoire ou dans un lien symbolique");
+        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+        return -1;
+    }
+
+    // Les clones qui voient encore ce fichier par leur source doivent garder l'ancien contenu
+    if (unshare_inode(inode_idx) == -1) {
+        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+        return -1;
+    }
+
+    // Tete de lecture/ecriture (position logique dans le fichier) et inode du fichier
+    int lecteur = f->tete_lecture;
+    int inode = f->inode;
+    lock_inode(inode, F_WRLCK);  // Attendre les lecteurs de ce fichier dans d'autres processus
+
+    fprintf(fs.log, "\ntête de lecture en début d'écriture : %d\n", lecteur);
+
+    // On écrit bloc par bloc, sans jamais déborder du bloc courant
+    int j = 0;
+    if (log_structured) {
+        j = write_log(inode, texte, size, lecteur);
+        lecteur += j;
+        if (j < size) {
+            printf("Erreur : ordinateur saturé !!!! (aucun bloc disponible)\n");
+            fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+        }
+    }
+    while (!log_structured && j < size) {
+        // Octets au-delà des blocs alloués : gardés en mémoire jusqu'à la validation
+        int garde = delay_write(inode, texte + j, size - j, lecteur);
+        if (garde > 0) {
+            j += garde;
+            lecteur += garde;
+            continue;
+        }
+
+        int block_index = lecteur / BLOCK_SIZE;
+        int offset = lecteur % BLOCK_SIZE;
+        int num_block = -1;
+        if (block_index < NUM_BLOCKS) {
+            // Alloue le bloc s'il manque, le recopie s'il est partagé
+            num_block = block_for_write(inode, block_index);
+        }
+
+        // Vérifier si un block a été alloué
+        if (num_block == -1) {
+            printf("Erreur : ordinateur saturé !!!! (aucun bloc disponible)\n");
+            fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+            break;
+        }
+
+        int n = BLOCK_SIZE - offset;
+        if (n > size - j) {
+            n = size - j;
+        }
+        // pwrite : la position de fs.file est partagée entre les threads
+        if (pwrite(fileno(fs.file), texte + j, n, BLOCK_OFFSET(num_block) + offset) != n) {
+            fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+            break;
+        }
+        j += n;
+        lecteur += n;
+    }
+
+    // Mettre a jour la taille si on a écrit au-delà de la fin
+    int maj_size = 0;
+    if (lecteur > fs.inodes[inode].size) {
+        maj_size = lecteur - fs.inodes[inode].size;
+        fs.inodes[inode].size = lecteur;
+    }
+    if (j > 0) {
+        fs.inodes[inode].modification_time = time(NULL);
+    }
+
+    fprintf(fs.log, "\nAugmentation de la taille du fichier de %d octets\n", maj_size);
+
+    // Mettre a jour récursivement la taille des repertoires parents
+    update_parent_sizes(inode, maj_size);
+
+    // Mise a jour de la tête de lecture après écriture
+    f->tete_lecture = lecteur;
+    fprintf(fs.log, "\nTête de lecture en fin d'écriture : %d\n", lecteur);
+
+    return j;
+
+}
+
+/**
+ * @brief Écrit dans un fichier ouvert (voir write_file_locked) sous le verrou en écriture de son inode.
+ *
+ * Un descripteur n'est utilisé que par un thread à la fois.
+ */
+int write_file(int desc, const char *texte, int size) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, desc_inode(desc), 1);
+    inode_locks_acquire(&verrous);
+    int ecrit = write_file_locked(desc, texte, size);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return ecrit;
+}
+
+/**
+ * @brief Lit des données à partir d'un fichier ouvert.
+ *
+ * @param desc Descripteur du fichier ouvert.
+ * @param texte Buffer où stocker les données lues.
+ * @param size Nombre d'octets à lire.
+ */
+void read_file_locked(int desc, char *texte, int size){
+    FileDesc *f = fd_get(desc);
+
+    // Vérifier si le descripteur est valide
+    if (f == NULL){
+        fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
+        printf("Erreur : descrpiteur invalide\n");
+    } else if(size < 0) {
+        printf("Erreur : taille négatif\n");
+    // Vérifier que le fichier n'est pas un répertoire
+    } else if(fs.inodes[f->inode].type != 1 && fs.inodes[f->inode].type != 2){
+        fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
+        printf("Erreur : le type de fichier est un répertoire ou non reconnu\n");
+    } else { 
+        //Vérification permission'r'
+        int inode = f->inode;
+        if (!has_permission(inode, 'r')) {
+            fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
+            printf("Erreur : permission de lecture refusée pour cet inode.\n");
+            return; // on stoppe la fonction ici
+        }
+
+        // tete de lecture (position logique dans le fichier)
+        int lecteur = f->tete_lecture;
+
+        fprintf(fs.log, "\nTête de lecture en début de lecture : %d\n", lecteur);
+
+        // On ne lit pas au-delà de la fin du fichier
+        int fin = fs.inodes[inode].size;
+        if (lecteur + size > fin) {
+            fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
+            printf("Erreur : Fin du fichier dépassé par la tête de lecture\n");
+        }
+
+        // On copie le contenu bloc par bloc dans le buffer
+        int j = 0;
+        while (j < size && lecteur < fin) {
+            int num_block = fs.inodes[inode].blocks[lecteur / BLOCK_SIZE];
+            int offset = lecteur % BLOCK_SIZE;
+            int n = BLOCK_SIZE - offset;
+            // Blocs physiquement contigus : une seule lecture pour toute la suite
+            while (num_block != -1 && n < size - j && lecteur + n < fin
+                   && fs.inodes[inode].blocks[(lecteur + n) / BLOCK_SIZE] == num_block + (offset + n) / BLOCK_SIZE) {
+                n += BLOCK_SIZE;
+            }
+            if (n > size - j) {
+                n = size - j;
+            }
+            if (n > fin - lecteur) {
+                n = fin - lecteur;
+            }
+            if (num_block == -1) {
+                // Trou dans le fichier (zéros), ou octets en attente d'allocation
+                delay_read(inode, texte + j, lecteur, n);
+            } else if (pread(fileno(fs.file), texte + j, n, BLOCK_OFFSET(num_block) + offset) != n) {
+                // pread : la position de fs.file est partagée entre les threads
+                memset(texte + j, 0, n);
+            }
+            j += n;
+            lecteur += n;
+        }
+
+        // On marque la fin du texte
+        texte[j] = '\0';
+
+        // Mise a jour de la tête de lecture après écriture
+        f->tete_lecture = lecteur;
+        fprintf(fs.log, "\nTête de lecture en fin de lecture : %d\n", lecteur);
+    }
+    
+
+
+}
+
+/**
+ * @brief Lit dans un fichier ouvert (voir read_file_locked) sous le verrou en lecture de son inode.
+ *
+ * Plusieurs threads peuvent lire le même fichier en même temps, chacun avec son descripteur.
+ */
+void read_file(int desc, char *texte, int size) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, desc_inode(desc), 0);
+    inode_locks_acquire(&verrous);
+    read_file_locked(desc, texte, size);
+    inode_locks_release(&verrous);
+    op_end(pris);
+}
+
+/**
+ * @brief Ferme un fichier ouvert et libère son descripteur.
+ *
+ * La dernière fermeture d'un fichier supprimé pendant qu'il était ouvert
+ * libère son inode et ses blocs, sous le verrou en écriture de l'inode
+ * (delete_file regarde le compteur sous ce même verrou).
+ *
+ * @param desc Descripteur du fichier à fermer.
+ * @return 1 si un inode a été libéré (à journaliser), 0 sinon, -1 si le descripteur est invalide.
+ */
+int fd_close(int desc) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, desc_inode(desc), 1);
+    inode_locks_acquire(&verrous);
+
+    int libere = -1;
+    int inode = fd_release(desc);
+    if (inode != -1) {
+        libere = 0;
+        if (__atomic_sub_fetch(&open_refs[inode], 1, __ATOMIC_ACQ_REL) == 0 &&
+            fs.inodes[inode].size >= 0 && fs.inodes[inode].inode_rep_parent == -1) {
+            release_inode(inode);
+            fprintf(fs.log, "\nInode %d supprimé libéré à la dernière fermeture\n", inode);
+            libere = 1;
+        }
+    }
+
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return libere;
+}
+
+void close_file(int desc){
+    // Vérifier si le descripteur est valide
+    if (fd_close(desc) == -1){
+        printf("Erreur : descrpiteur invalide\n");
+        fprintf(fs.log, "\nErreur sur la fermeture du descripteur %d\n", desc);
+    } else {
+        fprintf(fs.log, "\nDescripteur %d fermé\n", desc);
+    }
+}
+
+/**
+ * @brief Ferme tous les descripteurs d'une table et rend sa mémoire (fin de session).
+ *
+ * @param t La table.
+ * @return Le nombre d'inodes libérés par ces fermetures.
+ */
+int fd_table_close_all(FdTable *t) {
+    FdTable *avant = session_fds;
+    session_fds = t;
+    int liberes = 0;
+    for (int desc = 0; desc < t->capacity && t->nb_open > 0; desc++) {
+        if (fd_get(desc) != NULL) {
+            liberes += fd_close(desc) == 1;
+        }
+    }
+    for (int c = 0; c < t->capacity / FD_CHUNK; c++) {
+        free(t->chunks[c]);
+    }
+    free(t->chunks);
+    t->chunks = NULL;
+    t->capacity = 0;
+    t->free_head = -1;
+    session_fds = avant;
+    return liberes;
+}
+
+
+/**
+ * @brief Déplace la tête de lecture d'un fichier ouvert.
+ *
+ * @param desc Descripteur du fichier.
+ * @param offset Décalage à appliquer.
+ * @param whence Origine du déplacement : 0=début, 1=fin, 2=position actuelle.
+ */
+void seek_file_locked(int desc, int offset, int whence){
+    FileDesc *f = fd_get(desc);
+    // Vérifier si le descripteur est valide
+    if (f == NULL){
+        fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
+        printf("Erreur : descrpiteur invalide\n");
+    // Offset doit etre > 0
+    } else if (offset < 0) {
+        fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
+        printf("Erreur : offset < 0\n");
+    } else {
+        int inode = f->inode;
+        int lecteur = f->tete_lecture;
+        fprintf(fs.log, "\nTête de lecture avant le déplacement : %d\n", lecteur);
+
+        // La tête de lecture est une position logique : plus besoin de parcourir les blocs
+        if (whence == 0) {
+            fprintf(fs.log, "\nDéplacement à partir du début\n");
+            lecteur = offset;
+        } else if (whence == 2) {
+            fprintf(fs.log, "\nDéplacement par rapport à la position courante\n");
+            lecteur = lecteur + offset;
+        } else if (whence == 1) {
+            fprintf(fs.log, "\nDéplacement par rapport à la fin\n");
+            lecteur = fs.inodes[inode].size - offset;
+        } else {
+            printf("Erreur : option non reconnu \n");
+            fprintf(fs.log, "\nOption de déplacement non recconu\n");
+            return;
+        }
+
+        // Vérifier qu'on reste dans le fichier
+        if (lecteur < 0 || lecteur > fs.inodes[inode].size) {
+            fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
+            printf("Erreur : tete de lecture en dehors du fichier\n");
+            return;
+        }
+
+        // On met a jour la tete de lecture
+        f->tete_lecture = lecteur;
+        fprintf(fs.log, "\nTête de lecture en fin de déplacement : %d\n", lecteur);
+    }
+}
+
+/**
+ * @brief Déplace la tête de lecture (voir seek_file_locked) sous le verrou en lecture de l'inode.
+ */
+void seek_file(int desc, int offset, int whence) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, desc_inode(desc), 0);
+    inode_locks_acquire(&verrous);
+    seek_file_locked(desc, offset, whence);
+    inode_locks_release(&verrous);
+    op_end(pris);
+}
+
+
+
+/**
+ * @brief Copie un fichier vers un nouveau fichier dans un répertoire cible.
+ *
+ * La copie partage les blocs de données de la source (compteur de références
+ * par bloc) : seules les métadonnées sont écrites, quelle que soit la taille
+ * du fichier. Les blocs sont recopiés à la demande à la première modification.
+ * Avec partage à 0, le contenu est au contraire recopié en flux dans des blocs
+ * propres au nouveau fichier (copy_file_data).
+ *
+ * @param filename Nom du fichier à copier.
+ * @param newname Nouveau nom du fichier copié.
+ * @param inode_dir_source Inode du répertoire source.
+ * @param inode_dir_target Inode du répertoire cible.
+ * @param partage 1 pour partager les blocs, 0 pour une copie complète du contenu.
+ * @param jobs Pour une copie complète : si non NULL, les copies de blocs y sont
+ *             seulement préparées (l'appelant les exécute plus tard avec run_copy_jobs).
+ * @return L'inode du nouveau fichier ou -1 en cas d'erreur.
+ */
+int copy_file_planned(char *filename, char *newname, int inode_dir_source, int inode_dir_target, int partage, CopyJobs *jobs) {
+    Directory *dir_source = dir_of(inode_dir_source);
+    Directory *dir_target = dir_of(inode_dir_target);
+
+    // Vérifier si le fichier existe
+    int source_inode_index = rechInode(filename, dir_source);
+    if(source_inode_index == -1){
+        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
+        printf("Erreur : Fichier inexistant.\n");
+        return -1;
+    }
+    // ----- (1) Vérifier la permission 'r' sur le fichier source -----
+    if (!has_permission(source_inode_index, 'r')) {
+        printf("Erreur : pas de permission de lecture sur le fichier source '%s'.\n", filename);
+        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
+        return -1;
+    }
+    // ----- (2) Vérifier la permission 'w' sur le répertoire de destination -----
+    if (!has_permission(inode_dir_target, 'w')) {
+        printf("Erreur : pas de permission d'écriture dans le répertoire cible.\n");
+        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
+        return -1;
+    }
+
+    // Vérifier si un fichier du même nom existe dans le répertoire source
+    int exist_target_inode = rechInode(newname, dir_target);
+    if(exist_target_inode != -1){
+        printf("Erreur : Un fichier de ce nom existe déjà dans le répertoire.\n");
+        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
+        return -1;
+    }
+
+    // La copie lit (ou partage) les blocs de la source : ses octets en attente doivent en avoir
+    if (flush_delayed(source_inode_index) == -1) {
+        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
+        return -1;
+    }
+
+    // Créer un fichier copie
+    int new_inode_index = create_file(newname, fs.inodes[source_inode_index].permissions, inode_dir_target);
+
+    // Vérifier si le fichier a été créé
+    if (new_inode_index == -1) {
+        return -1;
+    }
+    Inode *source_inode = &fs.inodes[source_inode_index];
+    Inode *new_inode = &fs.inodes[new_inode_index];
+
+    if (partage) {
+        // Partager les blocs de la source au lieu de les recopier : la copie ne
+        // coûte que des métadonnées, les blocs ne seront dupliqués qu'à la première
+        // écriture dans l'un des deux fichiers (voir block_for_write)
+        free_block(new_inode->blocks[0]);  // Bloc alloué par create_file, inutile ici
+        for (int i = 0; i < NUM_BLOCKS; i++) {
+            new_inode->blocks[i] = source_inode->blocks[i];
+            share_block(new_inode->blocks[i]);
+        }
+    } else if ((jobs ? plan_file_copy(source_inode_index, new_inode_index, jobs)
+                     : copy_file_data(source_inode_index, new_inode_index)) == -1) {
+        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
+        new_inode->size = 0;
+        delete_file(newname, inode_dir_target);
+        return -1;
+    }
+
+    // Mettre a jour la taille et le type du nouveau fichier
+    new_inode->type = source_inode->type;
+    new_inode->size = source_inode->size;
+    update_parent_sizes(new_inode_index, new_inode->size);
+
+    fprintf(fs.log, "\nFichier %s copié vers le répertoire d'inode %d\n", filename, inode_dir_target);
+    printf("Fichier %s copié avec succès.\n", filename);
+    return new_inode_index;
+}
+
+/**
+ * @brief Copie un fichier vers un nouveau fichier dans un répertoire cible (voir copy_file_planned).
+ */
+int copy_file(char *filename, char *newname, int inode_dir_source, int inode_dir_target, int partage) {
+    return copy_file_planned(filename, newname, inode_dir_source, inode_dir_target, partage, NULL);
+}
+
+
+
+/**
+ * @brief Contexte d'une copie d'arborescence : mode de copie et copies de blocs préparées par chaque ouvrier.
+ */
+typedef struct {
+    int partage;                          /**< 1 pour partager les blocs des fichiers */
+    CopyJobs *jobs;                       /**< NULL pour copier le contenu tout de suite */
+    CopyJobs worker_jobs[POOL_MAX_WORKERS];
+} CopyWalk;
+
+/**
+ * @brief Tâche de copie : recopie les entrées du répertoire task.inode dans task.aux.
+ *
+ * Chaque sous-répertoire est créé dans la destination puis confié à une
+ * nouvelle tâche. Une création qui échoue alors que la source est lisible
+ * signifie que les inodes ou la place manquent : le reste est abandonné.
+ */
+int copy_visit(TaskPool *pool, int worker, Task task) {
+    CopyWalk *copie = pool->arg;
+    Directory *srcDir = malloc(sizeof(Directory));
+    if (!srcDir) {
+        return -1;
+    }
+    dir_snapshot(task.inode, srcDir);
+    int status = 0;
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES && status == 0; i++) {
+        int childInode = srcDir->entries[i].inode_index;
+        if (childInode == -1) {
+            continue;
+        }
+        // Récupération des informations de l'enfant
+        char *childName = srcDir->entries[i].filename;
+        int childType = fs.inodes[childInode].type;
+        int lisible = has_permission(childInode, 'r');
+
+        if (childType == 1 || childType == 2) {
+            // 1 = fichier, 2 = lien symbolique
+            CopyJobs *jobs = copie->jobs ? &copie->worker_jobs[worker] : NULL;
+            if (copy_file_planned(childName, childName, task.inode, task.aux, copie->partage, jobs) == -1 && lisible) {
+                status = -1;
+            }
+        } else if (childType == 0) {
+            // 0 = répertoire : créé ici, son contenu sera recopié par une autre tâche
+            if (!lisible) {
+                fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", childName);
+                printf("Erreur : pas de permission de lecture sur le répertoire source '%s'.\n", childName);
+                continue;
+            }
+            int newDirInode = create_directory(childName, task.aux);
+            if (newDirInode == -1) {
+                fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", childName);
+                printf("Erreur : Échec de la création du répertoire '%s' dans le répertoire %d.\n", childName, task.aux);
+                status = -1;
+                continue;
+            }
+            fprintf(fs.log, "\nRépertoire '%s' (inode %d) copié dans le répertoire %d (nouveau inode %d)\n", childName, childInode, task.aux, newDirInode);
+            printf("Répertoire '%s' (inode %d) copié dans le répertoire %d (nouveau inode %d).\n", childName, childInode, task.aux, newDirInode);
+            pool_push(pool, worker, (Task){childInode, newDirInode, NULL});
+        }
+    }
+    free(srcDir);
+    return status;
+}
+
+/**
+ * Copie récursivement un répertoire (et son contenu) d'un répertoire parent source vers un répertoire parent destination.
+ *
+ * L'arborescence est parcourue par copy_threads ouvriers (pool_run) : chaque
+ * répertoire est une tâche, ce qui ne dépend pas de la pile et occupe les
+ * autres cœurs pendant la création des inodes et le partage des blocs.
+ *
+ * @param srcDirName   Le nom du répertoire à copier.
+ * @param srcParentDir L'inode du répertoire parent source (celui qui contient srcDirName).
+ * @param dstParentDir L'inode du répertoire parent de destination (là où on veut copier).
+ * @param partage      1 pour partager les blocs des fichiers, 0 pour recopier leur contenu.
+ * @param jobs         Liste recevant les copies de blocs des fichiers (NULL pour copier tout de suite).
+ * @return L'inode du nouveau répertoire copié, ou -1 en cas d'erreur.
+ */
+ int copy_directory_planned(const char *srcDirName, const char *newname, int srcParentDir, int dstParentDir, int partage, CopyJobs *jobs) {
+    // 1) Trouver l'inode du répertoire source
+    int srcDirInode = rechInode(srcDirName, dir_of(srcParentDir));
+    if (srcDirInode == -1) {
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+        printf("Erreur : Le répertoire '%s' n'existe pas dans le répertoire %d.\n", srcDirName, srcParentDir);
+        return -1;
+    }
+
+    // 2) Vérifier que c'est bien un répertoire
+    if (fs.inodes[srcDirInode].type != 0) {  // 0 = répertoire
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+        printf("Erreur : '%s' n'est pas un répertoire.\n", srcDirName);
+        return -1;
+    }
+    // 3) Vérifier la permission 'r' sur le répertoire source
+    if (!has_permission(srcDirInode, 'r')) {
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+        printf("Erreur : pas de permission de lecture sur le répertoire source '%s'.\n", srcDirName);
+        return -1;
+    }
+    // La destination ne doit pas être dans la source : la copie s'y recopierait sans fin
+    for (int x = dstParentDir; x != -1; x = fs.inodes[x].inode_rep_parent) {
+        if (x == srcDirInode) {
+            fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+            printf("Erreur : impossible de copier un répertoire dans sa propre arborescence.\n");
+            return -1;
+        }
+        if (x == 0) {
+            break;
+        }
+    }
+
+    // 4) Vérifier si un répertoire (ou fichier) du même nom existe déjà dans la destination
+    int alreadyInode = rechInode(newname, dir_of(dstParentDir));
+    if (alreadyInode != -1) {
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+        printf("Erreur : Le nom '%s' existe déjà dans le répertoire de destination.\n", newname);
+        return -1;
+    }
+    // 5) Vérifier la permission 'w' sur le répertoire de destination (pour y créer un nouveau dossier)
+    if (!has_permission(dstParentDir, 'w')) {
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+        printf("Erreur : pas de permission d'écriture dans le répertoire destination (inode %d).\n", dstParentDir);
+        return -1;
+    }
+
+    // 6) Créer un nouveau répertoire dans le répertoire parent de destination
+    int newDirInode = create_directory(newname, dstParentDir);
+    if (newDirInode == -1) {
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
+        printf("Erreur : Échec de la création du répertoire '%s' dans le répertoire %d.\n", newname, dstParentDir);
+        return -1;
+    }
+
+    // 7) Copier le contenu, un répertoire par tâche ; les copies de blocs
+    //    préparées par les ouvriers sont ensuite réunies dans jobs
+    CopyWalk *copie = calloc(1, sizeof(CopyWalk));
+    if (!copie) {
+        return -1;
+    }
+    copie->partage = partage;
+    copie->jobs = jobs;
+    int status = pool_run(copy_visit, copie, (Task){srcDirInode, newDirInode, NULL}, copy_threads);
+    for (int k = 0; k < POOL_MAX_WORKERS; k++) {
+        CopyJobs *w = &copie->worker_jobs[k];
+        if (jobs && w->count > 0) {  // Même interrompue, les fichiers déjà créés reçoivent leur contenu
+            CopyJob *items = realloc(jobs->items, (jobs->count + w->count) * sizeof(CopyJob));
+            if (items) {
+                memcpy(items + jobs->count, w->items, w->count * sizeof(CopyJob));
+                jobs->items = items;
+                jobs->count += w->count;
+                jobs->capacity = jobs->count;
+            } else {
+                status = -1;
+            }
+        }
+        free(w->items);
+    }
+    free(copie);
+    if (status == -1) {
+        fprintf(fs.log, "\nErreur sur la copie du répertoire %s : copie interrompue\n", srcDirName);
+        printf("Erreur : copie de '%s' interrompue (inodes ou espace insuffisants).\n", srcDirName);
+        return -1;
+    }
+
+    fprintf(fs.log, "\nRépertoire '%s' (inode %d) copié dans le répertoire %d (nouveau inode %d)\n", srcDirName, srcDirInode, dstParentDir, newDirInode);
+    printf("Répertoire '%s' (inode %d) copié dans le répertoire %d (nouveau inode %d).\n", srcDirName, srcDirInode, dstParentDir, newDirInode);
+
+    return newDirInode;
+}
+
+/**
+ * @brief Clone un répertoire en temps constant, quelle que soit la taille de son arborescence.
+ *
+ * Le nouveau répertoire ne reçoit qu'un inode et la mention de sa source
+ * (clone_src) : ses entrées sont recopiées au premier accès (dir_of), ou
+ * juste avant que la source ne change (unshare_dir), un niveau à la fois.
+ * Les fichiers partagent leurs blocs avec ceux de la source et ne s'en
+ * séparent qu'à la première écriture (copie sur écriture).
+ *
+ * @param src_inode Répertoire à cloner.
+ * @param parent Répertoire qui recevra le clone.
+ * @param name Nom du clone.
+ * @return L'inode du clone, ou -1 en cas d'erreur.
+ */
+int clone_directory(int src_inode, int parent, const char *name) {
+    if (check_entry_name(name) == -1) {
+        return -1;
+    }
+    if (fs.inodes[src_inode].type != 0 || fs.inodes[parent].type != 0) {
+        printf("Erreur : la source et la destination doivent être des répertoires.\n");
+        fprintf(fs.log, "\nErreur sur le clonage du répertoire %d\n", src_inode);
+        return -1;
+    }
+    if (!has_permission(src_inode, 'r') || !has_permission(parent, 'w')) {
+        printf("Erreur : permission refusée.\n");
+        fprintf(fs.log, "\nErreur sur le clonage du répertoire %d\n", src_inode);
+        return -1;
+    }
+    // La source ne doit pas contenir le clone : elle changerait en le recevant
+    for (int x = parent; ; x = fs.inodes[x].inode_rep_parent) {
+        if (x == src_inode) {
+            printf("Erreur : impossible de cloner un répertoire dans sa propre arborescence.\n");
+            fprintf(fs.log, "\nErreur sur le clonage du répertoire %d\n", src_inode);
+            return -1;
+        }
+        if (x == 0) {
+            break;
+        }
+    }
+    if (rechInode(name, dir_of(parent)) != -1) {
+        printf("Erreur : Le nom '%s' existe déjà dans le répertoire de destination.\n", name);
+        fprintf(fs.log, "\nErreur sur le clonage du répertoire %d\n", src_inode);
+        return -1;
+    }
+    int index = rechEntree(parent);
+    if (index == -1 || unshare_dir(parent) == -1) {
+        printf("Erreur : impossible d'ajouter une entrée au répertoire destination.\n");
+        fprintf(fs.log, "\nErreur sur le clonage du répertoire %d\n", src_inode);
+        return -1;
+    }
+
+    int clone = clone_inode(src_inode, parent);
+    if (clone == -1) {
+        printf("Erreur: Aucun inode libre pour créer le clone.\n");
+        fprintf(fs.log, "\nErreur sur le clonage du répertoire %d\n", src_inode);
+        return -1;
+    }
+    fs.inodes[clone].creation_time = time(NULL);
+    Directory *dir = &fs.directories[clone];
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        memset(dir->entries[i].filename, 0, MAX_FILE_NAME);
+        dir->entries[i].inode_index = -1;
+    }
+    fs.clone_src[clone] = src_inode;
+
+    Directory *parent_dir = dir_of(parent);
+    strncpy(parent_dir->entries[index].filename, name, MAX_FILE_NAME);
+    parent_dir->entries[index].inode_index = clone;
+    mark_dir(parent);
+    mark_dir(clone);
+    update_parent_sizes(clone, fs.inodes[clone].size);
+
+    fprintf(fs.log, "\nClone paresseux du répertoire %d : inode %d\n", src_inode, clone);
+    return clone;
+}
+
+/**
+ * @brief Copie récursivement un répertoire (voir copy_directory_planned).
+ *
+ * Pour une copie complète, on construit d'abord tout le squelette de la
+ * destination (répertoires, inodes, allocation des blocs) en une seule passe
+ * sur les métadonnées, puis le contenu des fichiers est recopié en parallèle
+ * par copy_threads ouvriers.
+ */
+int copy_directory(const char *srcDirName, const char *newname, int srcParentDir, int dstParentDir, int partage) {
+    if (partage) {
+        return copy_directory_planned(srcDirName, newname, srcParentDir, dstParentDir, partage, NULL);
+    }
+
+    CopyJobs jobs = {0};
+    struct timespec debut, fin;
+    clock_gettime(CLOCK_MONOTONIC, &debut);
+
+    int newDirInode = copy_directory_planned(srcDirName, newname, srcParentDir, dstParentDir, partage, &jobs);
+    int nb_jobs = jobs.count;
+    if (run_copy_jobs(&jobs, copy_threads) == -1) {
+        fprintf(fs.log, "\nErreur sur la copie du contenu du répertoire %s\n", srcDirName);
+        printf("Erreur : échec de la copie du contenu de '%s'.\n", srcDirName);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    fprintf(fs.log, "\nCopie du contenu de '%s' : %d suites de blocs, %d ouvriers, %.3f ms\n", srcDirName, nb_jobs, copy_threads,
+            (fin.tv_sec - debut.tv_sec) * 1e3 + (fin.tv_nsec - debut.tv_nsec) / 1e6);
+    return newDirInode;
+}
+
+
+
+/**
+ * @brief Compte les blocs libres de la partition.
+ *
+ * @return Le nombre de blocs dont le compteur de références est nul.
+ */
+int count_free_blocks() {
+    int nb = 0;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        if (fs.free_blocks[i] == 0) {
+            nb++;
+        }
+    }
+    return nb;
+}
+
+/**
+ * @brief Transfère une portion d'un fichier hôte vers une suite de blocs contigus de l'image.
+ *
+ * Comme pour copy_block_run, on laisse d'abord le noyau copier directement
+ * du fichier hôte vers l'image (kernel_copy) ; à défaut on passe par un
+ * tampon de COPY_CHUNK octets, le dernier bloc étant complété par des zéros.
+ *
+ * @param host_fd Descripteur du fichier hôte.
+ * @param host_off Position de la portion dans le fichier hôte.
+ * @param first_block Premier bloc destination.
+ * @param len Nombre d'octets à transférer (au plus COPY_CHUNK).
+ * @param buffer Tampon de repli, alloué à la demande et libéré par l'appelant.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int import_run(int host_fd, off_t host_off, int first_block, size_t len, char **buffer) {
+    fflush(fs.file);
+    int status = kernel_copy(host_fd, host_off, fileno(fs.file), BLOCK_OFFSET(first_block), len);
+    if (status != 1) {
+        return status;
+    }
+
+    if (*buffer == NULL) {
+        *buffer = alloc_io_buffer(COPY_CHUNK);
+        if (*buffer == NULL) {
+            return -1;
+        }
+    }
+    size_t size = ((len + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(host_fd, *buffer + done, len - done, host_off + done);
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    memset(*buffer + len, 0, size - len);
+    if (write_blocks(first_block, *buffer, size) != (ssize_t)size) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Importe un fichier de l'hôte dans l'image.
+ *
+ * La taille étant connue d'avance, les blocs sont réservés par suites
+ * contiguës (allocate_run) puis remplis par transferts de COPY_CHUNK octets.
+ * Les permissions du propriétaire et la date de modification sont reprises
+ * du fichier hôte.
+ *
+ * @param hostpath Chemin du fichier sur l'hôte.
+ * @param name Nom du fichier à créer dans l'image.
+ * @param dir_inode Inode du répertoire de destination.
+ * @return L'inode du fichier créé, ou -1 en cas d'erreur.
+ */
+int import_file(const char *hostpath, const char *name, int dir_inode) {
+    int host_fd = open(hostpath, O_RDONLY);
+    struct stat st;
+    if (host_fd == -1 || fstat(host_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        fprintf(fs.log, "\nErreur sur l'import de %s\n", hostpath);
+        printf("Erreur : impossible de lire le fichier hôte '%s'.\n", hostpath);
+        if (host_fd != -1) {
+            close(host_fd);
+        }
+        return -1;
+    }
+
+    // Vérifier que le fichier tient dans l'image avant de créer quoi que ce soit
+    int nb_blocks = (st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (st.st_size > (off_t)NUM_BLOCKS * BLOCK_SIZE || nb_blocks > count_free_blocks() - delayed_blocks + 1) {
+        fprintf(fs.log, "\nErreur sur l'import de %s\n", hostpath);
+        printf("Erreur : pas assez d'espace pour importer '%s' (%lld octets).\n", hostpath, (long long)st.st_size);
+        close(host_fd);
+        return -1;
+    }
+
+    char permissions[4] = "---";
+    if (st.st_mode & S_IRUSR) permissions[0] = 'r';
+    if (st.st_mode & S_IWUSR) permissions[1] = 'w';
+    if (st.st_mode & S_IXUSR) permissions[2] = 'x';
+
+    int inode_index = create_file(name, permissions, dir_inode);
+    if (inode_index == -1) {
+        close(host_fd);
+        return -1;
+    }
+    Inode *inode = &fs.inodes[inode_index];
+
+    char *buffer = NULL;
+    int erreur = 0;
+    if (nb_blocks > 0) {
+        free_block(inode->blocks[0]);  // Bloc initial de create_file : on réserve des suites contiguës
+        inode->blocks[0] = -1;
+
+        int i = 0;
+        while (i < nb_blocks && !erreur) {
+            int want = nb_blocks - i;
+            if (want > COPY_CHUNK / BLOCK_SIZE) {
+                want = COPY_CHUNK / BLOCK_SIZE;
+            }
+            int length;
+            int first = allocate_run(want, &length, inode_index, block_goal(inode_index, i));
+            if (first == -1) {
+                erreur = 1;
+                break;
+            }
+            for (int k = 0; k < length; k++) {
+                inode->blocks[i + k] = first + k;
+            }
+            off_t off = (off_t)i * BLOCK_SIZE;
+            size_t len = (size_t)length * BLOCK_SIZE;
+            if (off + (off_t)len > st.st_size) {
+                len = st.st_size - off;
+            }
+            if (import_run(host_fd, off, first, len, &buffer) == -1) {
+                erreur = 1;
+            }
+            i += length;
+        }
+    }
+    free(buffer);
+    close(host_fd);
+
+    if (erreur) {
+        fprintf(fs.log, "\nErreur sur l'import de %s\n", hostpath);
+        printf("Erreur : échec de l'import de '%s'.\n", hostpath);
+        delete_file((char *)name, dir_inode);
+        return -1;
+    }
+
+    inode->size = st.st_size;
+    inode->modification_time = st.st_mtime;
+    update_parent_sizes(inode_index, inode->size);
+    fprintf(fs.log, "\nImport de %s vers l'inode %d : %lld octets, %d blocs\n", hostpath, inode_index, (long long)st.st_size, nb_blocks);
+    return inode_index;
+}
+
+/**
+ * @brief Importe récursivement un répertoire de l'hôte dans l'image.
+ *
+ * Seuls les fichiers réguliers et les répertoires sont importés ; les autres
+ * entrées (liens, périphériques...) sont ignorées et signalées dans le log.
+ *
+ * @param hostpath Chemin du répertoire sur l'hôte.
+ * @param name Nom du répertoire à créer dans l'image.
+ * @param dir_inode Inode du répertoire de destination.
+ * @return L'inode du répertoire créé, ou -1 en cas d'erreur.
+ */
+int import_tree(const char *hostpath, const char *name, int dir_inode) {
+    DIR *host_dir = opendir(hostpath);
+    if (host_dir == NULL) {
+        fprintf(fs.log, "\nErreur sur l'import de %s\n", hostpath);
+        printf("Erreur : impossible d'ouvrir le répertoire hôte '%s'.\n", hostpath);
+        return -1;
+    }
+
+    int new_dir = create_directory(name, dir_inode);
+    if (new_dir == -1) {
+        closedir(host_dir);
+        return -1;
+    }
+
+    int resultat = new_dir;
+    struct dirent *entree;
+    while ((entree = readdir(host_dir)) != NULL) {
+        if (strcmp(entree->d_name, ".") == 0 || strcmp(entree->d_name, "..") == 0) {
+            continue;
+        }
+        char chemin[4096];
+        snprintf(chemin, sizeof(chemin), "%s/%s", hostpath, entree->d_name);
+        struct stat st;
+        if (strlen(entree->d_name) >= MAX_FILE_NAME || lstat(chemin, &st) == -1) {
+            fprintf(fs.log, "\nImport de %s ignoré\n", chemin);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (import_tree(chemin, entree->d_name, new_dir) == -1) {
+                resultat = -1;
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            if (import_file(chemin, entree->d_name, new_dir) == -1) {
+                resultat = -1;
+            }
+        } else {
+            fprintf(fs.log, "\nImport de %s ignoré : ni fichier ni répertoire\n", chemin);
+        }
+    }
+    closedir(host_dir);
+    return resultat;
+}
+
+/**
+ * @brief Détermine le répertoire et le nom de destination d'un import.
+ *
+ * Si imagepath désigne un répertoire existant, l'entrée y est créée sous le
+ * nom de base de hostpath ; sinon le dernier composant de imagepath donne le
+ * nom et ce qui précède le répertoire.
+ *
+ * @param hostpath Chemin source sur l'hôte.
+ * @param imagepath Chemin de destination dans l'image.
+ * @param current_dir Inode du répertoire courant.
+ * @param name Reçoit le nom à créer (MAX_FILE_NAME octets).
+ * @return L'inode du répertoire de destination, ou -1 si le chemin est invalide.
+ */
+int resolve_import_target(const char *hostpath, const char *imagepath, int current_dir, char *name) {
+    char parent[1024];
+    strncpy(parent, imagepath, sizeof(parent) - 1);
+    parent[sizeof(parent) - 1] = '\0';
+
+    int dir = current_dir;
+    char *base = strrchr(parent, '/');
+    if (base != NULL) {
+        *base++ = '\0';
+        dir = get_inode_from_path(parent[0] == '\0' ? "/" : parent, current_dir);
+    } else {
+        base = parent;
+    }
+    if (dir == -1 || fs.inodes[dir].type != 0) {
+        printf("Erreur : répertoire cible invalide.\n");
+        return -1;
+    }
+
+    if (base[0] != '\0' && strcmp(base, ".") != 0 && strcmp(base, "..") != 0) {
+        int existant = rechInode(base, dir_of(dir));
+        if (existant == -1 || fs.inodes[existant].type != 0) {
+            strncpy(name, base, MAX_FILE_NAME - 1);
+            name[MAX_FILE_NAME - 1] = '\0';
+            return dir;
+        }
+        dir = existant;
+    } else if (strcmp(base, "..") == 0) {
+        dir = fs.inodes[dir].inode_rep_parent;
+    }
+
+    // Destination = répertoire existant : garder le nom de base du chemin hôte
+    char host[1024];
+    strncpy(host, hostpath, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    size_t len = strlen(host);
+    while (len > 1 && host[len - 1] == '/') {
+        host[--len] = '\0';
+    }
+    char *host_base = strrchr(host, '/');
+    strncpy(name, host_base ? host_base + 1 : host, MAX_FILE_NAME - 1);
+    name[MAX_FILE_NAME - 1] = '\0';
+    return dir;
+}
+
+
+
+/**
+ * @brief Transfère une suite de blocs contigus de l'image vers un fichier hôte.
+ *
+ * On essaie d'abord copy_file_range (kernel_copy), puis sendfile (plus
+ * ancien, accepte deux systèmes de fichiers différents), et en dernier
+ * recours un tampon de COPY_CHUNK octets. Le repli est décidé à chaque
+ * appel : les ouvriers de copy_threads exportent en parallèle.
+ *
+ * @param first_block Premier bloc source.
+ * @param len Nombre d'octets à transférer (au plus COPY_CHUNK).
+ * @param host_fd Descripteur du fichier hôte.
+ * @param host_off Position d'écriture dans le fichier hôte.
+ * @param buffer Tampon de repli, alloué à la demande et libéré par l'appelant.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int export_run(int first_block, size_t len, int host_fd, off_t host_off, char **buffer) {
+    fflush(fs.file);
+    int fd = fileno(fs.file);
+    int copie = kernel_copy(fd, BLOCK_OFFSET(first_block), host_fd, host_off, len);
+    if (copie != 1) {
+        return copie;
+    }
+
+    off_t off_in = BLOCK_OFFSET(first_block);
+    size_t sent = 0;
+    if (lseek(host_fd, host_off, SEEK_SET) == -1) {
+        return -1;
+    }
+    while (sent < len) {
+        ssize_t n = sendfile(host_fd, fd, &off_in, len - sent);
+        if (n == -1 && errno != ENOSYS && errno != EINVAL) {
+            return -1;
+        }
+        if (n <= 0) {
+            break;  // Indisponible ici, ou source plus courte : le tampon tranchera
+        }
+        sent += n;
+    }
+    if (sent == len) {
+        return 0;
+    }
+
+    if (*buffer == NULL) {
+        *buffer = alloc_io_buffer(COPY_CHUNK);
+        if (*buffer == NULL) {
+            return -1;
+        }
+    }
+    size_t size = ((len + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+    if (read_blocks(first_block, *buffer, size) != (ssize_t)size) {
+        return -1;
+    }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(host_fd, *buffer + done, len - done, host_off + done);
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Convertit les permissions d'un inode en mode POSIX (bits du propriétaire).
+ *
+ * @param inode_index L'inode concerné.
+ * @return Le mode à appliquer au fichier hôte.
+ */
+mode_t host_mode(int inode_index) {
+    mode_t mode = 0;
+    if (fs.inodes[inode_index].permissions[0] == 'r') mode |= S_IRUSR;
+    if (fs.inodes[inode_index].permissions[1] == 'w') mode |= S_IWUSR;
+    if (fs.inodes[inode_index].permissions[2] == 'x') mode |= S_IXUSR;
+    return mode;
+}
+
+/**
+ * @brief Exporte un fichier (ou un lien symbolique) de l'image vers l'hôte.
+ *
+ * Le contenu est transféré par suites de blocs physiquement contigus, sans
+ * jamais charger le fichier en mémoire ; les blocs jamais écrits restent des
+ * trous dans le fichier hôte. Permissions et date de modification sont
+ * reportées sur le fichier hôte.
+ *
+ * @param inode_index Inode à exporter.
+ * @param hostpath Chemin du fichier à créer sur l'hôte (remplacé s'il existe).
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int export_file(int inode_index, const char *hostpath) {
+    Inode *inode = &fs.inodes[inode_index];
+
+    if (!has_permission(inode_index, 'r')) {
+        fprintf(fs.log, "\nErreur sur l'export de l'inode %d\n", inode_index);
+        printf("Erreur : pas de permission de lecture sur l'inode %d.\n", inode_index);
+        return -1;
+    }
+    flush_delayed(inode_index);  // Les suites de blocs sont exportées telles quelles
+
+    struct timespec dates[2];
+    dates[0].tv_sec = time(NULL);
+    dates[0].tv_nsec = 0;
+    dates[1].tv_sec = inode->modification_time;
+    dates[1].tv_nsec = 0;
+
+    if (inode->type == 2) {
+        // Lien symbolique : la cible est stockée dans le premier bloc
+        char cible[BLOCK_SIZE + 1];
+        read_blocks(inode->blocks[0], cible, BLOCK_SIZE);
+        cible[BLOCK_SIZE] = '\0';
+        unlink(hostpath);
+        if (symlink(cible, hostpath) == -1) {
+            fprintf(fs.log, "\nErreur sur l'export de %s\n", hostpath);
+            printf("Erreur : impossible de créer le lien '%s' sur l'hôte.\n", hostpath);
+            return -1;
+        }
+        utimensat(AT_FDCWD, hostpath, dates, AT_SYMLINK_NOFOLLOW);
+        return 0;
+    }
+
+    int host_fd = open(hostpath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (host_fd == -1) {
+        fprintf(fs.log, "\nErreur sur l'export de %s\n", hostpath);
+        printf("Erreur : impossible de créer le fichier hôte '%s'.\n", hostpath);
+        return -1;
+    }
+
+    char *buffer = NULL;
+    int erreur = 0;
+    int nb_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int i = 0;
+    while (i < nb_blocks && !erreur) {
+        if (inode->blocks[i] == -1) {
+            i++;  // Trou : rien à écrire
+            continue;
+        }
+        // Étendre la suite tant que les blocs physiques se suivent
+        int length = 1;
+        while (i + length < nb_blocks && length < COPY_CHUNK / BLOCK_SIZE &&
+               inode->blocks[i + length] == inode->blocks[i] + length) {
+            length++;
+        }
+        off_t off = (off_t)i * BLOCK_SIZE;
+        size_t len = (size_t)length * BLOCK_SIZE;
+        if (off + (off_t)len > inode->size) {
+            len = inode->size - off;
+        }
+        if (export_run(inode->blocks[i], len, host_fd, off, &buffer) == -1) {
+            erreur = 1;
+        }
+        i += length;
+    }
+    free(buffer);
+
+    if (!erreur && ftruncate(host_fd, inode->size) == -1) {
+        erreur = 1;
+    }
+    if (!erreur) {
+        fchmod(host_fd, host_mode(inode_index));
+        futimens(host_fd, dates);
+    }
+    close(host_fd);
+
+    if (erreur) {
+        fprintf(fs.log, "\nErreur sur l'export de %s\n", hostpath);
+        printf("Erreur : échec de l'export vers '%s'.\n", hostpath);
+        return -1;
+    }
+    fprintf(fs.log, "\nExport de l'inode %d vers %s : %d octets\n", inode_index, hostpath, inode->size);
+    return 0;
+}
+
+/**
+ * @brief Contexte d'un export d'arborescence : répertoires hôtes créés par chaque ouvrier.
+ */
+typedef struct {
+    PathList dirs[POOL_MAX_WORKERS];  /**< Répertoires dont le mode et la date restent à fixer */
+    int echecs;                       /**< Entrées qui n'ont pas pu être exportées */
+} ExportWalk;
+
+/**
+ * @brief Crée sur l'hôte le répertoire correspondant à un répertoire de l'image.
+ *
+ * @return 0 si succès, -1 si le répertoire est illisible ou ne peut pas être créé.
+ */
+int export_dir(int dir_inode, const char *hostpath) {
+    if (!has_permission(dir_inode, 'r')) {
+        fprintf(fs.log, "\nErreur sur l'export de l'inode %d\n", dir_inode);
+        printf("Erreur : pas de permission de lecture sur le répertoire d'inode %d.\n", dir_inode);
+        return -1;
+    }
+    if (mkdir(hostpath, S_IRWXU) == -1 && errno != EEXIST) {
+        fprintf(fs.log, "\nErreur sur l'export de %s\n", hostpath);
+        printf("Erreur : impossible de créer le répertoire hôte '%s'.\n", hostpath);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Tâche d'export : exporte les fichiers d'un répertoire, crée ses sous-répertoires.
+ */
+int export_visit(TaskPool *pool, int worker, Task task) {
+    ExportWalk *export = pool->arg;
+    Directory *dir = malloc(sizeof(Directory));
+    if (!dir) {
+        return -1;
+    }
+    dir_snapshot(task.inode, dir);
+    int status = 0;
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES && status == 0; i++) {
+        int child = dir->entries[i].inode_index;
+        if (child == -1) {
+            continue;
+        }
+        char chemin[4096];
+        join_path(chemin, sizeof(chemin), task.path, dir->entries[i].filename);
+        if (fs.inodes[child].type != 0) {
+            if (export_file(child, chemin) == -1) {
+                __atomic_add_fetch(&export->echecs, 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+        if (export_dir(child, chemin) == -1) {
+            __atomic_add_fetch(&export->echecs, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        char *copie = strdup(chemin);
+        if (copie == NULL || path_list_add(&export->dirs[worker], chemin, child) == -1) {
+            free(copie);
+            status = -1;
+            continue;
+        }
+        pool_push(pool, worker, (Task){child, 0, copie});
+    }
+    free(dir);
+    return status;
+}
+
+/**
+ * @brief Exporte récursivement un répertoire de l'image vers l'hôte.
+ *
+ * Les répertoires sont répartis entre copy_threads ouvriers (pool_run). Les
+ * permissions et la date des répertoires hôtes ne sont fixées qu'à la fin du
+ * parcours, pour qu'un répertoire sans 'w' puisse tout de même être rempli.
+ *
+ * @param dir_inode Inode du répertoire à exporter.
+ * @param hostpath Chemin du répertoire à créer sur l'hôte.
+ * @return 0 si succès, -1 si au moins une entrée n'a pas pu être exportée.
+ */
+int export_tree(int dir_inode, const char *hostpath) {
+    ExportWalk *export = calloc(1, sizeof(ExportWalk));
+    char *racine = strdup(hostpath);
+    if (!export || !racine || export_dir(dir_inode, hostpath) == -1 ||
+        path_list_add(&export->dirs[0], hostpath, dir_inode) == -1) {
+        if (export) {
+            path_list_free(&export->dirs[0]);
+        }
+        free(export);
+        free(racine);
+        return -1;
+    }
+
+    int resultat = pool_run(export_visit, export, (Task){dir_inode, 0, racine}, copy_threads);
+    if (export->echecs > 0) {
+        resultat = -1;
+    }
+
+    for (int k = 0; k < POOL_MAX_WORKERS; k++) {
+        PathList *dirs = &export->dirs[k];
+        for (int i = 0; i < dirs->nb; i++) {
+            struct timespec dates[2];
+            dates[0].tv_sec = time(NULL);
+            dates[0].tv_nsec = 0;
+            dates[1].tv_sec = fs.inodes[dirs->inodes[i]].modification_time;
+            dates[1].tv_nsec = 0;
+            chmod(dirs->paths[i], host_mode(dirs->inodes[i]));
+            utimensat(AT_FDCWD, dirs->paths[i], dates, 0);
+        }
+        path_list_free(dirs);
+    }
+    free(export);
+    return resultat;
+}
+
+
+
+/**
+ * @brief Retrouve l'inode désigné par un lien symbolique (en suivant les liens en chaîne).
+ *
+ * @param inode_index Inode du lien (ou de tout autre fichier, renvoyé tel quel).
+ * @return L'inode final, ou -1 si la cible n'existe pas ou si la chaîne est trop longue.
+ */
+int resolve_symlink(int inode_index) {
+    int profondeur = 0;
+    while (inode_index != -1 && fs.inodes[inode_index].type == 2) {
+        if (++profondeur > 8) {
+            printf("Erreur : trop de liens symboliques en chaîne.\n");
+            return -1;
+        }
+        char cible[BLOCK_SIZE + 1];
+        read_blocks(fs.inodes[inode_index].blocks[0], cible, BLOCK_SIZE);
+        cible[BLOCK_SIZE] = '\0';
+        // Un chemin relatif part du répertoire qui contient le lien
+        inode_index = get_inode_from_path(cible, fs.inodes[inode_index].inode_rep_parent);
+    }
+    return inode_index;
+}
+
+/**
+ * @brief Écrit tous les octets d'un tampon sur un descripteur hôte.
+ *
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int write_all(int out_fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(out_fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#define SERVE_CHUNK (64 * 1024)     /**< Taille maximale des données d'une trame de sortie */
+#define SERVE_MAX_REQUEST 4096      /**< Taille maximale des données d'une requête */
+#define SERVE_MAX_SESSIONS 256      /**< Clients connectés en même temps au serveur */
+#define SERVE_TIMEOUT 5             /**< Délai (s) pour recevoir une requête commencée ou envoyer une trame */
+
+/**
+ * @brief Opérations du protocole du serveur (option --serve).
+ */
+enum {
+    SERVE_COMMAND = 1,  /**< Requête : ligne de commande du shell. Réponse : SERVE_OUTPUT... puis SERVE_DONE */
+    SERVE_LOOKUP,       /**< Requête : chemin. Réponse : SERVE_DONE, status = inode ou -1 */
+    SERVE_STAT,         /**< Requête : chemin. Réponse : SERVE_DONE suivi d'un ServeStat, status = inode ou -1 */
+    SERVE_OPEN,         /**< Requête : chemin. Réponse : SERVE_DONE, status = descripteur de la session ou -1 */
+    SERVE_READ,         /**< Requête : ServeRead. Réponse : SERVE_DONE suivi des octets lus, status = leur nombre ou -1 */
+    SERVE_CLOSE,        /**< Requête : descripteur (int32). Réponse : SERVE_DONE, status = 0 ou -1 */
+    SERVE_OUTPUT = 16,  /**< Réponse : morceau de la sortie de la commande */
+    SERVE_DONE          /**< Réponse : fin de la requête, status = code de retour */
+};
+
+#define SERVE_PROMPT 1  /**< Drapeau d'une requête SERVE_COMMAND : renvoyer l'invite après la sortie */
+
+/**
+ * @brief En-tête de chaque trame échangée avec le serveur, suivi de length octets.
+ *
+ * Les entiers sont dans l'ordre de la machine : client et serveur partagent
+ * une socket locale.
+ */
+typedef struct {
+    uint32_t length;  /**< Octets de données après l'en-tête */
+    uint16_t op;      /**< Opération (SERVE_*) */
+    uint16_t flags;   /**< SERVE_PROMPT */
+    int32_t status;   /**< Réponse : code de retour ou inode */
+} ServeHeader;
+
+/**
+ * @brief Réponse à SERVE_STAT.
+ */
+typedef struct {
+    int32_t inode;
+    int32_t type;
+    int32_t size;
+    int32_t link_count;
+    int64_t creation_time;
+    int64_t modification_time;
+    char permissions[4];
+} ServeStat;
+
+/**
+ * @brief Requête SERVE_READ : lit à la position courante du descripteur, qui avance d'autant.
+ */
+typedef struct {
+    int32_t desc;     /**< Descripteur rendu par SERVE_OPEN */
+    uint32_t length;  /**< Octets demandés (SERVE_CHUNK au plus) */
+} ServeRead;
+
+/**
+ * @brief Envoie tous les octets d'un tampon sur une socket, sans SIGPIPE si le client est parti.
+ *
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int send_all(int fd, const void *buf, size_t len, int flags) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, flags | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reçoit exactement len octets d'une socket.
+ *
+ * @return 0 si succès, -1 si la connexion est fermée ou en erreur.
+ */
+int recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Envoie une trame (en-tête puis données).
+ *
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int serve_send(int fd, uint16_t op, uint16_t flags, int32_t status, const void *data, uint32_t length) {
+    ServeHeader h = {length, op, flags, status};
+    if (send_all(fd, &h, sizeof(h), length > 0 ? MSG_MORE : 0) == -1) {
+        return -1;
+    }
+    return length > 0 ? send_all(fd, data, length, 0) : 0;
+}
+
+/**
+ * @brief Envoie au client la sortie accumulée par la requête en cours.
+ */
+void session_flush() {
+    if (session_out_len > 0) {
+        // Un client parti ne doit pas interrompre la commande : sa sortie est perdue
+        if (session_send_lock) {
+            pthread_mutex_lock(session_send_lock);
+        }
+        serve_send(session_fd, SERVE_OUTPUT, 0, 0, session_out, session_out_len);
+        if (session_send_lock) {
+            pthread_mutex_unlock(session_send_lock);
+        }
+        session_out_len = 0;
+    }
+}
+
+/**
+ * @brief Fait écrire ce thread chez un client déjà servi par un autre (ouvrier d'un parcours).
+ *
+ * @param fd Socket du client.
+ * @param lock Verrou partagé par tous les threads qui écrivent chez ce client.
+ * @return 0 si succès, -1 si la mémoire manque (la sortie reste alors locale).
+ */
+int session_join(int fd, pthread_mutex_t *lock) {
+    session_out = malloc(SERVE_CHUNK);
+    if (session_out == NULL) {
+        return -1;
+    }
+    session_out_len = 0;
+    session_fd = fd;
+    session_send_lock = lock;
+    return 0;
+}
+
+/**
+ * @brief Envoie ce qui reste de la sortie d'un thread entré par session_join.
+ */
+void session_leave() {
+    if (session_fd == -1) {
+        return;
+    }
+    session_flush();
+    free(session_out);
+    session_out = NULL;
+    session_fd = -1;
+    session_send_lock = NULL;
+}
+
+/**
+ * @brief Ajoute des octets à la sortie de la requête en cours, par trames de SERVE_CHUNK.
+ */
+void session_write(const char *buf, size_t len) {
+    while (len > 0) {
+        size_t n = SERVE_CHUNK - session_out_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(session_out + session_out_len, buf, n);
+        session_out_len += n;
+        buf += n;
+        len -= n;
+        if (session_out_len == SERVE_CHUNK) {
+            session_flush();
+        }
+    }
+}
+
+/**
+ * @brief Écriture de stdout en mode serveur : chaque thread écrit chez son client.
+ *
+ * stdout est sans tampon, chaque printf arrive donc ici dans le thread qui
+ * l'a appelé. Hors requête (récupérateur, messages du serveur), la sortie va
+ * sur la vraie sortie standard.
+ */
+ssize_t session_stdout_write(void *cookie, const char *buf, size_t size) {
+    (void)cookie;
+    if (session_fd != -1) {
+        session_write(buf, size);
+    } else {
+        write_all(STDOUT_FILENO, buf, size);
+    }
+    return size;
+}
+
+/**
+ * @brief Écrit la sortie d'une commande sur out_fd, ou chez le client si out_fd est la sortie standard d'une requête.
+ *
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int output_all(int out_fd, const char *buf, size_t len) {
+    if (out_fd == STDOUT_FILENO && session_fd != -1) {
+        session_write(buf, len);
+        return 0;
+    }
+    return write_all(out_fd, buf, len);
+}
+
+/**
+ * @brief Envoie le contenu d'un fichier de l'image sur un descripteur hôte (cat).
+ *
+ * Le fichier est parcouru par suites de blocs physiquement contigus. Si la
+ * sortie est un tube, les données y sont poussées par splice sans passer par
+ * l'espace utilisateur ; sinon elles transitent par un tampon fixe de
+ * COPY_CHUNK octets. La mémoire utilisée ne dépend donc pas de la taille du
+ * fichier, les premiers octets partent dès la première suite lue, et le
+ * contenu est transmis tel quel (octets nuls compris).
+ *
+ * @param inode_index Inode du fichier à afficher.
+ * @param out_fd Descripteur de sortie (STDOUT_FILENO pour le shell).
+ * @return Le nombre d'octets envoyés, ou -1 en cas d'erreur.
+ */
+long stream_file_locked(int inode_index, int out_fd) {
+    Inode *inode = &fs.inodes[inode_index];
+    if (!has_permission(inode_index, 'r')) {
+        fprintf(fs.log, "\nErreur sur la lecture de l'inode %d\n", inode_index);
+        printf("Erreur : permission de lecture refusée pour cet inode.\n");
+        return -1;
+    }
+    flush_delayed(inode_index);  // Les suites de blocs sont envoyées telles quelles
+
+    struct stat st;
+    int client = out_fd == STDOUT_FILENO && session_fd != -1;  // Sortie renvoyée au client par trames
+    int tube = !client && fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    char *buffer = NULL;
+    int erreur = 0;
+    long envoye = 0;
+
+    fflush(stdout);
+    fflush(fs.file);
+    int nb_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int i = 0;
+    while (i < nb_blocks && !erreur) {
+        // Étendre la suite tant que les blocs physiques se suivent (ou tant qu'on est dans un trou)
+        int first = inode->blocks[i];
+        int length = 1;
+        while (i + length < nb_blocks && length < COPY_CHUNK / BLOCK_SIZE &&
+               (first == -1 ? inode->blocks[i + length] == -1 : inode->blocks[i + length] == first + length)) {
+            length++;
+        }
+        size_t len = (size_t)length * BLOCK_SIZE;
+        if ((long)i * BLOCK_SIZE + (long)len > inode->size) {
+            len = inode->size - (long)i * BLOCK_SIZE;
+        }
+
+        if (tube && first != -1) {
+            loff_t off = BLOCK_OFFSET(first);
+            size_t done = 0;
+            while (done < len) {
+                ssize_t n = splice(fileno(fs.file), &off, out_fd, NULL, len - done, SPLICE_F_MORE);
+                if (n <= 0) {
+                    break;
+                }
+                done += n;
+            }
+            if (done == len) {
+                envoye += len;
+                i += length;
+                continue;
+            }
+            if (done > 0 || (errno != EINVAL && errno != ENOSYS)) {
+                erreur = 1;
+                break;
+            }
+            tube = 0;  // splice refusé : on repasse par le tampon
+        }
+
+        if (buffer == NULL && (buffer = alloc_io_buffer(COPY_CHUNK)) == NULL) {
+            erreur = 1;
+            break;
+        }
+        if (first == -1) {
+            memset(buffer, 0, len);  // Trou dans le fichier : lu comme des zéros
+        } else if (read_blocks(first, buffer, (size_t)length * BLOCK_SIZE) != (ssize_t)length * BLOCK_SIZE) {
+            erreur = 1;
+            break;
+        }
+        if (output_all(out_fd, buffer, len) == -1) {
+            erreur = 1;
+            break;
+        }
+        envoye += len;
+        i += length;
+    }
+    free(buffer);
+
+    if (erreur) {
+        fprintf(fs.log, "\nErreur sur la lecture de l'inode %d après %ld octets\n", inode_index, envoye);
+        return -1;
+    }
+    fprintf(fs.log, "\nLecture de l'inode %d : %ld octets envoyés\n", inode_index, envoye);
+    return envoye;
+}
+
+/**
+ * @brief Envoie le contenu d'un fichier (voir stream_file_locked) sous le verrou en lecture de son inode.
+ */
+long stream_file(int inode_index, int out_fd) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, inode_index, 0);
+    inode_locks_acquire(&verrous);
+    long envoye = stream_file_locked(inode_index, out_fd);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return envoye;
+}
+
+
+
+/**
+ * @brief Crée un lien dur vers un fichier existant.
+ *
+ * @param link_name Nom du nouveau lien dur.
+ * @param filename Nom du fichier source.
+ * @param inode_dir_source Inode du répertoire contenant le fichier source.
+ * @param inode_dir_target Inode du répertoire cible où sera créé le lien dur.
+ * @return 0 en cas de succès, -1 en cas d'erreur.
+ */
+int create_hard_link_locked(const char *link_name, char *filename, int inode_dir_source, int inode_dir_target) {
+    if (check_entry_name(link_name) == -1) {
+        return -1;
+    }
+    // Répertoire source et cible
+    Directory *dir_source = dir_of(inode_dir_source);
+    Directory *dir_target = dir_of(inode_dir_target);
+    int inode_index = rechInode(filename, dir_source);
+
+    // Vérifier si le fichier existe
+    if(inode_index == -1){
+        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
+        printf("Erreur: Fichier inexistant.\n");
+        return -1;
+    }
+
+    // Vérifier au cas où un fichier du nom du lien existe dans la cible
+    int exist_target_inode = rechInode(link_name, dir_target);
+    if(exist_target_inode != -1){
+        printf("Erreur : Un fichier de ce nom existe déjà dans le répertoire.\n");
+        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
+        return -1;
+    }
+
+    // Chercher une entrée libre dans le répertoire
+    int index = rechEntree(inode_dir_target);
+    if (index == -1){
+        printf("Erreur: Pas d'espace libre dans le répertoire.\n");
+        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
+        return -1;
+    }
+
+    if (unshare_inode(inode_index) == -1 || unshare_dir(inode_dir_target) == -1) {
+        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
+        return -1;
+    }
+
+    // Ajouter le lien dans le répertoire cible
+    strncpy(dir_target->entries[index].filename, link_name, MAX_FILE_NAME);
+    dir_target->entries[index].inode_index = inode_index;
+    mark_dir(inode_dir_target);
+    fs.inodes[inode_index].link_count++;  // Incrémenter le nombre de liens
+    printf("Lien dur '%s' créé pour le fichier '%s'.\n", link_name, filename);
+    fprintf(fs.log, "\nLien dur '%s' créé pour le fichier '%s'.\n", link_name, filename);
+    return 0;
+    
+}
+
+/**
+ * @brief Crée un lien dur (voir create_hard_link_locked) sous les verrous des deux répertoires et du fichier.
+ */
+int create_hard_link(const char *link_name, char *filename, int inode_dir_source, int inode_dir_target) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, inode_dir_source, 0);
+    inode_locks_add(&verrous, inode_dir_target, 1);
+    inode_locks_entry(&verrous, inode_dir_source, filename, 1);
+    int resultat = create_hard_link_locked(link_name, filename, inode_dir_source, inode_dir_target);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return resultat;
+}
+
+
+/**
+ * @brief Déplace un fichier d'un répertoire source vers un répertoire cible.
+ *
+ * @param filename Nom du fichier à déplacer.
+ * @param inode_dir_source Inode du répertoire source.
+ * @param inode_dir_target Inode du répertoire cible.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int move_file_locked(char *filename, int inode_dir_source, int inode_dir_target) {
+    Directory *dir_source = dir_of(inode_dir_source);
+    Directory *dir_target = dir_of(inode_dir_target);
+
+    // Vérifier si le fichier existe
+    int inode_index = rechInode(filename, dir_source);
+    int status = -1;
+    if(inode_index == -1){
+        fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
+        printf("Erreur: Fichier inexistant.\n");
+    } else {
+         // Vérifier la permission 'w' sur le répertoire source (on va enlever l'entrée)
+        if (!has_permission(inode_dir_source, 'w')) {
+            printf("Erreur : pas de permission d'écriture dans le répertoire source (inode %d).\n", inode_dir_source);
+            fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
+            return -1;
+        }
+
+        // Vérifier si aucun fichier du même nom existe dans le répertoire cible
+        int exist_target_inode = rechInode(filename, dir_target);
+        if(exist_target_inode != -1){
+            printf("Erreur : Un fichier de ce nom existe déjà dans le répertoire.\n");
+            fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
+        } else {
+            if (!has_permission(inode_dir_target, 'w')) {
+                printf("Erreur : pas de permission d'écriture dans le répertoire cible (inode %d).\n", inode_dir_target);
+                fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
+                return -1;
+            }
+        
+
+            Inode *inode = &fs.inodes[inode_index];
+            
+            // Chercher une entrée libre dans le répertoire
+            int index = rechEntree(inode_dir_target);
+            if (index == -1){
+                printf("Erreur: Pas d'espace libre dans le répertoire cible.\n");
+                fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
+            } else if (unshare_dir(inode_dir_source) == -1 || unshare_dir(inode_dir_target) == -1) {
+                fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
+            } else {
+
+                
+
+                // Ajouter le fichier au répertoire cible
+                strncpy(dir_target->entries[index].filename, filename, MAX_FILE_NAME);
+                dir_target->entries[index].inode_index = inode_index;
+                mark_dir(inode_dir_target);
+
+                
+
+                // Supprimer l'entrée du répertoire
+                int i = 0;
+                int stop = 0;
+                while (!stop) {
+                    if (dir_source->entries[i].inode_index == inode_index && strcmp(filename, dir_source->entries[i].filename) == 0) {
+                        dir_source->entries[i].inode_index = -1;
+                        mark_dir(inode_dir_source);
+                        memset(dir_source->entries[i].filename, 0, MAX_FILE_NAME);
+                        stop = 1;
+                    }
+                    i++;
+                }
+                
+                inode->modification_time = time(NULL);  // Mettre à jour le temps de modification
+
+                printf("Fichier déplacé de répertoire %d à répertoire %d.\n", inode_dir_source, inode_dir_target);
+                fprintf(fs.log, "\nFichier déplacé de répertoire %d à répertoire %d\n", inode_dir_source, inode_dir_target);
+                status = 0;
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief Déplace un fichier (voir move_file_locked) sous les verrous des deux répertoires et du fichier.
+ */
+int move_file(char *filename, int inode_dir_source, int inode_dir_target) {
+    int pris = op_begin(0);
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, inode_dir_source, 1);
+    inode_locks_add(&verrous, inode_dir_target, 1);
+    inode_locks_entry(&verrous, inode_dir_source, filename, 1);
+    int status = move_file_locked(filename, inode_dir_source, inode_dir_target);
+    inode_locks_release(&verrous);
+    op_end(pris);
+    return status;
+}
+
+
+
+
+
+
+
+
+/**
+ * @brief Écrit tout un tampon à une position donnée de l'image.
+ *
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int write_image(const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    fflush(fs.file);
+    while (len > 0) {
+        ssize_t n = pwrite(fileno(fs.file), p, len, offset);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Signale aux autres processus que les métadonnées de l'image ont changé.
+ *
+ * Appelé, sous verrou exclusif, après chaque écriture dans le journal ou les
+ * tables : les autres sessions rechargeront leur copie avant leur prochaine
+ * commande (revalidate_metadata).
+ */
+void publish_generation() {
+    meta_generation++;
+    write_image(&meta_generation, sizeof(meta_generation), GENERATION_OFFSET);
+}
+
+
+/**
+ * @brief Ajoute des octets au tampon d'enregistrements du journal.
+ */
+void journal_put(const void *data, size_t len) {
+    if (journal_buf_len + len > journal_buf_capacity) {
+        size_t capacity = journal_buf_capacity ? journal_buf_capacity : 4096;
+        while (journal_buf_len + len > capacity) {
+            capacity *= 2;
+        }
+        char *grown = realloc(journal_buf, capacity);
+        if (grown == NULL) {
+            perror("Erreur d'allocation du journal");
+            exit(1);
+        }
+        journal_buf = grown;
+        journal_buf_capacity = capacity;
+    }
+    memcpy(journal_buf + journal_buf_len, data, len);
+    journal_buf_len += len;
+}
+
+void journal_put_u8(uint8_t v)   { journal_put(&v, sizeof(v)); }
+void journal_put_u16(uint16_t v) { journal_put(&v, sizeof(v)); }
+void journal_put_i32(int32_t v)  { journal_put(&v, sizeof(v)); }
+void journal_put_i64(int64_t v)  { journal_put(&v, sizeof(v)); }
+
+/**
+ * @brief Somme de contrôle FNV-1a des enregistrements d'une validation.
+ */
+uint32_t journal_checksum(const char *data, size_t len, uint32_t seq) {
+    uint32_t h = 2166136261u ^ seq;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Encode dans journal_buf les différences entre fs et journal_shadow.
+ *
+ * Les enregistrements suivent un en-tête JournalCommit laissé vide ici.
+ *
+ * Seuls les champs modifiés sont écrits : métadonnées d'un inode, plage de
+ * son tableau de blocs, entrée de répertoire, plage du compteur de blocs,
+ * répertoire courant et liste des orphelins.
+ */
+void journal_encode() {
+    journal_buf_len = sizeof(JournalCommit);  // En-tête de validation, rempli par journal_commit
+
+    for (int i = 0; i < NUM_INODES; i++) {
+        Inode *cur = &fs.inodes[i];
+        Inode *old = &journal_shadow->inodes[i];
+        if (cur->id != old->id || cur->type != old->type || cur->size != old->size ||
+            cur->creation_time != old->creation_time || cur->modification_time != old->modification_time ||
+            memcmp(cur->permissions, old->permissions, 3) != 0 ||
+            cur->link_count != old->link_count || cur->inode_rep_parent != old->inode_rep_parent) {
+            journal_put_u8(J_INODE);
+            journal_put_u16(i);
+            journal_put_i32(cur->id);
+            journal_put_i32(cur->type);
+            journal_put_i32(cur->size);
+            journal_put_i64(cur->creation_time);
+            journal_put_i64(cur->modification_time);
+            journal_put(cur->permissions, 3);
+            journal_put_i32(cur->link_count);
+            journal_put_i32(cur->inode_rep_parent);
+        }
+        if (memcmp(cur->blocks, old->blocks, sizeof(cur->blocks)) != 0) {
+            int first = 0, last = NUM_BLOCKS - 1;
+            while (cur->blocks[first] == old->blocks[first]) first++;
+            while (cur->blocks[last] == old->blocks[last]) last--;
+            journal_put_u8(J_BLOCKS);
+            journal_put_u16(i);
+            journal_put_u16(first);
+            journal_put_u16(last - first + 1);
+            journal_put(&cur->blocks[first], (last - first + 1) * sizeof(int32_t));
+        }
+    }
+
+    for (int d = 0; d < NUM_INODES; d++) {
+        if (!journal_dir_dirty[d]) {
+            continue;
+        }
+        journal_dir_dirty[d] = 0;
+        for (int e = 0; e < NUM_DIRECTORY_ENTRIES; e++) {
+            DirectoryEntry *cur = &fs.directories[d].entries[e];
+            DirectoryEntry *old = &journal_shadow->directories[d].entries[e];
+            if (cur->inode_index != old->inode_index || strncmp(cur->filename, old->filename, MAX_FILE_NAME) != 0) {
+                size_t len = strnlen(cur->filename, MAX_FILE_NAME);
+                journal_put_u8(J_DIRENT);
+                journal_put_u16(d);
+                journal_put_u16(e);
+                journal_put_i32(cur->inode_index);
+                journal_put_u8(len);
+                journal_put(cur->filename, len);
+            }
+        }
+    }
+
+    if (memcmp(fs.free_blocks, journal_shadow->free_blocks, sizeof(fs.free_blocks)) != 0) {
+        int first = 0, last = NUM_BLOCKS - 1;
+        while (fs.free_blocks[first] == journal_shadow->free_blocks[first]) first++;
+        while (fs.free_blocks[last] == journal_shadow->free_blocks[last]) last--;
+        journal_put_u8(J_REFS);
+        journal_put_u16(first);
+        journal_put_u16(last - first + 1);
+        journal_put(&fs.free_blocks[first], (last - first + 1) * sizeof(int32_t));
+    }
+
+    for (int i = 0; i < NUM_INODES; i++) {
+        if (fs.clone_src[i] != journal_shadow->clone_src[i]) {
+            journal_put_u8(J_CLONE);
+            journal_put_u16(i);
+            journal_put_i32(fs.clone_src[i]);
+        }
+    }
+
+    if (fs.current_dir != journal_shadow->current_dir || fs.nb_orphans != journal_shadow->nb_orphans ||
+        memcmp(fs.orphans, journal_shadow->orphans, fs.nb_orphans * sizeof(int)) != 0) {
+        journal_put_u8(J_STATE);
+        journal_put_i32(fs.current_dir);
+        journal_put_i32(fs.nb_orphans);
+        journal_put(fs.orphans, fs.nb_orphans * sizeof(int32_t));
+    }
+}
+
+/**
+ * @brief Applique des enregistrements du journal à un état du système de fichiers.
+ *
+ * Sert à rejouer le journal au montage (cible = fs) et à tenir à jour la
+ * copie journal_shadow. Les éléments touchés sont notés pour le prochain
+ * point de contrôle. Les enregistrements contiennent des valeurs absolues :
+ * les rejouer deux fois ne change rien.
+ *
+ * @param data Les enregistrements.
+ * @param len Leur taille en octets.
+ * @param cible L'état à modifier.
+ * @return 0 si succès, -1 si un enregistrement est invalide.
+ */
+int journal_apply(const char *data, size_t len, Filesystem *cible) {
+    size_t pos = 0;
+#define LIRE(dst, n) do { if (pos + (n) > len) return -1; memcpy((dst), data + pos, (n)); pos += (n); } while (0)
+    while (pos < len) {
+        uint8_t type;
+        uint16_t a, b, c;
+        int32_t v;
+        int64_t t;
+        LIRE(&type, 1);
+        switch (type) {
+            case J_INODE: {
+                LIRE(&a, 2);
+                if (a >= NUM_INODES) return -1;
+                Inode *inode = &cible->inodes[a];
+                LIRE(&v, 4); inode->id = v;
+                LIRE(&v, 4); inode->type = v;
+                LIRE(&v, 4); inode->size = v;
+                LIRE(&t, 8); inode->creation_time = t;
+                LIRE(&t, 8); inode->modification_time = t;
+                LIRE(inode->permissions, 3);
+                LIRE(&v, 4); inode->link_count = v;
+                LIRE(&v, 4); inode->inode_rep_parent = v;
+                ckpt_inode_dirty[a] = 1;
+                break;
+            }
+            case J_BLOCKS:
+                LIRE(&a, 2); LIRE(&b, 2); LIRE(&c, 2);
+                if (a >= NUM_INODES || b + c > NUM_BLOCKS) return -1;
+                LIRE(&cible->inodes[a].blocks[b], c * sizeof(int32_t));
+                ckpt_inode_dirty[a] = 1;
+                break;
+            case J_DIRENT: {
+                uint8_t n;
+                LIRE(&a, 2); LIRE(&b, 2); LIRE(&v, 4); LIRE(&n, 1);
+                // n tient sur un octet : au plus MAX_FILE_NAME, nom alors rangé sans zéro final
+                if (a >= NUM_INODES || b >= NUM_DIRECTORY_ENTRIES) return -1;
+                DirectoryEntry *entry = &cible->directories[a].entries[b];
+                entry->inode_index = v;
+                memset(entry->filename, 0, MAX_FILE_NAME);
+                LIRE(entry->filename, n);
+                ckpt_dir_dirty[a] = 1;
+                break;
+            }
+            case J_REFS:
+                LIRE(&a, 2); LIRE(&b, 2);
+                if (a + b > NUM_BLOCKS) return -1;
+                LIRE(&cible->free_blocks[a], b * sizeof(int32_t));
+                break;
+            case J_STATE:
+                LIRE(&v, 4); cible->current_dir = v;
+                LIRE(&v, 4);
+                if (v < 0 || v > NUM_INODES) return -1;
+                cible->nb_orphans = v;
+                LIRE(cible->orphans, v * sizeof(int32_t));
+                break;
+            case J_CLONE:
+                LIRE(&a, 2); LIRE(&v, 4);
+                if (a >= NUM_INODES || v < -1 || v >= NUM_INODES) return -1;
+                cible->clone_src[a] = v;
+                break;
+            default:
+                return -1;
+        }
+    }
+#undef LIRE
+    return 0;
+}
+
+/**
+ * @brief Écrit en place l'état journal_shadow (parties modifiées seulement) puis vide le journal.
+ *
+ * Tant que le journal n'est pas vidé, il contient tout ce qui est réécrit
+ * ici : une écriture interrompue par un arrêt brutal est réparée au montage
+ * suivant en rejouant le journal.
+ */
+void write_checkpoint() {
+    int nb_inodes = 0, nb_dirs = 0;
+    for (int i = 0; i < NUM_INODES; i++) {
+        if (ckpt_inode_dirty[i]) {
+            write_image(&journal_shadow->inodes[i], sizeof(Inode), offsetof(Filesystem, inodes) + i * sizeof(Inode));
+            ckpt_inode_dirty[i] = 0;
+            nb_inodes++;
+        }
+        if (ckpt_dir_dirty[i]) {
+            write_image(&journal_shadow->directories[i], sizeof(Directory), offsetof(Filesystem, directories) + i * sizeof(Directory));
+            ckpt_dir_dirty[i] = 0;
+            nb_dirs++;
+        }
+    }
+    write_image(journal_shadow->free_blocks, sizeof(fs.free_blocks), offsetof(Filesystem, free_blocks));
+    write_image(&journal_shadow->current_dir, sizeof(int), offsetof(Filesystem, current_dir));
+    write_image(journal_shadow->orphans, sizeof(fs.orphans) + sizeof(int), offsetof(Filesystem, orphans));
+    write_image(journal_shadow->clone_src, sizeof(fs.clone_src), offsetof(Filesystem, clone_src));
+    fdatasync(fileno(fs.file));
+
+    // Nouvelle génération : les enregistrements restés dans la zone sont ignorés au montage
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.generation = ++journal_generation;
+    write_image(&header, sizeof(header), JOURNAL_OFFSET);
+    fdatasync(fileno(fs.file));
+    journal_tail = sizeof(JournalHeader);
+    publish_generation();
+
+    pthread_mutex_lock(&journal_mutex);
+    journal_synced_seq = journal_written_seq;
+    pthread_mutex_unlock(&journal_mutex);
+    limbo_release();
+    fprintf(fs.log, "\nPoint de contrôle : %d inodes, %d répertoires réécrits, journal vidé\n", nb_inodes, nb_dirs);
+}
+
+void journal_open();
+
+/**
+ * @brief Ajoute au journal les modifications faites depuis la dernière validation.
+ *
+ * Appelée avec fs_mutex : l'écriture est séquentielle et ne fait que
+ * quelques dizaines d'octets par opération, mais n'est pas encore sur disque.
+ * La comparaison porte sur tout l'état : aucune opération d'un autre thread
+ * ne doit être en cours (verrou exclusif, voir journal_commit).
+ * L'appelant attend ensuite la synchronisation avec journal_sync, de
+ * préférence après avoir relâché fs_mutex pour que plusieurs validations
+ * partagent le même fdatasync. Rien n'est écrit pendant une transaction.
+ *
+ * @return Le numéro de la validation à attendre avec journal_sync.
+ */
+long journal_commit_locked() {
+    if (tx_snapshot == NULL && !snapshot_mounted) {
+        flush_all_delayed();  // Les données sont dans l'image avant les métadonnées qui les décrivent
+    }
+    if (journal_shadow == NULL || tx_snapshot != NULL || snapshot_mounted) {
+        return journal_written_seq;
+    }
+    journal_encode();
+    size_t len = journal_buf_len - sizeof(JournalCommit);
+    if (len == 0) {
+        return journal_written_seq;
+    }
+
+    // Journal plein : on vide d'abord l'état précédent, déjà protégé par le journal
+    if (journal_tail + journal_buf_len > JOURNAL_SIZE) {
+        write_checkpoint();
+    }
+
+    uint32_t seq = journal_written_seq + 1;
+    JournalCommit commit;
+    commit.type = J_COMMIT;
+    commit.generation = journal_generation;
+    commit.seq = seq;
+    commit.length = len;
+    commit.checksum = journal_checksum(journal_buf + sizeof(commit), len, seq);
+    memcpy(journal_buf, &commit, sizeof(commit));
+
+    write_image(journal_buf, journal_buf_len, JOURNAL_OFFSET + journal_tail);
+    journal_tail += journal_buf_len;
+    publish_generation();
+    if (journal_apply(journal_buf + sizeof(commit), len, journal_shadow) == -1) {
+        // journal_shadow ne suit plus le journal : on repart de fs avec un point de contrôle complet
+        fprintf(fs.log, "\nErreur : validation %u non applicable, point de contrôle complet\n", seq);
+        journal_open();
+        memset(ckpt_inode_dirty, 1, sizeof(ckpt_inode_dirty));
+        memset(ckpt_dir_dirty, 1, sizeof(ckpt_dir_dirty));
+        write_checkpoint();
+    }
+
+    pthread_mutex_lock(&journal_mutex);
+    journal_written_seq = seq;
+    pthread_mutex_unlock(&journal_mutex);
+    fprintf(fs.log, "\nJournal : validation %u, %zu octets\n", seq, journal_buf_len);
+    return seq;
+}
+
+/**
+ * @brief Valide le journal (voir journal_commit_locked) en excluant les opérations des autres threads.
+ *
+ * @return Le numéro de la validation à attendre avec journal_sync.
+ */
+long journal_commit() {
+    int pris = op_begin(1);
+    long seq = journal_commit_locked();
+    op_end(pris);
+    return seq;
+}
+
+/**
+ * @brief Attend que la validation seq soit sur disque (validation groupée).
+ *
+ * Le premier appelant devient meneur et fait un seul fdatasync pour toutes
+ * les validations déjà écrites ; les suivants attendent la fin de cette
+ * synchronisation au lieu d'en lancer une autre.
+ *
+ * @param seq Numéro rendu par journal_commit.
+ */
+void journal_sync(long seq) {
+    pthread_mutex_lock(&journal_mutex);
+    while (journal_synced_seq < seq) {
+        if (journal_syncing) {
+            pthread_cond_wait(&journal_cond, &journal_mutex);
+            continue;
+        }
+        journal_syncing = 1;
+        long cible = journal_written_seq;
+        pthread_mutex_unlock(&journal_mutex);
+        fdatasync(fileno(fs.file));
+        pthread_mutex_lock(&journal_mutex);
+        if (journal_synced_seq < cible) {
+            journal_synced_seq = cible;
+        }
+        journal_syncing = 0;
+        pthread_cond_broadcast(&journal_cond);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    limbo_release();
+}
+
+/**
+ * @brief Prépare la copie journal_shadow de l'état courant (référence des différences).
+ */
+void journal_open() {
+    if (journal_shadow == NULL) {
+        journal_shadow = malloc(sizeof(Filesystem));
+        if (journal_shadow == NULL) {
+            perror("Erreur d'allocation du journal");
+            exit(1);
+        }
+    }
+    memcpy(journal_shadow, &fs, sizeof(Filesystem));
+    memset(journal_dir_dirty, 0, sizeof(journal_dir_dirty));
+}
+
+/**
+ * @brief Écrit une image complète (après une initialisation) et un journal vide.
+ */
+void journal_format() {
+    write_image(&fs, sizeof(Filesystem), 0);
+    journal_open();
+    write_checkpoint();
+}
+
+/**
+ * @brief Vérifie qu'une validation lue dans le journal est complète et de la génération courante.
+ *
+ * @param commit L'en-tête de la validation.
+ * @param records Ses enregistrements.
+ * @param disponible Nombre d'octets lus après l'en-tête.
+ * @return 1 si la validation peut être rejouée, 0 sinon.
+ */
+int journal_commit_valid(const JournalCommit *commit, const char *records, size_t disponible) {
+    return commit->type == J_COMMIT && commit->generation == journal_generation &&
+           commit->length <= disponible &&
+           commit->checksum == journal_checksum(records, commit->length, commit->seq);
+}
+
+/**
+ * @brief Rejoue au montage les validations complètes restées dans le journal.
+ *
+ * Chaque validation est un en-tête JournalCommit suivi de ses enregistrements.
+ * On s'arrête à la première validation incomplète ou d'une autre génération
+ * (écriture interrompue, ou reste d'un journal déjà vidé).
+ *
+ * @return Le nombre de validations rejouées.
+ */
+int journal_replay() {
+    JournalHeader header;
+    fflush(fs.file);
+    if (pread(fileno(fs.file), &header, sizeof(header), JOURNAL_OFFSET) != sizeof(header) ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0) {
+        journal_generation = 0;  // Image sans journal : il sera créé au premier point de contrôle
+        return 0;
+    }
+    journal_generation = header.generation;
+
+    char *zone = malloc(JOURNAL_SIZE);
+    if (zone == NULL) {
+        return 0;
+    }
+    ssize_t lu = pread(fileno(fs.file), zone, JOURNAL_SIZE, JOURNAL_OFFSET);
+    size_t pos = sizeof(JournalHeader);
+    int nb = 0;
+    JournalCommit commit;
+    while (lu > 0 && pos + sizeof(commit) <= (size_t)lu) {
+        memcpy(&commit, zone + pos, sizeof(commit));
+        char *records = zone + pos + sizeof(commit);
+        if (!journal_commit_valid(&commit, records, (size_t)lu - pos - sizeof(commit)) ||
+            journal_apply(records, commit.length, &fs) == -1) {
+            break;
+        }
+        pos += sizeof(commit) + commit.length;
+        journal_written_seq = commit.seq;
+        nb++;
+    }
+    journal_tail = pos;
+    free(zone);
+    journal_synced_seq = journal_written_seq;
+    if (nb > 0) {
+        fprintf(fs.log, "\nJournal : %d validations rejouées au montage\n", nb);
+    }
+    return nb;
+}
+
+/**
+ * @brief Point de contrôle : valide le journal puis réécrit en place les tables modifiées.
+ */
+void checkpoint_filesystem() {
+    if (snapshot_mounted) {
+        return;  // L'état en mémoire est celui de l'instantané : rien à écrire
+    }
+    int pris = op_begin(1);
+    journal_commit();
+    write_checkpoint();
+    op_end(pris);
+    fprintf(fs.log, "\nSystème de fichier sauvegardé avec succès\n");
+}
+
+/**
+ * @brief Charge l'état du système de fichiers depuis un fichier binaire.
+ *
+ * @param filename Nom du fichier contenant la sauvegarde.
+ */
+void load_filesystem(const char *filename) {
+    FILE *file = fopen(filename, "rb+");  // Ouverture en mode lecture/écriture binaire
+    if (!file) {
+        printf("Aucune sauvegarde trouvée. Initialisation d'un nouveau système.\n");
+        init_filesystem(filename);
+        lock_filesystem(1);
+        journal_format();
+    } else {
+        FILE *log = fopen("log.txt", "a");   // Création du fichier texte pour les log
+        // Lecture sous verrou exclusif : une autre session peut être en train de rejouer ou de replier le journal
+        fs.file = file;
+        fs.log = log;
+        lock_range(META_LOCK_OFFSET, sizeof(fs.free_blocks), F_WRLCK);
+        meta_lock = F_WRLCK;
+        if (pread(fileno(file), &fs, sizeof(Filesystem), 0) != (ssize_t)sizeof(Filesystem)) {
+            printf("Erreur : image incomplète.\n");
+        }
+        if (pread(fileno(file), &meta_generation, sizeof(meta_generation), GENERATION_OFFSET) != sizeof(meta_generation)) {
+            meta_generation = 0;
+        }
+        printf("Système de fichiers chargé avec succès.\n");
+        fs.file = file;
+        fs.log = log;
+        fprintf(fs.log, "\nSystème de fichier chargé avec succès\n");
+        open_direct_io(filename);
+
+        // Rejouer le journal puis le vider (ou le créer sur une image qui n'en a pas)
+        int rejouees = journal_replay();
+        journal_open();
+        rejouees += release_unlinked_inodes();
+        if (rejouees > 0 || journal_generation == 0) {
+            write_checkpoint();
+        }
+    }
+}
+
+/**
+ * @brief Ouvre une transaction : les modifications suivantes restent en mémoire jusqu'au commit.
+ *
+ * L'état courant est copié, puis chaque bloc alloué reçoit une référence de
+ * plus : toute écriture dans un fichier existant passe alors par la copie sur
+ * écriture (block_for_write) et les blocs de l'état validé ne sont jamais
+ * modifiés. Un abort n'a donc qu'à restaurer la copie. Rien n'est journalisé
+ * avant le commit : un point de contrôle pendant la transaction écrit l'état
+ * validé, qui reste cohérent sur disque.
+ *
+ * @return 0 si succès, -1 si une transaction est déjà ouverte ou si la mémoire manque.
+ */
+int begin_transaction() {
+    if (tx_snapshot != NULL) {
+        printf("Erreur : une transaction est déjà en cours.\n");
+        return -1;
+    }
+    flush_all_delayed();  // L'état conservé pour abort ne doit rien laisser en attente
+    tx_snapshot = malloc(sizeof(Filesystem));
+    if (tx_snapshot == NULL) {
+        printf("Erreur : mémoire insuffisante pour ouvrir une transaction.\n");
+        fprintf(fs.log, "\nEchec de l'ouverture de transaction\n");
+        return -1;
+    }
+    memcpy(tx_snapshot, &fs, sizeof(Filesystem));
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        share_block(i);  // Sans effet sur les blocs libres
+    }
+    fprintf(fs.log, "\nDébut de transaction\n");
+    return 0;
+}
+
+/**
+ * @brief Valide la transaction en cours : toutes ses modifications forment une seule validation du journal.
+ *
+ * @return 0 si succès, -1 si aucune transaction n'est ouverte.
+ */
+int commit_transaction() {
+    if (tx_snapshot == NULL) {
+        printf("Erreur : aucune transaction en cours.\n");
+        return -1;
+    }
+    // Rendre les références posées au begin ; les blocs supprimés pendant la
+    // transaction redeviennent libres à ce moment
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        if (tx_snapshot->free_blocks[i] > 0) {
+            free_block(i);
+        }
+    }
+    free(tx_snapshot);
+    tx_snapshot = NULL;
+    journal_sync(journal_commit());
+    fprintf(fs.log, "\nTransaction validée\n");
+    return 0;
+}
+
+/**
+ * @brief Annule la transaction en cours : l'état validé au begin est restauré.
+ *
+ * @return 0 si succès, -1 si aucune transaction n'est ouverte.
+ */
+int abort_transaction() {
+    if (tx_snapshot == NULL) {
+        printf("Erreur : aucune transaction en cours.\n");
+        return -1;
+    }
+    // Les fichiers hôtes ouverts entre-temps restent ceux de l'état courant
+    FILE *file = fs.file;
+    FILE *log = fs.log;
+    for (int i = 0; i < NUM_INODES; i++) {
+        discard_delayed(i);  // Écritures de la transaction, jamais allouées
+    }
+    memcpy(&fs, tx_snapshot, sizeof(Filesystem));
+    fs.file = file;
+    fs.log = log;
+    for (int i = 0; i < NUM_INODES; i++) {
+        mark_dir(i);
+    }
+    free(tx_snapshot);
+    tx_snapshot = NULL;
+    fprintf(fs.log, "\nTransaction annulée\n");
+    return 0;
+}
+
+/**
+ * @brief En-tête d'un fichier d'instantané.
+ *
+ * Il est suivi des inodes, du répertoire racine puis des répertoires des
+ * inodes de type répertoire, dans l'ordre des inodes. Les données ne sont
+ * pas copiées : held marque les blocs sur lesquels l'instantané a posé une
+ * référence, ce qui suffit pour que les écritures suivantes les recopient
+ * (block_for_write) au lieu de les modifier.
+ */
+typedef struct {
+    char magic[8];                  /**< SNAPSHOT_MAGIC */
+    time_t creation_time;           /**< Date de création de l'instantané */
+    int current_dir;                /**< Répertoire courant au moment de l'instantané */
+    unsigned char held[NUM_BLOCKS]; /**< 1 si l'instantané retient une référence sur le bloc */
+    int clone_src[NUM_INODES];      /**< Clones de répertoires encore paresseux (voir clone_directory) */
+} SnapshotHeader;
+
+/**
+ * @brief Construit le chemin du fichier d'un instantané à partir de son nom.
+ *
+ * @param name Nom de l'instantané.
+ * @param path Reçoit le chemin.
+ * @param size Taille de path.
+ * @return 0 si succès, -1 si le nom est invalide.
+ */
+int snapshot_path(const char *name, char *path, size_t size) {
+    if (name[0] == '\0' || strlen(name) >= MAX_SNAPSHOT_NAME || strchr(name, '/') != NULL) {
+        printf("Erreur : nom d'instantané invalide '%s'.\n", name);
+        return -1;
+    }
+    snprintf(path, size, "%s%s", SNAPSHOT_PREFIX, name);
+    return 0;
+}
+
+/**
+ * @brief Lit l'en-tête d'un instantané et vérifie sa signature.
+ *
+ * @param in Fichier de l'instantané, positionné au début.
+ * @param header Reçoit l'en-tête.
+ * @return 0 si succès, -1 si le fichier n'est pas un instantané.
+ */
+int read_snapshot_header(FILE *in, SnapshotHeader *header) {
+    if (fread(header, sizeof(SnapshotHeader), 1, in) != 1 || memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Recense au montage les blocs retenus par les instantanés existants.
+ *
+ * Les références elles-mêmes sont déjà dans le compteur de blocs de l'image ;
+ * snapshot_pins sert seulement à empêcher le nettoyeur de segments de
+ * déplacer un bloc qu'un instantané désigne.
+ */
+void load_snapshot_pins() {
+    memset(snapshot_pins, 0, sizeof(snapshot_pins));
+    DIR *d = opendir(".");
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, SNAPSHOT_PREFIX, strlen(SNAPSHOT_PREFIX)) != 0) {
+            continue;
+        }
+        FILE *in = fopen(e->d_name, "rb");
+        SnapshotHeader header;
+        if (in != NULL && read_snapshot_header(in, &header) == 0) {
+            for (int b = 0; b < NUM_BLOCKS; b++) {
+                snapshot_pins[b] += header.held[b];
+            }
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+    }
+    closedir(d);
+}
+
+/**
+ * @brief Supprime les instantanés d'une image réinitialisée (--init) : leurs blocs n'existent plus.
+ */
+void drop_snapshots() {
+    DIR *d = opendir(".");
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, SNAPSHOT_PREFIX, strlen(SNAPSHOT_PREFIX)) == 0) {
+            unlink(e->d_name);
+            fprintf(fs.log, "\nSuppression de l'instantané obsolète %s\n", e->d_name + strlen(SNAPSHOT_PREFIX));
+        }
+    }
+    closedir(d);
+    memset(snapshot_pins, 0, sizeof(snapshot_pins));
+}
+
+/**
+ * @brief Fige l'état courant dans un instantané, sans copier de données.
+ *
+ * Une référence est posée sur chaque bloc alloué, comme au début d'une
+ * transaction, puis validée dans le journal avant que le fichier de
+ * l'instantané n'apparaisse : un arrêt brutal entre les deux laisse au pire
+ * des blocs retenus pour rien, jamais un instantané dont les blocs auraient
+ * été réécrits.
+ *
+ * @param name Nom de l'instantané.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int create_snapshot(const char *name) {
+    char path[MAX_SNAPSHOT_NAME + 32], tmp[MAX_SNAPSHOT_NAME + 40];
+    if (snapshot_path(name, path, sizeof(path)) == -1) {
+        return -1;
+    }
+    if (tx_snapshot != NULL) {
+        printf("Erreur : impossible de créer un instantané pendant une transaction.\n");
+        return -1;
+    }
+    flush_all_delayed();  // L'instantané retient les blocs : toutes les données doivent en avoir
+    if (access(path, F_OK) == 0) {
+        printf("Erreur : l'instantané '%s' existe déjà.\n", name);
+        return -1;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.creation_time = time(NULL);
+    header.current_dir = fs.current_dir;
+    memcpy(header.clone_src, fs.clone_src, sizeof(header.clone_src));
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        if (fs.free_blocks[b] > 0) {
+            header.held[b] = 1;
+            share_block(b);
+        }
+    }
+    journal_sync(journal_commit());
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *out = fopen(tmp, "wb");
+    int ok = out != NULL
+        && fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(fs.inodes, sizeof(fs.inodes), 1, out) == 1
+        && fwrite(&fs.root_dir, sizeof(Directory), 1, out) == 1;
+    for (int i = 0; ok && i < NUM_INODES; i++) {
+        if (fs.inodes[i].type == 0) {
+            ok = fwrite(&fs.directories[i], sizeof(Directory), 1, out) == 1;
+        }
+    }
+    if (out != NULL) {
+        ok = fflush(out) == 0 && fsync(fileno(out)) == 0 && ok;
+        fclose(out);
+    }
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            if (header.held[b]) {
+                free_block(b);
+            }
+        }
+        printf("Erreur : impossible d'écrire l'instantané '%s'.\n", name);
+        fprintf(fs.log, "\nEchec de la création de l'instantané %s\n", name);
+        return -1;
+    }
+
+    int retenus = 0;
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        snapshot_pins[b] += header.held[b];
+        retenus += header.held[b];
+    }
+    fprintf(fs.log, "\nCréation de l'instantané %s (%d blocs retenus)\n", name, retenus);
+    return 0;
+}
+
+/**
+ * @brief Supprime un instantané et rend les références qu'il retenait.
+ *
+ * Le fichier est supprimé d'abord : un arrêt brutal avant la validation
+ * suivante laisse des blocs retenus pour rien, mais aucun bloc libéré alors
+ * qu'un instantané le désigne encore.
+ *
+ * @param name Nom de l'instantané.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int delete_snapshot(const char *name) {
+    char path[MAX_SNAPSHOT_NAME + 32];
+    if (snapshot_path(name, path, sizeof(path)) == -1) {
+        return -1;
+    }
+    if (tx_snapshot != NULL) {
+        printf("Erreur : impossible de supprimer un instantané pendant une transaction.\n");
+        return -1;
+    }
+    FILE *in = fopen(path, "rb");
+    SnapshotHeader header;
+    if (in == NULL || read_snapshot_header(in, &header) == -1) {
+        if (in != NULL) {
+            fclose(in);
+        }
+        printf("Erreur : instantané '%s' introuvable.\n", name);
+        return -1;
+    }
+    fclose(in);
+    unlink(path);
+
+    int liberes = 0;
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        if (header.held[b]) {
+            free_block(b);
+            snapshot_pins[b]--;
+            liberes += fs.free_blocks[b] == 0;
+        }
+    }
+    fprintf(fs.log, "\nSuppression de l'instantané %s (%d blocs libérés)\n", name, liberes);
+    return liberes;
+}
+
+/**
+ * @brief Affiche les instantanés et l'espace que chacun retient seul.
+ *
+ * Un bloc retenu par l'instantané mais qui n'appartient plus à aucun inode
+ * courant est un bloc « divergent » : c'est ce que coûte l'instantané.
+ */
+void list_snapshots() {
+    unsigned char courant[NUM_BLOCKS];
+    memset(courant, 0, sizeof(courant));
+    for (int i = 0; i < NUM_INODES; i++) {
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            if (fs.inodes[i].blocks[b] >= 0) {
+                courant[fs.inodes[i].blocks[b]] = 1;
+            }
+        }
+    }
+
+    DIR *d = opendir(".");
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *e;
+    int n = 0;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, SNAPSHOT_PREFIX, strlen(SNAPSHOT_PREFIX)) != 0) {
+            continue;
+        }
+        FILE *in = fopen(e->d_name, "rb");
+        SnapshotHeader header;
+        if (in != NULL && read_snapshot_header(in, &header) == 0) {
+            int retenus = 0, divergents = 0;
+            for (int b = 0; b < NUM_BLOCKS; b++) {
+                retenus += header.held[b];
+                divergents += header.held[b] && !courant[b];
+            }
+            char date[32];
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&header.creation_time));
+            printf("  %-20s %s  %d blocs retenus, %d divergents (%d octets)\n",
+                   e->d_name + strlen(SNAPSHOT_PREFIX), date, retenus, divergents, divergents * BLOCK_SIZE);
+            n++;
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+    }
+    closedir(d);
+    if (n == 0) {
+        printf("Aucun instantané.\n");
+    }
+}
+
+/**
+ * @brief Remplace en mémoire l'état courant par celui d'un instantané (montage en lecture seule).
+ *
+ * Les blocs de données sont lus dans l'image elle-même : ils n'ont pas pu
+ * changer tant que l'instantané retient une référence dessus. Plus rien
+ * n'est écrit dans l'image ni dans le journal jusqu'à la sortie.
+ *
+ * @param name Nom de l'instantané.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int mount_snapshot(const char *name) {
+    char path[MAX_SNAPSHOT_NAME + 32];
+    if (snapshot_path(name, path, sizeof(path)) == -1) {
+        return -1;
+    }
+    FILE *in = fopen(path, "rb");
+    SnapshotHeader header;
+    int ok = in != NULL && read_snapshot_header(in, &header) == 0
+        && fread(fs.inodes, sizeof(fs.inodes), 1, in) == 1
+        && fread(&fs.root_dir, sizeof(Directory), 1, in) == 1;
+    for (int i = 0; ok && i < NUM_INODES; i++) {
+        if (fs.inodes[i].type == 0) {
+            ok = fread(&fs.directories[i], sizeof(Directory), 1, in) == 1;
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (!ok) {
+        printf("Erreur : instantané '%s' introuvable ou illisible.\n", name);
+        return -1;
+    }
+
+    snapshot_mounted = 1;
+    log_structured = 0;  // Aucune écriture, donc aucun segment à nettoyer
+    fs.nb_orphans = 0;   // Les orphelins sont ceux de l'état courant, pas de l'instantané
+    fs.current_dir = header.current_dir;
+    memcpy(fs.clone_src, header.clone_src, sizeof(fs.clone_src));
+    fprintf(fs.log, "\nMontage en lecture seule de l'instantané %s\n", name);
+    return 0;
+}
+
+/**
+ * @brief Pose ou retire un verrou d'enregistrement OFD sur une plage de l'image.
+ *
+ * Les verrous OFD appartiennent à la description de fichier ouverte : ils
+ * protègent d'un autre processus, pas d'un autre thread du même processus
+ * (c'est le rôle de fs_mutex). L'appel attend que la plage soit disponible.
+ *
+ * @param start Début de la plage.
+ * @param len Longueur de la plage (0 : jusqu'à la fin du fichier).
+ * @param type F_RDLCK, F_WRLCK ou F_UNLCK.
+ * @return 0 si succès, -1 en cas d'erreur.
+ */
+int lock_range(off_t start, off_t len, short type) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+    while (fcntl(fileno(fs.file), F_OFD_SETLKW, &fl) == -1) {
+        if (errno != EINTR) {
+            fprintf(fs.log, "\nEchec du verrou sur la plage %ld (+%ld) : %s\n", (long)start, (long)len, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Verrouille les données d'un inode le temps de la commande.
+ *
+ * Un lecteur (F_RDLCK) empêche un autre processus de réécrire ou de libérer
+ * les blocs qu'il est en train de lire ; un écrivain (F_WRLCK) attend que
+ * les lecteurs de ce fichier aient fini.
+ *
+ * @param inode_index Inode concerné.
+ * @param type F_RDLCK ou F_WRLCK.
+ */
+void lock_inode(int inode_index, short type) {
+    if (!snapshot_mounted && inode_index >= 0 && inode_index < NUM_INODES) {
+        lock_range(INODE_LOCK_OFFSET(inode_index), sizeof(Inode), type);
+    }
+}
+
+/**
+ * @brief Recharge les métadonnées depuis l'image (tables puis journal).
+ *
+ * Le répertoire courant de la session et les fichiers de l'hôte sont
+ * conservés ; les descripteurs ouverts ne sont pas dans fs.
+ */
+void reload_metadata() {
+    FILE *file = fs.file, *log = fs.log;
+    int current_dir = fs.current_dir;
+
+    fflush(file);
+    if (pread(fileno(file), &fs, sizeof(Filesystem), 0) != (ssize_t)sizeof(Filesystem)) {
+        fprintf(log, "\nErreur de relecture des métadonnées\n");
+    }
+    fs.file = file;
+    fs.log = log;
+    fs.current_dir = current_dir;
+
+    journal_replay();
+    journal_open();
+    load_snapshot_pins();  // Un autre processus a pu créer ou supprimer un instantané
+    log_head = -1;
+    fprintf(fs.log, "\nMétadonnées rechargées (génération %llu)\n", (unsigned long long)meta_generation);
+}
+
+/**
+ * @brief Applique les validations ajoutées au journal par d'autres processus.
+ *
+ * Tant qu'aucun point de contrôle n'a changé la génération du journal, les
+ * validations des autres processus suivent journal_tail : on ne lit que
+ * celles-ci (quelques dizaines d'octets par opération) et on les applique à
+ * fs et à journal_shadow, au lieu de relire toutes les tables.
+ *
+ * @return Le nombre de validations appliquées, -1 s'il faut tout recharger.
+ */
+int journal_catch_up() {
+    JournalHeader header;
+    int fd = fileno(fs.file);
+    if (journal_shadow == NULL ||
+        pread(fd, &header, sizeof(header), JOURNAL_OFFSET) != sizeof(header) ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.generation != journal_generation) {
+        return -1;  // Point de contrôle d'un autre processus : le journal a été vidé
+    }
+
+    int current_dir = fs.current_dir;
+    char *records = NULL;
+    int nb = 0;
+    JournalCommit commit;
+    while (journal_tail + sizeof(commit) <= JOURNAL_SIZE &&
+           pread(fd, &commit, sizeof(commit), JOURNAL_OFFSET + journal_tail) == sizeof(commit) &&
+           commit.type == J_COMMIT && commit.generation == journal_generation) {
+        size_t disponible = JOURNAL_SIZE - journal_tail - sizeof(commit);
+        if (commit.length > disponible) {
+            break;
+        }
+        char *grown = realloc(records, commit.length ? commit.length : 1);
+        if (grown == NULL) {
+            nb = -1;
+            break;
+        }
+        records = grown;
+        if (pread(fd, records, commit.length, JOURNAL_OFFSET + journal_tail + sizeof(commit)) != (ssize_t)commit.length ||
+            !journal_commit_valid(&commit, records, disponible)) {
+            break;
+        }
+        if (journal_apply(records, commit.length, &fs) == -1 ||
+            journal_apply(records, commit.length, journal_shadow) == -1) {
+            nb = -1;  // fs est à moitié modifié : seul un rechargement complet le répare
+            break;
+        }
+        journal_tail += sizeof(commit) + commit.length;
+        pthread_mutex_lock(&journal_mutex);
+        if (journal_written_seq < commit.seq) {
+            journal_written_seq = commit.seq;  // Nos validations suivantes prennent la suite
+        }
+        pthread_mutex_unlock(&journal_mutex);
+        nb++;
+    }
+    free(records);
+
+    // Le répertoire courant est propre à la session (voir reload_metadata)
+    fs.current_dir = current_dir;
+    if (journal_shadow != NULL) {
+        journal_shadow->current_dir = current_dir;
+    }
+    return nb;
+}
+
+/**
+ * @brief Vérifie, sous verrou, que la copie des métadonnées est à jour.
+ *
+ * Un autre processus qui a modifié l'image a incrémenté le compteur de
+ * génération : on applique alors ses validations (journal_catch_up), ou on
+ * recharge tout si un point de contrôle a vidé le journal entre-temps.
+ */
+void revalidate_metadata() {
+    uint64_t generation = 0;
+    fflush(fs.file);
+    if (pread(fileno(fs.file), &generation, sizeof(generation), GENERATION_OFFSET) != sizeof(generation)) {
+        generation = 0;
+    }
+    if (generation != meta_generation) {
+        meta_generation = generation;
+        int nb = journal_catch_up();
+        if (nb < 0) {
+            reload_metadata();
+            return;
+        }
+        load_snapshot_pins();  // Un autre processus a pu créer ou supprimer un instantané
+        log_head = -1;
+        fprintf(fs.log, "\nMétadonnées : %d validations d'autres processus appliquées (génération %llu)\n",
+                nb, (unsigned long long)meta_generation);
+    }
+}
+
+/**
+ * @brief Relâche le verrou des métadonnées mais garde ceux des inodes.
+ *
+ * Utilisé par les lectures longues (rfile, cat) une fois les inodes à lire
+ * verrouillés : les écrivains d'autres processus peuvent alors travailler
+ * sur le reste de l'image pendant que le contenu défile.
+ */
+void release_metadata() {
+    if (meta_lock == F_RDLCK) {
+        lock_range(META_LOCK_OFFSET, sizeof(fs.free_blocks), F_UNLCK);
+        meta_lock = F_UNLCK;
+    }
+}
+
+/**
+ * @brief Verrouille les métadonnées pour une commande, puis revalide la copie en mémoire.
+ *
+ * Les lecteurs se partagent le verrou ; un écrivain l'a seul, ce qui
+ * sérialise les écritures dans le journal et les allocations entre
+ * processus. Pendant une transaction ou un script, le verrou exclusif est
+ * déjà tenu et l'appel ne fait rien.
+ *
+ * @param exclusif 1 pour une commande qui modifie l'image, 0 pour une lecture.
+ */
+void lock_filesystem(int exclusif) {
+    short type = exclusif ? F_WRLCK : F_RDLCK;
+    if (snapshot_mounted || meta_lock == F_WRLCK || meta_lock == type) {
+        return;
+    }
+    // Pas de conversion lecture -> écriture : deux processus qui la tentent
+    // ensemble s'attendraient mutuellement. La revalidation suit de toute façon.
+    if (meta_lock == F_RDLCK) {
+        release_metadata();
+    }
+    if (lock_range(META_LOCK_OFFSET, sizeof(fs.free_blocks), type) == 0) {
+        meta_lock = type;
+    }
+    revalidate_metadata();
+}
+
+/**
+ * @brief Relâche tous les verrous de la commande (métadonnées et inodes).
+ *
+ * Sans effet pendant une transaction ou un script, qui gardent le verrou
+ * exclusif jusqu'au commit, à l'abort ou à la fin.
+ */
+void unlock_filesystem() {
+    if (snapshot_mounted || tx_snapshot != NULL || session_exclusive) {
+        return;
+    }
+    lock_range(0, 0, F_UNLCK);
+    meta_lock = F_UNLCK;
+}
+
+
+/**
+ * @brief Affiche l'état actuel du système de fichiers (inodes et répertoire courant).
+ *
+ * @param current_dir Inode du répertoire courant.
+ */
+void display_filesystem(int current_dir) {
+    Directory dir = *dir_of(current_dir);
+
+    printf("\n===== État du système de fichiers =====\n");
+
+    // Affichage des inodes
+    printf("Inodes utilisés :\n");
+    for (int i = 0; i < NUM_INODES; i++) {
+        if (fs.inodes[i].size >= 0) { // Seuls les inodes utilisés sont affichés
+            printf("Inode %d: Taille=%d octets, Liens=%d, Permissions=%s\n",
+                   fs.inodes[i].id, fs.inodes[i].size, fs.inodes[i].link_count, fs.inodes[i].permissions);
+        }
+    }
+
+    // Affichage des fichiers dans le répertoire courant
+    printf("\nRépertoire courant :\n");
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        if (dir.entries[i].inode_index != -1) {
+            printf("- %s (inode %d) (type %d)\n", dir.entries[i].filename, dir.entries[i].inode_index, fs.inodes[dir.entries[i].inode_index].type);
+        }
+    }
+    printf("\n=======================================\n");
+}
+
+
+/**
+ * @brief Change le répertoire courant en suivant le chemin spécifié.
+ *
+ * @param path Chemin absolu ou relatif vers le nouveau répertoire.
+ * @param inode_dir Inode du répertoire actuel.
+ * @return Inode du nouveau répertoire courant ou -1 en cas d'erreur.
+ */
+int changerRep(char *path, int inode_dir){
+
+    // On cherche l'inode du chemin
+    int inode = get_inode_from_path(path, inode_dir);
+
+    // Vérifier si le chemin est valide
+    if (inode == -1){
+        fprintf(fs.log, "\nErreur sur le changement de répertoire vers %s\n", path);
+        printf("Erreur : chemin non valide\n");
         return -1;
     }
-    // Vérifier la permission 'w'
-    int inode_idx = fs.opened_file[desc].inode;
-    if (!has_permission(inode_idx, 'w')) {
-        printf("Erreur : permission d'écriture refusée.\n");
-        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+
+    // Vérifier si on a bien un répertoire
+    if (fs.inodes[inode].type != 0){
+        fprintf(fs.log, "\nErreur sur le changement de répertoire vers %s\n", path);
+        printf("Erreur : le fichier cible du chemin n'est pas un répertoire.\n");
         return -1;
     }
 
-    // Vérifier si on ecrit bien dans un fichier
-    if(fs.inodes[fs.opened_file[desc].inode].type != 1){
-        printf("Erreur : tente d'ecrire dans un repertoire ou dans un lien symbolique");
-        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+    fprintf(fs.log, "\nNouveau répertoire courant : %s\n", path);
+    return inode;
+}
+
+
+
+/**
+ * @brief Affiche le message d'aide décrivant les commandes disponibles.
+ */
+void print_help() {
+    printf("Mini Gestionnaire de Fichiers\n");
+    printf("Usage: ./filesystem [OPTIONS]\n\n");
+
+    printf("Options:\n");
+    printf("  --help           Affiche ce message d'aide\n");
+    printf("  --init           Force une nouvelle initialisation du système de fichiers\n");
+    printf("  -d               Transferts volumineux en O_DIRECT (sans double cache)\n");
+    printf("  -l, --log-structured\n");
+    printf("                   Écrire les données en journal : blocs neufs pris en tête, segments nettoyés en fond\n");
+    printf("  -s, --snapshot <nom>\n");
+    printf("                   Monter en lecture seule l'instantané nom au lieu de l'état courant\n");
+    printf("  -j <n>           Nombre d'ouvriers des parcours d'arborescence (cp, get -r, du, find, chmod -R)\n");
+    printf("                   et du serveur (défaut : 4)\n");
+    printf("  --batch <script> Exécuter les commandes d'un script (- : entrée standard) sans invite,\n");
+    printf("                   en ne sauvegardant qu'à la fin et sur 'checkpoint'\n");
+    printf("  --continue       Avec --batch : continuer après une commande en erreur\n");
+    printf("  --serve <socket> Garder l'image chargée et servir des clients sur une socket Unix\n");
+    printf("                   (-j : nombre d'ouvriers ; arrêt par SIGINT ou SIGTERM)\n");
+    printf("  --connect <socket>\n");
+    printf("                   Shell léger : envoyer les commandes à un serveur --serve\n");
+    printf("  --max-open <n>   Descripteurs ouverts au plus par session (défaut : %d)\n", DEFAULT_MAX_OPEN);
+    printf("  --no-delalloc    Choisir les blocs à chaque écriture au lieu de les allouer à la validation\n");
+    printf("  --defrag <Ko/s>  Défragmenter en tâche de fond sans dépasser ce débit (shell et serveur)\n\n");
+
+    printf("Commandes disponibles en mode interactif :\n");
+    printf("  begin / commit / abort           Grouper des commandes : sauvegardées ensemble au commit, annulées par abort\n");
+    printf("  cat <path>                       Envoyer le contenu brut d'un fichier sur la sortie standard\n");
+    printf("  cd <path>                        Changer de répertoire\n");
+    printf("  chmod [-R] <fichier> <perms>     Modifier les permissions (ex: rwx, r--, etc. ; -R : toute l'arborescence)\n");
+    printf("  checkpoint                       Sauvegarder l'image immédiatement (utile en --batch)\n");
+    printf("  clone <dir> <newdir>             Cloner un répertoire en temps constant (contenu recopié au besoin)\n");
+    printf("  cp [--full] <src> <newname> <dest_path>\n");
+    printf("                                   Copier un fichier ou répertoire (--full : recopie le contenu)\n");
+    printf("  defrag [path]                    Ranger chaque fichier d'un seul tenant et regrouper l'espace libre\n");
+    printf("  defrag --background [Ko/s] | --stop\n");
+    printf("                                   Défragmenter en tâche de fond à débit limité, ou arrêter\n");
+    printf("  du [path]                        Espace occupé par une arborescence (fichiers, octets, blocs)\n");
+    printf("  exit                             Quitter le programme\n");
+    printf("  find <path> [motif]              Lister les chemins d'une arborescence dont le nom correspond au motif\n");
+    printf("  get [-r] <chemin_image> <hote>   Exporter un fichier (ou une arborescence avec -r) vers l'hôte\n");
+    printf("  put [-r] <chemin_hote> <chemin_image>\n");
+    printf("                                   Importer un fichier (ou une arborescence avec -r) de l'hôte\n");
+    printf("  help                             Afficher ce message d'aide\n");
+    printf("  ln <filename> <linkname> <path>  Créer un lien dur du fichier filename dans le répertoire path\n");
+    printf("  ls                               Lister les fichiers du répertoire courant\n");
+    printf("  mkdir <dir>                      Créer un répertoire\n");
+    printf("  mv <src> <dest_path>             Déplacer un fichier ou répertoire\n");
+    printf("  pwd                              Afficher le répertoire courant\n");
+    printf("  remdir <dir>                     Supprimer un répertoire récursivement\n");
+    printf("  rm <file>                        Supprimer un fichier\n");
+    printf("  rfile <filename>                 Afficher le contenu d'un fichier\n");
+    printf("  snapshot create|delete <nom>     Créer (sans copier de données) ou supprimer un instantané de l'image\n");
+    printf("  snapshot list                    Lister les instantanés et l'espace qu'ils retiennent\n");
+    printf("  stat <file>                      Afficher les informations d'un fichier ou répertoire\n");
+    printf("  sym <target_path> <linkname>     Créer un lien symbolique vers le fichier dans path\n");
+    printf("  touch <file>                     Créer un fichier vide\n");
+    printf("  wfile <filename> <mode> \"<texte>\"\n");
+    printf("                                   Écrire dans un fichier (modes: add, rewrite)\n");
+}
+
+
+/**
+ * @brief Affiche le prompt avec le chemin complet du répertoire courant.
+ *
+ * @param current_dir Inode du répertoire courant.
+ */
+void print_prompt(int current_dir) {
+    // Augmenter la taille du buffer pour le chemin
+    char path[2048] = "";  // Augmenté de 1024 à 2048
+    int dir = current_dir;
+    
+    printf("fs:/");
+
+    while (dir != 0 && dir != -1) {
+        char dirname[MAX_FILE_NAME] = "?";
+        int parent = fs.inodes[dir].inode_rep_parent;
+        
+        // Vérifier que le parent est valide avant d'y accéder
+        if (parent < 0 || parent >= NUM_DIRECTORY_ENTRIES) {
+            break;
+        }
+
+        Directory *parent_dir = dir_of(parent);
+
+        for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+            if (parent_dir->entries[i].inode_index == dir) {
+                strncpy(dirname, parent_dir->entries[i].filename, MAX_FILE_NAME - 1);
+                dirname[MAX_FILE_NAME - 1] = '\0'; // Assurer la terminaison
+                break;
+            }
+        }
+
+        // Vérifier si nous avons assez d'espace avant de concaténer
+        if (strlen(dirname) + strlen(path) + 2 < sizeof(path)) {  // +2 pour '/' et '\0'
+            char temp[2048] = "/";
+            strncat(temp, dirname, sizeof(temp) - strlen(temp) - 1);
+            strncat(temp, path, sizeof(temp) - strlen(temp) - 1);
+            strncpy(path, temp, sizeof(path) - 1);
+            path[sizeof(path) - 1] = '\0';  // Assurer la terminaison
+        } else {
+            printf("[chemin trop long]");
+            break;
+        }
+
+        dir = parent;
+    }
+    
+    printf("%s%s> ", path, tx_snapshot ? " (transaction)" : "");
+    fflush(stdout);
+}
+
+
+/**
+ * @brief Génère le chemin complet à partir de l'inode du répertoire courant.
+ *
+ * @param current_dir Inode du répertoire courant.
+ * @param path Buffer où stocker le chemin généré.
+ * @param path_size Taille du buffer fourni.
+ */
+void generate_full_path(int current_dir, char *path, size_t path_size) {
+    if (!path || path_size == 0) return; // Vérifier les paramètres
+
+    path[0] = '\0';  // Initialiser comme une chaîne vide
+    int dir = current_dir;
+
+    while (dir != 0 && dir != -1) {
+        char dirname[MAX_FILE_NAME] = "?";
+        int parent = fs.inodes[dir].inode_rep_parent;
+
+        // Vérifier que l'index du parent est valide
+        if (parent < 0 || parent >= NUM_DIRECTORY_ENTRIES) break;
+
+        Directory *parent_dir = dir_of(parent);
+
+        for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+            if (parent_dir->entries[i].inode_index == dir) {
+                strncpy(dirname, parent_dir->entries[i].filename, MAX_FILE_NAME - 1);
+                dirname[MAX_FILE_NAME - 1] = '\0';  // S'assurer de la terminaison
+                break;
+            }
+        }
+
+        // Vérifier si on a assez de place avant de concaténer
+        if (strlen(path) + strlen(dirname) + 2 < path_size) {
+            char temp[2048];
+            snprintf(temp, sizeof(temp), "/%s%s", dirname, path);
+            strncpy(path, temp, path_size - 1);
+            path[path_size - 1] = '\0';  // Assurer la terminaison
+        } else {
+            strncpy(path, "[chemin trop long]", path_size - 1);
+            path[path_size - 1] = '\0';
+            break;
+        }
+
+        dir = parent;
+    }
+}
+
+/**
+ * @brief Affiche les descripteurs de fichiers actuellement ouverts.
+ */
+void print_desc(){
+    for (int i = 0; i < fd_table()->capacity ; i++){
+        if (fd_get(i) != NULL){
+            printf("Descripteur %d : inode %d\n", i, desc_inode(i));
+        }
+    }
+}
+
+
+/**
+ * @brief Liste le contenu du répertoire courant avec détails (permissions, type, taille).
+ *
+ * @param current_dir Inode du répertoire courant.
+ */
+void list_directory(int current_dir) {
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, current_dir, 0);
+    inode_locks_acquire(&verrous);
+    Directory dir = *dir_of(current_dir);
+    inode_locks_release(&verrous);
+    printf("Contenu du répertoire :\n");
+    
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        if (dir.entries[i].inode_index != -1) {
+            Inode *inode = &fs.inodes[dir.entries[i].inode_index];
+            char type = '?';
+            char perm[4] = "---";
+            
+            switch(inode->type) {
+                case 0: type = 'd'; break;  // Répertoire
+                case 1: type = 'f'; break;  // Fichier
+                case 2: type = 'l'; break;  // Lien symbolique
+            }
+            
+            // Afficher les permissions de manière lisible
+            if (inode->permissions[0] == 'r') perm[0] = 'r';
+            if (inode->permissions[1] == 'w') perm[1] = 'w';
+            if (inode->permissions[2] == 'x') perm[2] = 'x';
+            
+            printf("[%c%s] %-20s (inode %d, taille %d octets)\n", 
+                   type, perm, dir.entries[i].filename, 
+                   dir.entries[i].inode_index, inode->size);
+        }
+    }
+}
+
+/**
+ * @brief Copie cohérente d'un inode, sans verrou tant qu'aucun écrivain ne le garde.
+ *
+ * @param inode Inode à copier.
+ * @param copie Reçoit la copie.
+ */
+void inode_snapshot(int inode, Inode *copie) {
+    for (int essai = 0; essai < SEQ_RETRIES; essai++) {
+        unsigned seq = seq_read_begin(inode);
+        if (seq & 1) {
+            break;
+        }
+        *copie = fs.inodes[inode];
+        if (!seq_read_retry(inode, seq)) {
+            return;
+        }
+    }
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, inode, 0);
+    inode_locks_acquire(&verrous);
+    *copie = fs.inodes[inode];
+    inode_locks_release(&verrous);
+}
+
+/**
+ * @brief Totaux de du pour un ouvrier.
+ */
+typedef struct {
+    long octets;      /**< Taille cumulée des fichiers et liens */
+    long blocs;       /**< Blocs qu'ils occupent */
+    int fichiers;
+    int repertoires;
+    int illisibles;   /**< Répertoires sans permission 'r', non parcourus */
+} DuTotal;
+
+/**
+ * @brief Contexte de du : totaux par ouvrier et inodes déjà comptés (liens durs).
+ */
+typedef struct {
+    DuTotal totals[POOL_MAX_WORKERS];
+    unsigned char vus[NUM_INODES];
+} DuWalk;
+
+/**
+ * @brief Tâche de du : compte les entrées d'un répertoire, pousse ses sous-répertoires.
+ */
+int du_visit(TaskPool *pool, int worker, Task task) {
+    DuWalk *du = pool->arg;
+    DuTotal *total = &du->totals[worker];
+    total->repertoires++;
+    if (!has_permission(task.inode, 'r')) {
+        total->illisibles++;
+        return 0;
+    }
+    Directory *dir = malloc(sizeof(Directory));
+    if (!dir) {
+        return -1;
+    }
+    dir_snapshot(task.inode, dir);
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        int child = dir->entries[i].inode_index;
+        // Un inode atteint par plusieurs liens durs n'est compté qu'une fois
+        if (child == -1 || __atomic_exchange_n(&du->vus[child], 1, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        Inode copie;
+        inode_snapshot(child, &copie);
+        if (copie.type == 0) {
+            pool_push(pool, worker, (Task){child, 0, NULL});
+            continue;
+        }
+        total->fichiers++;
+        total->octets += copie.size;
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            total->blocs += copie.blocks[b] != -1;
+        }
+    }
+    free(dir);
+    return 0;
+}
+
+/**
+ * @brief Affiche l'espace occupé par une arborescence (du).
+ *
+ * @param dir_inode Répertoire à mesurer.
+ * @param path Chemin affiché.
+ * @return 0 si succès, -1 si le parcours a échoué.
+ */
+int disk_usage(int dir_inode, const char *path) {
+    DuWalk *du = calloc(1, sizeof(DuWalk));
+    if (!du) {
+        return -1;
+    }
+    du->vus[dir_inode] = 1;
+    int status = pool_run(du_visit, du, (Task){dir_inode, 0, NULL}, copy_threads);
+
+    DuTotal somme = {0};
+    for (int k = 0; k < POOL_MAX_WORKERS; k++) {
+        somme.octets += du->totals[k].octets;
+        somme.blocs += du->totals[k].blocs;
+        somme.fichiers += du->totals[k].fichiers;
+        somme.repertoires += du->totals[k].repertoires;
+        somme.illisibles += du->totals[k].illisibles;
+    }
+    free(du);
+    if (status == -1) {
+        fprintf(fs.log, "\nErreur sur le parcours de %s\n", path);
+        printf("Erreur : parcours de '%s' interrompu.\n", path);
+        return -1;
+    }
+    printf("%ld octets, %ld blocs, %d fichiers, %d répertoires : %s\n",
+           somme.octets, somme.blocs, somme.fichiers, somme.repertoires, path);
+    if (somme.illisibles > 0) {
+        printf("(%d répertoires sans permission de lecture non parcourus)\n", somme.illisibles);
+    }
+    return 0;
+}
+
+/**
+ * @brief Contexte de find : motif cherché et résultats de chaque ouvrier.
+ */
+typedef struct {
+    const char *motif;                  /**< Motif fnmatch sur le nom, NULL pour tout lister */
+    PathList found[POOL_MAX_WORKERS];
+} FindWalk;
+
+/**
+ * @brief Tâche de find : retient les entrées d'un répertoire dont le nom correspond.
+ */
+int find_visit(TaskPool *pool, int worker, Task task) {
+    FindWalk *find = pool->arg;
+    if (!has_permission(task.inode, 'r')) {
+        return 0;
+    }
+    Directory *dir = malloc(sizeof(Directory));
+    if (!dir) {
+        return -1;
+    }
+    dir_snapshot(task.inode, dir);
+    int status = 0;
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES && status == 0; i++) {
+        int child = dir->entries[i].inode_index;
+        if (child == -1) {
+            continue;
+        }
+        char chemin[4096];
+        join_path(chemin, sizeof(chemin), task.path, dir->entries[i].filename);
+        if (find->motif == NULL || fnmatch(find->motif, dir->entries[i].filename, 0) == 0) {
+            status = path_list_add(&find->found[worker], chemin, child);
+        }
+        if (fs.inodes[child].type == 0 && status == 0) {
+            char *copie = strdup(chemin);
+            if (copie == NULL) {
+                status = -1;
+            } else {
+                pool_push(pool, worker, (Task){child, 0, copie});
+            }
+        }
+    }
+    free(dir);
+    return status;
+}
+
+/**
+ * @brief Compare deux chemins pour qsort.
+ */
+int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Affiche, triés, les chemins d'une arborescence dont le nom correspond à un motif (find).
+ *
+ * @param dir_inode Répertoire de départ.
+ * @param path Chemin de ce répertoire, préfixe des chemins affichés.
+ * @param motif Motif à la manière du shell (*, ?, [...]), NULL pour tout afficher.
+ * @return Le nombre de chemins trouvés, -1 si le parcours a échoué.
+ */
+int find_entries(int dir_inode, const char *path, const char *motif) {
+    FindWalk *find = calloc(1, sizeof(FindWalk));
+    char *racine = strdup(path);
+    if (!find || !racine) {
+        free(find);
+        free(racine);
+        return -1;
+    }
+    find->motif = motif;
+    int status = pool_run(find_visit, find, (Task){dir_inode, 0, racine}, copy_threads);
+
+    // Les ouvriers trouvent les entrées dans le désordre : on les rassemble et on trie
+    PathList tous = {0};
+    if (motif == NULL) {
+        status |= path_list_add(&tous, path, dir_inode);
+    }
+    for (int k = 0; k < POOL_MAX_WORKERS; k++) {
+        for (int i = 0; i < find->found[k].nb && status == 0; i++) {
+            status = path_list_add(&tous, find->found[k].paths[i], find->found[k].inodes[i]);
+        }
+        path_list_free(&find->found[k]);
+    }
+    free(find);
+    qsort(tous.paths, tous.nb, sizeof(char *), compare_paths);
+    for (int i = 0; i < tous.nb; i++) {
+        printf("%s\n", tous.paths[i]);
+    }
+    int nb = tous.nb;
+    path_list_free(&tous);
+    if (status == -1) {
+        fprintf(fs.log, "\nErreur sur le parcours de %s\n", path);
+        printf("Erreur : parcours de '%s' interrompu.\n", path);
         return -1;
     }
+    return nb;
+}
 
-    
-    // tableau pour lire si on a ecrit un nouveau charactere ou non
-    char texte_tmp[1];
-    memset(texte_tmp, 0, sizeof(char));
-    texte_tmp[0] = '\0';
-
-    // Tete de lecture/ecriture et inode du fichier
-    int lecteur = fs.opened_file[desc].tete_lecture;
-    int inode = fs.opened_file[desc].inode;
-
-    fprintf(fs.log, "\ntête de lecture en début d'écriture : %d\n", lecteur);
-
-    // index des blocs du fichier a ecrire
-    int block_index = -1;
+/**
+ * @brief Contexte de chmod -R : nouvelles permissions et entrées modifiées par ouvrier.
+ */
+typedef struct {
+    const char *permissions;
+    int modifies[POOL_MAX_WORKERS];
+} ChmodWalk;
 
-    // taille supplémentaire du fichier
-    int maj_size = 0;
+/**
+ * @brief Change les permissions d'un inode sous son verrou.
+ *
+ * @return 0 si succès, -1 si l'inode partagé avec un clone n'a pas pu en être séparé.
+ */
+int set_permissions(int inode_index, const char *permissions) {
+    InodeLocks verrous = {0};
+    inode_locks_add(&verrous, inode_index, 1);
+    inode_locks_acquire(&verrous);
+    int status = unshare_inode(inode_index);
+    if (status != -1) {
+        strncpy(fs.inodes[inode_index].permissions, permissions, 3);
+        fs.inodes[inode_index].modification_time = time(NULL);
+    }
+    inode_locks_release(&verrous);
+    return status;
+}
 
-    // on cherche le numéro de bloc a ecrire
-    int i = 0;
-    int num_block;
-    while (block_index == -1 && i<NUM_BLOCKS){
-        num_block = fs.inodes[inode].blocks[i];
-        // Si la tete de lecture se trouve entre le bloc et le bloc suivant, on recupere le bloc
-        if (sizeof(Filesystem) + num_block*BLOCK_SIZE <= lecteur && lecteur < sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){
-            block_index = i;
+/**
+ * @brief Tâche de chmod -R : change les permissions des entrées d'un répertoire.
+ */
+int chmod_visit(TaskPool *pool, int worker, Task task) {
+    ChmodWalk *chmod_walk = pool->arg;
+    Directory *dir = malloc(sizeof(Directory));
+    if (!dir) {
+        return -1;
+    }
+    dir_snapshot(task.inode, dir);
+    int status = 0;
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES && status == 0; i++) {
+        int child = dir->entries[i].inode_index;
+        if (child == -1) {
+            continue;
+        }
+        status = set_permissions(child, chmod_walk->permissions);
+        chmod_walk->modifies[worker]++;
+        if (fs.inodes[child].type == 0) {
+            pool_push(pool, worker, (Task){child, 0, NULL});
         }
-        i++;
     }
+    free(dir);
+    return status;
+}
 
-
-    // Vérifier si la tete de lecture est bien dans le fichier
-    if(block_index == -1){
-        printf("Erreur : la tête de lecture n'est pas dans le fichier.\n");
-        fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
+/**
+ * @brief Change les permissions d'un répertoire et de toute son arborescence (chmod -R).
+ *
+ * @param dir_inode Répertoire de départ.
+ * @param permissions Chaîne de 3 caractères (ex.: "rw-").
+ * @return Le nombre d'inodes modifiés, -1 en cas d'erreur.
+ */
+int change_permissions_tree(int dir_inode, const char *permissions) {
+    ChmodWalk *chmod_walk = calloc(1, sizeof(ChmodWalk));
+    if (!chmod_walk) {
         return -1;
-    } else {
-        // On écrit dans le bloc tant que le bloc n'est pas complet
-        int j = 0;
-        while (j<size && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){
-            // On se positionne pour ecrire
-            fseek(fs.file, lecteur, SEEK_SET);
-            // On lit pour verifier si il y a des caracteres ecrit (pour mettre a jour la taille)
-            fread(texte_tmp, sizeof(char),1,fs.file);
-            // On se repositionne pour ecrire
-            fseek(fs.file, -1, SEEK_CUR);
-            // On met a jour la taille si il n'y avait rien d'ecrit
-            if (texte_tmp[0]  == '\0'){
-                maj_size++;
-                fs.inodes[inode].size = fs.inodes[inode].size + 1;
-                texte_tmp[0] = '\0';
-            }
-            // On ecrit
-            fwrite(texte+j, sizeof(char), 1, fs.file);
-            j++;
-            lecteur++;
-        }
-        int stop = 0;
-        // On réitère le processus précédent tant qu'il y a de la place a ecrire
-        while (j<size && !stop){
-            block_index++;
-            num_block = fs.inodes[inode].blocks[block_index];
-            // On alloue de la memoire si il ne reste plus aucun bloc
-            if (num_block == -1){
-                num_block = allocate_block();
-                fs.inodes[inode].blocks[block_index] = num_block;
-            }
-
-            // Vérifier si un block a été alloué
-            if(num_block == -1){
-                stop = 1;
-                printf("Erreur : ordinateur saturé !!!! (aucun bloc disponible)\n");
-                fprintf(fs.log, "\nErreur sur l'écriture dans le fichier du descripteur %d\n", desc);
-            } else {
-                // On se positionne dans le bloc
-                lecteur = sizeof(Filesystem) + num_block*BLOCK_SIZE;
-                // Même processus pour ecrire dans le bloc + maj de la taille
-                while(j<size && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){ 
-                    fseek(fs.file, lecteur, SEEK_SET);
-                    fread(texte_tmp, sizeof(char),1,fs.file);
-                    fseek(fs.file, -1, SEEK_CUR);
-                    if (texte_tmp[0] == '\0'){
-                        maj_size++;
-                        fs.inodes[inode].size = fs.inodes[inode].size + 1;
-                        texte_tmp[0] = '\0';
-                    }
-                    fwrite(texte+j, sizeof(char), 1, fs.file);
-                    j++;
-                    lecteur++;
-                }
+    }
+    chmod_walk->permissions = permissions;
+    int pris = op_begin(0);
+    int status = set_permissions(dir_inode, permissions);
+    if (status != -1) {
+        status = pool_run(chmod_visit, chmod_walk, (Task){dir_inode, 0, NULL}, copy_threads);
+    }
+    op_end(pris);
+    int nb = 1;
+    for (int k = 0; k < POOL_MAX_WORKERS; k++) {
+        nb += chmod_walk->modifies[k];
+    }
+    free(chmod_walk);
+    if (status == -1) {
+        fprintf(fs.log, "\nErreur lors du changement de permissions sous l'inode %d\n", dir_inode);
+        return -1;
+    }
+    fprintf(fs.log, "\nNouvelles permissions pour %d inodes sous l'inode %d : %.3s\n", nb, dir_inode, permissions);
+    return nb;
+}
+
+/**
+ * @brief Compte les segments contigus d'un fichier.
+ *
+ * Un segment est une suite de blocs logiques consécutifs rangés dans des
+ * blocs physiques consécutifs : lire le fichier coûte un accès par segment.
+ *
+ * @param node L'inode examiné.
+ * @param nb_blocks Reçoit le nombre de blocs alloués.
+ * @return Le nombre de segments (0 si le fichier n'a aucun bloc).
+ */
+int file_extents(const Inode *node, int *nb_blocks) {
+    int segments = 0, precedent = -2;
+    *nb_blocks = 0;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        int b = node->blocks[i];
+        if (b != -1) {
+            (*nb_blocks)++;
+            if (b != precedent + 1) {
+                segments++;
             }
         }
-
+        precedent = b == -1 ? -2 : b;
     }
+    return segments;
+}
 
+/**
+ * @brief Affiche les informations détaillées sur un fichier ou répertoire.
+ *
+ * @param filename Nom du fichier ou répertoire à examiner.
+ * @param current_dir Inode du répertoire courant.
+ */
+void print_file_info(const char *filename, int current_dir) {
+    int inode = lookup_entry(current_dir, filename);
+    if (inode == -1) {
+        printf("Fichier '%s' introuvable\n", filename);
+        return;
+    }
     
-    fprintf(fs.log, "\nAugmentation de la taille du fichier de %d octets\n", maj_size);
+    Inode copie;
+    inode_snapshot(inode, &copie);
 
-    // Mettre a jour récursivement la taille des repertoires parents
-    int id_rep_parent = inode;
-    while (id_rep_parent != 0){
-        id_rep_parent = fs.inodes[id_rep_parent].inode_rep_parent;
-        fs.inodes[id_rep_parent].size = fs.inodes[id_rep_parent].size + maj_size;
+    Inode *node = &copie;
+    printf("Informations sur '%s':\n", filename);
+    printf("  Inode: %d\n", inode);
+    printf("  Type: %s\n", 
+           node->type == 0 ? "Répertoire" : 
+           node->type == 1 ? "Fichier" : 
+           node->type == 2 ? "Lien symbolique" : "Inconnu");
+    printf("  Taille: %d octets\n", node->size);
+    printf("  Permissions: %.3s\n", node->permissions);
+    printf("  Liens: %d\n", node->link_count);
+    if (node->type != 0) {
+        // Fragmentation : 0 % en un seul segment, 100 % si aucun bloc ne suit le précédent
+        int nb_blocks;
+        int segments = file_extents(node, &nb_blocks);
+        printf("  Blocs: %d en %d segment%s (fragmentation %d %%)\n", nb_blocks, segments,
+               segments > 1 ? "s" : "", nb_blocks > 1 ? 100 * (segments - 1) / (nb_blocks - 1) : 0);
+        int attente = __atomic_load_n(&delayed[inode].reserved, __ATOMIC_RELAXED);
+        if (attente > 0) {
+            printf("  En attente d'allocation: %d bloc%s\n", attente, attente > 1 ? "s" : "");
+        }
     }
-    
-    // Mise a jour de la tête de lecture après écriture
-    fs.opened_file[desc].tete_lecture = lecteur;
-    fprintf(fs.log, "\nTête de lecture en fin d'écriture : %d\n", lecteur);
+    char date[32];
+    printf("  Créé le: %s", ctime_r(&node->creation_time, date));
+    printf("  Modifié le: %s", ctime_r(&node->modification_time, date));
+}
 
-    return maj_size;
 
-}
 
 /**
- * @brief Lit des données à partir d'un fichier ouvert.
+ * @brief Mesure le morcellement de l'espace libre.
  *
- * @param desc Descripteur du fichier ouvert.
- * @param texte Buffer où stocker les données lues.
- * @param size Nombre d'octets à lire.
+ * @param largest Reçoit la plus longue suite de blocs libres.
+ * @return Le nombre de suites de blocs libres.
  */
-void read_file(int desc, char *texte, int size){
-
-    // Vérifier si le descripteur est valide
-    if (desc > MAX_FILE_OPEN || desc < 0 || fs.opened_file[desc].inode == -1){
-        fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
-        printf("Erreur : descrpiteur invalide\n");
-    } else if(size < 0) {
-        printf("Erreur : taille négatif\n");
-    // Vérifier que le fichier n'est pas un répertoire
-    } else if(fs.inodes[fs.opened_file[desc].inode].type != 1 && fs.inodes[fs.opened_file[desc].inode].type != 2){
-        fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
-        printf("Erreur : le type de fichier est un répertoire ou non reconnu\n");
-    } else { 
-        //Vérification permission'r'
-        int inode = fs.opened_file[desc].inode;
-        if (!has_permission(inode, 'r')) {
-            fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
-            printf("Erreur : permission de lecture refusée pour cet inode.\n");
-            return; // on stoppe la fonction ici
+int free_space_extents(int *largest) {
+    int morceaux = 0, longueur = 0;
+    *largest = 0;
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        if (fs.free_blocks[b] != 0) {
+            longueur = 0;
+            continue;
         }
-
-        // tete de lecture et inode du fichier
-        int lecteur = fs.opened_file[desc].tete_lecture;
-
-        fprintf(fs.log, "\nTête de lecture en début de lecture : %d\n", lecteur);
-
-        // chercher l'index du bloc du fichier a lire et le numero du bloc dans le file system
-        int block_index = -1;
-        int i = 0;
-        int num_block;
-        while (block_index == -1 && i<NUM_BLOCKS){
-            // Si la tete de lecture se trouve entre le bloc et le bloc suivant, on recupere le bloc
-            num_block = fs.inodes[inode].blocks[i];
-            if (sizeof(Filesystem) + num_block*BLOCK_SIZE <= lecteur && lecteur < sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){
-                block_index = i;
-            }
-            i++;
+        if (longueur++ == 0) {
+            morceaux++;
         }
-
-        // Verifier si la tete de lecture est dans le bloc
-        if(block_index == -1){
-            fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
-            printf("Erreur : la tête de lecture n'est pas dans le fichier.\n");
-        } else {
-            // On copie chaque caractere du file system dans le buffer
-            int j = 0;
-            while (j<size && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){
-                fseek(fs.file, lecteur, SEEK_SET);
-                fread(texte+j, sizeof(char),1,fs.file);
-                j++;
-                lecteur++;
-            }
-
-
-            // On réitère le processus jusqu'à la fin de la taille du mot a lire
-            int stop = 0;
-            while (j<size && !stop){
-                block_index++;
-                num_block = fs.inodes[inode].blocks[block_index];
-
-                // Vérifier si on est toujours dans le fichier
-                if(num_block == -1){
-                    stop = 1;
-                    fprintf(fs.log, "\nErreur sur la lecture du fichier de descripteur %d\n", desc);
-                    printf("Erreur : Fin du fichier dépassé par la tête de lecture\n");
-                } else {
-                    // On se positionne au bon endroit
-                    lecteur = sizeof(Filesystem) + num_block*BLOCK_SIZE;
-                    while(j<size && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){
-                        fseek(fs.file, lecteur, SEEK_SET);
-                        fread(texte+j,sizeof(char),1,fs.file);
-                        j++;
-                        lecteur++;
-                    }
-                }
-            }
+        if (longueur > *largest) {
+            *largest = longueur;
         }
-        // On marque la fin du texte
-        texte[size] = '\0';
-
-        // Mise a jour de la tête de lecture après écriture
-        fs.opened_file[desc].tete_lecture = lecteur;
-        fprintf(fs.log, "\nTête de lecture en fin de lecture : %d\n", desc);
     }
-    
-
-
+    return morceaux;
 }
 
 /**
- * @brief Ferme un fichier ouvert et libère son descripteur.
+ * @brief Cherche count blocs libres consécutifs.
  *
- * @param desc Descripteur du fichier à fermer.
+ * @param count Longueur voulue.
+ * @param from Premier bloc où la suite peut commencer.
+ * @param to La suite commence avant ce bloc (elle peut le dépasser).
+ * @return Le premier bloc de la suite, -1 s'il n'y en a pas.
  */
-void close_file(int desc){
-    // Vérifier si le descripteur est valide
-    if (desc > MAX_FILE_OPEN || desc < 0 || fs.opened_file[desc].inode == -1){
-        printf("Erreur : descrpiteur invalide\n");
-        fprintf(fs.log, "\nErreur sur la fermeture du descripteur %d\n", desc);
-    } else {
-        fs.opened_file[desc].inode = -1;
-        fs.opened_file[desc].tete_lecture = -1;
-        fprintf(fs.log, "\nDescripteur %d fermé\n", desc);
+int find_free_run(int count, int from, int to) {
+    int debut = from, longueur = 0;
+    for (int b = from; b < NUM_BLOCKS && debut < to; b++) {
+        if (fs.free_blocks[b] != 0) {
+            debut = b + 1;
+            longueur = 0;
+        } else if (++longueur == count) {
+            return debut;
+        }
     }
+    return -1;
 }
 
-
 /**
- * @brief Déplace la tête de lecture d'un fichier ouvert.
- *
- * @param desc Descripteur du fichier.
- * @param offset Décalage à appliquer.
- * @param whence Origine du déplacement : 0=début, 1=fin, 2=position actuelle.
+ * @brief Bilan d'une défragmentation.
  */
-void seek_file(int desc, int offset, int whence){
-    // Vérifier si le descripteur est valide
-    if (desc > MAX_FILE_OPEN || desc < 0 || fs.opened_file[desc].inode == -1){
-        fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
-        printf("Erreur : descrpiteur invalide\n");
-    // Offset doit etre > 0
-    } else if (offset < 0) {
-        fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
-        printf("Erreur : offset < 0\n");
-    } else {
-        // Le cas ou on se poistionne par rapport au debut
-        if (whence == 0){
-            fprintf(fs.log, "\nDéplacement à partir du début\n");
-            // On place le lecteur au debut du fichier
-            int inode = fs.opened_file[desc].inode;
-            fs.opened_file[desc].tete_lecture = sizeof(Filesystem) + fs.inodes[inode].blocks[0]*BLOCK_SIZE;
-            int lecteur = fs.opened_file[desc].tete_lecture;
-
-            fprintf(fs.log, "\nTête de lecture avant le déplacement : %d\n",lecteur);
-
-            // On avance de bloc tant qu'on arrive pas a l'endroit souhaité
-            int block_index = 0;
-            int j = 0;
-            int stop = 0;
-            while (j<offset && !stop){
-                // On se positionne au bloc suivant
-                int num_block = fs.inodes[inode].blocks[block_index];
-                if(num_block == -1){
-                    stop = 1;
-                    fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
-                    printf("Erreur : tete de lecture en dehors du fichier\n");
-                } else {
-                    // On avance tant qu'on arrive pas a l'endroit souhaité
-                    lecteur = sizeof(Filesystem) + num_block*BLOCK_SIZE;
-                    while(j<offset && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){ 
-                        j++;
-                        lecteur++;
-                    }
-                }
-                block_index++;
-            }
-            // On met a jour la tete de lecture
-            fs.opened_file[desc].tete_lecture = lecteur;
-            fprintf(fs.log, "\nTête de lecture en fin de déplacement : %d\n", lecteur);
-        
+typedef struct {
+    int examined;         /**< Fichiers examinés */
+    int moved;            /**< Déplacements de fichiers */
+    int blocks;           /**< Blocs recopiés */
+    int segments_before;  /**< Segments des fichiers examinés, avant */
+    int segments_after;   /**< ... et après */
+    int left;             /**< Fichiers restés fragmentés (blocs partagés ou pas de place d'un seul tenant) */
+} DefragStats;
 
-        } else {
-            fprintf(fs.log, "\nDéplacement par rapport à la position courante\n");
-            // Cas où on se positionne par rapport a la position courante
-            if (whence == 2){
-                int lecteur = fs.opened_file[desc].tete_lecture;
-                int inode = fs.opened_file[desc].inode;
-                int block_index = -1;
-                int i = 0;
-
-                fprintf(fs.log, "\nTête de lecture avant le déplacement : %d\n",lecteur);
+/**
+ * @brief Contexte du parcours qui rassemble les fichiers à défragmenter.
+ */
+typedef struct {
+    int files[NUM_INODES];
+    int nb;
+    unsigned char vus[NUM_INODES];
+} DefragWalk;
 
-                // On cherche l'indice du bloc du fichier et le numéro du bloc dans le file system
-                int num_block;
-                while (block_index == -1 && i<NUM_BLOCKS){
-                    num_block = fs.inodes[inode].blocks[i];
-                    if (sizeof(Filesystem) + num_block*BLOCK_SIZE <= lecteur && lecteur < sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){
-                        block_index = i;
-                    }
-                    i++;
-                }
+/**
+ * @brief Tâche de defrag : retient les fichiers d'un répertoire, pousse ses sous-répertoires.
+ */
+int defrag_visit(TaskPool *pool, int worker, Task task) {
+    DefragWalk *walk = pool->arg;
+    Directory *dir = dir_of(task.inode);
+    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
+        int child = dir->entries[i].inode_index;
+        if (child == -1 || __atomic_exchange_n(&walk->vus[child], 1, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (fs.inodes[child].type == 0) {
+            pool_push(pool, worker, (Task){child, 0, NULL});
+        } else if (fs.inodes[child].type == 1) {
+            walk->files[__atomic_fetch_add(&walk->nb, 1, __ATOMIC_RELAXED)] = child;
+        }
+    }
+    return 0;
+}
 
-                // On avance de offset par rapport a la position couante
-                int j = 0;
-                int stop = 0;
-                while (j<offset && !stop){
-                    num_block = fs.inodes[inode].blocks[block_index];
-                    // On vérifier si on est dans le fichier
-                    if(num_block == -1){
-                        stop = 1;
-                        fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
-                        printf("Erreur : tete de lecture en dehors du fichier\n");
-                    } else {
-                        // On positionne la tete de lecture et on avance
-                        lecteur = sizeof(Filesystem) + num_block*BLOCK_SIZE;
-                        while(j<offset && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){ 
-                            j++;
-                            lecteur++;
-                        }
-                    }
-                    block_index++;
-                }
-                // On met a jour la tete de lecture
-                fs.opened_file[desc].tete_lecture = lecteur;
-                fprintf(fs.log, "\nTête de lecture en fin de déplacement : %d\n", lecteur);
-            } else {
-                fprintf(fs.log, "\nDéplacement par rapport à la fin\n");
-                // Cas où on se positionne par rapport a la fin
-                if (whence == 1){
-                    // On place le lecteur au debut du fichier
-                    int inode = fs.opened_file[desc].inode;
-                    fs.opened_file[desc].tete_lecture = sizeof(Filesystem) + fs.inodes[inode].blocks[0]*BLOCK_SIZE;
-                    int lecteur = fs.opened_file[desc].tete_lecture;
-                    
-                    fprintf(fs.log, "\nTête de lecture avant le déplacement : %d\n",lecteur);
-
-                    // On avance de bloc tant qu'on arrive pas a l'endroit souhaité
-                    int block_index = 0;
-                    int j = 0;
-                    int stop = 0;
-                    int pos = fs.inodes[inode].size - offset;
-                    while (j<pos && !stop){
-                        // On se positionne au bloc suivant
-                        int num_block = fs.inodes[inode].blocks[block_index];
-                        if(num_block == -1){
-                            stop = 1;
-                            fprintf(fs.log, "\nErreur sur le déplacement dans le fichier de descripteur %d\n", desc);
-                            printf("Erreur : tete de lecture en dehors du fichier\n");
-                        } else {
-                            // On avance tant qu'on arrive pas a l'endroit souhaité
-                            lecteur = sizeof(Filesystem) + num_block*BLOCK_SIZE;
-                            while(j<pos && lecteur <= sizeof(Filesystem) + (num_block+1)*BLOCK_SIZE){ 
-                                j++;
-                                lecteur++;
-                            }
-                        }
-                        block_index++;
-                    }
-                    // On met a jour la tete de lecture
-                    fs.opened_file[desc].tete_lecture = lecteur;
-                    fprintf(fs.log, "\nTête de lecture en fin de déplacement : %d\n", lecteur);
+/**
+ * @brief Premier bloc physique d'un fichier, NUM_BLOCKS s'il n'en a aucun.
+ */
+int first_block(int inode_index) {
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        if (fs.inodes[inode_index].blocks[i] != -1) {
+            return fs.inodes[inode_index].blocks[i];
+        }
+    }
+    return NUM_BLOCKS;
+}
 
+/**
+ * @brief Ordre de qsort : fichiers triés par premier bloc physique.
+ */
+int compare_first_block(const void *a, const void *b) {
+    return first_block(*(const int *)a) - first_block(*(const int *)b);
+}
 
-                } else {
-                    printf("Erreur : option non reconnu \n");
-                    fprintf(fs.log, "\nOption de déplacement non recconu\n");
-                }
+/**
+ * @brief Rassemble les fichiers à défragmenter, dans l'ordre de leur premier bloc.
+ *
+ * Pour toute l'image, la table des inodes est lue directement : les
+ * fichiers supprimés mais encore ouverts sont compris.
+ *
+ * @param racine Répertoire (0 pour toute l'image) ou fichier.
+ * @param walk Reçoit les fichiers.
+ * @return 0 si succès, -1 si le parcours a échoué.
+ */
+int defrag_collect(int racine, DefragWalk *walk) {
+    memset(walk, 0, sizeof(DefragWalk));
+    if (fs.inodes[racine].type == 1) {
+        walk->files[walk->nb++] = racine;
+    } else if (racine == 0) {
+        for (int i = 0; i < NUM_INODES; i++) {
+            if (fs.inodes[i].type == 1 && fs.inodes[i].size != -1) {
+                walk->files[walk->nb++] = i;
             }
         }
+    } else {
+        walk->vus[racine] = 1;
+        if (pool_run(defrag_visit, walk, (Task){racine, 0, NULL}, copy_threads) == -1) {
+            return -1;
+        }
     }
+    qsort(walk->files, walk->nb, sizeof(int), compare_first_block);
+    return 0;
 }
 
-
-
 /**
- * @brief Copie un fichier vers un nouveau fichier dans un répertoire cible.
+ * @brief Range les blocs d'un fichier en une seule suite contiguë.
  *
- * @param filename Nom du fichier à copier.
- * @param newname Nouveau nom du fichier copié.
- * @param inode_dir_source Inode du répertoire source.
- * @param inode_dir_target Inode du répertoire cible.
- * @return L'inode du nouveau fichier ou -1 en cas d'erreur.
+ * Un fichier en plusieurs segments est recopié dans la première place libre
+ * assez grande à partir de son groupe d'allocation ; un fichier déjà
+ * contigu ne l'est que s'il trouve une place plus tôt dans le groupe, ce
+ * qui resserre les fichiers et regroupe l'espace libre en fin de groupe.
+ * Les trous du fichier sont conservés. Les blocs partagés (copie par
+ * partage, clone, instantané) restent en place.
+ *
+ * Les nouveaux blocs sont écrits avant que la table de blocs de l'inode ne
+ * change, en une fois, sous l'opération exclusive de l'appelant. Les
+ * anciens blocs ne sont pas libérés ici mais ajoutés à old : l'appelant les
+ * libère après avoir fini sa passe et ne les réutilise qu'une fois la
+ * nouvelle table au journal, pour qu'un arrêt brutal retrouve le fichier
+ * intact d'un côté ou de l'autre.
+ *
+ * @param inode_index Le fichier.
+ * @param st Bilan, mis à jour.
+ * @param old Reçoit les anciens blocs.
+ * @param nb_old Nombre de blocs dans old, mis à jour.
+ * @return Le nombre de blocs recopiés (0 si le fichier reste en place), -1 en cas d'erreur.
  */
-int copy_file(char *filename, char *newname, int inode_dir_source, int inode_dir_target) {
-    Directory *dir_source = &fs.directories[inode_dir_source];
-    Directory *dir_target = &fs.directories[inode_dir_target];
+int defrag_file(int inode_index, DefragStats *st, int *old, int *nb_old) {
+    Inode *inode = &fs.inodes[inode_index];
+    if (inode->type != 1 || inode->size == -1) {
+        return 0;
+    }
 
-    // Vérifier si le fichier existe
-    int source_inode_index = rechInode(filename, *dir_source);
-    if(source_inode_index == -1){
-        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
-        printf("Erreur : Fichier inexistant.\n");
-        return -1;
+    // Le minimum est un segment par morceau de fichier entre deux trous
+    int nb, morceaux = 0, partage = 0, premier = -1;
+    int segments = file_extents(inode, &nb);
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        int b = inode->blocks[i];
+        if (b == -1) {
+            continue;
+        }
+        if (premier == -1) {
+            premier = b;
+        }
+        morceaux += i == 0 || inode->blocks[i - 1] == -1;
+        partage |= fs.free_blocks[b] != 1;
     }
-    // ----- (1) Vérifier la permission 'r' sur le fichier source -----
-    if (!has_permission(source_inode_index, 'r')) {
-        printf("Erreur : pas de permission de lecture sur le fichier source '%s'.\n", filename);
-        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
-        return -1;
+    st->examined++;
+    st->segments_before += segments;
+
+    int debut_groupe = inode_group(inode_index) * GROUP_BLOCKS;
+    int cible = -1;
+    if (nb > 0 && !partage) {
+        if (segments > morceaux) {
+            cible = find_free_run(nb, debut_groupe, NUM_BLOCKS);
+            if (cible == -1) {
+                cible = find_free_run(nb, 0, debut_groupe);
+            }
+        } else {
+            cible = find_free_run(nb, premier >= debut_groupe ? debut_groupe : 0, premier);
+        }
     }
-    // ----- (2) Vérifier la permission 'w' sur le répertoire de destination -----
-    if (!has_permission(inode_dir_target, 'w')) {
-        printf("Erreur : pas de permission d'écriture dans le répertoire cible.\n");
-        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
-        return -1;
+    if (cible == -1) {
+        st->segments_after += segments;
+        st->left += segments > morceaux;
+        return 0;
     }
 
-    // Vérifier si un fichier du même nom existe dans le répertoire source
-    int exist_target_inode = rechInode(newname, *dir_target);
-    if(exist_target_inode != -1){
-        printf("Erreur : Un fichier de ce nom existe déjà dans le répertoire.\n");
-        fprintf(fs.log, "\nErreur sur la copie du fichier %s\n", filename);
-        return -1;
+    for (int k = 0; k < nb; k++) {
+        fs.free_blocks[cible + k] = 1;
     }
-
-    // Créer un fichier copie
-    int new_inode_index = create_file(newname, fs.inodes[source_inode_index].permissions, inode_dir_target);
-
-    // Vérifier si le fichier a été créé
-    if (new_inode_index == -1) {
+    // Recopie par suites de blocs consécutifs à la fois dans le fichier et dans l'image
+    char *buffer = NULL;
+    int rang = 0, erreur = 0;
+    for (int i = 0; i < NUM_BLOCKS && !erreur; ) {
+        if (inode->blocks[i] == -1) {
+            i++;
+            continue;
+        }
+        int run = 1;
+        while (i + run < NUM_BLOCKS && run < COPY_CHUNK / BLOCK_SIZE &&
+               inode->blocks[i + run] == inode->blocks[i] + run) {
+            run++;
+        }
+        erreur = copy_block_run(inode->blocks[i], cible + rang, run, &buffer) == -1;
+        rang += run;
+        i += run;
+    }
+    free(buffer);
+    if (erreur) {
+        for (int k = 0; k < nb; k++) {
+            fs.free_blocks[cible + k] = 0;
+        }
+        printf("Erreur : recopie des blocs de l'inode %d impossible.\n", inode_index);
+        fprintf(fs.log, "\nErreur sur la défragmentation de l'inode %d\n", inode_index);
         return -1;
     }
-    Inode *source_inode = &fs.inodes[source_inode_index];
-    Inode *new_inode = &fs.inodes[new_inode_index];
-
-    
-    // Mettre a jour la taille du nouveau fichier
-    new_inode->size = source_inode->size;
 
-    
+    // Un lecteur d'un autre processus ne doit pas voir ses blocs changer sous lui
+    lock_inode(inode_index, F_WRLCK);
+    rang = 0;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        if (inode->blocks[i] != -1) {
+            old[(*nb_old)++] = inode->blocks[i];
+            inode->blocks[i] = cible + rang++;
+        }
+    }
 
-    // Copier les blocs
-    char content[new_inode->size];
-    int fd1 = open_file(newname, inode_dir_target);
-    int fd2 = open_file(filename, inode_dir_source);
-    read_file(fd2, content, new_inode->size);
-    write_file(fd1, content, new_inode->size);
-    close_file(fd1);
-    close_file(fd2);
+    st->moved++;
+    st->blocks += nb;
+    st->segments_after += morceaux;
+    fprintf(fs.log, "\nDéfragmentation de l'inode %d : %d blocs, %d segments -> %d, blocs %d à %d\n",
+            inode_index, nb, segments, morceaux, cible, cible + nb - 1);
+    return nb;
+}
 
-    
-    fprintf(fs.log, "\nFichier %s copié vers le répertoire d'inode %d\n", filename, inode_dir_target);
-    printf("Fichier %s copié avec succès.\n", filename);
-    return new_inode_index;
+/**
+ * @brief Libère les anciens blocs d'une passe de défragmentation.
+ */
+void defrag_release(int *old, int nb_old) {
+    for (int k = 0; k < nb_old; k++) {
+        free_block(old[k]);
+    }
 }
 
+/**
+ * @brief Indique si la défragmentation en fond doit passer.
+ */
+int defrag_wanted() {
+    return defrag_background && !log_structured && tx_snapshot == NULL && !snapshot_mounted;
+}
 
+/**
+ * @brief Une passe de la défragmentation en fond : déplace au plus un fichier.
+ *
+ * Appelée par le récupérateur sous l'opération exclusive. Les anciens
+ * blocs sont libérés tout de suite : le récupérateur valide le journal et
+ * attend sa synchronisation avant de rendre l'opération, puis attend assez
+ * longtemps pour rester sous defrag_budget.
+ *
+ * @return Le nombre de blocs recopiés, 0 s'il n'y a rien à déplacer.
+ */
+int defrag_step() {
+    DefragWalk *walk = malloc(sizeof(DefragWalk));
+    int *old = malloc(NUM_BLOCKS * sizeof(int));
+    int blocs = 0, nb_old = 0;
+    flush_all_delayed();  // Les blocs pris ici ne doivent pas manquer aux écritures en attente
+    if (walk != NULL && old != NULL && defrag_collect(0, walk) == 0) {
+        DefragStats st = {0};
+        for (int k = 0; k < walk->nb && blocs == 0; k++) {
+            blocs = defrag_file(walk->files[k], &st, old, &nb_old);
+        }
+        defrag_release(old, nb_old);
+    }
+    free(walk);
+    free(old);
+    return blocs > 0 ? blocs : 0;
+}
 
 /**
- * Copie récursivement un répertoire (et son contenu) d'un répertoire parent source vers un répertoire parent destination.
+ * @brief Défragmente un fichier ou une arborescence, et resserre l'espace libre.
  *
- * @param srcDirName   Le nom du répertoire à copier.
- * @param srcParentDir L'inode du répertoire parent source (celui qui contient srcDirName).
- * @param dstParentDir L'inode du répertoire parent de destination (là où on veut copier).
- * @return L'inode du nouveau répertoire copié, ou -1 en cas d'erreur.
+ * Travaille par passes : une passe ne prend que de l'espace déjà libre à
+ * son début, puis libère les anciens blocs et valide le journal avant la
+ * suivante, qui peut alors s'en servir. S'arrête quand une passe ne déplace
+ * plus rien, ou après DEFRAG_ROUNDS passes.
+ *
+ * @param racine Répertoire (0 pour toute l'image) ou fichier.
+ * @param path Chemin affiché.
+ * @return 0 si succès, -1 en cas d'erreur.
  */
- int copy_directory(const char *srcDirName, const char *newname, int srcParentDir, int dstParentDir) {
-    // 1) Trouver l'inode du répertoire source
-    int srcDirInode = rechInode(srcDirName, fs.directories[srcParentDir]);
-    if (srcDirInode == -1) {
-        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
-        printf("Erreur : Le répertoire '%s' n'existe pas dans le répertoire %d.\n", srcDirName, srcParentDir);
+int defragment(int racine, const char *path) {
+    if (log_structured) {
+        printf("Erreur : en mode journalisé, le nettoyeur de segments range déjà les blocs.\n");
         return -1;
     }
-
-    // 2) Vérifier que c'est bien un répertoire
-    if (fs.inodes[srcDirInode].type != 0) {  // 0 = répertoire
-        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
-        printf("Erreur : '%s' n'est pas un répertoire.\n", srcDirName);
+    if (tx_snapshot != NULL) {
+        printf("Erreur : pas de défragmentation pendant une transaction.\n");
         return -1;
     }
-    // 3) Vérifier la permission 'r' sur le répertoire source
-    if (!has_permission(srcDirInode, 'r')) {
-        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
-        printf("Erreur : pas de permission de lecture sur le répertoire source '%s'.\n", srcDirName);
+    DefragWalk *walk = malloc(sizeof(DefragWalk));
+    int *old = malloc(NUM_BLOCKS * sizeof(int));
+    if (walk == NULL || old == NULL) {
+        free(walk);
+        free(old);
         return -1;
     }
 
-
-
-    // 4) Vérifier si un répertoire (ou fichier) du même nom existe déjà dans la destination
-    int alreadyInode = rechInode(newname, fs.directories[dstParentDir]);
-    if (alreadyInode != -1) {
-        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
-        printf("Erreur : Le nom '%s' existe déjà dans le répertoire de destination.\n", newname);
-        return -1;
+    flush_all_delayed();  // Les blocs pris ici ne doivent pas manquer aux écritures en attente
+    int plus_grand_avant, plus_grand_apres;
+    int libres_avant = free_space_extents(&plus_grand_avant);
+    DefragStats total = {0}, st = {0};
+    int status = 0;
+    for (int passe = 0; passe < DEFRAG_ROUNDS; passe++) {
+        if (defrag_collect(racine, walk) == -1) {
+            status = -1;
+            break;
+        }
+        memset(&st, 0, sizeof(st));
+        int nb_old = 0;
+        for (int k = 0; k < walk->nb && status == 0; k++) {
+            status = defrag_file(walk->files[k], &st, old, &nb_old) == -1 ? -1 : 0;
+        }
+        if (passe == 0) {
+            total.examined = st.examined;
+            total.segments_before = st.segments_before;
+        }
+        total.moved += st.moved;
+        total.blocks += st.blocks;
+        defrag_release(old, nb_old);
+        journal_sync(journal_commit());
+        if (st.moved == 0 || status == -1) {
+            break;
+        }
     }
-    // 5) Vérifier la permission 'w' sur le répertoire de destination (pour y créer un nouveau dossier)
-    if (!has_permission(dstParentDir, 'w')) {
-        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
-        printf("Erreur : pas de permission d'écriture dans le répertoire destination (inode %d).\n", dstParentDir);
+    int libres_apres = free_space_extents(&plus_grand_apres);
+    free(walk);
+    free(old);
+    if (status == -1) {
+        fprintf(fs.log, "\nErreur sur la défragmentation de %s\n", path);
         return -1;
     }
 
-    // 6) Créer un nouveau répertoire dans le répertoire parent de destination
-    int newDirInode = create_directory(newname, dstParentDir);
-    if (newDirInode == -1) {
-        fprintf(fs.log, "\nErreur sur la copie du répertoire %s\n", srcDirName);
-        printf("Erreur : Échec de la création du répertoire '%s' dans le répertoire %d.\n", newname, dstParentDir);
-        return -1;
+    // La dernière passe n'a rien déplacé : ses chiffres sont ceux de l'état final
+    printf("%d fichiers, %d déplacements (%d blocs recopiés), segments %d -> %d : %s\n",
+           total.examined, total.moved, total.blocks, total.segments_before, st.segments_after, path);
+    printf("Espace libre : %d morceau%s -> %d, plus grande suite %d -> %d blocs\n",
+           libres_avant, libres_avant > 1 ? "x" : "", libres_apres, plus_grand_avant, plus_grand_apres);
+    if (st.left > 0) {
+        printf("(%d fichiers restés fragmentés : blocs partagés ou pas de place d'un seul tenant)\n", st.left);
     }
+    fprintf(fs.log, "\nDéfragmentation de %s : %d blocs recopiés\n", path, total.blocks);
+    return 0;
+}
 
-    // 7) Parcourir le contenu du répertoire source et copier chaque entrée
-    Directory *srcDir = &fs.directories[srcDirInode];
-    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-        int childInode = srcDir->entries[i].inode_index;
-        if (childInode != -1) {
-            // Récupération des informations de l'enfant
-            const char *childName = srcDir->entries[i].filename;
-            int childType = fs.inodes[childInode].type;
 
-            if (childType == 1 || childType == 2) {
-                // 1 = fichier, 2 = lien symbolique
-                // On copie le fichier dans le nouveau répertoire
-                copy_file((char *)childName, (char *)childName, srcDirInode, newDirInode);
 
-            } else if (childType == 0) {
-                // 0 = répertoire
-                // Copie récursive du sous-répertoire
-                copy_directory(childName, childName, srcDirInode, newDirInode);
-            } 
+/**
+ * @brief Découpe une ligne de commande en arguments, sur place.
+ *
+ * Les arguments sont séparés par des espaces ou des tabulations. Une partie
+ * entre guillemets ("..." ou '...') peut contenir des espaces ; hors des
+ * apostrophes, une barre oblique inverse protège le caractère suivant.
+ *
+ * @param line La ligne à découper (modifiée).
+ * @param argv Reçoit les arguments.
+ * @param max_args Taille de argv.
+ * @return Le nombre d'arguments, -1 s'il y en a trop, -2 si un guillemet n'est pas fermé.
+ */
+int tokenize(char *line, char **argv, int max_args) {
+    int argc = 0;
+    char *lire = line;
+    char *ecrire = line;
+
+    while (1) {
+        while (*lire == ' ' || *lire == '\t') {
+            lire++;
+        }
+        if (*lire == '\0') {
+            return argc;
+        }
+        if (argc == max_args) {
+            return -1;
+        }
+        argv[argc++] = ecrire;
+
+        char guillemet = 0;
+        while (*lire != '\0' && (guillemet || (*lire != ' ' && *lire != '\t'))) {
+            if (guillemet && *lire == guillemet) {
+                guillemet = 0;
+                lire++;
+            } else if (!guillemet && (*lire == '"' || *lire == '\'')) {
+                guillemet = *lire++;
+            } else {
+                if (*lire == '\\' && guillemet != '\'' && lire[1] != '\0') {
+                    lire++;
+                }
+                *ecrire++ = *lire++;
+            }
+        }
+        if (guillemet) {
+            return -2;
+        }
+        int suite = *lire != '\0';
+        *ecrire++ = '\0';  // ecrire ne dépasse jamais lire : on peut terminer l'argument sur place
+        if (suite) {
+            lire++;
         }
     }
-
-    fprintf(fs.log, "\nRépertoire '%s' (inode %d) copié dans le répertoire %d (nouveau inode %d)\n", srcDirName, srcDirInode, dstParentDir, newDirInode);
-    printf("Répertoire '%s' (inode %d) copié dans le répertoire %d (nouveau inode %d).\n", srcDirName, srcDirInode, dstParentDir, newDirInode);
-
-    return newDirInode;
 }
 
-
+/**
+ * @brief exit : termine la session.
+ */
+int cmd_exit(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv; (void)cwd;
+    return 1;
+}
 
 /**
- * @brief Crée un lien dur vers un fichier existant.
- *
- * @param link_name Nom du nouveau lien dur.
- * @param filename Nom du fichier source.
- * @param inode_dir_source Inode du répertoire contenant le fichier source.
- * @param inode_dir_target Inode du répertoire cible où sera créé le lien dur.
- * @return 0 en cas de succès, -1 en cas d'erreur.
+ * @brief checkpoint : valide le journal et réécrit les tables sur disque.
  */
-int create_hard_link(const char *link_name, char *filename, int inode_dir_source, int inode_dir_target) {
-    // Répertoire source et cible
-    Directory *dir_source = &fs.directories[inode_dir_source];
-    Directory *dir_target = &fs.directories[inode_dir_target];
-    int inode_index = rechInode(filename, *dir_source);
+int cmd_checkpoint(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv; (void)cwd;
+    checkpoint_filesystem();
+    return 0;
+}
 
-    // Vérifier si le fichier existe
-    if(inode_index == -1){
-        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
-        printf("Erreur: Fichier inexistant.\n");
+/**
+ * @brief begin : ouvre une transaction.
+ */
+int cmd_begin(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv; (void)cwd;
+    if (begin_transaction() == -1) {
         return -1;
     }
+    printf("Transaction ouverte.\n");
+    return 0;
+}
 
-    // Vérifier au cas où un fichier du nom du lien existe dans la cible
-    int exist_target_inode = rechInode(link_name, *dir_target);
-    if(exist_target_inode != -1){
-        printf("Erreur : Un fichier de ce nom existe déjà dans le répertoire.\n");
-        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
+/**
+ * @brief commit : valide la transaction en cours.
+ */
+int cmd_commit(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv; (void)cwd;
+    if (commit_transaction() == -1) {
         return -1;
     }
+    printf("Transaction validée.\n");
+    return 0;
+}
 
-    // Chercher une entrée libre dans le répertoire
-    int index = rechEntree(inode_dir_target);
-    if (index == -1){
-        printf("Erreur: Pas d'espace libre dans le répertoire.\n");
-        fprintf(fs.log, "\nErreur sur la création de lien dur pour le fichier %s\n", filename);
+/**
+ * @brief abort : annule la transaction en cours.
+ */
+int cmd_abort(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv;
+    if (abort_transaction() == -1) {
         return -1;
     }
-
-    // Ajouter le lien dans le répertoire cible
-    strncpy(dir_target->entries[index].filename, link_name, MAX_FILE_NAME);
-    dir_target->entries[index].inode_index = inode_index;
-    fs.inodes[inode_index].link_count++;  // Incrémenter le nombre de liens
-    printf("Lien dur '%s' créé pour le fichier '%s'.\n", link_name, filename);
-    fprintf(fs.log, "\nLien dur '%s' créé pour le fichier '%s'.\n", link_name, filename);
+    *cwd = fs.current_dir;  // Le répertoire courant a pu être supprimé pendant la transaction
+    printf("Transaction annulée.\n");
     return 0;
-    
 }
 
-
 /**
- * @brief Déplace un fichier d'un répertoire source vers un répertoire cible.
- *
- * @param filename Nom du fichier à déplacer.
- * @param inode_dir_source Inode du répertoire source.
- * @param inode_dir_target Inode du répertoire cible.
+ * @brief help : affiche la liste des commandes.
  */
-void move_file(char *filename, int inode_dir_source, int inode_dir_target) {
-    Directory *dir_source = &fs.directories[inode_dir_source];
-    Directory *dir_target = &fs.directories[inode_dir_target];
-
-    // Vérifier si le fichier existe
-    int inode_index = rechInode(filename, *dir_source);
-    if(inode_index == -1){
-        fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
-        printf("Erreur: Fichier inexistant.\n");
-    } else {
-         // Vérifier la permission 'w' sur le répertoire source (on va enlever l'entrée)
-        if (!has_permission(inode_dir_source, 'w')) {
-            printf("Erreur : pas de permission d'écriture dans le répertoire source (inode %d).\n", inode_dir_source);
-            fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
-            return;
-        }
-
-        // Vérifier si aucun fichier du même nom existe dans le répertoire cible
-        int exist_target_inode = rechInode(filename, *dir_target);
-        if(exist_target_inode != -1){
-            printf("Erreur : Un fichier de ce nom existe déjà dans le répertoire.\n");
-            fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
-        } else {
-            if (!has_permission(inode_dir_target, 'w')) {
-                printf("Erreur : pas de permission d'écriture dans le répertoire cible (inode %d).\n", inode_dir_target);
-                fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
-                return;
-            }
-        
-
-            Inode *inode = &fs.inodes[inode_index];
-            
-            // Chercher une entrée libre dans le répertoire
-            int index = rechEntree(inode_dir_target);
-            if (index == -1){
-                printf("Erreur: Pas d'espace libre dans le répertoire cible.\n");
-                fprintf(fs.log, "\nErreur sur le déplacement du fichier %s\n", filename);
-            } else {
-
-                
+int cmd_help(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv; (void)cwd;
+    print_help();
+    return 0;
+}
 
-                // Ajouter le fichier au répertoire cible
-                strncpy(dir_target->entries[index].filename, filename, MAX_FILE_NAME);
-                dir_target->entries[index].inode_index = inode_index;
+/**
+ * @brief ls : liste le contenu du répertoire courant.
+ */
+int cmd_ls(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv;
+    list_directory(*cwd);
+    return 0;
+}
 
-                
+/**
+ * @brief pwd : affiche le chemin du répertoire courant.
+ */
+int cmd_pwd(int argc, char **argv, int *cwd) {
+    (void)argc; (void)argv;
+    char path[2048] = "";
+    generate_full_path(*cwd, path, sizeof(path));
 
-                // Supprimer l'entrée du répertoire
-                int i = 0;
-                int stop = 0;
-                while (!stop) {
-                    if (dir_source->entries[i].inode_index == inode_index && strcmp(filename, dir_source->entries[i].filename) == 0) {
-                        dir_source->entries[i].inode_index = -1;
-                        memset(dir_source->entries[i].filename, 0, MAX_FILE_NAME);
-                        stop = 1;
-                    }
-                    i++;
-                }
-                
-                inode->modification_time = time(NULL);  // Mettre à jour le temps de modification
+    // Vérifier si le chemin commence par '/' et éviter une double barre
+    printf("/%s\n", path[0] == '/' ? path + 1 : path);
+    return 0;
+}
 
-                printf("Fichier déplacé de répertoire %d à répertoire %d.\n", inode_dir_source, inode_dir_target);
-                fprintf(fs.log, "\nFichier déplacé de répertoire %d à répertoire %d\n", inode_dir_source, inode_dir_target);
-            }
-        }
+/**
+ * @brief cd : change de répertoire courant.
+ */
+int cmd_cd(int argc, char **argv, int *cwd) {
+    (void)argc;
+    int new_dir = changerRep(argv[1], *cwd);
+    // Vérifier si on a pu accéder a un nouveau répertoire (changerRep a affiché l'erreur)
+    if (new_dir == -1) {
+        return -1;
+    }
+    *cwd = new_dir;
+    if (!serving) {
+        fs.current_dir = new_dir;  // Chaque client du serveur a son propre répertoire courant
     }
+    return 0;
 }
 
+/**
+ * @brief clone : copie une arborescence en partageant ses blocs.
+ */
+int cmd_clone(int argc, char **argv, int *cwd) {
+    (void)argc;
+    // argv[1] = répertoire source, argv[2] = chemin du clone (le dernier composant est son nom)
+    int source = get_inode_from_path(argv[1], *cwd);
+    if (source == -1) {
+        printf("Erreur : répertoire source introuvable.\n");
+        return -1;
+    }
+    char parent_path[1024];
+    strncpy(parent_path, argv[2], sizeof(parent_path) - 1);
+    parent_path[sizeof(parent_path) - 1] = '\0';
+    char *slash = strrchr(parent_path, '/');
+    const char *name = argv[2];
+    int parent = *cwd;
+    if (slash != NULL) {
+        *slash = '\0';
+        name = slash + 1;
+        parent = get_inode_from_path(parent_path[0] == '\0' ? "/" : parent_path, *cwd);
+    }
+    if (parent == -1 || name[0] == '\0') {
+        printf("Erreur : destination invalide.\n");
+        return -1;
+    }
+    if (clone_directory(source, parent, name) == -1) {
+        return -1;
+    }
+    printf("Répertoire '%s' cloné en '%s'.\n", argv[1], argv[2]);
+    return 0;
+}
 
+/**
+ * @brief mkdir : crée un répertoire.
+ */
+int cmd_mkdir(int argc, char **argv, int *cwd) {
+    (void)argc;
+    if (create_directory(argv[1], *cwd) == -1) {
+        printf("Erreur: impossible de créer le répertoire\n");
+        return -1;
+    }
+    return 0;
+}
 
+/**
+ * @brief touch : crée un fichier vide.
+ */
+int cmd_touch(int argc, char **argv, int *cwd) {
+    (void)argc;
+    if (create_file(argv[1], "rw-", *cwd) == -1) {
+        printf("Erreur: impossible de créer le fichier\n");
+        return -1;
+    }
+    return 0;
+}
 
+/**
+ * @brief rm : supprime un fichier.
+ */
+int cmd_rm(int argc, char **argv, int *cwd) {
+    (void)argc;
+    return delete_file(argv[1], *cwd);
+}
 
-
-
+/**
+ * @brief remdir : supprime un répertoire.
+ */
+int cmd_remdir(int argc, char **argv, int *cwd) {
+    (void)argc;
+    if (delete_directory(argv[1], *cwd) == -1) {
+        printf("Erreur: impossible de supprimer le répertoire\n");
+        return -1;
+    }
+    return 0;
+}
 
 /**
- * @brief Sauvegarde l'état du système de fichiers dans un fichier binaire.
- *
- * @param filename Nom du fichier où stocker les données du système de fichiers.
+ * @brief put : importe dans l'image un fichier de l'hôte, ou une arborescence avec -r.
  */
-void save_filesystem(const char *filename) {
-    // Fermeture de l'instance du filesystem pour éviter les problèmes d'accès concurrents
-    fclose(fs.file);
+int cmd_put(int argc, char **argv, int *cwd) {
+    // "put -r hostdir imagepath" importe une arborescence complète
+    int recursif = strcmp(argv[1], "-r") == 0;
+    if (argc != (recursif ? 4 : 3)) {
+        printf("Usage : put [-r] <chemin_hote> <chemin_image>\n");
+        return -1;
+    }
+    char *source = argv[argc - 2];
+    char name[MAX_FILE_NAME];
+    int dest = resolve_import_target(source, argv[argc - 1], *cwd, name);
+    if (dest == -1) {
+        return -1;
+    }
 
-    FILE *file = fopen(filename, "rb+");  // Ouverture en mode binaire écriture
-    if (!file) {
-        perror("Erreur lors de la sauvegarde du système de fichiers");
-        fprintf(fs.log, "\nErreur lors de la sauvegarde du filesystem\n");
-        return;
+    struct timespec debut, fin;
+    clock_gettime(CLOCK_MONOTONIC, &debut);
+    int inode = recursif ? import_tree(source, name, dest) : import_file(source, name, dest);
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    fprintf(fs.log, "\nImport de '%s' : %.3f ms\n", source,
+            (fin.tv_sec - debut.tv_sec) * 1e3 + (fin.tv_nsec - debut.tv_nsec) / 1e6);
+    if (inode == -1) {
+        printf("Erreur lors de l'import\n");
+        return -1;
     }
+    printf("'%s' importé avec succès.\n", source);
+    return 0;
+}
 
-    fwrite(&fs, sizeof(Filesystem), 1, file);  // Écriture de toute la structure
-    fclose(file);
+/**
+ * @brief get : exporte vers l'hôte un fichier de l'image, ou une arborescence avec -r.
+ */
+int cmd_get(int argc, char **argv, int *cwd) {
+    // "get -r imagepath hostpath" exporte une arborescence complète
+    int recursif = strcmp(argv[1], "-r") == 0;
+    if (argc != (recursif ? 4 : 3)) {
+        printf("Usage : get [-r] <chemin_image> <chemin_hote>\n");
+        return -1;
+    }
+    char *source = argv[argc - 2];
+    char *dest = argv[argc - 1];
+    int inode = get_inode_from_path(source, *cwd);
+    if (inode == -1) {
+        printf("Erreur : fichier non existant \n");
+        return -1;
+    }
+    if (fs.inodes[inode].type == 0 && !recursif) {
+        printf("Erreur : '%s' est un répertoire (utiliser get -r).\n", source);
+        return -1;
+    }
 
-    // On ouvre le l'instance du filesystem
-    fs.file = fopen(filename, "rb+");
-    fprintf(fs.log, "\nSystème de fichier sauvegardé avec succès\n");
+    // Destination = répertoire hôte existant : garder le nom de la source
+    char hostpath[4096];
+    struct stat st;
+    if (stat(dest, &st) == 0 && S_ISDIR(st.st_mode) && inode != 0) {
+        const char *base = strrchr(source, '/');
+        snprintf(hostpath, sizeof(hostpath), "%s/%s", dest, base ? base + 1 : source);
+    } else {
+        snprintf(hostpath, sizeof(hostpath), "%s", dest);
+    }
+
+    struct timespec debut, fin;
+    clock_gettime(CLOCK_MONOTONIC, &debut);
+    int ok = fs.inodes[inode].type == 0 ? export_tree(inode, hostpath) : export_file(inode, hostpath);
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    fprintf(fs.log, "\nExport de '%s' : %.3f ms\n", source,
+            (fin.tv_sec - debut.tv_sec) * 1e3 + (fin.tv_nsec - debut.tv_nsec) / 1e6);
+    if (ok == -1) {
+        printf("Erreur lors de l'export\n");
+        return -1;
+    }
+    printf("'%s' exporté vers '%s'.\n", source, hostpath);
+    return 0;
 }
 
 /**
- * @brief Charge l'état du système de fichiers depuis un fichier binaire.
- *
- * @param filename Nom du fichier contenant la sauvegarde.
+ * @brief cp : copie un fichier (blocs partagés, ou recopiés avec --full).
  */
-void load_filesystem(const char *filename) {
-    FILE *file = fopen(filename, "rb");  // Ouverture en mode lecture binaire
-    if (!file) {
-        printf("Aucune sauvegarde trouvée. Initialisation d'un nouveau système.\n");
-        init_filesystem(filename);
+int cmd_cp(int argc, char **argv, int *cwd) {
+    // "cp --full src newname dest" recopie le contenu au lieu de partager les blocs
+    int partage = strcmp(argv[1], "--full") != 0;
+    if (argc != (partage ? 4 : 5)) {
+        printf("Usage : cp [--full] <src> <newname> <dest_path>\n");
+        return -1;
+    }
+    char *source = argv[argc - 3];
+    char *newname = argv[argc - 2];
+    int inode = get_inode_from_path(argv[argc - 1], *cwd);
+    // Vérifier si le chemin est bien valide et est un répertoire
+    if (inode == -1 || fs.inodes[inode].type != 0){
+        printf("Erreur : répertoire cible invalide.\n");
+        return -1;
+    }
+    // Vérifier l'existence du fichier a copier
+    int inode_src = rechInode(source, dir_of(*cwd));
+    if (inode_src == -1){
+        printf("Erreur : fichier non existant \n");
+        return -1;
+    }
+    // Vérifier le type de fichier pour choisir la fonction coper a effectuer
+    int resultat;
+    if (fs.inodes[inode_src].type == 1 || fs.inodes[inode_src].type == 2){
+        resultat = copy_file(source, newname, *cwd, inode, partage);
+    } else if (fs.inodes[inode_src].type == 0) {
+        resultat = copy_directory(source, newname, *cwd, inode, partage);
     } else {
-        fread(&fs, sizeof(Filesystem), 1, file);  // Lecture des données enregistrées
-        fclose(file);
-        printf("Système de fichiers chargé avec succès.\n");
-        fs.file = fopen(filename, "rb+");
-        fs.log = fopen("log.txt", "a");   // Création du fichier texte pour les log
-        fprintf(fs.log, "\nSystème de fichier chargé avec succès\n");
+        printf("Erreur : type de fichier non reconnu\n");
+        return -1;
     }
+    if (resultat == -1) {
+        printf("Erreur lors de la copie\n");
+        return -1;
+    }
+    return 0;
 }
 
 /**
- * @brief Verrouille le système de fichiers pour éviter les accès concurrents.
+ * @brief mv : déplace ou renomme un fichier.
  */
-void lock_filesystem() {
-    int fd = fileno(fs.file);  // Obtenir le descripteur de fichier
-    flock(fd, LOCK_EX);  // Appliquer un verrou exclusif
+int cmd_mv(int argc, char **argv, int *cwd) {
+    (void)argc;
+    int src_inode = rechInode(argv[1], dir_of(*cwd));
+    // Vérifier la validité de l'inode
+    if (src_inode == -1) {
+        printf("Erreur: fichier source introuvable\n");
+        return -1;
+    }
+    int dest_dir = get_inode_from_path(argv[2], *cwd);
+    // Vérifier que le chemin est un répertoire
+    if (dest_dir == -1 || fs.inodes[dest_dir].type != 0) {
+        printf("Erreur : répertoire cible invalide.\n");
+        return -1;
+    }
+    // Vérifier le typre de fichier a deplacer
+    if (fs.inodes[src_inode].type == 0){
+        return move_directory(argv[1], *cwd, dest_dir) == -1 ? -1 : 0;
+    } else if (fs.inodes[src_inode].type == 1 || fs.inodes[src_inode].type == 2){
+        return move_file(argv[1], *cwd, dest_dir);
+    }
+    printf("Erreur : type de fichier non reconnu\n");
+    return -1;
 }
 
 /**
- * Déverrouille le système de fichiers.
+ * @brief ln : crée un lien physique.
  */
-void unlock_filesystem() {
-    int fd = fileno(fs.file);
-    flock(fd, LOCK_UN);  // Libérer le verrou
+int cmd_ln(int argc, char **argv, int *cwd) {
+    (void)argc;
+    int inode = get_inode_from_path(argv[3], *cwd);
+    // Vérifier que le chemin mène a un répertoire
+    if (inode == -1 || fs.inodes[inode].type != 0){
+        printf("Erreur : répertoire cible invalide.\n");
+        return -1;
+    }
+    if (create_hard_link(argv[2], argv[1], *cwd, inode) == -1) {
+        printf("Erreur lors de la création du lien dur\n");
+        return -1;
+    }
+    return 0;
 }
 
+/**
+ * @brief sym : crée un lien symbolique.
+ */
+int cmd_sym(int argc, char **argv, int *cwd) {
+    (void)argc;
+    if (create_symbolic_link(argv[2], argv[1], *cwd) == -1) {
+        printf("Erreur lors de la création du lien symbolique\n");
+        return -1;
+    }
+    return 0;
+}
 
 /**
- * @brief Affiche l'état actuel du système de fichiers (inodes et répertoire courant).
- *
- * @param current_dir Inode du répertoire courant.
+ * @brief rfile et cat : affichent le contenu d'un fichier (cat l'envoie brut).
  */
-void display_filesystem(int current_dir) {
-    Directory dir = fs.directories[current_dir];
+int cmd_rfile(int argc, char **argv, int *cwd) {
+    (void)argc;
+    // rfile présente le contenu, cat l'envoie brut (utilisable dans un tube)
+    int brut = strcmp(argv[0], "cat") == 0;
+    int inode = brut ? get_inode_from_path(argv[1], *cwd) : rechInode(argv[1], dir_of(*cwd));
+    // Un lien symbolique est lu à travers sa cible
+    if (inode != -1) {
+        inode = resolve_symlink(inode);
+    }
+    // Vérifier que le fichier existe
+    if(inode == -1){
+        printf("Erreur : fichier non existant\n");
+        return -1;
+    } else if(fs.inodes[inode].type == 0) {
+        printf("Erreur : tentation de lecture d'un répertoire\n");
+        return -1;
+    } else if(fs.inodes[inode].type != 1) {
+        printf("Erreur : type de fichier non reconnu\n");
+        return -1;
+    } else if (!has_permission(inode, 'r')) {
+        printf("Erreur : permission de lecture refusée pour cet inode.\n");
+        return -1;
+    }
 
-    printf("\n===== État du système de fichiers =====\n");
+    // Seul le fichier reste verrouillé pendant la lecture : les écrivains
+    // d'autres processus peuvent travailler sur le reste de l'image
+    lock_inode(inode, F_RDLCK);
+    release_metadata();
 
-    // Affichage des inodes
-    printf("Inodes utilisés :\n");
-    for (int i = 0; i < NUM_INODES; i++) {
-        if (fs.inodes[i].size >= 0) { // Seuls les inodes utilisés sont affichés
-            printf("Inode %d: Taille=%d octets, Liens=%d, Permissions=%s\n",
-                   fs.inodes[i].id, fs.inodes[i].size, fs.inodes[i].link_count, fs.inodes[i].permissions);
-        }
+    if (!brut) {
+        printf("contenu du fichier : ");
     }
-
-    // Affichage des fichiers dans le répertoire courant
-    printf("\nRépertoire courant :\n");
-    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-        if (dir.entries[i].inode_index != -1) {
-            printf("- %s (inode %d) (type %d)\n", dir.entries[i].filename, dir.entries[i].inode_index, fs.inodes[dir.entries[i].inode_index].type);
-        }
+    if (stream_file(inode, STDOUT_FILENO) == -1) {
+        printf("Erreur lors de la lecture\n");
+        return -1;
     }
-    printf("\n=======================================\n");
+    if (!brut) {
+        printf("\n");
+    }
+    return 0;
 }
 
-
 /**
- * @brief Change le répertoire courant en suivant le chemin spécifié.
- *
- * @param path Chemin absolu ou relatif vers le nouveau répertoire.
- * @param inode_dir Inode du répertoire actuel.
- * @return Inode du nouveau répertoire courant ou l'inode initial en cas d'erreur.
+ * @brief wfile : écrit du texte dans un fichier.
  */
-int changerRep(char *path, int inode_dir){
-
-    // On cherche l'inode du chemin
-    int inode = get_inode_from_path(path, inode_dir);
-
-    // Vérifier si le chemin est valide
-    if (inode == -1){
-        fprintf(fs.log, "\nErreur sur le changement de répertoire vers %s\n", path);
-        printf("Erreur : chemin non valide\n");
-        return inode_dir;
+int cmd_wfile(int argc, char **argv, int *cwd) {
+    // Vérification si on ajoute ou on ecrase le contenu
+    if (strcmp(argv[2], "add") != 0 && strcmp(argv[2], "rewrite") != 0) {
+        printf("mode d'écriture non reconnu\n");
+        return -1;
     }
 
-    // Vérifier si on a bien un répertoire
-    if (fs.inodes[inode].type != 0){
-        fprintf(fs.log, "\nErreur sur le changement de répertoire vers %s\n", path);
-        printf("Erreur : le fichier cible du chemin n'est pas un répertoire.\n");
-        return inode_dir;
+    // Le texte est normalement un seul argument ("entre guillemets" s'il contient
+    // des espaces) ; plusieurs mots non protégés sont recollés par un espace
+    char texte[1024] = "";
+    for (int i = 3; i < argc; i++) {
+        if (i > 3) {
+            strncat(texte, " ", sizeof(texte) - strlen(texte) - 1);
+        }
+        strncat(texte, argv[i], sizeof(texte) - strlen(texte) - 1);
     }
 
-    fprintf(fs.log, "\nNouveau répertoire courant : %s\n", path);
-    return inode;
+    int fd = open_file(argv[1], *cwd);
+    if (fd == -1) {
+        return -1;
+    }
+    int size = strlen(texte);
+    // add : écrire à la fin du fichier, rewrite : au début
+    seek_file(fd, 0, strcmp(argv[2], "add") == 0 ? 1 : 0);
+    int ecrit = write_file(fd, texte, size);
+    close_file(fd);
+    return ecrit == size ? 0 : -1;
 }
 
-
-
 /**
- * @brief Affiche le message d'aide décrivant les commandes disponibles.
+ * @brief stat : affiche les informations d'un fichier.
  */
-void print_help() {
-    printf("Mini Gestionnaire de Fichiers\n");
-    printf("Usage: ./filesystem [OPTIONS]\n\n");
-
-    printf("Options:\n");
-    printf("  --help           Affiche ce message d'aide\n");
-    printf("  --init           Force une nouvelle initialisation du système de fichiers\n\n");
-
-    printf("Commandes disponibles en mode interactif :\n");
-    printf("  cd <path>                        Changer de répertoire\n");
-    printf("  chmod <fichier> <perms>          Modifier les permissions (ex: rwx, r--, etc.)\n");
-    printf("  cp <src> <newname> <dest_path>   Copier un fichier ou répertoire\n");
-    printf("  exit                             Quitter le programme\n");
-    printf("  help                             Afficher ce message d'aide\n");
-    printf("  ln <filename> <linkname> <path>  Créer un lien dur du fichier filename dans le répertoire path\n");
-    printf("  ls                               Lister les fichiers du répertoire courant\n");
-    printf("  mkdir <dir>                      Créer un répertoire\n");
-    printf("  mv <src> <dest_path>             Déplacer un fichier ou répertoire\n");
-    printf("  pwd                              Afficher le répertoire courant\n");
-    printf("  remdir <dir>                     Supprimer un répertoire récursivement\n");
-    printf("  rm <file>                        Supprimer un fichier\n");
-    printf("  rfile <filename>                 Afficher le contenu d'un fichier\n");
-    printf("  stat <file>                      Afficher les informations d'un fichier ou répertoire\n");
-    printf("  sym <target_path> <linkname>     Créer un lien symbolique vers le fichier dans path\n");
-    printf("  touch <file>                     Créer un fichier vide\n");
-    printf("  wfile <filename> <mode> <texte>  Écrire dans un fichier (modes: add, rewrite)\n");
+int cmd_stat(int argc, char **argv, int *cwd) {
+    (void)argc;
+    int status = rechInode(argv[1], dir_of(*cwd)) == -1 ? -1 : 0;
+    print_file_info(argv[1], *cwd);
+    return status;
 }
 
-
 /**
- * @brief Affiche le prompt avec le chemin complet du répertoire courant.
- *
- * @param current_dir Inode du répertoire courant.
+ * @brief snapshot : crée, supprime ou liste les instantanés.
  */
-void print_prompt(int current_dir) {
-    // Augmenter la taille du buffer pour le chemin
-    char path[2048] = "";  // Augmenté de 1024 à 2048
-    int dir = current_dir;
-    
-    printf("fs:/");
-
-    while (dir != 0 && dir != -1) {
-        char dirname[MAX_FILE_NAME] = "?";
-        int parent = fs.inodes[dir].inode_rep_parent;
-        
-        // Vérifier que le parent est valide avant d'y accéder
-        if (parent < 0 || parent >= NUM_DIRECTORY_ENTRIES) {
-            break;
-        }
-
-        Directory *parent_dir = &fs.directories[parent];
-
-        for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-            if (parent_dir->entries[i].inode_index == dir) {
-                strncpy(dirname, parent_dir->entries[i].filename, MAX_FILE_NAME - 1);
-                dirname[MAX_FILE_NAME - 1] = '\0'; // Assurer la terminaison
-                break;
-            }
+int cmd_snapshot(int argc, char **argv, int *cwd) {
+    (void)cwd;
+    // argv[1] = create, delete ou list, argv[2] = nom de l'instantané
+    if (strcmp(argv[1], "list") == 0 && argc == 2) {
+        list_snapshots();
+        return 0;
+    }
+    if (strcmp(argv[1], "create") == 0 && argc == 3) {
+        if (create_snapshot(argv[2]) == -1) {
+            return -1;
         }
-
-        // Vérifier si nous avons assez d'espace avant de concaténer
-        if (strlen(dirname) + strlen(path) + 2 < sizeof(path)) {  // +2 pour '/' et '\0'
-            char temp[2048] = "/";
-            strncat(temp, dirname, sizeof(temp) - strlen(temp) - 1);
-            strncat(temp, path, sizeof(temp) - strlen(temp) - 1);
-            strncpy(path, temp, sizeof(path) - 1);
-            path[sizeof(path) - 1] = '\0';  // Assurer la terminaison
-        } else {
-            printf("[chemin trop long]");
-            break;
+        printf("Instantané '%s' créé.\n", argv[2]);
+        return 0;
+    }
+    if (strcmp(argv[1], "delete") == 0 && argc == 3) {
+        int liberes = delete_snapshot(argv[2]);
+        if (liberes == -1) {
+            return -1;
         }
-
-        dir = parent;
+        printf("Instantané '%s' supprimé (%d blocs libérés).\n", argv[2], liberes);
+        return 0;
     }
-    
-    printf("%s> ", path);
-    fflush(stdout);
+    printf("Usage : snapshot <create|delete> <nom> | snapshot list\n");
+    return -1;
 }
 
-
 /**
- * @brief Génère le chemin complet à partir de l'inode du répertoire courant.
+ * @brief Résout le répertoire d'un parcours (du, find) et son chemin absolu.
  *
- * @param current_dir Inode du répertoire courant.
- * @param path Buffer où stocker le chemin généré.
- * @param path_size Taille du buffer fourni.
+ * @return L'inode du répertoire, ou -1 si le chemin n'en désigne pas un.
  */
-void generate_full_path(int current_dir, char *path, size_t path_size) {
-    if (!path || path_size == 0) return; // Vérifier les paramètres
-
-    path[0] = '\0';  // Initialiser comme une chaîne vide
-    int dir = current_dir;
-
-    while (dir != 0 && dir != -1) {
-        char dirname[MAX_FILE_NAME] = "?";
-        int parent = fs.inodes[dir].inode_rep_parent;
+int walk_root(const char *path, int cwd, char *absolu, size_t size) {
+    int inode = get_inode_from_path(path, cwd);
+    if (inode == -1 || fs.inodes[inode].type != 0) {
+        printf("Erreur : '%s' n'est pas un répertoire.\n", path);
+        return -1;
+    }
+    generate_full_path(inode, absolu, size);
+    if (absolu[0] == '\0') {
+        snprintf(absolu, size, "/");
+    }
+    return inode;
+}
 
-        // Vérifier que l'index du parent est valide
-        if (parent < 0 || parent >= NUM_DIRECTORY_ENTRIES) break;
+/**
+ * @brief du : affiche l'espace occupé par une arborescence.
+ */
+int cmd_du(int argc, char **argv, int *cwd) {
+    char absolu[2048];
+    int inode = walk_root(argc > 1 ? argv[1] : ".", *cwd, absolu, sizeof(absolu));
+    return inode == -1 ? -1 : disk_usage(inode, absolu);
+}
 
-        Directory *parent_dir = &fs.directories[parent];
+/**
+ * @brief find : liste les entrées d'une arborescence, filtrées par nom.
+ */
+int cmd_find(int argc, char **argv, int *cwd) {
+    char absolu[2048];
+    int inode = walk_root(argv[1], *cwd, absolu, sizeof(absolu));
+    if (inode == -1 || find_entries(inode, absolu, argc > 2 ? argv[2] : NULL) == -1) {
+        return -1;
+    }
+    return 0;
+}
 
-        for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-            if (parent_dir->entries[i].inode_index == dir) {
-                strncpy(dirname, parent_dir->entries[i].filename, MAX_FILE_NAME - 1);
-                dirname[MAX_FILE_NAME - 1] = '\0';  // S'assurer de la terminaison
-                break;
-            }
+/**
+ * @brief chmod : change les permissions d'un fichier ou d'une arborescence.
+ */
+int cmd_chmod(int argc, char **argv, int *cwd) {
+    // "chmod -R dir perms" change aussi toute l'arborescence de dir
+    if (argc == 4) {
+        int inode = strcmp(argv[1], "-R") == 0 ? get_inode_from_path(argv[2], *cwd) : -1;
+        if (inode == -1 || fs.inodes[inode].type != 0) {
+            printf("Usage : chmod [-R] <file> <perms>\n");
+            return -1;
         }
-
-        // Vérifier si on a assez de place avant de concaténer
-        if (strlen(path) + strlen(dirname) + 2 < path_size) {
-            char temp[2048];
-            snprintf(temp, sizeof(temp), "/%s%s", dirname, path);
-            strncpy(path, temp, path_size - 1);
-            path[path_size - 1] = '\0';  // Assurer la terminaison
-        } else {
-            strncpy(path, "[chemin trop long]", path_size - 1);
-            path[path_size - 1] = '\0';
-            break;
+        int nb = change_permissions_tree(inode, argv[3]);
+        if (nb == -1) {
+            printf("Erreur : impossible de modifier les permissions.\n");
+            return -1;
         }
-
-        dir = parent;
+        printf("Permissions de %d entrées sous '%s' modifiées en '%.3s'.\n", nb, argv[2], argv[3]);
+        return 0;
+    }
+    // argv[1] = nom du fichier/répertoire, argv[2] = nouvelles permissions
+    if (change_permissions(argv[1], argv[2], *cwd) == -1) {
+        printf("Erreur : impossible de modifier les permissions.\n");
+        return -1;
     }
+    return 0;
 }
 
 /**
- * @brief Affiche les descripteurs de fichiers actuellement ouverts.
+ * @brief defrag : défragmente l'image, ou pilote la défragmentation en fond.
  */
-void print_desc(){
-    for (int i = 0; i < MAX_FILE_OPEN ; i++){
-        if (fs.opened_file[i].inode != -1){
-            printf("Descripteur %d : inode %d\n", i, fs.opened_file[i].inode);
+int cmd_defrag(int argc, char **argv, int *cwd) {
+    // "defrag --background [Ko/s]" lance la défragmentation en fond, "defrag --stop" l'arrête
+    if (argc > 1 && strcmp(argv[1], "--background") == 0) {
+        int budget = argc > 2 ? atoi(argv[2]) : defrag_budget;
+        if (budget <= 0) {
+            printf("Usage : defrag --background [Ko/s]\n");
+            return -1;
         }
+        if (!reclaimer_running) {
+            printf("Erreur : pas de tâche de fond avec --batch.\n");
+            return -1;
+        }
+        defrag_budget = budget;
+        defrag_background = 1;
+        // Le shell tient fs_mutex ; le serveur réveille le récupérateur après la commande
+        if (!serving) {
+            pthread_cond_signal(&reclaim_cond);
+        }
+        printf("Défragmentation en fond à %d Ko/s.\n", budget);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "--stop") == 0) {
+        defrag_background = 0;
+        printf("Défragmentation en fond arrêtée.\n");
+        return 0;
+    }
+    if (argc > 2) {
+        printf("Usage : defrag [path] | defrag --background [Ko/s] | defrag --stop\n");
+        return -1;
+    }
+
+    char absolu[2048] = "";
+    int inode = argc > 1 ? get_inode_from_path(argv[1], *cwd) : 0;
+    if (inode == -1) {
+        return -1;
+    }
+    if (fs.inodes[inode].type == 2) {
+        printf("Erreur : '%s' n'est ni un fichier ni un répertoire.\n", argv[1]);
+        return -1;
+    }
+    generate_full_path(inode, absolu, sizeof(absolu));
+    if (absolu[0] == '\0') {
+        snprintf(absolu, sizeof(absolu), "/");
     }
+    return defragment(inode, absolu);
 }
 
+#define COMMAND_TABLE_SIZE 64   /**< Taille de la table de hachage des commandes (puissance de 2) */
+#define MAX_ARGS 64             /**< Nombre maximal d'arguments d'une commande, nom compris */
 
-/**
- * @brief Liste le contenu du répertoire courant avec détails (permissions, type, taille).
- *
- * @param current_dir Inode du répertoire courant.
- */
-void list_directory(int current_dir) {
-    Directory dir = fs.directories[current_dir];
-    printf("Contenu du répertoire :\n");
-    
-    for (int i = 0; i < NUM_DIRECTORY_ENTRIES; i++) {
-        if (dir.entries[i].inode_index != -1) {
-            Inode *inode = &fs.inodes[dir.entries[i].inode_index];
-            char type = '?';
-            char perm[4] = "---";
-            
-            switch(inode->type) {
-                case 0: type = 'd'; break;  // Répertoire
-                case 1: type = 'f'; break;  // Fichier
-                case 2: type = 'l'; break;  // Lien symbolique
+/**
+ * @brief Description d'une commande du shell.
+ */
+typedef struct {
+    const char *name;                                   /**< Nom de la commande */
+    int min_args;                                       /**< Nombre minimal d'arguments (sans le nom) */
+    int max_args;                                       /**< Nombre maximal d'arguments */
+    int (*handler)(int argc, char **argv, int *cwd);    /**< Fonction exécutant la commande */
+    int read_only;                                      /**< 1 si la commande ne modifie pas l'image */
+    const char *usage;                                  /**< Syntaxe affichée en cas d'erreur d'arité */
+} Command;
+
+Command commands[] = {
+    {"exit",       0, 0,  cmd_exit,       1, "exit"},
+    {"checkpoint", 0, 0,  cmd_checkpoint, 1, "checkpoint"},
+    {"begin",      0, 0,  cmd_begin,      1, "begin"},
+    {"commit",     0, 0,  cmd_commit,     1, "commit"},
+    {"abort",      0, 0,  cmd_abort,      1, "abort"},
+    {"help",       0, 0,  cmd_help,       1, "help"},
+    {"ls",         0, 0,  cmd_ls,         1, "ls"},
+    {"pwd",        0, 0,  cmd_pwd,        1, "pwd"},
+    {"cd",         1, 1,  cmd_cd,         0, "cd <path>"},
+    {"mkdir",      1, 1,  cmd_mkdir,      0, "mkdir <dir>"},
+    {"touch",      1, 1,  cmd_touch,      0, "touch <file>"},
+    {"rm",         1, 1,  cmd_rm,         0, "rm <file>"},
+    {"remdir",     1, 1,  cmd_remdir,     0, "remdir <dir>"},
+    {"put",        2, 3,  cmd_put,        0, "put [-r] <chemin_hote> <chemin_image>"},
+    {"get",        2, 3,  cmd_get,        1, "get [-r] <chemin_image> <chemin_hote>"},
+    {"cp",         3, 4,  cmd_cp,         0, "cp [--full] <src> <newname> <dest_path>"},
+    {"clone",      2, 2,  cmd_clone,      0, "clone <dir> <newdir>"},
+    {"mv",         2, 2,  cmd_mv,         0, "mv <src> <dest_path>"},
+    {"ln",         3, 3,  cmd_ln,         0, "ln <filename> <linkname> <path>"},
+    {"sym",        2, 2,  cmd_sym,        0, "sym <target_path> <linkname>"},
+    {"rfile",      1, 1,  cmd_rfile,      1, "rfile <filename>"},
+    {"cat",        1, 1,  cmd_rfile,      1, "cat <path>"},
+    {"wfile",      3, MAX_ARGS - 1, cmd_wfile,      0, "wfile <filename> <add|rewrite> \"<texte>\""},
+    {"stat",       1, 1,  cmd_stat,       1, "stat <file>"},
+    {"chmod",      2, 3,  cmd_chmod,      0, "chmod [-R] <file> <perms>"},
+    {"du",         0, 1,  cmd_du,         1, "du [path]"},
+    {"find",       1, 2,  cmd_find,       1, "find <path> [motif]"},
+    {"defrag",     0, 2,  cmd_defrag,     0, "defrag [path] | defrag --background [Ko/s] | defrag --stop"},
+    {"snapshot",   1, 2,  cmd_snapshot,   0, "snapshot <create|delete> <nom> | snapshot list"},
+};
+
+Command *command_table[COMMAND_TABLE_SIZE];  // Table de hachage (adressage ouvert) sur le nom des commandes
+
+/**
+ * @brief Hachage FNV-1a d'un nom de commande.
+ */
+unsigned int hash_command(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Retrouve la description d'une commande à partir de son nom.
+ *
+ * La table de hachage est remplie au premier appel.
+ *
+ * @param name Le nom de la commande.
+ * @return La description, ou NULL si la commande n'existe pas.
+ */
+Command *find_command(const char *name) {
+    static int prete = 0;
+    if (!prete) {
+        for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+            unsigned int h = hash_command(commands[i].name) & (COMMAND_TABLE_SIZE - 1);
+            while (command_table[h] != NULL) {
+                h = (h + 1) & (COMMAND_TABLE_SIZE - 1);
             }
-            
-            // Afficher les permissions de manière lisible
-            if (inode->permissions[0] == 'r') perm[0] = 'r';
-            if (inode->permissions[1] == 'w') perm[1] = 'w';
-            if (inode->permissions[2] == 'x') perm[2] = 'x';
-            
-            printf("[%c%s] %-20s (inode %d, taille %d octets)\n", 
-                   type, perm, dir.entries[i].filename, 
-                   dir.entries[i].inode_index, inode->size);
+            command_table[h] = &commands[i];
+        }
+        prete = 1;
+    }
+
+    unsigned int h = hash_command(name) & (COMMAND_TABLE_SIZE - 1);
+    while (command_table[h] != NULL) {
+        if (strcmp(command_table[h]->name, name) == 0) {
+            return command_table[h];
         }
+        h = (h + 1) & (COMMAND_TABLE_SIZE - 1);
     }
+    return NULL;
 }
 
 /**
- * @brief Affiche les informations détaillées sur un fichier ou répertoire.
+ * @brief Exécute une commande du shell.
  *
- * @param filename Nom du fichier ou répertoire à examiner.
- * @param current_dir Inode du répertoire courant.
+ * La ligne est découpée une seule fois (tokenize) puis la commande est
+ * retrouvée dans la table de hachage. Ne sauvegarde pas l'image : c'est à
+ * l'appelant de décider quand les modifications sont écrites, d'après
+ * *modifie (validation du journal après chaque commande qui modifie l'image
+ * en interactif, un seul point de contrôle en fin de script pour --batch, ou
+ * sur la commande checkpoint).
+ *
+ * @param command La ligne de commande, sans saut de ligne (modifiée).
+ * @param cwd Inode du répertoire courant, mis à jour par cd.
+ * @param modifie Reçoit 1 si la commande peut avoir modifié l'image, 0 sinon.
+ * @return 0 si la commande a réussi, -1 en cas d'erreur, 1 pour exit.
  */
-void print_file_info(const char *filename, int current_dir) {
-    int inode = rechInode(filename, fs.directories[current_dir]);
-    if (inode == -1) {
-        printf("Fichier '%s' introuvable\n", filename);
-        return;
+int execute_command(char *command, int *cwd, int *modifie) {
+    char *argv[MAX_ARGS];
+    *modifie = 0;
+
+    fprintf(fs.log, "\n\n\ncommande effectué : %s\n", command);
+    int argc = tokenize(command, argv, MAX_ARGS);
+    if (argc == -1) {
+        printf("Erreur : trop d'arguments.\n");
+        return -1;
+    }
+    if (argc == -2) {
+        printf("Erreur : guillemet non fermé.\n");
+        return -1;
+    }
+    if (argc == 0) {
+        return 0;
+    }
+
+    Command *cmd = find_command(argv[0]);
+    if (cmd == NULL) {
+        printf("Commande inconnue: %s\n", argv[0]);
+        return -1;
+    }
+    if (argc - 1 < cmd->min_args || argc - 1 > cmd->max_args) {
+        printf("Usage : %s\n", cmd->usage);
+        return -1;
     }
-    
-    Inode *node = &fs.inodes[inode];
-    printf("Informations sur '%s':\n", filename);
-    printf("  Inode: %d\n", inode);
-    printf("  Type: %s\n", 
-           node->type == 0 ? "Répertoire" : 
-           node->type == 1 ? "Fichier" : 
-           node->type == 2 ? "Lien symbolique" : "Inconnu");
-    printf("  Taille: %d octets\n", node->size);
-    printf("  Permissions: %s\n", node->permissions);
-    printf("  Liens: %d\n", node->link_count);
-    printf("  Créé le: %s", ctime(&node->creation_time));
-    printf("  Modifié le: %s", ctime(&node->modification_time));
-}
 
+    // Un instantané monté ne se modifie pas ; cd ne touche qu'au répertoire courant
+    if (snapshot_mounted && !cmd->read_only && cmd->handler != cmd_cd) {
+        printf("Erreur : instantané monté en lecture seule.\n");
+        return -1;
+    }
+    // Une transaction engloberait les commandes de tous les clients du serveur
+    if (serving && (cmd->handler == cmd_begin || cmd->handler == cmd_commit || cmd->handler == cmd_abort)) {
+        printf("Erreur : pas de transaction en mode serveur.\n");
+        return -1;
+    }
 
+    // Verrous pour la durée de la commande (entre threads, puis entre
+    // processus) : partagés pour une lecture, exclusifs pour une modification
+    // et pour les commandes de transaction ou de point de contrôle
+    int exclusif = !cmd->read_only || cmd->handler == cmd_begin || cmd->handler == cmd_commit ||
+                   cmd->handler == cmd_abort || cmd->handler == cmd_checkpoint;
+    int pris = op_begin(exclusif);
+    lock_filesystem(exclusif);
+
+    *modifie = !cmd->read_only;
+    int status = cmd->handler(argc, argv, cwd);
+    op_end(pris);
+    return status;
+}
 
 /**
- * @brief Lance le shell interactif du gestionnaire de fichiers.
+ * @brief Monte le système de fichiers (ou le réinitialise si demandé).
  *
  * @param force_init Force la réinitialisation du système de fichiers si non nul.
- * @return Code de sortie du shell interactif.
  */
-int interactive_shell(int force_init) {
+void mount_filesystem(int force_init) {
     if (force_init) {
         printf("Initialisation forcée du système de fichiers...\n");
         init_filesystem("filesystem.img");
@@ -1907,279 +8449,611 @@ int interactive_shell(int force_init) {
         // Créer une structure de répertoires de base
         create_directory("usr", 0);
         int home_dir = create_directory("home", 0);
-        create_directory("local", rechInode("usr", fs.directories[0]));
+        create_directory("local", rechInode("usr", dir_of(0)));
         fs.current_dir = home_dir; // Démarrer dans /home
+        lock_filesystem(1);
+        journal_format();
+        drop_snapshots();
     } else {
         load_filesystem("filesystem.img");
+        load_snapshot_pins();
+    }
+    // En mode script, le verrou exclusif pris au montage est gardé jusqu'à la fin
+    unlock_filesystem();
+
+    if (snapshot_to_mount != NULL) {
+        if (mount_snapshot(snapshot_to_mount) == -1) {
+            exit(1);
+        }
+        printf("Instantané '%s' monté en lecture seule.\n", snapshot_to_mount);
+    }
+}
+
+/**
+ * @brief Ferme le système de fichiers après une dernière sauvegarde.
+ */
+void unmount_filesystem() {
+    if (tx_snapshot != NULL) {
+        printf("Transaction non validée : annulation.\n");
+        abort_transaction();
     }
+    fprintf(fs.log, "\n\nFermeture du système de fichier\n");
+    fd_table_close_all(&process_fds);  // Un fichier supprimé encore ouvert est libéré maintenant
+    lock_filesystem(1);  // Le point de contrôle final part de l'état le plus récent
+    checkpoint_filesystem();
+    fclose(fs.log);
+    fclose(fs.file);
+}
 
-    save_filesystem("filesystem.img");
+/**
+ * @brief Lance le shell interactif du gestionnaire de fichiers.
+ *
+ * @param force_init Force la réinitialisation du système de fichiers si non nul.
+ * @return Code de sortie du shell interactif.
+ */
+int interactive_shell(int force_init) {
+    mount_filesystem(force_init);
 
     int current_dir = fs.current_dir;
-    char command[256];
-    char arg1[256];
-    char arg2[256];
-    char arg3[256];
+    char command[1024];
     
     printf("Mini Gestionnaire de Fichiers. Tapez 'help' pour l'aide.\n");
-    
+
+    // Le verrou n'est relâché que pendant l'attente d'une commande,
+    // ce qui laisse le récupérateur travailler pendant que l'utilisateur tape
+    start_reclaimer();
+    pthread_mutex_lock(&fs_mutex);
+
     while (1) {
         print_prompt(current_dir);
-        
-        if (fgets(command, sizeof(command), stdin) != NULL) {
-            // Supprimer le saut de ligne
-            command[strcspn(command, "\n")] = 0;
-            
-            if (strcmp(command, "exit") == 0) {
-                fprintf(fs.log, "\n\n\ncommande effectué : exit\n");
-                break;
 
-            } else if (strcmp(command, "help") == 0) {
-                fprintf(fs.log, "\n\n\ncommande effectué : help\n");
-                print_help();
-                save_filesystem("filesystem.img");
+        pthread_mutex_unlock(&fs_mutex);
+        char *lu = fgets(command, sizeof(command), stdin);
+        pthread_mutex_lock(&fs_mutex);
+
+        if (lu == NULL) {
+            break;  // Fin de l'entrée standard
+        }
+        // Supprimer le saut de ligne
+        command[strcspn(command, "\n")] = 0;
+        int modifie;
+        if (execute_command(command, &current_dir, &modifie) == 1) {
+            unlock_filesystem();  // Ne pas garder un inode verrouillé en attendant le verrou de fermeture
+            break;
+        }
+        // Les commandes en lecture seule n'ont rien à journaliser ; dans une
+        // transaction, rien n'est écrit avant le commit (voir journal_commit).
+        // Le verrou des métadonnées est rendu dès la validation écrite, et
+        // fs_mutex pendant la synchronisation pour que d'autres validations
+        // puissent partager le même fdatasync
+        long seq = modifie ? journal_commit() : -1;
+        unlock_filesystem();
+        if (modifie) {
+            pthread_mutex_unlock(&fs_mutex);
+            journal_sync(seq);
+            pthread_mutex_lock(&fs_mutex);
+        }
+    }
+    
+    pthread_mutex_unlock(&fs_mutex);
+    stop_reclaimer();
+
+    unmount_filesystem();
+    return 0;
+}
 
+/**
+ * @brief Exécute un script de commandes sans invite (option --batch).
+ *
+ * Les lignes vides et les commentaires (# ou //) sont ignorés. L'image n'est
+ * sauvegardée qu'en fin de script et sur les commandes checkpoint ; la durée
+ * de chaque commande est notée dans log.txt et un récapitulatif est affiché
+ * sur la sortie d'erreur.
+ *
+ * @param script Chemin du script, ou "-" pour l'entrée standard.
+ * @param force_init Force la réinitialisation du système de fichiers si non nul.
+ * @param continuer Si non nul, continue après une commande en erreur au lieu de s'arrêter.
+ * @return 0 si toutes les commandes ont réussi, 1 sinon.
+ */
+int run_batch(const char *script, int force_init, int continuer) {
+    FILE *in = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Erreur : impossible d'ouvrir le script '%s'.\n", script);
+        return 1;
+    }
 
-            } else if (strcmp(command, "ls") == 0) {
-                fprintf(fs.log, "\n\n\ncommande effectué : ls\n");
-                list_directory(current_dir);
-                save_filesystem("filesystem.img");
+    // Le script tient le verrou exclusif du montage jusqu'à la fin : les
+    // autres processus attendent, puis rechargent l'image
+    session_exclusive = 1;
+    mount_filesystem(force_init);
 
+    int current_dir = fs.current_dir;
+    char command[1024];
+    int ligne = 0, nb_commandes = 0, nb_erreurs = 0;
+    double total = 0, pire = 0;
+    int ligne_pire = 0;
+
+    while (fgets(command, sizeof(command), in) != NULL) {
+        ligne++;
+        command[strcspn(command, "\n")] = 0;
+        char *debut_cmd = command + strspn(command, " \t");
+        if (debut_cmd[0] == '\0' || debut_cmd[0] == '#' || strncmp(debut_cmd, "//", 2) == 0) {
+            continue;
+        }
 
-            } else if (strcmp(command, "pwd") == 0) {
-                fprintf(fs.log, "\n\n\ncommande effectué : pwd\n");
-                char path[2048] = "";
-                generate_full_path(current_dir, path, sizeof(path));
+        struct timespec debut, fin;
+        clock_gettime(CLOCK_MONOTONIC, &debut);
+        int modifie;
+        int status = execute_command(debut_cmd, &current_dir, &modifie);
+        clock_gettime(CLOCK_MONOTONIC, &fin);
+
+        double ms = (fin.tv_sec - debut.tv_sec) * 1e3 + (fin.tv_nsec - debut.tv_nsec) / 1e6;
+        fprintf(fs.log, "\nScript ligne %d (%s) : %.3f ms\n", ligne, debut_cmd, ms);
+        nb_commandes++;
+        total += ms;
+        if (ms > pire) {
+            pire = ms;
+            ligne_pire = ligne;
+        }
 
-                // Vérifier si le chemin commence par '/' et éviter une double barre
-                printf("/%s\n", path[0] == '/' ? path + 1 : path);
-                save_filesystem("filesystem.img");
+        // Pas de récupérateur en mode script : le nettoyage des segments se fait
+        // entre deux commandes. Les blocs relâchés depuis la dernière validation
+        // ne redeviennent utilisables qu'une fois une validation sur disque :
+        // on en fait une avant de nettoyer, puis au passage suivant pour le segment nettoyé
+        if (cleaning_needed()) {
+            journal_sync(journal_commit());
+            if (cleaning_needed()) {
+                clean_segment();
+            }
+        }
 
+        if (status == 1) {
+            break;
+        }
+        if (status == -1) {
+            nb_erreurs++;
+            if (!continuer) {
+                fprintf(stderr, "Arrêt du script sur l'erreur de la ligne %d : %s\n", ligne, debut_cmd);
+                break;
+            }
+        }
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
 
-            } else if (sscanf(command, "cd %s", arg1) == 1) {
-                fprintf(fs.log, "\n\n\ncommande effectué : cd %s\n", arg1);
-                int new_dir = changerRep(arg1, current_dir);
-                // Vérifier si on a pu accéder a un nouveau répertoire
-                if (new_dir != -1) {
-                    current_dir = new_dir;
-                    fs.current_dir = current_dir;
-                } else {
-                    printf("Erreur: chemin invalide ou ce n'est pas un répertoire\n");
-                }
-                save_filesystem("filesystem.img");
+    // Libérer tout de suite les répertoires supprimés : pas de récupérateur en mode script
+    reclaim_orphans(-1, 1);
+    unmount_filesystem();
 
+    fprintf(stderr, "Script : %d commandes, %d erreurs, %.3f ms (la plus lente : ligne %d, %.3f ms)\n",
+            nb_commandes, nb_erreurs, total, ligne_pire, pire);
+    return nb_erreurs > 0;
+}
 
-            } else if (sscanf(command, "mkdir %s", arg1) == 1) {
-                fprintf(fs.log, "\n\n\ncommande effectué : mkdir %s\n", arg1);
-                if (create_directory(arg1, current_dir) == -1) {
-                    printf("Erreur: impossible de créer le répertoire\n");
-                }
-                save_filesystem("filesystem.img");
+/**
+ * @brief Client connecté au serveur.
+ */
+typedef struct {
+    int fd;       /**< Socket du client, -1 si la place est libre */
+    int cwd;      /**< Répertoire courant de la session */
+    int occupee;  /**< Une requête de ce client est entre les mains d'un ouvrier */
+    FdTable fds;  /**< Fichiers ouverts par ce client (SERVE_OPEN), fermés à la déconnexion */
+} Session;
+
+Session sessions[SERVE_MAX_SESSIONS];
+Session *serve_queue[SERVE_MAX_SESSIONS];  // Clients dont une requête attend un ouvrier (file circulaire)
+int serve_queue_head = 0, serve_queue_len = 0;
+pthread_mutex_t serve_mutex = PTHREAD_MUTEX_INITIALIZER;  // Protège sessions et la file
+pthread_cond_t serve_cond = PTHREAD_COND_INITIALIZER;
+int serve_wake[2] = {-1, -1};      // Tube qui réveille la boucle d'événements
+volatile sig_atomic_t serve_stop = 0;
 
+/**
+ * @brief Arrêt du serveur sur SIGINT ou SIGTERM.
+ */
+void serve_signal(int sig) {
+    (void)sig;
+    serve_stop = 1;
+    if (write(serve_wake[1], "", 1) < 0) {
+        // Tube plein : la boucle est déjà réveillée
+    }
+}
 
-            } else if (sscanf(command, "touch %s", arg1) == 1) {
-                fprintf(fs.log, "\n\n\ncommande effectué : touch %s\n", arg1);
-                if (create_file(arg1, "rw-", current_dir) == -1) {
-                    printf("Erreur: impossible de créer le fichier\n");
-                }
-                save_filesystem("filesystem.img");
+/**
+ * @brief Lit une requête d'un client et y répond.
+ *
+ * La sortie des commandes (printf, rfile...) part chez le client par trames
+ * SERVE_OUTPUT au fil de l'exécution. Une commande qui modifie l'image est
+ * validée au journal avant la réponse ; les validations simultanées de
+ * plusieurs ouvriers partagent le même fdatasync.
+ *
+ * @param s Le client.
+ * @param requete Tampon de SERVE_MAX_REQUEST + 1 octets.
+ * @return 0 si le client reste connecté, -1 pour le déconnecter.
+ */
+int serve_request(Session *s, char *requete) {
+    ServeHeader h;
+    if (recv_all(s->fd, &h, sizeof(h)) == -1 || h.length > SERVE_MAX_REQUEST ||
+        recv_all(s->fd, requete, h.length) == -1) {
+        return -1;
+    }
+    requete[h.length] = '\0';
+
+    session_fd = s->fd;
+    session_fds = &s->fds;
+    session_out_len = 0;
+    int status = -1;
+    ServeStat st;
+    const void *donnees = &st;
+    uint32_t taille = 0;
+    int liberes = 0;
+
+    if (h.op == SERVE_COMMAND) {
+        int modifie;
+        status = execute_command(requete, &s->cwd, &modifie);
+        if (modifie) {
+            long seq = journal_commit();
+            journal_sync(seq);
+            if (fs.nb_orphans > 0 || cleaning_needed() || defrag_wanted()) {
+                pthread_mutex_lock(&fs_mutex);
+                pthread_cond_signal(&reclaim_cond);
+                pthread_mutex_unlock(&fs_mutex);
+            }
+        }
+        if (status != 1 && (h.flags & SERVE_PROMPT)) {
+            int pris = op_begin(0);  // Le chemin peut traverser un clone paresseux
+            print_prompt(s->cwd);
+            op_end(pris);
+        }
+        session_flush();
+    } else if (h.op == SERVE_LOOKUP || h.op == SERVE_STAT) {
+        int pris = op_begin(0);
+        status = get_inode_from_path(requete, s->cwd);
+        op_end(pris);
+        session_out_len = 0;  // Les messages d'erreur ne sont pas renvoyés : seul le status compte
+        if (status != -1 && h.op == SERVE_STAT) {
+            Inode copie;
+            inode_snapshot(status, &copie);
+            memset(&st, 0, sizeof(st));
+            st.inode = status;
+            st.type = copie.type;
+            st.size = copie.size;
+            st.link_count = copie.link_count;
+            st.creation_time = copie.creation_time;
+            st.modification_time = copie.modification_time;
+            memcpy(st.permissions, copie.permissions, sizeof(copie.permissions));
+            taille = sizeof(st);
+        }
+    } else if (h.op == SERVE_OPEN) {
+        // open_file attend un nom dans un répertoire : séparer le dernier élément du chemin
+        char *nom = strrchr(requete, '/');
+        int dir = s->cwd;
+        if (nom != NULL) {
+            *nom++ = '\0';
+            int pris = op_begin(0);
+            dir = get_inode_from_path(requete[0] == '\0' ? "/" : requete, s->cwd);
+            op_end(pris);
+        } else {
+            nom = requete;
+        }
+        status = dir == -1 ? -1 : open_file(nom, dir);
+        session_out_len = 0;
+    } else if (h.op == SERVE_READ && h.length == sizeof(ServeRead)) {
+        // La réponse est lue dans le tampon de sortie, libre pendant une requête binaire
+        ServeRead lecture;
+        memcpy(&lecture, requete, sizeof(lecture));
+        FileDesc *f = fd_get(lecture.desc);
+        uint32_t longueur = lecture.length < SERVE_CHUNK - 1 ? lecture.length : SERVE_CHUNK - 1;
+        if (f != NULL) {
+            int fin = fs.inodes[f->inode].size;
+            if ((long)f->tete_lecture + longueur > fin) {
+                longueur = f->tete_lecture < fin ? fin - f->tete_lecture : 0;
+            }
+            int avant = f->tete_lecture;
+            read_file(lecture.desc, session_out, longueur);
+            status = f->tete_lecture - avant;
+            taille = status;
+            donnees = session_out;
+        }
+        session_out_len = 0;
+    } else if (h.op == SERVE_CLOSE && h.length == sizeof(int32_t)) {
+        int32_t desc;
+        memcpy(&desc, requete, sizeof(desc));
+        int libere = fd_close(desc);
+        liberes += libere == 1;
+        status = libere == -1 ? -1 : 0;
+    }
+    session_fd = -1;
+    session_fds = NULL;
 
+    if (liberes > 0) {
+        journal_sync(journal_commit());  // Fichier supprimé libéré à sa dernière fermeture
+    }
+    return serve_send(s->fd, SERVE_DONE, 0, status, donnees, taille) == -1 ||
+           (h.op == SERVE_COMMAND && status == 1) ? -1 : 0;
+}
 
-            } else if (sscanf(command, "rm %s", arg1) == 1) {
-                fprintf(fs.log, "\n\n\ncommande effectué : rm %s\n", arg1);
-                delete_file(arg1, current_dir);
-                save_filesystem("filesystem.img");
+/**
+ * @brief Ouvrier du serveur : traite une requête à la fois, pour n'importe quel client.
+ */
+void *serve_worker(void *arg) {
+    (void)arg;
+    char *requete = malloc(SERVE_MAX_REQUEST + 1);
+    session_out = malloc(SERVE_CHUNK);
+    if (requete == NULL || session_out == NULL) {
+        free(requete);
+        free(session_out);
+        return NULL;
+    }
 
+    pthread_mutex_lock(&serve_mutex);
+    while (1) {
+        while (serve_queue_len == 0 && !serve_stop) {
+            pthread_cond_wait(&serve_cond, &serve_mutex);
+        }
+        if (serve_stop) {
+            break;
+        }
+        Session *s = serve_queue[serve_queue_head];
+        serve_queue_head = (serve_queue_head + 1) % SERVE_MAX_SESSIONS;
+        serve_queue_len--;
+        pthread_mutex_unlock(&serve_mutex);
 
-            } else if (sscanf(command, "remdir %s", arg1) == 1) {
-                fprintf(fs.log, "\n\n\ncommande effectué : remdir %s\n", arg1);
-                if (delete_directory(arg1, current_dir) == -1) {
-                    printf("Erreur: impossible de supprimer le répertoire\n");
-                }
-                save_filesystem("filesystem.img");
+        int garder = serve_request(s, requete) == 0;
 
+        if (!garder) {
+            // Les fichiers laissés ouverts par le client sont fermés avec la session
+            if (fd_table_close_all(&s->fds) > 0) {
+                journal_sync(journal_commit());
+            }
+        }
+        pthread_mutex_lock(&serve_mutex);
+        if (!garder) {
+            close(s->fd);
+            s->fd = -1;
+        }
+        s->occupee = 0;
+        // Rendre le client à la boucle d'événements
+        if (write(serve_wake[1], "", 1) < 0) {
+            // Tube plein : la boucle est déjà réveillée
+        }
+    }
+    pthread_mutex_unlock(&serve_mutex);
 
-            } else if (sscanf(command, "cp %s %s %s", arg1, arg2, arg3) == 3) {
-                fprintf(fs.log, "\n\n\ncommande effectué : cp %s %s %s\n", arg1, arg2, arg3);
-                int inode = get_inode_from_path(arg3, current_dir);
-                // Vérifier si le chemin est bien valide et est un répertoire
-                if (inode == -1 || fs.inodes[inode].type != 0){
-                    printf("Erreur : répertoire cible invalide.\n");
-                } else {
-                    // Vérifier l'existence du fichier a copier
-                    int inode_src = rechInode(arg1, fs.directories[current_dir]);
-                    if (inode_src == -1){
-                        printf("Erreur : fichier non existant \n");
-                    } else {
-                        // Vérifier le type de fichier pour choisir la fonction coper a effectuer
-                        if (fs.inodes[inode_src].type == 1 || fs.inodes[inode_src].type == 2){
-                            if (copy_file(arg1, arg2, current_dir, inode) == -1) {
-                                printf("Erreur lors de la copie\n");
-                            }
-                        } else if (fs.inodes[inode_src].type == 0) {
-                            if (copy_directory(arg1, arg2, current_dir, inode) == -1){
-                                printf("Erreur lors de la copie\n"); 
-                            }
-                        } else {
-                            printf("Erreur : type de fichier non reconnu\n");
-                        }
-                    }
-                }
-                save_filesystem("filesystem.img");
+    free(requete);
+    free(session_out);
+    session_out = NULL;
+    return NULL;
+}
 
+/**
+ * @brief Garde l'image chargée et sert des clients sur une socket Unix (option --serve).
+ *
+ * Une boucle d'événements (poll) accepte les connexions et repère les
+ * clients qui ont envoyé une requête ; celle-ci est confiée à l'un des
+ * ouvriers (-j, 4 par défaut). Les lectures de clients différents se font en
+ * parallèle, les modifications passent une par une (voir op_begin). Comme
+ * pour --batch, l'image reste verrouillée en exclusif jusqu'à l'arrêt, sur
+ * SIGINT ou SIGTERM, qui se termine par un point de contrôle.
+ *
+ * @param socket_path Chemin de la socket à créer.
+ * @param force_init Force la réinitialisation du système de fichiers si non nul.
+ * @return 0 après un arrêt normal, 1 si la socket n'a pas pu être créée.
+ */
+int run_server(const char *socket_path, int force_init) {
+    struct sockaddr_un adresse;
+    memset(&adresse, 0, sizeof(adresse));
+    adresse.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(adresse.sun_path)) {
+        fprintf(stderr, "Erreur : chemin de socket trop long '%s'.\n", socket_path);
+        return 1;
+    }
+    strcpy(adresse.sun_path, socket_path);
+
+    int ecoute = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socket_path);  // Socket laissée par un serveur arrêté brutalement
+    if (ecoute == -1 || bind(ecoute, (struct sockaddr *)&adresse, sizeof(adresse)) == -1 ||
+        listen(ecoute, SOMAXCONN) == -1 || pipe2(serve_wake, O_NONBLOCK | O_CLOEXEC) == -1) {
+        fprintf(stderr, "Erreur : impossible d'écouter sur '%s' : %s\n", socket_path, strerror(errno));
+        if (ecoute != -1) {
+            close(ecoute);
+        }
+        return 1;
+    }
 
-            } else if (sscanf(command, "mv %s %s", arg1, arg2) == 2) {
-                fprintf(fs.log, "\n\n\ncommande effectué : mv %s %s\n", arg1, arg2);
-                int src_inode = rechInode(arg1, fs.directories[current_dir]);
-                // Vérifier la validité de l'inode
-                if (src_inode == -1) {
-                    printf("Erreur: fichier source introuvable\n");
-                    continue;
-                }
-                int dest_dir = get_inode_from_path(arg2, current_dir);
-                // Vérifier que le chemin est un répertoire
-                if (dest_dir != -1 && fs.inodes[dest_dir].type == 0) {
-                    // Vérifier le typre de fichier a deplacer
-                    if (fs.inodes[src_inode].type == 0){
-                        move_directory(arg1, current_dir, dest_dir);
-                    } else if (fs.inodes[src_inode].type == 1 || fs.inodes[src_inode].type == 2){
-                        move_file(arg1, current_dir, dest_dir);
-                    }else {
-                        printf("Erreur : type de fichier non reconnu\n");
-                    }
-                } else {
-                    printf("Erreur : répertoire cible invalide.\n");
-                }
-                save_filesystem("filesystem.img");
-                
+    session_exclusive = 1;
+    serving = 1;
+    mount_filesystem(force_init);
+    for (int i = 0; i < SERVE_MAX_SESSIONS; i++) {
+        sessions[i].fd = -1;
+    }
 
-            } else if (sscanf(command, "ln %s %s %s", arg1, arg2, arg3) == 3) {
-                fprintf(fs.log, "\n\n\ncommande effectué : ln %s %s %s\n", arg1, arg2, arg3);
-                int inode = get_inode_from_path(arg3, current_dir);
-                // Vérifier que le chemin mène a un répertoire
-                if (inode == -1 || fs.inodes[inode].type != 0){
-                    printf("Erreur : répertoire cible invalide.\n");
-                } else {
-                    if (create_hard_link(arg2, arg1, current_dir, inode) == -1) {
-                        printf("Erreur lors de la création du lien dur\n");
-                    }
+    // stdout sans tampon et aiguillée par thread vers le client de la requête
+    fflush(stdout);
+    FILE *console = stdout;
+    cookie_io_functions_t fonctions = {NULL, session_stdout_write, NULL, NULL};
+    FILE *sortie = fopencookie(NULL, "w", fonctions);
+    if (sortie != NULL) {
+        setvbuf(sortie, NULL, _IONBF, 0);
+        stdout = sortie;
+    }
+
+    // Seule la boucle d'événements reçoit les signaux d'arrêt
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigset_t masque, ancien;
+    sigemptyset(&masque);
+    sigaddset(&masque, SIGINT);
+    sigaddset(&masque, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &masque, &ancien);
+    start_reclaimer();
+    int nb_ouvriers = copy_threads;
+    pthread_t ouvriers[nb_ouvriers];
+    for (int i = 0; i < nb_ouvriers; i++) {
+        if (pthread_create(&ouvriers[i], NULL, serve_worker, NULL) != 0) {
+            nb_ouvriers = i;
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &ancien, NULL);
+
+    printf("Serveur en écoute sur %s (%d ouvriers).\n", socket_path, nb_ouvriers);
+    fprintf(fs.log, "\nServeur en écoute sur %s (%d ouvriers)\n", socket_path, nb_ouvriers);
+
+    struct pollfd attente[SERVE_MAX_SESSIONS + 2];
+    Session *client_de[SERVE_MAX_SESSIONS + 2];
+    struct timeval delai = {SERVE_TIMEOUT, 0};
+    while (!serve_stop) {
+        // Surveiller le réveil, la socket d'écoute et les clients sans requête en cours
+        int n = 0;
+        attente[n++] = (struct pollfd){serve_wake[0], POLLIN, 0};
+        attente[n++] = (struct pollfd){ecoute, POLLIN, 0};
+        pthread_mutex_lock(&serve_mutex);
+        for (int i = 0; i < SERVE_MAX_SESSIONS; i++) {
+            if (sessions[i].fd != -1 && !sessions[i].occupee) {
+                client_de[n] = &sessions[i];
+                attente[n++] = (struct pollfd){sessions[i].fd, POLLIN, 0};
+            }
+        }
+        pthread_mutex_unlock(&serve_mutex);
+
+        if (poll(attente, n, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(fs.log, "\nErreur du serveur (poll) : %s\n", strerror(errno));
+            break;
+        }
+        if (attente[0].revents) {
+            char vide[64];
+            while (read(serve_wake[0], vide, sizeof(vide)) > 0) {
+            }
+        }
+
+        if (attente[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(ecoute, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+                // Une requête commencée doit arriver en entier : un client bloqué ne retient pas un ouvrier
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &delai, sizeof(delai));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &delai, sizeof(delai));
+                pthread_mutex_lock(&serve_mutex);
+                int place = 0;
+                while (place < SERVE_MAX_SESSIONS && sessions[place].fd != -1) {
+                    place++;
                 }
-                save_filesystem("filesystem.img");
-            } else if (sscanf(command, "sym %s %s", arg1, arg2) == 2) {
-                if (create_symbolic_link(arg2, arg1, current_dir) == -1) {
-                    printf("Erreur lors de la création du lien symbolique\n");
+                if (place < SERVE_MAX_SESSIONS) {
+                    sessions[place].fd = fd;
+                    sessions[place].cwd = fs.current_dir;
+                    sessions[place].occupee = 0;
+                    sessions[place].fds = (FdTable){NULL, 0, -1, 0, PTHREAD_MUTEX_INITIALIZER};
                 }
-                save_filesystem("filesystem.img");
-           
-                
-            } else if (sscanf(command, "rfile %s", arg1) == 1){
-                fprintf(fs.log, "\n\n\ncommande effectué : rfile %s\n", arg1);
-                int inode = rechInode(arg1, fs.directories[current_dir]);
-                // Vérifier que le fichier existe
-                if(inode == -1){
-                    printf("Erreur : fichier non existant\n");
-                } else {
-                    // Vérifier si on a un lien ou un fichier
-                    if(fs.inodes[inode].type == 1){
-                        // Ouvrir le fichier puis lire puis fermer puis afficher
-                        int fd = open_file(arg1, current_dir);
-                        int size = fs.inodes[fs.opened_file[fd].inode].size;
-                        seek_file(fd, 0, 0);
-                        char texte[size+1];
-                        read_file(fd, texte, size);
-                        printf("contenu du fichier : %s\n", texte);
-                        save_filesystem("filesystem.img");
-
-                    } else if(fs.inodes[inode].type == 2){
-                        // Lecture du lien symbolique pour retrouver le fichier a llire
-                        char path[fs.inodes[inode].size + 1];
-                        int fd = open_file(arg1, current_dir);
-                        seek_file(fd, 0, 0);
-                        read_file(fd, path, fs.inodes[inode].size);
-                        close(fd);
-                        //printf("path : %s\n", path);
-
-                        // Chercher le fichier a lire
-                        int inode_target = get_inode_from_path(path, current_dir);
-                        int rep_parent = fs.inodes[inode_target].inode_rep_parent;
-                        int stop = 0;
-                        char filename[MAX_FILE_NAME];
-                        int i = 0;
-                        while(i<NUM_DIRECTORY_ENTRIES && !stop){
-                            if(fs.directories[rep_parent].entries[i].inode_index == inode_target){
-                                strncpy(filename, fs.directories[rep_parent].entries[i].filename, strlen(fs.directories[rep_parent].entries[i].filename));
-                                stop = 1;
-                            }
-                            i++;
-                        }
-                        filename[strlen(fs.directories[rep_parent].entries[i-1].filename)] = '\0';
-
-                        // Ouverture + Lecture du fichier lu
-                        fd = open_file(filename, rep_parent);
-                        int size = fs.inodes[fs.opened_file[fd].inode].size;
-                        seek_file(fd, 0, 0);
-                        char texte[size+1];
-                        read_file(fd, texte, size);
-                        printf("contenu du fichier : %s\n", texte);
-                        save_filesystem("filesystem.img");
-                        
-                    } else if(fs.inodes[inode].type == 0) {
-                        printf("Erreur : tentation de lecture d'un répertoire\n");
-                    } else {
-                        printf("Erreur : type de fichier non reconnu\n");
-                    }
+                pthread_mutex_unlock(&serve_mutex);
+                if (place == SERVE_MAX_SESSIONS) {
+                    fprintf(fs.log, "\nConnexion refusée : %d clients déjà connectés\n", SERVE_MAX_SESSIONS);
+                    close(fd);
                 }
-                
+            }
+        }
 
-            } else if (sscanf(command, "wfile %s %s %[^\n]", arg1, arg3, arg2) == 3){
-                fprintf(fs.log, "\n\n\ncommande effectué : wfile %s %s %s\n", arg1, arg3, arg2);
-                // Vérification si on ajoute ou on ecrase le contenu
-                if(strcmp(arg3, "add") == 0){
-                    int fd = open_file(arg1, current_dir);
-                    int size = strlen(arg2);
-                    seek_file(fd, 0, 1);
-                    write_file(fd, arg2, size);
-                    close_file(fd);
-                } else if (strcmp(arg3, "rewrite") == 0){
-                    int fd = open_file(arg1, current_dir);
-                    int size = strlen(arg2);
-                    seek_file(fd, 0, 0);
-                    write_file(fd, arg2, size);
-                    close_file(fd);
-                } else {
-                    printf("mode d'écriture non reconnu\n");
-                }
-                save_filesystem("filesystem.img");
-            
-                
-            } else if (sscanf(command, "stat %s", arg1) == 1) {
-                fprintf(fs.log, "\n\n\ncommande effectué : stat %s\n", arg1);
-                print_file_info(arg1, current_dir);
-                save_filesystem("filesystem.img");
+        pthread_mutex_lock(&serve_mutex);
+        for (int k = 2; k < n; k++) {
+            if (attente[k].revents) {
+                client_de[k]->occupee = 1;
+                serve_queue[(serve_queue_head + serve_queue_len) % SERVE_MAX_SESSIONS] = client_de[k];
+                serve_queue_len++;
+                pthread_cond_signal(&serve_cond);
+            }
+        }
+        pthread_mutex_unlock(&serve_mutex);
+    }
 
+    // Arrêt : les ouvriers finissent leur requête en cours
+    pthread_mutex_lock(&serve_mutex);
+    serve_stop = 1;
+    pthread_cond_broadcast(&serve_cond);
+    pthread_mutex_unlock(&serve_mutex);
+    for (int i = 0; i < nb_ouvriers; i++) {
+        pthread_join(ouvriers[i], NULL);
+    }
+    for (int i = 0; i < SERVE_MAX_SESSIONS; i++) {
+        if (sessions[i].fd != -1) {
+            fd_table_close_all(&sessions[i].fds);  // Repris par le point de contrôle final
+            close(sessions[i].fd);
+            sessions[i].fd = -1;
+        }
+    }
+    close(ecoute);
+    unlink(socket_path);
+    close(serve_wake[0]);
+    close(serve_wake[1]);
+    stop_reclaimer();
+
+    if (sortie != NULL) {
+        stdout = console;
+        fclose(sortie);
+    }
+    unmount_filesystem();
+    printf("Serveur arrêté.\n");
+    return 0;
+}
 
-            } else if (sscanf(command, "chmod %s %s", arg1, arg2) == 2) {
-                fprintf(fs.log, "\n\n\ncommande effectué : chmod %s %s\n", arg1, arg2);
-                // arg1 = nom du fichier/répertoire, arg2 = nouvelles permissions
-                if (change_permissions(arg1, arg2, current_dir) == -1) {
-                    printf("Erreur : impossible de modifier les permissions.\n");
-                }
-                save_filesystem("filesystem.img");
+/**
+ * @brief Shell léger : envoie les commandes à un serveur --serve et affiche ses réponses.
+ *
+ * @param socket_path Socket du serveur.
+ * @return 0 à la sortie, 1 si le serveur est injoignable ou a coupé la connexion.
+ */
+int run_client(const char *socket_path) {
+    struct sockaddr_un adresse;
+    memset(&adresse, 0, sizeof(adresse));
+    adresse.sun_family = AF_UNIX;
+    strncpy(adresse.sun_path, socket_path, sizeof(adresse.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&adresse, sizeof(adresse)) == -1) {
+        fprintf(stderr, "Erreur : serveur injoignable sur '%s' : %s\n", socket_path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
 
-            
-            } else if (strlen(command) > 0) {
-                fprintf(fs.log, "\n\n\ncommande effectué : %s\n", command);
-                printf("Commande inconnue: %s\n", command);
-                save_filesystem("filesystem.img");
-            }
-            
+    printf("Mini Gestionnaire de Fichiers (serveur %s). Tapez 'help' pour l'aide.\n", socket_path);
+    fflush(stdout);
+
+    // Une commande vide ne fait que demander l'invite
+    char command[1024] = "";
+    static char tampon[SERVE_CHUNK];
+    while (1) {
+        ServeHeader h;
+        if (serve_send(fd, SERVE_COMMAND, SERVE_PROMPT, 0, command, strlen(command)) == -1) {
+            h.op = 0;
+        } else {
+            do {
+                if (recv_all(fd, &h, sizeof(h)) == -1 || h.length > SERVE_CHUNK ||
+                    recv_all(fd, tampon, h.length) == -1) {
+                    h.op = 0;
+                    break;
+                }
+                if (h.op == SERVE_OUTPUT) {
+                    write_all(STDOUT_FILENO, tampon, h.length);
+                }
+            } while (h.op != SERVE_DONE);
+        }
+        if (h.op != SERVE_DONE) {
+            fprintf(stderr, "Erreur : connexion au serveur perdue.\n");
+            close(fd);
+            return 1;
+        }
+        if (h.status == 1 || fgets(command, sizeof(command), stdin) == NULL) {
+            break;
         }
+        command[strcspn(command, "\n")] = 0;
     }
-    
-    fprintf(fs.log, "\n\nFermeture du système de fichier\n");
-    save_filesystem("filesystem.img");
-    fclose(fs.log);
-    fclose(fs.file);
+    close(fd);
     return 0;
 }
 
@@ -2188,12 +9062,32 @@ int interactive_shell(int force_init) {
 
 
 
+
 int main(int argc, char *argv[]) {
     int force_init = 0;
+    int continuer = 0;
+    const char *script = NULL;
+    const char *serve_socket = NULL;
+    const char *connect_socket = NULL;
     int opt;
+
+    static struct option options[] = {
+        {"help",     no_argument,       NULL, 'h'},
+        {"init",     no_argument,       NULL, 'i'},
+        {"batch",    required_argument, NULL, 'b'},
+        {"continue", no_argument,       NULL, 'k'},
+        {"log-structured", no_argument, NULL, 'l'},
+        {"snapshot", required_argument, NULL, 's'},
+        {"serve",    required_argument, NULL, 'S'},
+        {"connect",  required_argument, NULL, 'c'},
+        {"max-open", required_argument, NULL, 'o'},
+        {"no-delalloc", no_argument,    NULL, 'n'},
+        {"defrag",   required_argument, NULL, 'D'},
+        {NULL, 0, NULL, 0}
+    };
     
     // Analyse des arguments en ligne de commande
-    while ((opt = getopt(argc, argv, "hi")) != -1) {
+    while ((opt = getopt_long(argc, argv, "hidj:b:kls:S:c:o:nD:", options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 print_help();
@@ -2201,12 +9095,61 @@ int main(int argc, char *argv[]) {
             case 'i':
                 force_init = 1;
                 break;
+            case 'd':
+                direct_io_enabled = 1;
+                break;
+            case 'j':
+                copy_threads = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'b':
+                script = optarg;
+                break;
+            case 'k':
+                continuer = 1;
+                break;
+            case 'l':
+                log_structured = 1;
+                break;
+            case 's':
+                snapshot_to_mount = optarg;
+                break;
+            case 'S':
+                serve_socket = optarg;
+                break;
+            case 'c':
+                connect_socket = optarg;
+                break;
+            case 'o':
+                max_open_files = atoi(optarg) > 0 ? atoi(optarg) : DEFAULT_MAX_OPEN;
+                break;
+            case 'n':
+                delayed_alloc = 0;
+                break;
+            case 'D':
+                defrag_background = 1;
+                defrag_budget = atoi(optarg) > 0 ? atoi(optarg) : DEFRAG_BUDGET;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-h] [-i]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-h] [-i] [-d] [-l] [-s nom] [-j n] [--batch <script|->] [--continue] [--serve|--connect <socket>] [--max-open n] [--no-delalloc] [--defrag Ko/s]\n", argv[0]);
                 return 1;
         }
     }
+
+    // Shell léger relié à un serveur : l'image n'est pas ouverte ici
+    if (connect_socket != NULL) {
+        return run_client(connect_socket);
+    }
+
+    // Garder l'image chargée pour des clients
+    if (serve_socket != NULL) {
+        return run_server(serve_socket, force_init);
+    }
+
+    // Exécuter un script sans invite
+    if (script != NULL) {
+        return run_batch(script, force_init, continuer);
+    }
     
     // Démarrer le shell interactif
     return interactive_shell(force_init);
-}
\ No newline at end of file
+}